@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+class AtomBiosImpl;
+
+// Command tables and IIO functions that were translated into C++ ahead of time (see AtomBios::translateToCpp).
+// The generated code only includes this header; it is compiled by the host, linked with libatombios,
+// and passed to AtomBios::setAotModule. runCommand then runs the translated functions instead of the bytecode.
+class AtomBiosAot {
+public:
+	// What a translated command runs on; native code from the JIT uses the same frame.
+	struct Frame {
+		uint32_t* workSpace;
+		// Already offset by params_shift; reloaded after every callTable, as the callee may grow the parameter space.
+		uint32_t* params;
+		AtomBiosImpl* impl;
+		// The parameter space vector itself; only used by libatombios.
+		void* paramsVector;
+		int paramsShift;
+		// Parameter space of the calling command, in dwords; callees are run behind it.
+		int parameterDwords;
+	};
+
+	// The bytecode a function was translated from.
+	// Functions are only used if the ROM they are loaded for contains the same bytecode.
+	struct Source {
+		uint32_t offset;
+		uint32_t size;
+		// FNV-1a over the bytecode.
+		uint32_t checksum;
+	};
+
+	struct Command {
+		int table;
+		Source source;
+		// The WorkSpace and parameter space (from params_shift on) the function accesses, in dwords.
+		uint32_t workSpaceDwords;
+		uint32_t parameterDwords;
+		void (*run)(Frame* frame);
+	};
+
+	struct IIOFunction {
+		uint8_t port;
+		Source source;
+		uint32_t (*run)(AtomBiosImpl* impl, uint32_t index, uint32_t data);
+	};
+
+	struct Module {
+		const Command* commands;
+		size_t commandCount;
+		const IIOFunction* iioFunctions;
+		size_t iioFunctionCount;
+	};
+
+	/// Called from generated code.
+
+	// Operands that are read and written through libatombios.
+	enum Operand : uint32_t {
+		Reg = 0,
+		WorkSpace = 2,
+		FrameBuffer = 3,
+		ID = 4,
+		PLL = 6,
+		MC = 7,
+		// A Reg operand that already includes the reg block.
+		AbsoluteReg = 0x100
+	};
+	static uint32_t read(AtomBiosImpl* impl, uint32_t operand, uint32_t idx);
+	static void write(AtomBiosImpl* impl, uint32_t operand, uint32_t idx, uint32_t val);
+
+	// Interpreter state that is shared with the bytecode.
+	static bool& flagAbove(AtomBiosImpl* impl);
+	static bool& flagEqual(AtomBiosImpl* impl);
+	static bool& flagBelow(AtomBiosImpl* impl);
+	static uint32_t& divMulQuotient(AtomBiosImpl* impl);
+	static uint32_t& divMulRemainder(AtomBiosImpl* impl);
+
+	static void callTable(Frame* frame, uint32_t table);
+	// SET_DATA_TABLE, SET_ATI_PORT, SET_PCI_PORT, SET_SYSIO_PORT, SET_REG_BLOCK and DELAY_MICROSECONDS.
+	static void misc(AtomBiosImpl* impl, uint32_t opcode, uint32_t imm);
+
+	// IIO functions.
+	static uint32_t cardRead(AtomBiosImpl* impl, uint32_t reg);
+	static void cardWrite(AtomBiosImpl* impl, uint32_t reg, uint32_t val);
+	static uint32_t iioAttributes(AtomBiosImpl* impl);
+};
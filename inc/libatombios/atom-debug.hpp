@@ -5,16 +5,16 @@
 #define LOG_OPCODE(name) \
 	if(AtomBIOSDebugSettings::logOpcodes) { \
 		lilrad_log(DEBUG, "opcode " name "(%s[%02x] %s (savedVal: %x) <- %s[%02x] %s (val: %x, newVal: %x))\n", \
-			OpcodeArgEncodingToString(arg), arg == OpcodeArgEncoding::Reg ? dstIdx + _regBlock : dstIdx, SrcEncodingToString(attrByte.dstAlign), \
+			OpcodeArgEncodingToString(arg), arg == OpcodeArgEncoding::Reg ? dstIdx + regBlock : dstIdx, SrcEncodingToString(attrByte.dstAlign), \
 			saved, \
-			OpcodeArgEncodingToString(attrByte.srcArg), attrByte.srcArg == OpcodeArgEncoding::Reg ? srcIdx + _regBlock : srcIdx, SrcEncodingToString(attrByte.srcAlign), \
+			OpcodeArgEncodingToString(attrByte.srcArg), attrByte.srcArg == OpcodeArgEncoding::Reg ? srcIdx + regBlock : srcIdx, SrcEncodingToString(attrByte.srcAlign), \
 			val, newVal); \
 	}
 
 #define LOG_OPCODE_DST_ONLY(name) \
 	if(AtomBIOSDebugSettings::logOpcodes) { \
 		lilrad_log(DEBUG, "opcode " name "(%s[%02x] %s (savedVal: %x, val: %x, newVal: %x))\n", \
-			OpcodeArgEncodingToString(arg), arg == OpcodeArgEncoding::Reg ? dstIdx + _regBlock : dstIdx, SrcEncodingToString(attrByte.dstAlign), \
+			OpcodeArgEncodingToString(arg), arg == OpcodeArgEncoding::Reg ? dstIdx + regBlock : dstIdx, SrcEncodingToString(attrByte.dstAlign), \
 			saved, val, newVal); \
 	}
 
@@ -23,10 +23,18 @@ if(AtomBIOSDebugSettings::logOpcodes) { \
 	lilrad_log(DEBUG, "  flags after opcode: A%i E%i B%i\n", _flagAbove, _flagEqual, _flagBelow); \
 }
 
+// Builds with LIBATOMBIOS_QUIET defined leave out the logging of the interpreter (e.g. for benchmarks).
 namespace AtomBIOSDebugSettings {
-	constexpr bool logCommandTableCreation = true;
+#ifdef LIBATOMBIOS_QUIET
+	constexpr bool enabled = false;
+#else
+	constexpr bool enabled = true;
+#endif
 
-	constexpr bool logOpcodes = true;
-	constexpr bool logIIOIndex = true;
-	constexpr bool logIIOOpcodes = true;
+	constexpr bool logCommandTableCreation = enabled;
+	constexpr bool logCommands = enabled;
+
+	constexpr bool logOpcodes = enabled;
+	constexpr bool logIIOIndex = enabled;
+	constexpr bool logIIOOpcodes = enabled;
 }
@@ -3,6 +3,9 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include <libatombios/aot.hpp>
+#include <libatombios/trace.hpp>
+
 class AtomBiosImpl;
 
 class AtomBios {
@@ -98,10 +101,372 @@ public:
 		GetVoltageInfo
 	};
 
+	// The name of the table, as in the enum; nullptr for tables outside of it.
+	static const char* commandTableName(CommandTables table);
+	// Whether the ROM has the table; running a table it does not have is an assertion failure.
+	bool hasCommand(CommandTables table);
+
 	void runCommand(CommandTables table, uint32_t* params, size_t size);
 
+	// Runs the table once for each of count parameter blocks of size dwords, which follow each other in params.
+	// The result is the same as that of count runCommand calls, one block after the other.
+	void runCommandBatch(CommandTables table, uint32_t* params, size_t size, size_t count);
+
+	// Batches of pure tables (see setMemoization) whose results do not depend on the state earlier runs left behind
+	// are split over workers, the number of threads that run a batch in parallel. run starts them: it must call
+	// task(taskContext, i) for every i below workers, concurrently, and return once all calls have returned. Each
+	// worker has its own copy of the ROM and interpreter state, which is made on its first use and kept. lilrad_alloc,
+	// lilrad_free and lilrad_log are then called from several threads at once. The statistics of the table do not
+	// include the runs of the workers. Less than 2 workers (the default) runs all batches here.
+	void setBatchWorkers(size_t workers, void (*run)(void (*task)(void* taskContext, size_t worker), void* taskContext,
+		size_t workers, void* context), void* context);
+
+	// Batches of such tables that do not call other tables can instead be run by a SIMD interpreter, which runs
+	// 8 blocks at once in lockstep (on each worker, if there are workers). Off by default; like the workers, it does
+	// not update the statistics of the table, and does not use the JIT or the memoized results.
+	void setLockstepBatches(bool enabled);
+
+	// Footprints: the registers, PLL and MC indexes a table may read and write, along with the tables and IIO functions
+	// it calls. They are found from the bytecode, for the reg block and IO mode the table would start with now, and
+	// follow SET_REG_BLOCK and SET_ATI_PORT where these are constant. Where the reg block or IIO port is not known,
+	// any register may be accessed; FB accesses can always reach the whole window. PLL and MC accesses through an
+	// index/data pair also access the pair.
+	enum class FootprintSpace {
+		Reg,
+		PLL,
+		MC,
+		FB
+	};
+	static constexpr int footprintSpaces = 4;
+
+	// Indexed by FootprintSpace.
+	struct FootprintStats {
+		// The amount of indexes that may be read / written.
+		uint32_t reads[footprintSpaces];
+		uint32_t writes[footprintSpaces];
+		// Any index may be read / written.
+		bool readsAny[footprintSpaces];
+		bool writesAny[footprintSpaces];
+		// The amount of opcodes the interpreter does not know (including instructions that run past the end of their
+		// table), and of tables the ROM does not have, that may be reached: running into either is an assertion failure.
+		uint32_t invalidOpcodes;
+		uint32_t missingTables;
+	};
+	FootprintStats footprintStats(CommandTables table);
+	// Copies up to max of the indexes that the table may read (or write) into indexes, in ascending order.
+	// Returns the amount of indexes there are, which may be more than max.
+	size_t footprintIndexes(CommandTables table, FootprintSpace space, bool write, uint32_t* indexes, size_t max);
+	// Likewise for the invalid opcodes the table may reach.
+	size_t footprintInvalidOpcodes(CommandTables table, uint8_t* opcodes, size_t max);
+	// Whether both tables may access an index that at least one of them writes.
+	bool commandsConflict(CommandTables a, CommandTables b);
+
+	struct CommandRequest {
+		CommandTables table;
+		uint32_t* params;
+		size_t size;
+	};
+	// Runs the requests like runCommand, with the workers of setBatchWorkers: requests run concurrently (each on its
+	// own worker) unless their footprints conflict, in which case the later one runs once the earlier one is done.
+	// Each request starts from the interpreter state (reg block, IO mode, data block, flags, ...) that there was when
+	// runCommands was called, as if each had an AtomBios of its own; afterwards, the state is the one the last
+	// request left behind. The libatombios_card_* and libatombios_delay_* functions are then called from several
+	// threads at once. Without workers (or in self-check or differential mode), the requests are run here, in order.
+	void runCommands(CommandRequest* requests, size_t count);
+
+	// Called whenever a table starts to run, including the tables that are called by other tables (depth is the
+	// amount of tables that called it). nullptr (the default) removes the hook.
+	void setTableEntryHook(void (*hook)(CommandTables table, uint32_t depth, void* context), void* context);
+
+	// Snapshots of the interpreter state: the parameter space, flags, reg block, data block, IO mode, DIV/MUL
+	// registers and so on, and the tables that are running, with their WorkSpace and the point they continue at.
+	// Registers, PLL, MC and the FB window are not part of it.
+	// Outside of runCommand, the snapshot only holds the interpreter state. From the table entry hook, it holds the run
+	// as well, which restoreSnapshot continues from the start of the entered table; if a table in the call stack was
+	// run as native code (see setJitMode and setAotModule), nullptr is returned instead. Snapshots can be restored
+	// any number of times, until they are freed.
+	struct Snapshot;
+	Snapshot* takeSnapshot();
+	// Restores the state; if the snapshot holds a run, it is continued until the table that was run by runCommand
+	// returns, and its parameter space is copied into params, like runCommand does. Must not be called from the hook.
+	void restoreSnapshot(const Snapshot* snapshot, uint32_t* params, size_t size);
+	void freeSnapshot(Snapshot* snapshot);
+
+	// Recordings of the card accesses of a run (register and PLL / MC reads with the values that were seen, writes
+	// and delays), so that the run can be repeated quickly, e.g. ASIC_Init on resume.
+	// recordCommand runs the command like runCommand does. replayCommand makes the recorded accesses again, without
+	// running the bytecode, and checks each read against the recorded value; it then leaves the parameter space, FB
+	// window and interpreter state the way the recorded run did. If the parameters, FB window or state the run starts
+	// from differ from the recorded ones, the command is run normally instead. If a read differs, the command is run
+	// again from the start, with the accesses that were already made skipped, and continues normally from that read.
+	// Returns whether the recording was used up to its end.
+	// Recordings only apply to the ROM they were recorded with. To start out from the state the recording did (e.g.
+	// after other commands were run since), take a snapshot outside of runCommand before recording, and restore it
+	// before the replay.
+	struct Recording;
+	Recording* recordCommand(CommandTables table, uint32_t* params, size_t size);
+	bool replayCommand(const Recording* recording, uint32_t* params, size_t size);
+	void freeRecording(Recording* recording);
+
+	// Writes a binary trace (see AtomBiosTrace) of the tables that are run, and of the card accesses and delays they
+	// make. The trace is collected in a buffer of bufferSize bytes, which is passed to write whenever it is full, and
+	// by flushTrace. Replaced writers get the rest of their trace first; nullptr stops tracing.
+	// Accesses that are taken from a recording or from the other run of differential mode are not traced, as they
+	// are not made.
+	void setTraceWriter(void (*write)(const uint8_t* data, size_t size, void* context), void* context, size_t bufferSize);
+	void flushTrace();
+
+	// A table that was run, for the timeline.
+	struct TableSpan {
+		CommandTables table;
+		// The amount of tables that called it.
+		uint32_t depth;
+		// Timestamps from the clock, in nanoseconds.
+		uint64_t begin;
+		uint64_t end;
+		// The accesses and delays of the table itself, without the ones of the tables it called.
+		uint32_t reads;
+		uint32_t writes;
+		uint32_t delays;
+		uint64_t delayMicroseconds;
+	};
+	// Calls span whenever a table returns; nullptr stops the timeline. The timestamps are taken from clock; without
+	// a clock, they are simulated: the time starts at 0, and advances by accessNanoseconds for every register, PLL or
+	// MC access, and by the delays. Accesses that are not made (see setTraceWriter) do not count.
+	void setTimeline(void (*span)(const TableSpan& span, void* context), uint64_t (*clock)(void* context),
+		uint32_t accessNanoseconds, void* context);
+
+	// Cost model: how long a table would take on hardware. Each instruction takes instructionNanoseconds, each access
+	// the latency of its space (indexed by FootprintSpace), and delays take their time.
+	struct CostModel {
+		uint32_t instructionNanoseconds;
+		uint32_t accessNanoseconds[footprintSpaces];
+	};
+	// What the cost model counts. Superinstructions count as one instruction; PLL and MC accesses through an
+	// index/data pair are the register accesses they make.
+	struct CostCounters {
+		uint64_t instructions;
+		uint64_t reads[footprintSpaces];
+		uint64_t writes[footprintSpaces];
+		uint64_t delayMicroseconds;
+	};
+	static uint64_t predictNanoseconds(const CostModel& model, const CostCounters& counters);
+
+	// Estimated from the bytecode, for the IO mode the table would start with now: the cheapest and the most
+	// expensive path through the table, where every branch may go either way. CALL_TABLE adds the path of the callee,
+	// SWITCH may go to any case, and Reg operands in IIO mode make the accesses of the IIO function. The index write
+	// of an index/data pair is always counted.
+	struct CostEstimate {
+		CostCounters best;
+		CostCounters worst;
+		uint64_t bestNanoseconds;
+		uint64_t worstNanoseconds;
+		// Cleared if the table may loop (or recurse), or may not return: loops are then counted once per path,
+		// and the worst case is not an upper bound.
+		bool bounded;
+	};
+	CostEstimate estimateCost(CommandTables table, const CostModel& model);
+
+	// Measured instead: while counters is set, the runs add their instructions, accesses and delays to it. Instructions
+	// run as native code (JIT or AOT) are not counted, and neither are accesses that are not made (see setTraceWriter).
+	void setCostCounters(CostCounters* counters);
+
+	// By default, PLL and MC accesses are forwarded to the libatombios_card_pll_* / libatombios_card_mc_* functions.
+	// On boards where these spaces sit behind an index/data register pair, they can instead be routed through
+	// the register functions; the selected index is then tracked, and redundant index writes are skipped.
+	void setPLLIndexDataPair(uint32_t indexReg, uint32_t dataReg);
+	void setMCIndexDataPair(uint32_t indexReg, uint32_t dataReg);
+	// Must be called if the host writes to a configured index register outside of runCommand.
+	void invalidateIndexCache();
+
+	// Watchpoints: the callback is called for each read of a watched register, PLL or MC index after the read, with
+	// the value read, and for each watched write before the write, with the value to be written. Indexes are the ones
+	// the bytecode accesses (registers including the reg block, in any IO mode; PLL and MC indexes, not the index/data
+	// pair). Accesses made by replayCommand are not seen.
+	struct Watch {
+		// Reg, PLL or MC.
+		FootprintSpace space;
+		// The first and last index of the range.
+		uint32_t first;
+		uint32_t last;
+		bool reads;
+		bool writes;
+	};
+	// Replaces the watches; count 0 removes them. The watched indexes of a space (over all of its ranges) may span at
+	// most maxWatchSpan indexes; otherwise, or for FB ranges, false is returned and the watches are left as they were.
+	// Batch workers share the watches, so the callback may then be called from several threads at once.
+	static constexpr uint32_t maxWatchSpan = 1 << 20;
+	bool setWatches(const Watch* watches, size_t count,
+		void (*callback)(FootprintSpace space, bool write, uint32_t index, uint32_t val, void* context), void* context);
+
+	// Posted writes, for hosts where card writes are slow but can be posted: register, PLL and MC writes are pushed
+	// into a queue of depth entries (rounded up to a power of 2, at least 2), which a host I/O thread drains by calling
+	// drainPostedWrites; the writes are then made by that thread, through the libatombios_card_*_write functions, in
+	// the order they were pushed. Runs only wait for the queue to be drained before a read or a delay (which they then
+	// make themselves), when the queue is full, and before runCommand (or recordCommand, replayCommand,
+	// restoreSnapshot, runCommands) returns; the table entry hook is also called with the queue drained.
+	// While waiting, wait is called (e.g. to yield) if it is set. Depth 0 (the default) makes the writes directly.
+	// Must not be called while a command runs; waits until the queue is drained. Batch workers do not post writes.
+	void setPostedWrites(uint32_t depth, void (*wait)(void* context), void* context);
+	// Called by the I/O thread: makes up to max of the posted writes, and returns how many it made. Only one thread
+	// may drain the queue.
+	size_t drainPostedWrites(size_t max);
+
+	struct PostedWriteStats {
+		// The writes that were posted, and the sum of the queue depths right after each was posted.
+		uint64_t writes;
+		uint64_t depthSum;
+		uint32_t maxDepth;
+		// The times a write waited for room in the full queue, and a read, delay or return for the queue to be
+		// drained; and the times wait was called (or the queue was polled) while waiting.
+		uint64_t fullStalls;
+		uint64_t drainStalls;
+		uint64_t waitCalls;
+	};
+	// Counted since setPostedWrites.
+	PostedWriteStats postedWriteStats();
+
+	// FB operands are served directly from this memory, which usually maps the BIOS scratch area in VRAM
+	// (but may as well be a plain buffer). The memory is not copied, and must stay valid until it is replaced.
+	// Without a window, or outside of it, FB reads return 0 and FB writes are dropped; the first such access after
+	// each setFrameBufferWindow call is logged as a warning.
+	void setFrameBufferWindow(uint8_t* base, size_t size);
+
+	// Common opcode sequences are fused into superinstructions when a table is decoded (on its first run).
+	// All values are 0 for tables that have not been run yet.
+	struct FusionStats {
+		uint32_t instructions;
+		uint32_t superinstructions;
+		// The amount of instructions covered by the superinstructions.
+		uint32_t fusedInstructions;
+		// The amount of times a superinstruction was run.
+		uint32_t superinstructionsRun;
+		// The amount of instructions the interpreter ran, with a superinstruction counting as one. Runs of native
+		// (JIT or AOT) code and memoized results are not counted.
+		uint64_t instructionsRun;
+	};
+	FusionStats fusionStats(CommandTables table);
+
+	// While counts is set (to 256 entries), the interpreter adds each instruction it runs to the entry of its opcode;
+	// superinstructions are counted under their own opcodes, from 0xF0 up. Like instructionsRun, this does not include
+	// native code, memoized results, or the runs of batch workers.
+	void setOpcodeProfile(uint64_t* counts);
+
+	// Coverage: while enabled, the interpreter marks the instructions it runs, and counts which way conditional jumps
+	// went and which SWITCH cases were taken. The counts add up over all runs with coverage enabled, until the
+	// decoded commands are dropped (by changing the optimizer mode). Native code, memoized results and batch workers
+	// are not covered.
+	void setCoverage(bool enabled);
+
+	struct CoverageStats {
+		// The size of the bytecode of the table, and its FNV-1a hash: the coverage of tables with the same bytecode
+		// can be merged, also across ROMs.
+		uint32_t bytecodeSize;
+		uint32_t bytecodeHash;
+		// The instructions that can be reached from the start of the table, and the ones of them that ran.
+		uint32_t instructions;
+		uint32_t instructionsRun;
+	};
+	CoverageStats coverageStats(CommandTables table);
+	// A bit per byte of the bytecode (LSB first), set at the offset of each instruction that ran (or, if ran is false,
+	// that can be reached). Copies up to max bytes, and returns the size of the bitmap, (bytecodeSize + 7) / 8.
+	size_t coverageBitmap(CommandTables table, bool ran, uint8_t* bitmap, size_t max);
+
+	struct BranchCoverage {
+		// Offset into the bytecode of the conditional jump or SWITCH.
+		uint16_t offset;
+		bool isSwitch;
+		// SWITCH: the value of the case, or the fallthrough when no case matched.
+		bool fallthrough;
+		uint32_t value;
+		// Jumps: how often they were taken and not taken; SWITCH: how often the case was taken.
+		uint32_t taken;
+		uint32_t notTaken;
+	};
+	// Copies up to max of the conditional jumps and SWITCH cases (one entry per case, and one for the fallthrough)
+	// into branches, in bytecode order; returns the amount there are.
+	size_t branchCoverage(CommandTables table, BranchCoverage* branches, size_t max);
+
+	// The JIT compiles command tables into native code once they have been run threshold times (x86-64 only).
+	// Executable memory is requested through the libatombios_jit_* functions; without them, everything
+	// stays with the interpreter. Tables the JIT can not handle also stay with the interpreter.
+	// In differential mode, each command is run by the interpreter first, and then again (with native code
+	// where available) against the recorded card accesses, parameter space and state; runs that differ are
+	// logged and counted, and the result of the interpreter is kept.
+	// The JIT is not used while the optimizer runs in self-check mode.
+	enum class JitMode {
+		Off,
+		On,
+		Differential
+	};
+	void setJitMode(JitMode mode, uint32_t threshold = 16);
+
+	// All values are 0 for tables that have not been run yet.
+	struct JitStats {
+		bool compiled;
+		// The native code was translated ahead of time (see setAotModule); codeSize is then 0.
+		bool translated;
+		uint32_t codeSize;
+		uint32_t runs;
+		uint32_t nativeRuns;
+	};
+	JitStats jitStats(CommandTables table);
+	uint32_t jitMismatches();
+
+	// Translates all command tables and IIO functions of this ROM into C++, which defines an AtomBiosAot::Module
+	// called moduleName. The source is passed to write in pieces.
+	// Tables and functions that can not be translated (as they contain invalid opcodes or jumps) are left out;
+	// they are run by the interpreter. The decoded form is translated, so the optimizer mode applies.
+	void translateToCpp(const char* moduleName, void (*write)(const char* data, size_t size, void* context), void* context);
+
+	// Runs the functions of a translated module instead of the bytecode (and the JIT), for the tables and IIO
+	// functions whose bytecode matches this ROM; the others are run as before. nullptr removes the module.
+	// The module must stay valid until it is replaced. Like the JIT, it is not used in self-check mode.
+	// Changing the module discards the decoded tables (and their statistics).
+	void setAotModule(const AtomBiosAot::Module* module);
+
+	// Pure command tables (ones that, along with the tables they call, only compute on their parameters, the
+	// WorkSpace and the ROM, without accessing registers, PLL, MC, FB or IIO, and without delays) keep the results of
+	// their last runs, up to entries per table. Runs with the same parameters (and the same flags, DIV/MUL registers,
+	// data block or mask shift, where the table depends on them) then take the result from there, without running the
+	// table. 0 (the default) disables this. Changing the amount discards the decoded tables (and their statistics).
+	void setMemoization(uint32_t entries);
+
+	// All values are 0 for tables that have not been run yet.
+	struct MemoStats {
+		bool pure;
+		uint32_t entries;
+		uint32_t hits;
+		uint32_t misses;
+	};
+	MemoStats memoStats(CommandTables table);
+
+	// The optimizer rewrites the decoded form of each table: it folds constant reg blocks into register
+	// addresses, forwards values through WorkSpace temporaries, drops WorkSpace stores that are never read,
+	// and turns divisions by immediates into multiplications.
+	// In self-check mode, every optimized instruction is also checked against what the plain interpreter
+	// computes; mismatches are logged and counted, and the plain result is used.
+	// Changing the mode discards the decoded tables (and their statistics).
+	enum class OptimizerMode {
+		Off,
+		On,
+		SelfCheck
+	};
+	void setOptimizerMode(OptimizerMode mode);
+
+	// All values are 0 for tables that have not been run yet.
+	struct OptimizerStats {
+		uint32_t foldedRegBlocks;
+		uint32_t forwardedSources;
+		uint32_t deadStores;
+		uint32_t reducedDivisions;
+	};
+	OptimizerStats optimizerStats(CommandTables table);
+	uint32_t selfCheckMismatches();
+
 	const uint32_t maxPSIndex();
 	const uint32_t maxWSIndex();
+	uint32_t skippedIndexWrites();
 private:
 	AtomBiosImpl* _impl;
 };
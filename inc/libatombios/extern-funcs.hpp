@@ -62,6 +62,12 @@ extern "C" [[gnu::weak]] uint32_t libatombios_card_pll_read(uint32_t reg);
 extern "C" [[gnu::weak]] void libatombios_delay_microseconds(uint32_t microseconds);
 extern "C" [[gnu::weak]] void libatombios_delay_milliseconds(uint32_t milliseconds);
 
+// Executable memory for the JIT; all three are needed for it to be used.
+// alloc returns writable memory, seal makes it executable (and no longer writable).
+extern "C" [[gnu::weak]] void* libatombios_jit_alloc(size_t size);
+extern "C" [[gnu::weak]] bool libatombios_jit_seal(void* ptr, size_t size);
+extern "C" [[gnu::weak]] void libatombios_jit_free(void* ptr, size_t size);
+
 // Prefer a assert from a standard lib, instead of our own implementation.
 #if !__has_include("assert.h")
 #define assert(x) \
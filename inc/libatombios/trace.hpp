@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary traces of the tables that were run and the card accesses they made (see AtomBios::setTraceWriter).
+//
+// A trace starts with the magic "ATBT" and the format version byte. Each event then starts with a byte holding
+// the event type in bits 0-2, the space of Read / Write in bits 3-4, and bit 5 for Read / Write events whose value
+// is the one of the previous Read / Write (no value follows). Operands are LEB128 varints; registers and values are
+// zigzag-encoded differences to the ones of the previous Read / Write.
+//   TableEnter: table, depth. Both differences start over from 0, so that a trace can be read from any TableEnter.
+//   TableExit:  -
+//   Read:       reg, value
+//   Write:      reg, value
+//   Delay:      microseconds
+class AtomBiosTrace {
+public:
+	static constexpr uint8_t magic[4] = {'A', 'T', 'B', 'T'};
+	static constexpr uint8_t version = 1;
+	static constexpr size_t headerSize = 5;
+
+	enum class EventType : uint8_t {
+		TableEnter = 0,
+		TableExit,
+		Read,
+		Write,
+		Delay
+	};
+	enum class Space : uint8_t {
+		Reg = 0,
+		PLL,
+		MC
+	};
+
+	static constexpr uint8_t typeMask = 0x07;
+	static constexpr int spaceShift = 3;
+	static constexpr uint8_t spaceMask = 0x18;
+	static constexpr uint8_t sameValue = 0x20;
+	// The longest event: the type byte and two 5-byte varints.
+	static constexpr size_t maxEventSize = 11;
+
+	struct Event {
+		EventType type;
+		// Read / Write only.
+		Space space;
+		// TableEnter only.
+		uint32_t table;
+		uint32_t depth;
+		// Read / Write: the register and value; Delay: the microseconds, in val.
+		uint32_t reg;
+		uint32_t val;
+	};
+
+	// A TableEnter event.
+	struct Invocation {
+		uint64_t offset;
+		uint32_t table;
+		uint32_t depth;
+	};
+
+	// Reads a trace from memory, e.g. a mapped file. The memory has to stay around as long as the reader.
+	// The invocations of all tables are found when the reader is created.
+	class Reader {
+	public:
+		Reader(const uint8_t* data, size_t size);
+		~Reader();
+
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+
+		// Whether the trace has a valid header; the events of an invalid trace are empty.
+		bool valid() const { return _valid; }
+		// Whether the trace ends within an event (e.g. when the writer did not flush), or has an unknown one.
+		bool truncated() const { return _truncated; }
+
+		// The next event; false at the end of the trace.
+		bool next(Event& event);
+		// The offset of the next event.
+		uint64_t offset() const { return _pos; }
+
+		size_t invocations() const;
+		const Invocation& invocation(size_t i) const;
+		// The next event is then the TableEnter of the invocation.
+		void seekInvocation(size_t i);
+
+	private:
+		bool _readVarint(uint32_t& val);
+
+		const uint8_t* _data;
+		size_t _size;
+		size_t _pos;
+		bool _valid;
+		bool _truncated;
+		uint32_t _reg;
+		uint32_t _val;
+
+		// The invocations, in the order of the trace.
+		struct Index;
+		Index* _index;
+	};
+};
@@ -0,0 +1,445 @@
+#include <iostream>
+#include <fstream>
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <CLI/CLI.hpp>
+#include <libatombios/atom.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../src-builder/rom-builder.hpp"
+
+// Benchmarks of the interpreter, on ROMs generated by the ROM builder (or a ROM from a file).
+// The card accesses and delays do nothing and the library is built without its logging, so the numbers are those
+// of the interpreter itself.
+
+using AtomRomBuilder::Label;
+using AtomRomBuilder::Table;
+
+static uint64_t allocations = 0;
+
+extern "C" void lilrad_log(enum LilradLogType type, const char* format, ...) {
+}
+
+extern "C" void* lilrad_alloc(size_t size) {
+	allocations++;
+	return malloc(size);
+}
+
+extern "C" void lilrad_free(void* ptr) {
+	free(ptr);
+}
+
+extern "C" void libatombios_card_reg_write(uint32_t reg, uint32_t val) {
+}
+extern "C" uint32_t libatombios_card_reg_read(uint32_t reg) {
+	return 0;
+}
+extern "C" void libatombios_card_mc_write(uint32_t reg, uint32_t val) {
+}
+extern "C" uint32_t libatombios_card_mc_read(uint32_t reg) {
+	return 0;
+}
+extern "C" void libatombios_card_pll_write(uint32_t reg, uint32_t val) {
+}
+extern "C" uint32_t libatombios_card_pll_read(uint32_t reg) {
+	return 0;
+}
+
+extern "C" void libatombios_delay_microseconds(uint32_t microseconds) {
+}
+extern "C" void libatombios_delay_milliseconds(uint32_t milliseconds) {
+}
+
+extern "C" void* libatombios_jit_alloc(size_t size) {
+	void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return ptr == MAP_FAILED ? nullptr : ptr;
+}
+extern "C" bool libatombios_jit_seal(void* ptr, size_t size) {
+	return mprotect(ptr, size, PROT_READ | PROT_EXEC) == 0;
+}
+extern "C" void libatombios_jit_free(void* ptr, size_t size) {
+	munmap(ptr, size);
+}
+
+/// Workloads.
+
+struct Workload {
+	std::vector<uint8_t> rom;
+	AtomBios::CommandTables table;
+	// Opcodes one run of the table executes, counting END_OF_TABLE; 0 where this is not known.
+	uint64_t opcodes;
+};
+
+// Runs body iterations times, with WS[0] as the counter; body emits the opcodes of one iteration and returns their
+// number. Returns the number of opcodes the loop executes.
+static uint64_t emitLoop(Table& table, uint32_t iterations, const std::function<uint64_t(Table&)>& body) {
+	table.op(Opcodes::MOVE_TO_REG, OpcodeArgEncoding::WorkSpace, 0, OpcodeArgEncoding::Imm, iterations);
+
+	Label loop = table.label();
+	table.bind(loop);
+	uint64_t bodyOpcodes = body(table);
+	table.op(Opcodes::SUB_INTO_REG, OpcodeArgEncoding::WorkSpace, 0, OpcodeArgEncoding::Imm, 1);
+	table.op(Opcodes::COMPARE_FROM_REG, OpcodeArgEncoding::WorkSpace, 0, OpcodeArgEncoding::Imm, 0);
+	table.jump(Opcodes::JUMP_NOTEQUAL, loop);
+
+	return 1 + iterations * (bodyOpcodes + 3);
+}
+
+// A table that runs body in a loop, as ASIC_Init.
+static Workload loopWorkload(uint32_t iterations, const std::function<uint64_t(Table&)>& body,
+		const std::function<void(AtomRomBuilder::Rom&)>& extra = nullptr) {
+	Table table(16, 8);
+	uint64_t opcodes = emitLoop(table, iterations, body);
+	table.end();
+
+	AtomRomBuilder::Rom rom;
+	rom.setCommand(AtomBios::ASIC_Init, table);
+	if(extra) {
+		extra(rom);
+	}
+	return Workload{rom.build(), AtomBios::ASIC_Init, opcodes + 1};
+}
+
+// Roughly the shape of ASIC_Init: tables that are called in turn, which do read-modify-writes of registers,
+// program PLLs with computed dividers, wait, and pick register values by a parameter.
+static Workload asicInitWorkload() {
+	constexpr auto WS = OpcodeArgEncoding::WorkSpace;
+	constexpr auto PS = OpcodeArgEncoding::ParameterSpace;
+	constexpr auto Reg = OpcodeArgEncoding::Reg;
+	constexpr auto Imm = OpcodeArgEncoding::Imm;
+
+	AtomRomBuilder::Rom rom;
+	uint64_t opcodes = 0;
+
+	// ASIC_RegistersInit: read-modify-writes of a block of registers.
+	{
+		Table table(16, 0);
+		table.setRegBlock(0x1000);
+		uint64_t count = 1;
+		for(uint32_t reg = 0; reg < 32; reg++) {
+			table.op(Opcodes::MOVE_TO_REG, WS, 1, Reg, reg);
+			table.op(Opcodes::AND_INTO_REG, WS, 1, Imm, 0xFFFF00FF);
+			table.op(Opcodes::OR_INTO_REG, WS, 1, Imm, reg << 8);
+			table.op(Opcodes::MOVE_TO_REG, Reg, reg, WS, 1);
+			count += 4;
+		}
+		table.setRegBlock(0);
+		table.end();
+		rom.setCommand(AtomBios::ASIC_RegistersInit, table);
+		opcodes += count + 2;
+	}
+
+	// MemoryControllerInit: MC writes, and registers picked by the memory type in PS[0].
+	{
+		Table table(16, 8);
+		uint64_t count = 0;
+		count += emitLoop(table, 16, [](Table& t) {
+			t.op(Opcodes::MOVE_TO_MC, OpcodeArgEncoding::MC, 0x20, WS, 0);
+			t.mask(OpcodeArgEncoding::MC, 0x21, 0xFFFFFF00, WS, 0, SrcEncoding::SrcByte0);
+			return 2;
+		});
+
+		std::vector<std::pair<uint32_t, Label>> cases;
+		for(uint32_t type = 0; type < 8; type++) {
+			cases.push_back({type, table.label()});
+		}
+		Label done = table.label();
+		table.switchOn(PS, 0, SrcEncoding::SrcByte0, cases);
+		table.jump(Opcodes::JUMP_ALWAYS, done);
+		for(auto& [type, label] : cases) {
+			table.bind(label);
+			table.op(Opcodes::MOVE_TO_REG, Reg, 0x2000 + type, Imm, 0x100 * type);
+			table.jump(Opcodes::JUMP_ALWAYS, done);
+		}
+		table.bind(done);
+		// The switch, the case and its jump.
+		count += 3;
+		table.end();
+		rom.setCommand(AtomBios::MemoryControllerInit, table);
+		opcodes += 1 + count;
+	}
+
+	// SetEngineClock / SetMemoryClock: dividers out of the clock in PS[0], written to the PLL, and a wait.
+	for(int clock : {AtomBios::SetEngineClock, AtomBios::SetMemoryClock}) {
+		Table table(16, 8);
+		uint32_t pll = clock == AtomBios::SetEngineClock ? 0x10 : 0x20;
+		table.op(Opcodes::MOVE_TO_REG, WS, 1, PS, 0);
+		table.op(Opcodes::MUL_WITH_REG, WS, 1, Imm, 4);
+		table.op(Opcodes::MOVE_TO_REG, WS, 1, WS, WS_QUOTIENT);
+		table.op(Opcodes::DIV_WITH_REG, WS, 1, Imm, 100);
+		table.op(Opcodes::MOVE_TO_REG, WS, 2, WS, WS_QUOTIENT);
+		table.shiftLeft(WS, 2, 8);
+		table.op(Opcodes::OR_INTO_REG, WS, 2, WS, WS_REMAINDER);
+		table.op(Opcodes::MOVE_TO_PLL, OpcodeArgEncoding::PLL, pll, WS, 2);
+		table.op(Opcodes::MOVE_TO_REG, WS, 3, OpcodeArgEncoding::PLL, pll + 1);
+		table.op(Opcodes::OR_INTO_REG, WS, 3, Imm, 1);
+		table.op(Opcodes::MOVE_TO_PLL, OpcodeArgEncoding::PLL, pll + 1, WS, 3);
+		table.delayMicroseconds(10);
+		table.op(Opcodes::MOVE_TO_REG, PS, 0, WS, 2);
+		table.end();
+		rom.setCommand(clock, table);
+		opcodes += 13 + 1;
+	}
+
+	// ASIC_Init: the tables in turn, with the parameters they take.
+	{
+		Table table(16, 16);
+		table.op(Opcodes::MOVE_TO_REG, WS, 0, PS, 0);
+		table.callTable(AtomBios::ASIC_RegistersInit);
+		table.op(Opcodes::MOVE_TO_REG, PS, 0, Imm, 3);
+		table.callTable(AtomBios::MemoryControllerInit);
+		table.op(Opcodes::MOVE_TO_REG, PS, 0, Imm, 60000);
+		table.callTable(AtomBios::SetEngineClock);
+		table.op(Opcodes::MOVE_TO_REG, PS, 0, Imm, 80000);
+		table.callTable(AtomBios::SetMemoryClock);
+		table.op(Opcodes::MOVE_TO_REG, PS, 0, WS, 0);
+		table.end();
+		rom.setCommand(AtomBios::ASIC_Init, table);
+		opcodes += 10;
+	}
+
+	// The calls count as opcodes of the caller; the tables they run count on their own.
+	return Workload{rom.build(), AtomBios::ASIC_Init, opcodes};
+}
+
+// Micro-programs, one per opcode family; each runs its opcodes in a loop.
+static Workload familyWorkload(const std::string& family, uint32_t iterations) {
+	constexpr auto WS = OpcodeArgEncoding::WorkSpace;
+	constexpr auto PS = OpcodeArgEncoding::ParameterSpace;
+	constexpr auto Reg = OpcodeArgEncoding::Reg;
+	constexpr auto Imm = OpcodeArgEncoding::Imm;
+
+	if(family == "move") {
+		return loopWorkload(iterations, [](Table& t) {
+			t.op(Opcodes::MOVE_TO_REG, WS, 1, Imm, 0x12345678);
+			t.op(Opcodes::MOVE_TO_REG, WS, 2, WS, 1);
+			t.op(Opcodes::MOVE_TO_REG, PS, 0, WS, 2);
+			t.op(Opcodes::MOVE_TO_REG, WS, 3, PS, 0, SrcEncoding::SrcByte8, SrcEncoding::SrcByte16);
+			t.op(Opcodes::MOVE_TO_REG, WS, 3, Imm, 0xBEEF, SrcEncoding::SrcWord0);
+			return 5;
+		});
+	} else if(family == "alu") {
+		return loopWorkload(iterations, [](Table& t) {
+			t.op(Opcodes::ADD_INTO_REG, WS, 1, Imm, 3);
+			t.op(Opcodes::SUB_INTO_REG, WS, 2, WS, 1);
+			t.op(Opcodes::AND_INTO_REG, WS, 1, Imm, 0x0FFFFFFF);
+			t.op(Opcodes::OR_INTO_REG, WS, 2, Imm, 0x10, SrcEncoding::SrcByte0);
+			t.op(Opcodes::XOR_INTO_REG, WS, 3, WS, 2);
+			return 5;
+		});
+	} else if(family == "shift") {
+		return loopWorkload(iterations, [](Table& t) {
+			t.shiftLeft(WS, 1, 4);
+			t.shiftRight(WS, 1, 2);
+			t.shiftLeft(WS, 2, 1, SrcEncoding::SrcByte8);
+			t.shiftRight(WS, 2, 3, SrcEncoding::SrcWord16);
+			return 4;
+		});
+	} else if(family == "muldiv") {
+		return loopWorkload(iterations, [](Table& t) {
+			t.op(Opcodes::MOVE_TO_REG, WS, 1, WS, 0);
+			t.op(Opcodes::MUL_WITH_REG, WS, 1, Imm, 7);
+			t.op(Opcodes::DIV_WITH_REG, WS, 1, Imm, 10);
+			t.op(Opcodes::MOVE_TO_REG, WS, 2, Imm, 3);
+			t.op(Opcodes::DIV_WITH_REG, WS, 1, WS, 2);
+			return 5;
+		});
+	} else if(family == "compare") {
+		return loopWorkload(iterations, [](Table& t) {
+			Label skip = t.label();
+			Label next = t.label();
+			t.op(Opcodes::COMPARE_FROM_REG, WS, 1, Imm, 5);
+			t.jump(Opcodes::JUMP_EQUAL, skip);
+			t.op(Opcodes::MOVE_TO_REG, WS, 2, Imm, 1);
+			t.bind(skip);
+			t.op(Opcodes::TEST_FROM_REG, WS, 0, Imm, 1);
+			t.jump(Opcodes::JUMP_EQUAL, next);
+			t.bind(next);
+			return 5;
+		});
+	} else if(family == "switch") {
+		// A case for every value of the low byte of the counter.
+		return loopWorkload(iterations, [](Table& t) {
+			std::vector<std::pair<uint32_t, Label>> cases;
+			for(uint32_t val = 0; val < 256; val++) {
+				cases.push_back({val, t.label()});
+			}
+			Label done = t.label();
+			t.switchOn(WS, 0, SrcEncoding::SrcByte0, cases);
+			for(auto& [val, label] : cases) {
+				t.bind(label);
+				t.op(Opcodes::MOVE_TO_REG, WS, 1, Imm, val);
+				t.jump(Opcodes::JUMP_ALWAYS, done);
+			}
+			t.bind(done);
+			return 3;
+		});
+	} else if(family == "mask") {
+		return loopWorkload(iterations, [](Table& t) {
+			t.mask(WS, 1, 0xFFFF0000, WS, 0, SrcEncoding::SrcWord0);
+			t.mask(WS, 2, 0x0F, Imm, 0x42, SrcEncoding::SrcByte16);
+			t.clear(WS, 3);
+			return 3;
+		});
+	} else if(family == "reg") {
+		return loopWorkload(iterations, [](Table& t) {
+			t.setRegBlock(0x400);
+			t.op(Opcodes::MOVE_TO_REG, Reg, 0x10, WS, 0);
+			t.op(Opcodes::MOVE_TO_REG, WS, 1, Reg, 0x11);
+			t.mask(Reg, 0x12, 0xFFFF00FF, Imm, 0x3300, SrcEncoding::SrcWord0);
+			t.setRegBlock(0);
+			return 5;
+		});
+	} else if(family == "pllmc") {
+		return loopWorkload(iterations, [](Table& t) {
+			t.op(Opcodes::MOVE_TO_PLL, OpcodeArgEncoding::PLL, 0x10, WS, 0);
+			t.op(Opcodes::MOVE_TO_REG, WS, 1, OpcodeArgEncoding::PLL, 0x11);
+			t.op(Opcodes::MOVE_TO_MC, OpcodeArgEncoding::MC, 0x20, WS, 0);
+			t.op(Opcodes::MOVE_TO_REG, WS, 1, OpcodeArgEncoding::MC, 0x21);
+			return 4;
+		});
+	} else if(family == "call") {
+		return loopWorkload(iterations, [](Table& t) {
+			t.callTable(AtomBios::GetDisplaySurfaceSize);
+			return 1 + 2;
+		}, [](AtomRomBuilder::Rom& rom) {
+			Table callee(4, 0);
+			callee.op(Opcodes::MOVE_TO_REG, WS, 0, Imm, 1);
+			callee.end();
+			rom.setCommand(AtomBios::GetDisplaySurfaceSize, callee);
+		});
+	} else if(family == "iio") {
+		// Index / data register pairs, through IIO functions for reads (port 1) and writes (port 2).
+		return loopWorkload(iterations, [](Table& t) {
+			t.setATIPort(2);
+			t.op(Opcodes::MOVE_TO_REG, Reg, 0x30, WS, 0);
+			t.setATIPort(1);
+			t.op(Opcodes::MOVE_TO_REG, WS, 1, Reg, 0x31);
+			t.setATIPort(0);
+			return 5;
+		}, [](AtomRomBuilder::Rom& rom) {
+			AtomRomBuilder::IIOFunction read;
+			read.moveIndex(16, 0, 0);
+			read.write(0x10);
+			read.read(0x11);
+			rom.setIIOFunction(1, read);
+
+			AtomRomBuilder::IIOFunction write;
+			write.moveIndex(16, 0, 0);
+			write.write(0x10);
+			write.moveData(32, 0, 0);
+			write.write(0x11);
+			rom.setIIOFunction(2, write);
+		});
+	}
+
+	return Workload{};
+}
+
+static const char* familyNames[] = {
+	"move", "alu", "shift", "muldiv", "compare", "switch", "mask", "reg", "pllmc", "call", "iio"
+};
+
+/// Measurement.
+
+struct Result {
+	double nsPerCall;
+	double nsPerOpcode;
+	double allocationsPerCall;
+};
+
+static Result measure(const Workload& workload, AtomBios::OptimizerMode optimizer, AtomBios::JitMode jit,
+		uint32_t calls, uint32_t warmup) {
+	std::vector<uint8_t> rom = workload.rom;
+	AtomBios atomBios(rom.data(), rom.size());
+	atomBios.setOptimizerMode(optimizer);
+	atomBios.setJitMode(jit);
+
+	uint32_t params[4] = {};
+	// Decoding, the JIT and first allocations are left out.
+	for(uint32_t i = 0; i < warmup; i++) {
+		atomBios.runCommand(workload.table, params, 4);
+	}
+
+	uint64_t allocationsBefore = allocations;
+	auto start = std::chrono::steady_clock::now();
+	for(uint32_t i = 0; i < calls; i++) {
+		params[0] = 0;
+		atomBios.runCommand(workload.table, params, 4);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double ns = std::chrono::duration<double, std::nano>(end - start).count();
+	Result result;
+	result.nsPerCall = ns / calls;
+	result.nsPerOpcode = workload.opcodes ? result.nsPerCall / workload.opcodes : 0;
+	result.allocationsPerCall = static_cast<double>(allocations - allocationsBefore) / calls;
+	return result;
+}
+
+int main(int argc, char** argv) {
+	std::string workloadName = "asic_init";
+	std::string romPath{};
+	std::string optimize = "off";
+	std::string jit = "off";
+	uint32_t calls = 1000;
+	uint32_t warmup = 64;
+	uint32_t iterations = 100;
+
+	CLI::App app{"atombios-bench"};
+	argv = app.ensure_utf8(argv);
+
+	app.add_option("workload", workloadName, "asic_init, an opcode family (move, alu, shift, muldiv, compare, switch, "
+		"mask, reg, pllmc, call, iio) or all");
+	app.add_option("--rom", romPath, "Run ASIC_Init of this ROM instead of a generated one; tables that wait for "
+		"registers to change may not finish, as reads return 0");
+	app.add_option("-O,--optimize", optimize, "Optimizer mode: off or on");
+	app.add_option("-j,--jit", jit, "JIT mode: off or on");
+	app.add_option("-n,--calls", calls, "Measured calls of the table");
+	app.add_option("--warmup", warmup, "Calls before the measurement");
+	app.add_option("--iterations", iterations, "Loop iterations of the opcode family programs");
+
+	CLI11_PARSE(app, argc, argv);
+
+	AtomBios::OptimizerMode optimizerMode = optimize == "on" ? AtomBios::OptimizerMode::On : AtomBios::OptimizerMode::Off;
+	AtomBios::JitMode jitMode = jit == "on" ? AtomBios::JitMode::On : AtomBios::JitMode::Off;
+
+	std::vector<std::pair<std::string, Workload>> workloads;
+	if(!romPath.empty()) {
+		std::ifstream file(romPath, std::ios::in | std::ios::binary);
+		if(!file) {
+			std::cerr << "can not open " << romPath << std::endl;
+			return 1;
+		}
+		std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		workloads.push_back({"asic_init (" + romPath + ")", Workload{data, AtomBios::ASIC_Init, 0}});
+	} else if(workloadName == "asic_init" || workloadName == "all") {
+		workloads.push_back({"asic_init", asicInitWorkload()});
+	}
+	for(const char* family : familyNames) {
+		if(romPath.empty() && (workloadName == family || workloadName == "all")) {
+			workloads.push_back({family, familyWorkload(family, iterations)});
+		}
+	}
+	if(workloads.empty()) {
+		std::cerr << "unknown workload " << workloadName << std::endl;
+		return 1;
+	}
+
+	for(auto& [name, workload] : workloads) {
+		Result result = measure(workload, optimizerMode, jitMode, calls, warmup);
+		printf("%-12s optimizer %-3s jit %-3s: %12.1f ns/call", name.c_str(), optimize.c_str(), jit.c_str(), result.nsPerCall);
+		if(workload.opcodes) {
+			printf(" %8.2f ns/opcode (%llu opcodes)", result.nsPerOpcode, static_cast<unsigned long long>(workload.opcodes));
+		}
+		printf(" %8.2f allocations/call\n", result.allocationsPerCall);
+	}
+	return 0;
+}
@@ -0,0 +1,706 @@
+#include "assembler.hpp"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace AtomRomBuilder {
+
+namespace {
+
+struct Line {
+	int number;
+	std::vector<std::string> tokens;
+};
+
+struct Operand {
+	OpcodeArgEncoding arg;
+	uint32_t idx;
+	// Whether the operand had an alignment suffix.
+	bool aligned;
+	SrcEncoding align;
+};
+
+struct OpcodeFamily {
+	const char* name;
+	Opcodes family;
+};
+
+constexpr OpcodeFamily families[] = {
+	{"move", Opcodes::MOVE_TO_REG},
+	{"and", Opcodes::AND_INTO_REG},
+	{"or", Opcodes::OR_INTO_REG},
+	{"xor", Opcodes::XOR_INTO_REG},
+	{"add", Opcodes::ADD_INTO_REG},
+	{"sub", Opcodes::SUB_INTO_REG},
+	{"mul", Opcodes::MUL_WITH_REG},
+	{"div", Opcodes::DIV_WITH_REG},
+	{"cmp", Opcodes::COMPARE_FROM_REG},
+	{"test", Opcodes::TEST_FROM_REG}
+};
+
+constexpr OpcodeFamily jumps[] = {
+	{"jmp", Opcodes::JUMP_ALWAYS},
+	{"je", Opcodes::JUMP_EQUAL},
+	{"jne", Opcodes::JUMP_NOTEQUAL},
+	{"jb", Opcodes::JUMP_BELOW},
+	{"ja", Opcodes::JUMP_ABOVE},
+	{"jbe", Opcodes::JUMP_BELOWOREQUAL},
+	{"jae", Opcodes::JUMP_ABOVEOREQUAL}
+};
+
+struct Space {
+	const char* name;
+	OpcodeArgEncoding arg;
+};
+
+constexpr Space spaces[] = {
+	{"reg", OpcodeArgEncoding::Reg},
+	{"ps", OpcodeArgEncoding::ParameterSpace},
+	{"ws", OpcodeArgEncoding::WorkSpace},
+	{"fb", OpcodeArgEncoding::FrameBuffer},
+	{"id", OpcodeArgEncoding::ID},
+	{"pll", OpcodeArgEncoding::PLL},
+	{"mc", OpcodeArgEncoding::MC}
+};
+
+const char* alignmentNames[] = {"dword", "w0", "w8", "w16", "b0", "b8", "b16", "b24"};
+
+struct SpecialWorkSpace {
+	const char* name;
+	uint32_t idx;
+};
+
+constexpr SpecialWorkSpace specialWorkSpaces[] = {
+	{"quotient", WS_QUOTIENT},
+	{"remainder", WS_REMAINDER},
+	{"dataptr", WS_DATAPTR},
+	{"shift", WS_SHIFT},
+	{"or_mask", WS_OR_MASK},
+	{"and_mask", WS_AND_MASK},
+	{"fb_window", WS_FB_WINDOW},
+	{"attributes", WS_ATTRIBUTES},
+	{"regptr", WS_REGPTR}
+};
+
+class Assembler {
+public:
+	Assembler(Rom& rom, std::string& error)
+	: _rom{rom}, _error{error} { }
+
+	bool run(const std::string& source);
+
+private:
+	bool _fail(int line, const std::string& message) {
+		_error = "line " + std::to_string(line) + ": " + message;
+		return false;
+	}
+
+	bool _split(const std::string& source, std::vector<Line>& lines);
+	bool _expand(const std::vector<Line>& lines, size_t& pos, std::vector<Line>& out, int depth, int64_t iteration);
+	bool _substitute(const Line& line, int64_t iteration, Line& out);
+
+	bool _number(const Line& line, const std::string& token, uint32_t& val);
+	bool _bounded(const Line& line, const std::string& token, uint32_t max, uint32_t& val);
+	bool _operand(const Line& line, const std::string& token, Operand& operand);
+	bool _commandTable(const Line& line, const std::string& token, uint32_t& table);
+	bool _arguments(const Line& line, size_t count);
+
+	bool _table(const std::vector<Line>& lines, size_t& pos);
+	bool _instruction(const std::vector<Line>& lines, size_t& pos, Table& table);
+	bool _iio(const std::vector<Line>& lines, size_t& pos);
+	bool _data(const std::vector<Line>& lines, size_t& pos);
+	bool _bytes(const Line& line, std::vector<uint8_t>& bytes);
+
+	Label _label(Table& table, const std::string& name);
+
+	Rom& _rom;
+	std::string& _error;
+
+	// The labels of the table that is assembled.
+	std::map<std::string, Label> _labels;
+	std::set<std::string> _boundLabels;
+	std::map<std::string, int> _labelUses;
+};
+
+bool Assembler::_split(const std::string& source, std::vector<Line>& lines) {
+	size_t start = 0;
+	int number = 1;
+	while(start <= source.size()) {
+		size_t end = source.find('\n', start);
+		if(end == std::string::npos) {
+			end = source.size();
+		}
+		std::string text = source.substr(start, end - start);
+		size_t comment = text.find_first_of(";#");
+		if(comment != std::string::npos) {
+			text.resize(comment);
+		}
+
+		Line line{number, {}};
+		std::string token;
+		for(char c : text) {
+			if(c == ' ' || c == '\t' || c == ',' || c == '\r') {
+				if(!token.empty()) {
+					line.tokens.push_back(token);
+					token.clear();
+				}
+			} else {
+				token += c;
+			}
+		}
+		if(!token.empty()) {
+			line.tokens.push_back(token);
+		}
+		if(!line.tokens.empty()) {
+			lines.push_back(line);
+		}
+
+		start = end + 1;
+		number++;
+	}
+	return true;
+}
+
+bool Assembler::_substitute(const Line& line, int64_t iteration, Line& out) {
+	out.number = line.number;
+	out.tokens.clear();
+	for(const std::string& token : line.tokens) {
+		std::string result;
+		size_t pos = 0;
+		while(true) {
+			size_t open = token.find('{', pos);
+			if(open == std::string::npos) {
+				result += token.substr(pos);
+				break;
+			}
+			size_t close = token.find('}', open);
+			if(close == std::string::npos) {
+				return _fail(line.number, "unterminated {} in " + token);
+			}
+			result += token.substr(pos, open - pos);
+
+			std::string expr = token.substr(open + 1, close - open - 1);
+			if(iteration < 0 || expr.empty() || expr[0] != 'i') {
+				return _fail(line.number, "{" + expr + "} outside of a repeat, or not of the iteration");
+			}
+			int64_t val = iteration;
+			if(expr.size() > 1) {
+				char* end;
+				int64_t offset = strtoll(expr.c_str() + 2, &end, 0);
+				if((expr[1] != '+' && expr[1] != '-') || *end || expr.size() == 2) {
+					return _fail(line.number, "invalid expression {" + expr + "}");
+				}
+				val += expr[1] == '+' ? offset : -offset;
+			}
+			result += std::to_string(val);
+			pos = close + 1;
+		}
+		out.tokens.push_back(result);
+	}
+	return true;
+}
+
+// Copies the lines up to the endrepeat of this depth into out, with the repeats in them expanded.
+bool Assembler::_expand(const std::vector<Line>& lines, size_t& pos, std::vector<Line>& out, int depth, int64_t iteration) {
+	while(pos < lines.size()) {
+		const Line& line = lines[pos];
+		if(line.tokens[0] == "endrepeat") {
+			if(!depth) {
+				return _fail(line.number, "endrepeat without repeat");
+			}
+			return true;
+		}
+
+		if(line.tokens[0] != "repeat") {
+			Line substituted;
+			if(!_substitute(line, iteration, substituted)) {
+				return false;
+			}
+			out.push_back(substituted);
+			pos++;
+			continue;
+		}
+
+		// The count may depend on the iteration of the repeat around this one.
+		Line substituted;
+		uint32_t count;
+		if(!_substitute(line, iteration, substituted) || !_arguments(substituted, 1)
+				|| !_number(substituted, substituted.tokens[1], count)) {
+			return false;
+		}
+
+		size_t body = pos + 1;
+		size_t end = body;
+		for(uint32_t i = 0; i < (count ? count : 1); i++) {
+			// Without iterations, the body is still walked once, to find its end.
+			std::vector<Line> discard;
+			end = body;
+			if(!_expand(lines, end, count ? out : discard, depth + 1, i)) {
+				return false;
+			}
+		}
+		pos = end + 1;
+	}
+
+	if(depth) {
+		return _fail(lines.back().number, "repeat without endrepeat");
+	}
+	return true;
+}
+
+bool Assembler::_number(const Line& line, const std::string& token, uint32_t& val) {
+	char* end;
+	errno = 0;
+	long long parsed = strtoll(token.c_str(), &end, 0);
+	if(token.empty() || *end || errno || parsed < -0x80000000LL || parsed > 0xFFFFFFFFLL) {
+		return _fail(line.number, "invalid number " + token);
+	}
+	val = static_cast<uint32_t>(parsed);
+	return true;
+}
+
+bool Assembler::_bounded(const Line& line, const std::string& token, uint32_t max, uint32_t& val) {
+	if(!_number(line, token, val)) {
+		return false;
+	}
+	if(val > max) {
+		return _fail(line.number, token + " is larger than " + std::to_string(max));
+	}
+	return true;
+}
+
+bool Assembler::_arguments(const Line& line, size_t count) {
+	if(line.tokens.size() != count + 1) {
+		return _fail(line.number, line.tokens[0] + " takes " + std::to_string(count) + " operands");
+	}
+	return true;
+}
+
+bool Assembler::_operand(const Line& line, const std::string& token, Operand& operand) {
+	std::string text = token;
+	operand.aligned = false;
+	operand.align = SrcEncoding::SrcDword;
+
+	size_t dot = text.rfind('.');
+	if(dot != std::string::npos) {
+		std::string suffix = text.substr(dot + 1);
+		bool found = false;
+		for(int align = 0; align < 8; align++) {
+			if(suffix == alignmentNames[align]) {
+				operand.align = static_cast<SrcEncoding>(align);
+				found = true;
+			}
+		}
+		if(!found) {
+			return _fail(line.number, "unknown alignment " + suffix);
+		}
+		operand.aligned = true;
+		text.resize(dot);
+	}
+
+	size_t open = text.find('[');
+	if(open == std::string::npos) {
+		operand.arg = OpcodeArgEncoding::Imm;
+		return _number(line, text, operand.idx);
+	}
+	if(text.back() != ']') {
+		return _fail(line.number, "invalid operand " + token);
+	}
+
+	std::string space = text.substr(0, open);
+	std::string idx = text.substr(open + 1, text.size() - open - 2);
+	for(const Space& candidate : spaces) {
+		if(space != candidate.name) {
+			continue;
+		}
+		operand.arg = candidate.arg;
+
+		if(operand.arg == OpcodeArgEncoding::WorkSpace) {
+			for(const SpecialWorkSpace& special : specialWorkSpaces) {
+				if(idx == special.name) {
+					operand.idx = special.idx;
+					return true;
+				}
+			}
+		}
+		bool wide = operand.arg == OpcodeArgEncoding::Reg || operand.arg == OpcodeArgEncoding::ID;
+		return _bounded(line, idx, wide ? 0xFFFF : 0xFF, operand.idx);
+	}
+	return _fail(line.number, "unknown operand space " + space);
+}
+
+bool Assembler::_commandTable(const Line& line, const std::string& token, uint32_t& table) {
+	for(int i = 0; i <= AtomBios::GetVoltageInfo; i++) {
+		if(token == AtomBios::commandTableName(static_cast<AtomBios::CommandTables>(i))) {
+			table = i;
+			return true;
+		}
+	}
+	if(token.empty() || !isdigit(static_cast<unsigned char>(token[0]))) {
+		return _fail(line.number, "unknown command table " + token);
+	}
+	return _bounded(line, token, AtomBios::GetVoltageInfo, table);
+}
+
+Label Assembler::_label(Table& table, const std::string& name) {
+	auto it = _labels.find(name);
+	if(it != _labels.end()) {
+		return it->second;
+	}
+	Label label = table.label();
+	_labels.emplace(name, label);
+	return label;
+}
+
+bool Assembler::_bytes(const Line& line, std::vector<uint8_t>& bytes) {
+	const std::string& op = line.tokens[0];
+	size_t size = op == "db" ? 1 : op == "dw" ? 2 : 4;
+	for(size_t i = 1; i < line.tokens.size(); i++) {
+		uint32_t val;
+		if(!_number(line, line.tokens[i], val)) {
+			return false;
+		}
+		if(size < 4 && val >> (8 * size) && static_cast<int32_t>(val) >= 0) {
+			return _fail(line.number, line.tokens[i] + " does not fit into " + op);
+		}
+		for(size_t byte = 0; byte < size; byte++) {
+			bytes.push_back(val >> (8 * byte));
+		}
+	}
+	return true;
+}
+
+bool Assembler::_instruction(const std::vector<Line>& lines, size_t& pos, Table& table) {
+	const Line& line = lines[pos];
+	const std::string& op = line.tokens[0];
+
+	if(op.back() == ':') {
+		std::string name = op.substr(0, op.size() - 1);
+		if(line.tokens.size() != 1 || name.empty()) {
+			return _fail(line.number, "a label stands on its own line");
+		}
+		if(!_boundLabels.insert(name).second) {
+			return _fail(line.number, "label " + name + " is defined twice");
+		}
+		table.bind(_label(table, name));
+		return true;
+	}
+
+	for(const OpcodeFamily& family : families) {
+		if(op != family.name) {
+			continue;
+		}
+		Operand dst, src;
+		if(!_arguments(line, 2) || !_operand(line, line.tokens[1], dst) || !_operand(line, line.tokens[2], src)) {
+			return false;
+		}
+		if(dst.arg == OpcodeArgEncoding::Imm || dst.arg == OpcodeArgEncoding::ID) {
+			return _fail(line.number, "the destination of " + op + " can not be " + line.tokens[1]);
+		}
+
+		SrcEncoding srcAlign = src.aligned ? src.align : dst.align;
+		SrcEncoding dstAlign = dst.aligned ? dst.align : defaultDestinationAlignment(srcAlign);
+		if(!alignmentsCombine(srcAlign, dstAlign)) {
+			return _fail(line.number, std::string("a source of alignment ") + alignmentNames[srcAlign]
+				+ " can not be combined with a destination of alignment " + alignmentNames[dstAlign]);
+		}
+		table.op(family.family, dst.arg, dst.idx, src.arg, src.idx, srcAlign, dstAlign);
+		return true;
+	}
+
+	for(const OpcodeFamily& jump : jumps) {
+		if(op != jump.name) {
+			continue;
+		}
+		if(!_arguments(line, 1)) {
+			return false;
+		}
+		_labelUses.emplace(line.tokens[1], line.number);
+		table.jump(jump.family, _label(table, line.tokens[1]));
+		return true;
+	}
+
+	if(op == "mask") {
+		Operand dst, src;
+		uint32_t mask;
+		if(!_arguments(line, 3) || !_operand(line, line.tokens[1], dst) || !_number(line, line.tokens[2], mask)
+				|| !_operand(line, line.tokens[3], src)) {
+			return false;
+		}
+		if(dst.arg == OpcodeArgEncoding::Imm || dst.arg == OpcodeArgEncoding::ID) {
+			return _fail(line.number, "the destination of mask can not be " + line.tokens[1]);
+		}
+		SrcEncoding srcAlign = src.aligned ? src.align : dst.align;
+		SrcEncoding dstAlign = dst.aligned ? dst.align : defaultDestinationAlignment(srcAlign);
+		if(!alignmentsCombine(srcAlign, dstAlign)) {
+			return _fail(line.number, "the alignments of mask can not be combined");
+		}
+		table.mask(dst.arg, dst.idx, mask, src.arg, src.idx, srcAlign, dstAlign);
+		return true;
+	}
+
+	if(op == "shl" || op == "shr" || op == "clear") {
+		Operand dst;
+		uint32_t count = 0;
+		if(!_arguments(line, op == "clear" ? 1 : 2) || !_operand(line, line.tokens[1], dst)
+				|| (op != "clear" && !_bounded(line, line.tokens[2], 0xFF, count))) {
+			return false;
+		}
+		if(dst.arg == OpcodeArgEncoding::Imm || dst.arg == OpcodeArgEncoding::ID) {
+			return _fail(line.number, "the destination of " + op + " can not be " + line.tokens[1]);
+		}
+		if(op == "shl") {
+			table.shiftLeft(dst.arg, dst.idx, count, dst.align);
+		} else if(op == "shr") {
+			table.shiftRight(dst.arg, dst.idx, count, dst.align);
+		} else {
+			table.clear(dst.arg, dst.idx, dst.align);
+		}
+		return true;
+	}
+
+	if(op == "switch") {
+		Operand src;
+		if(!_arguments(line, 1) || !_operand(line, line.tokens[1], src)) {
+			return false;
+		}
+
+		std::vector<std::pair<uint32_t, Label>> cases;
+		for(pos++; pos < lines.size() && lines[pos].tokens[0] != "endswitch"; pos++) {
+			const Line& caseLine = lines[pos];
+			uint32_t val;
+			if(caseLine.tokens[0] != "case") {
+				return _fail(caseLine.number, "only cases can be within a switch");
+			}
+			if(!_arguments(caseLine, 2) || !_number(caseLine, caseLine.tokens[1], val)) {
+				return false;
+			}
+			_labelUses.emplace(caseLine.tokens[2], caseLine.number);
+			cases.push_back({val, _label(table, caseLine.tokens[2])});
+		}
+		if(pos == lines.size()) {
+			return _fail(line.number, "switch without endswitch");
+		}
+		table.switchOn(src.arg, src.idx, src.align, cases);
+		return true;
+	}
+
+	if(op == "call") {
+		uint32_t callee;
+		if(!_arguments(line, 1) || !_commandTable(line, line.tokens[1], callee)) {
+			return false;
+		}
+		table.callTable(callee);
+		return true;
+	}
+
+	if(op == "regblock" || op == "datatable" || op == "atiport" || op == "delay") {
+		uint32_t val;
+		bool wide = op == "regblock" || op == "atiport";
+		if(!_arguments(line, 1) || !_bounded(line, line.tokens[1], wide ? 0xFFFF : 0xFF, val)) {
+			return false;
+		}
+		if(op == "regblock") {
+			table.setRegBlock(val);
+		} else if(op == "datatable") {
+			table.setDataTable(val);
+		} else if(op == "atiport") {
+			table.setATIPort(val);
+		} else {
+			table.delayMicroseconds(val);
+		}
+		return true;
+	}
+
+	if(op == "db" || op == "dw" || op == "dd") {
+		std::vector<uint8_t> bytes;
+		if(!_bytes(line, bytes)) {
+			return false;
+		}
+		table.raw(bytes);
+		return true;
+	}
+
+	if(op == "end") {
+		if(!_arguments(line, 0)) {
+			return false;
+		}
+		table.end();
+		return true;
+	}
+
+	return _fail(line.number, "unknown instruction " + op);
+}
+
+bool Assembler::_table(const std::vector<Line>& lines, size_t& pos) {
+	const Line& line = lines[pos];
+	uint32_t index;
+	uint32_t workSpaceSize = 0;
+	uint32_t parameterSpaceSize = 0;
+	if(line.tokens.size() < 2 || !_commandTable(line, line.tokens[1], index)) {
+		return line.tokens.size() < 2 ? _fail(line.number, "table takes a name or index") : false;
+	}
+	for(size_t i = 2; i < line.tokens.size(); i += 2) {
+		if(i + 1 >= line.tokens.size() || (line.tokens[i] != "ws" && line.tokens[i] != "ps")) {
+			return _fail(line.number, "table takes ws <bytes> and ps <bytes>");
+		}
+		uint32_t& size = line.tokens[i] == "ws" ? workSpaceSize : parameterSpaceSize;
+		if(!_bounded(line, line.tokens[i + 1], line.tokens[i] == "ws" ? 0xFF : 0x7F, size)) {
+			return false;
+		}
+		if(size % sizeof(uint32_t)) {
+			return _fail(line.number, "the WorkSpace and parameter space sizes are multiples of 4");
+		}
+	}
+
+	Table table(workSpaceSize, parameterSpaceSize);
+	_labels.clear();
+	_boundLabels.clear();
+	_labelUses.clear();
+	for(pos++; pos < lines.size() && lines[pos].tokens[0] != "endtable"; pos++) {
+		if(!_instruction(lines, pos, table)) {
+			return false;
+		}
+	}
+	if(pos == lines.size()) {
+		return _fail(line.number, "table without endtable");
+	}
+
+	for(auto& [name, use] : _labelUses) {
+		if(!_boundLabels.count(name)) {
+			return _fail(use, "undefined label " + name);
+		}
+	}
+	if(sizeof(AtomBiosImpl::CommonHeader) + 2 + table.size() > 0xFFFF) {
+		return _fail(line.number, "the table is larger than 64 KiB");
+	}
+	_rom.setCommand(index, table);
+	return true;
+}
+
+bool Assembler::_iio(const std::vector<Line>& lines, size_t& pos) {
+	const Line& line = lines[pos];
+	uint32_t port;
+	if(!_arguments(line, 1) || !_bounded(line, line.tokens[1], 0xFF, port)) {
+		return false;
+	}
+
+	IIOFunction function;
+	for(pos++; pos < lines.size() && lines[pos].tokens[0] != "endiio"; pos++) {
+		const Line& instr = lines[pos];
+		const std::string& op = instr.tokens[0];
+		uint32_t args[3];
+		size_t count = op == "read" || op == "write" ? 1 : op == "clear" || op == "set" ? 2 : 3;
+		if(op != "read" && op != "write" && op != "clear" && op != "set" && op != "move_index" && op != "move_attr"
+				&& op != "move_data") {
+			return _fail(instr.number, "unknown IIO instruction " + op);
+		}
+		if(!_arguments(instr, count)) {
+			return false;
+		}
+		for(size_t i = 0; i < count; i++) {
+			if(!_bounded(instr, instr.tokens[i + 1], count == 1 ? 0xFFFF : 0xFF, args[i])) {
+				return false;
+			}
+		}
+
+		if(op == "read") {
+			function.read(args[0]);
+		} else if(op == "write") {
+			function.write(args[0]);
+		} else if(op == "clear") {
+			function.clear(args[0], args[1]);
+		} else if(op == "set") {
+			function.set(args[0], args[1]);
+		} else if(op == "move_index") {
+			function.moveIndex(args[0], args[1], args[2]);
+		} else if(op == "move_attr") {
+			function.moveAttr(args[0], args[1], args[2]);
+		} else {
+			function.moveData(args[0], args[1], args[2]);
+		}
+	}
+	if(pos == lines.size()) {
+		return _fail(line.number, "iio without endiio");
+	}
+	_rom.setIIOFunction(port, function);
+	return true;
+}
+
+bool Assembler::_data(const std::vector<Line>& lines, size_t& pos) {
+	const Line& line = lines[pos];
+	uint32_t index;
+	constexpr uint32_t iioTable = (offsetof(AtomBiosImpl::DataTable, indirectIOAccess) - sizeof(AtomBiosImpl::CommonHeader)) / sizeof(uint16_t);
+	if(!_arguments(line, 1) || !_bounded(line, line.tokens[1], sizeof(AtomBiosImpl::DataTable::dataTables) / sizeof(uint16_t) - 1, index)) {
+		return false;
+	}
+	if(index == iioTable) {
+		return _fail(line.number, "the IIO functions are given by iio");
+	}
+
+	std::vector<uint8_t> contents;
+	for(pos++; pos < lines.size() && lines[pos].tokens[0] != "enddata"; pos++) {
+		const std::string& op = lines[pos].tokens[0];
+		if(op != "db" && op != "dw" && op != "dd") {
+			return _fail(lines[pos].number, "data tables hold db, dw and dd lines");
+		}
+		if(!_bytes(lines[pos], contents)) {
+			return false;
+		}
+	}
+	if(pos == lines.size()) {
+		return _fail(line.number, "data without enddata");
+	}
+	_rom.setDataTable(index, contents);
+	return true;
+}
+
+bool Assembler::run(const std::string& source) {
+	std::vector<Line> split;
+	std::vector<Line> lines;
+	size_t pos = 0;
+	if(!_split(source, split) || !_expand(split, pos, lines, 0, -1)) {
+		return false;
+	}
+
+	for(pos = 0; pos < lines.size(); pos++) {
+		const Line& line = lines[pos];
+		const std::string& op = line.tokens[0];
+		bool ok;
+		if(op == "table") {
+			ok = _table(lines, pos);
+		} else if(op == "iio") {
+			ok = _iio(lines, pos);
+		} else if(op == "data") {
+			ok = _data(lines, pos);
+		} else {
+			ok = _fail(line.number, op + " outside of a table, iio function or data table");
+		}
+		if(!ok) {
+			return false;
+		}
+	}
+
+	if(_rom.size() > 0x10000) {
+		return _fail(lines.empty() ? 1 : lines.back().number, "the ROM is larger than the 64 KiB its tables can address");
+	}
+	return true;
+}
+
+} // namespace anonymous
+
+bool assemble(const std::string& source, Rom& rom, std::string& error) {
+	Assembler assembler(rom, error);
+	return assembler.run(source);
+}
+
+} // namespace AtomRomBuilder
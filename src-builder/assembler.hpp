@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+
+#include "rom-builder.hpp"
+
+// Assembles a textual description of a ROM into an AtomRomBuilder::Rom.
+//
+// A description holds command tables, IIO functions and data tables; ';' and '#' start comments, and operands
+// are separated by commas.
+//
+//   table <name or index> [ws <bytes>] [ps <bytes>]
+//   loop:                               a label, for jumps and switch cases within the table
+//       move ws[0], 100                 move / and / or / xor / add / sub / mul / div / cmp / test <dst>, <src>
+//       move ws[1].b8, reg[0x1234]      operands: reg / ps / ws / fb / pll / mc / id[<index>] or an immediate;
+//       move ws[2], ws[quotient]        ws[] also takes the names of the special indexes (quotient, remainder,
+//                                       dataptr, shift, or_mask, and_mask, fb_window, attributes, regptr)
+//       mask reg[0x10], 0xFF00, 0x12.w0 dst = (dst & mask) | src
+//       shl ws[1], 4 / shr / clear ws[1]
+//       jne loop                        jmp / je / jne / jb / ja / jbe / jae
+//       switch ws[0].b0                 the cases, then endswitch
+//         case 3, loop
+//       endswitch
+//       call <name or index> / regblock / datatable / atiport / delay <value>
+//       db 0x01, 0x02                   raw bytes; dw and dd for words and dwords
+//       end                             END_OF_TABLE
+//   endtable
+//
+//   iio <port>
+//       read 0x10 / write 0x10 / clear <bits>, <shift> / set <bits>, <shift>
+//       move_index / move_attr / move_data <bits>, <source shift>, <destination shift>
+//   endiio
+//
+//   data <index>                        a data table, out of db / dw / dd lines
+//   enddata
+//
+// Alignments are given by a suffix of the operand: .dword (the default), .w0, .w8, .w16, .b0, .b8, .b16, .b24.
+// Without one, the source takes the alignment of the destination, or the destination the widest one the source
+// alignment can be combined with.
+//
+// Lines between "repeat <count>" and "endrepeat" are repeated; {i} in them is replaced by the iteration, counting
+// from 0, and {i+N} / {i-N} by the iteration plus or minus N. Repeats can be nested; {i} is that of the innermost.
+namespace AtomRomBuilder {
+
+// On failure, error holds the line and what is wrong with it.
+bool assemble(const std::string& source, Rom& rom, std::string& error);
+
+} // namespace AtomRomBuilder
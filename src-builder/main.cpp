@@ -0,0 +1,102 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <CLI/CLI.hpp>
+#include <libatombios/atom.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "assembler.hpp"
+#include "workloads.hpp"
+
+// Assembles a ROM out of a textual description (see assembler.hpp), or generates one of the scalable workloads.
+
+extern "C" void lilrad_log(enum LilradLogType type, const char* format, ...) {
+	if(type != WARNING && type != ERROR) {
+		return;
+	}
+
+	va_list arglist;
+	va_start(arglist, format);
+	vfprintf(stderr, format, arglist);
+	va_end(arglist);
+}
+
+extern "C" void* lilrad_alloc(size_t size) {
+	return malloc(size);
+}
+
+extern "C" void lilrad_free(void* ptr) {
+	free(ptr);
+}
+
+int main(int argc, char** argv) {
+	std::string input{};
+	std::string output{};
+	std::string generate{};
+	uint32_t size = 16;
+
+	CLI::App app{"atombios-asm"};
+	argv = app.ensure_utf8(argv);
+
+	app.add_option("input", input, "Description of the ROM");
+	app.add_option("-o,--output", output, "The ROM image")->required();
+	app.add_option("-g,--generate", generate, "Generate a workload instead: call-chain, switch or loop");
+	app.add_option("-s,--size", size, "Size of the generated workload: the call depth, switch cases or loop iterations");
+
+	CLI11_PARSE(app, argc, argv);
+
+	AtomRomBuilder::Rom rom;
+	if(!generate.empty()) {
+		if(generate == "call-chain") {
+			if(size > AtomBios::GetVoltageInfo) {
+				std::cerr << "calls can be at most " << AtomBios::GetVoltageInfo << " deep" << std::endl;
+				return 1;
+			}
+			rom = AtomRomBuilder::callChain(size);
+		} else if(generate == "switch") {
+			if(size > 0xFFFF) {
+				std::cerr << "the cases are word values" << std::endl;
+				return 1;
+			}
+			rom = AtomRomBuilder::largeSwitch(size);
+		} else if(generate == "loop") {
+			rom = AtomRomBuilder::hotLoop(size);
+		} else {
+			std::cerr << "unknown workload " << generate << std::endl;
+			return 1;
+		}
+	} else {
+		std::ifstream file(input);
+		if(input.empty() || !file) {
+			std::cerr << "can not open " << input << std::endl;
+			return 1;
+		}
+		std::stringstream source;
+		source << file.rdbuf();
+
+		std::string error;
+		if(!AtomRomBuilder::assemble(source.str(), rom, error)) {
+			std::cerr << input << ": " << error << std::endl;
+			return 1;
+		}
+	}
+
+	if(rom.size() > 0x10000) {
+		std::cerr << "the ROM is larger than the 64 KiB its tables can address" << std::endl;
+		return 1;
+	}
+
+	std::vector<uint8_t> image = rom.build();
+	std::ofstream file(output, std::ios::out | std::ios::binary);
+	file.write(reinterpret_cast<const char*>(image.data()), image.size());
+	if(!file) {
+		std::cerr << "can not write " << output << std::endl;
+		return 1;
+	}
+	return 0;
+}
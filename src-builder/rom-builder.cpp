@@ -0,0 +1,389 @@
+#include "rom-builder.hpp"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace AtomRomBuilder {
+
+namespace {
+
+// The tables of the master command table.
+constexpr int commandTableCount = AtomBios::GetVoltageInfo + 1;
+constexpr int dataTableCount = sizeof(AtomBiosImpl::DataTable::dataTables) / sizeof(uint16_t);
+
+// Offset of the destination variant of an opcode family.
+int destinationOffset(OpcodeArgEncoding dst) {
+	switch(dst) {
+	case OpcodeArgEncoding::Reg: return 0;
+	case OpcodeArgEncoding::ParameterSpace: return 1;
+	case OpcodeArgEncoding::WorkSpace: return 2;
+	case OpcodeArgEncoding::FrameBuffer: return 3;
+	case OpcodeArgEncoding::PLL: return 4;
+	case OpcodeArgEncoding::MC: return 5;
+	default:
+		assert(!"not a destination");
+		return 0;
+	}
+}
+
+void put16(std::vector<uint8_t>& rom, size_t offset, uint16_t val) {
+	rom[offset] = val & 0xFF;
+	rom[offset + 1] = val >> 8;
+}
+
+// Layout: the ROM header, the ROM table at 0x100, the master command and data tables after it, and then
+// the IIO functions, command tables and data tables one after the other.
+constexpr size_t romTableBase = 0x100;
+constexpr size_t commandTableBase = romTableBase + sizeof(AtomBiosImpl::AtomRomTable);
+constexpr size_t commandTableSize = sizeof(AtomBiosImpl::CommonHeader) + 2 * commandTableCount;
+constexpr size_t dataTableBase = commandTableBase + commandTableSize;
+constexpr size_t dataTableSize = sizeof(AtomBiosImpl::DataTable);
+
+void putHeader(std::vector<uint8_t>& rom, size_t offset, uint16_t size) {
+	put16(rom, offset, size);
+	rom[offset + offsetof(AtomBiosImpl::CommonHeader, tableFormatRevision)] = 1;
+	rom[offset + offsetof(AtomBiosImpl::CommonHeader, tableContentRevision)] = 1;
+}
+
+} // namespace anonymous
+
+SrcEncoding defaultDestinationAlignment(SrcEncoding srcAlign) {
+	return alignmentsCombine(srcAlign, SrcEncoding::SrcDword) ? SrcEncoding::SrcDword : srcAlign;
+}
+
+bool alignmentsCombine(SrcEncoding srcAlign, SrcEncoding dstAlign) {
+	for(int sel = 0; sel < 4; sel++) {
+		if(atom_dst_to_src[srcAlign][sel] == dstAlign) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Table.
+
+Table::Table(uint8_t workSpaceSize, uint8_t parameterSpaceSize)
+: _workSpaceSize{workSpaceSize}, _parameterSpaceSize{parameterSpaceSize} {
+}
+
+void Table::_byte(uint8_t val) {
+	_code.push_back(val);
+}
+
+void Table::_word(uint16_t val) {
+	_byte(val & 0xFF);
+	_byte(val >> 8);
+}
+
+void Table::_dword(uint32_t val) {
+	_word(val & 0xFFFF);
+	_word(val >> 16);
+}
+
+void Table::_idx(OpcodeArgEncoding arg, uint32_t idx) {
+	switch(arg) {
+	case OpcodeArgEncoding::Reg:
+	case OpcodeArgEncoding::ID:
+		_word(idx);
+		break;
+	case OpcodeArgEncoding::Imm:
+		break;
+	default:
+		_byte(idx);
+		break;
+	}
+}
+
+void Table::_aligned(SrcEncoding align, uint32_t val) {
+	switch(align) {
+	case SrcEncoding::SrcDword:
+		_dword(val);
+		break;
+	case SrcEncoding::SrcWord0:
+	case SrcEncoding::SrcWord8:
+	case SrcEncoding::SrcWord16:
+		_word(val);
+		break;
+	default:
+		_byte(val);
+		break;
+	}
+}
+
+void Table::_attrByte(OpcodeArgEncoding src, SrcEncoding srcAlign, SrcEncoding dstAlign) {
+	for(int sel = 0; sel < 4; sel++) {
+		if(atom_dst_to_src[srcAlign][sel] == dstAlign) {
+			_byte(src | (srcAlign << 3) | (sel << 6));
+			return;
+		}
+	}
+	assert(!"the destination alignment cannot be combined with the source alignment");
+}
+
+void Table::_target(Label label) {
+	assert(label.id < _labels.size());
+	_fixups.push_back({_code.size(), label.id});
+	_word(0);
+}
+
+void Table::op(Opcodes family, OpcodeArgEncoding dst, uint32_t dstIdx, OpcodeArgEncoding src, uint32_t srcIdx,
+		SrcEncoding srcAlign) {
+	op(family, dst, dstIdx, src, srcIdx, srcAlign, defaultDestinationAlignment(srcAlign));
+}
+
+void Table::op(Opcodes family, OpcodeArgEncoding dst, uint32_t dstIdx, OpcodeArgEncoding src, uint32_t srcIdx,
+		SrcEncoding srcAlign, SrcEncoding dstAlign) {
+	_byte(family + destinationOffset(dst));
+	_attrByte(src, srcAlign, dstAlign);
+	_idx(dst, dstIdx);
+	if(src == OpcodeArgEncoding::Imm) {
+		_aligned(srcAlign, srcIdx);
+	} else {
+		_idx(src, srcIdx);
+	}
+}
+
+void Table::mask(OpcodeArgEncoding dst, uint32_t dstIdx, uint32_t mask, OpcodeArgEncoding src, uint32_t srcIdx,
+		SrcEncoding srcAlign) {
+	Table::mask(dst, dstIdx, mask, src, srcIdx, srcAlign, defaultDestinationAlignment(srcAlign));
+}
+
+void Table::mask(OpcodeArgEncoding dst, uint32_t dstIdx, uint32_t mask, OpcodeArgEncoding src, uint32_t srcIdx,
+		SrcEncoding srcAlign, SrcEncoding dstAlign) {
+	_byte(Opcodes::MASK_INTO_REG + destinationOffset(dst));
+	_attrByte(src, srcAlign, dstAlign);
+	_idx(dst, dstIdx);
+	_aligned(dstAlign, mask);
+	if(src == OpcodeArgEncoding::Imm) {
+		_aligned(srcAlign, srcIdx);
+	} else {
+		_idx(src, srcIdx);
+	}
+}
+
+void Table::shiftLeft(OpcodeArgEncoding dst, uint32_t dstIdx, uint8_t count, SrcEncoding dstAlign) {
+	_byte(Opcodes::SHIFT_LEFT_IN_REG + destinationOffset(dst));
+	_attrByte(OpcodeArgEncoding::Imm, dstAlign, dstAlign);
+	_idx(dst, dstIdx);
+	_byte(count);
+}
+
+void Table::shiftRight(OpcodeArgEncoding dst, uint32_t dstIdx, uint8_t count, SrcEncoding dstAlign) {
+	_byte(Opcodes::SHIFT_RIGHT_IN_REG + destinationOffset(dst));
+	_attrByte(OpcodeArgEncoding::Imm, dstAlign, dstAlign);
+	_idx(dst, dstIdx);
+	_byte(count);
+}
+
+void Table::clear(OpcodeArgEncoding dst, uint32_t dstIdx, SrcEncoding dstAlign) {
+	_byte(Opcodes::CLEAR_IN_REG + destinationOffset(dst));
+	_attrByte(OpcodeArgEncoding::Imm, dstAlign, dstAlign);
+	_idx(dst, dstIdx);
+}
+
+Label Table::label() {
+	_labels.push_back(SIZE_MAX);
+	return Label{_labels.size() - 1};
+}
+
+void Table::bind(Label label) {
+	assert(label.id < _labels.size() && _labels[label.id] == SIZE_MAX);
+	_labels[label.id] = _code.size();
+}
+
+void Table::jump(Opcodes condition, Label target) {
+	assert(condition >= Opcodes::JUMP_ALWAYS && condition <= Opcodes::JUMP_NOTEQUAL);
+	_byte(condition);
+	_target(target);
+}
+
+void Table::switchOn(OpcodeArgEncoding src, uint32_t srcIdx, SrcEncoding srcAlign,
+		const std::vector<std::pair<uint32_t, Label>>& cases) {
+	_byte(Opcodes::SWITCH);
+	_attrByte(src, srcAlign, srcAlign);
+	if(src == OpcodeArgEncoding::Imm) {
+		_aligned(srcAlign, srcIdx);
+	} else {
+		_idx(src, srcIdx);
+	}
+	for(auto& [val, target] : cases) {
+		// Every case starts with a 0x63 byte; the list ends with 0x5A5A.
+		_byte(0x63);
+		_aligned(srcAlign, val);
+		_target(target);
+	}
+	_word(0x5A5A);
+}
+
+void Table::callTable(uint8_t table) {
+	_byte(Opcodes::CALL_TABLE);
+	_byte(table);
+}
+
+void Table::setRegBlock(uint16_t block) {
+	_byte(Opcodes::SET_REG_BLOCK);
+	_word(block);
+}
+
+void Table::setDataTable(uint8_t table) {
+	_byte(Opcodes::SET_DATA_TABLE);
+	_byte(table);
+}
+
+void Table::setATIPort(uint16_t port) {
+	_byte(Opcodes::SET_ATI_PORT);
+	_word(port);
+}
+
+void Table::delayMicroseconds(uint8_t microseconds) {
+	_byte(Opcodes::DELAY_MICROSECONDS);
+	_byte(microseconds);
+}
+
+void Table::end() {
+	_byte(Opcodes::END_OF_TABLE);
+}
+
+void Table::raw(const std::vector<uint8_t>& bytes) {
+	_code.insert(_code.end(), bytes.begin(), bytes.end());
+}
+
+std::vector<uint8_t> Table::bytecode() const {
+	std::vector<uint8_t> code = _code;
+	for(auto& [pos, id] : _fixups) {
+		assert(_labels[id] != SIZE_MAX);
+		// Jump targets are relative to the start of the table, including its header.
+		uint16_t target = _labels[id] + sizeof(AtomBiosImpl::CommonHeader) + 2;
+		code[pos] = target & 0xFF;
+		code[pos + 1] = target >> 8;
+	}
+	return code;
+}
+
+/// IIOFunction.
+
+void IIOFunction::read(uint16_t reg) {
+	_code.insert(_code.end(), {IIOOpcodes::READ, static_cast<uint8_t>(reg & 0xFF), static_cast<uint8_t>(reg >> 8)});
+}
+
+void IIOFunction::write(uint16_t reg) {
+	_code.insert(_code.end(), {IIOOpcodes::WRITE, static_cast<uint8_t>(reg & 0xFF), static_cast<uint8_t>(reg >> 8)});
+}
+
+void IIOFunction::clear(uint8_t bits, uint8_t shift) {
+	_code.insert(_code.end(), {IIOOpcodes::CLEAR, bits, shift});
+}
+
+void IIOFunction::set(uint8_t bits, uint8_t shift) {
+	_code.insert(_code.end(), {IIOOpcodes::SET, bits, shift});
+}
+
+void IIOFunction::moveIndex(uint8_t bits, uint8_t srcShift, uint8_t dstShift) {
+	_code.insert(_code.end(), {IIOOpcodes::MOVE_INDEX, bits, srcShift, dstShift});
+}
+
+void IIOFunction::moveAttr(uint8_t bits, uint8_t srcShift, uint8_t dstShift) {
+	_code.insert(_code.end(), {IIOOpcodes::MOVE_ATTR, bits, srcShift, dstShift});
+}
+
+void IIOFunction::moveData(uint8_t bits, uint8_t srcShift, uint8_t dstShift) {
+	_code.insert(_code.end(), {IIOOpcodes::MOVE_DATA, bits, srcShift, dstShift});
+}
+
+/// Rom.
+
+void Rom::setCommand(int table, const Table& command) {
+	assert(table >= 0 && table < commandTableCount);
+	_commands.insert_or_assign(table, command);
+}
+
+void Rom::setDataTable(int table, const std::vector<uint8_t>& contents) {
+	assert(table >= 0 && table < dataTableCount);
+	// The IIO functions have their own table.
+	assert(static_cast<size_t>(table) != (offsetof(AtomBiosImpl::DataTable, indirectIOAccess) - sizeof(AtomBiosImpl::CommonHeader)) / sizeof(uint16_t));
+	_dataTables[table] = contents;
+}
+
+void Rom::setIIOFunction(uint8_t port, const IIOFunction& function) {
+	_iioFunctions[port] = function;
+}
+
+size_t Rom::size() const {
+	size_t size = dataTableBase + dataTableSize;
+
+	// The header of the IIO functions, START / port and END of each, and the NOP after the last one.
+	size += sizeof(AtomBiosImpl::CommonHeader) + 1;
+	for(auto& [port, function] : _iioFunctions) {
+		size += 2 + function.code().size() + 3;
+	}
+
+	for(auto& [table, command] : _commands) {
+		size += sizeof(AtomBiosImpl::CommonHeader) + 2 + command.size();
+	}
+	for(auto& [table, contents] : _dataTables) {
+		size += contents.size();
+	}
+	return size;
+}
+
+std::vector<uint8_t> Rom::build() const {
+	std::vector<uint8_t> rom(dataTableBase + dataTableSize, 0);
+	put16(rom, 0, 0xAA55);
+	memcpy(rom.data() + 0x30, " 761295520", 10);
+	put16(rom, 0x48, romTableBase);
+
+	putHeader(rom, romTableBase, sizeof(AtomBiosImpl::AtomRomTable));
+	memcpy(rom.data() + romTableBase + offsetof(AtomBiosImpl::AtomRomTable, atomMagic), "ATOM", 4);
+	put16(rom, romTableBase + offsetof(AtomBiosImpl::AtomRomTable, commandTableBase), commandTableBase);
+	put16(rom, romTableBase + offsetof(AtomBiosImpl::AtomRomTable, dataTableBase), dataTableBase);
+
+	putHeader(rom, commandTableBase, commandTableSize);
+	putHeader(rom, dataTableBase, dataTableSize);
+
+	auto append = [&rom](const std::vector<uint8_t>& bytes) -> size_t {
+		size_t offset = rom.size();
+		rom.insert(rom.end(), bytes.begin(), bytes.end());
+		return offset;
+	};
+
+	// The IIO functions follow a header, and are found by walking from one START to the next.
+	{
+		std::vector<uint8_t> iio(sizeof(AtomBiosImpl::CommonHeader), 0);
+		for(auto& [port, function] : _iioFunctions) {
+			iio.push_back(IIOOpcodes::START);
+			iio.push_back(port);
+			iio.insert(iio.end(), function.code().begin(), function.code().end());
+			iio.insert(iio.end(), {IIOOpcodes::END, 0, 0});
+		}
+		// Ends the walk.
+		iio.push_back(IIOOpcodes::NOP);
+
+		size_t offset = append(iio);
+		putHeader(rom, offset, iio.size());
+		put16(rom, dataTableBase + offsetof(AtomBiosImpl::DataTable, indirectIOAccess), offset);
+	}
+
+	for(auto& [table, command] : _commands) {
+		std::vector<uint8_t> code = command.bytecode();
+		std::vector<uint8_t> bytes(sizeof(AtomBiosImpl::CommonHeader) + 2, 0);
+		bytes[sizeof(AtomBiosImpl::CommonHeader)] = command.workSpaceSize();
+		bytes[sizeof(AtomBiosImpl::CommonHeader) + 1] = command.parameterSpaceSize();
+		bytes.insert(bytes.end(), code.begin(), code.end());
+
+		size_t offset = append(bytes);
+		putHeader(rom, offset, bytes.size());
+		put16(rom, commandTableBase + sizeof(AtomBiosImpl::CommonHeader) + 2 * table, offset);
+	}
+
+	for(auto& [table, contents] : _dataTables) {
+		size_t offset = append(contents);
+		put16(rom, dataTableBase + sizeof(AtomBiosImpl::CommonHeader) + 2 * table, offset);
+	}
+
+	assert(rom.size() == size() && rom.size() <= 0x10000);
+	return rom;
+}
+
+} // namespace AtomRomBuilder
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <map>
+#include <vector>
+
+#include "../src/atom-private.hpp"
+
+// Builds ATOM ROM images out of command tables that are written in C++; used for synthetic workloads.
+// The opcodes are encoded with the definitions the interpreter decodes them with.
+namespace AtomRomBuilder {
+
+// A jump target inside of a table.
+struct Label {
+	size_t id;
+};
+
+class Table {
+public:
+	// The sizes are in bytes.
+	Table(uint8_t workSpaceSize = 0, uint8_t parameterSpaceSize = 0);
+
+	// Opcodes with a destination and a source, given by the REG variant of their family (e.g. Opcodes::ADD_INTO_REG);
+	// COMPARE_FROM_* and TEST_FROM_* compare the destination with the source.
+	// The destination alignment defaults to the widest one the source alignment can be combined with.
+	void op(Opcodes family, OpcodeArgEncoding dst, uint32_t dstIdx, OpcodeArgEncoding src, uint32_t srcIdx,
+		SrcEncoding srcAlign = SrcEncoding::SrcDword);
+	void op(Opcodes family, OpcodeArgEncoding dst, uint32_t dstIdx, OpcodeArgEncoding src, uint32_t srcIdx,
+		SrcEncoding srcAlign, SrcEncoding dstAlign);
+
+	// dst = (dst & mask) | src.
+	void mask(OpcodeArgEncoding dst, uint32_t dstIdx, uint32_t mask, OpcodeArgEncoding src, uint32_t srcIdx,
+		SrcEncoding srcAlign = SrcEncoding::SrcDword);
+	void mask(OpcodeArgEncoding dst, uint32_t dstIdx, uint32_t mask, OpcodeArgEncoding src, uint32_t srcIdx,
+		SrcEncoding srcAlign, SrcEncoding dstAlign);
+	void shiftLeft(OpcodeArgEncoding dst, uint32_t dstIdx, uint8_t count, SrcEncoding dstAlign = SrcEncoding::SrcDword);
+	void shiftRight(OpcodeArgEncoding dst, uint32_t dstIdx, uint8_t count, SrcEncoding dstAlign = SrcEncoding::SrcDword);
+	void clear(OpcodeArgEncoding dst, uint32_t dstIdx, SrcEncoding dstAlign = SrcEncoding::SrcDword);
+
+	Label label();
+	// Places the label at the next opcode.
+	void bind(Label label);
+	// One of Opcodes::JUMP_*.
+	void jump(Opcodes condition, Label target);
+	// Cases are compared in the order they are given; without a match, the opcode after the switch runs.
+	void switchOn(OpcodeArgEncoding src, uint32_t srcIdx, SrcEncoding srcAlign,
+		const std::vector<std::pair<uint32_t, Label>>& cases);
+
+	void callTable(uint8_t table);
+	void setRegBlock(uint16_t block);
+	void setDataTable(uint8_t table);
+	void setATIPort(uint16_t port);
+	void delayMicroseconds(uint8_t microseconds);
+	void end();
+
+	// Bytes that are not covered by the functions above.
+	void raw(const std::vector<uint8_t>& bytes);
+
+	// The bytecode, with the jumps resolved; asserts that all used labels are bound.
+	std::vector<uint8_t> bytecode() const;
+	// The size of the bytecode so far.
+	size_t size() const { return _code.size(); }
+
+	uint8_t workSpaceSize() const { return _workSpaceSize; }
+	uint8_t parameterSpaceSize() const { return _parameterSpaceSize; }
+
+private:
+	void _byte(uint8_t val);
+	void _word(uint16_t val);
+	void _dword(uint32_t val);
+	void _idx(OpcodeArgEncoding arg, uint32_t idx);
+	void _aligned(SrcEncoding align, uint32_t val);
+	void _attrByte(OpcodeArgEncoding src, SrcEncoding srcAlign, SrcEncoding dstAlign);
+	void _target(Label label);
+
+	uint8_t _workSpaceSize;
+	uint8_t _parameterSpaceSize;
+	std::vector<uint8_t> _code;
+	// Offsets of the labels into the code; SIZE_MAX while unbound.
+	std::vector<size_t> _labels;
+	// Places in the code that hold the offset of a label.
+	std::vector<std::pair<size_t, size_t>> _fixups;
+};
+
+// The widest destination alignment a source alignment can be stored into.
+SrcEncoding defaultDestinationAlignment(SrcEncoding srcAlign);
+// Whether the alignments can be combined in an attribute byte.
+bool alignmentsCombine(SrcEncoding srcAlign, SrcEncoding dstAlign);
+
+// Indirect IO functions (SET_ATI_PORT); see IIOOpcodes.
+class IIOFunction {
+public:
+	void read(uint16_t reg);
+	void write(uint16_t reg);
+	void clear(uint8_t bits, uint8_t shift);
+	void set(uint8_t bits, uint8_t shift);
+	void moveIndex(uint8_t bits, uint8_t srcShift, uint8_t dstShift);
+	void moveAttr(uint8_t bits, uint8_t srcShift, uint8_t dstShift);
+	void moveData(uint8_t bits, uint8_t srcShift, uint8_t dstShift);
+
+	const std::vector<uint8_t>& code() const { return _code; }
+
+private:
+	std::vector<uint8_t> _code;
+};
+
+class Rom {
+public:
+	// Index into the master command table; see AtomBios::CommandTables.
+	void setCommand(int table, const Table& command);
+	// Index into the master data table (SET_DATA_TABLE); the contents are placed as they are.
+	void setDataTable(int table, const std::vector<uint8_t>& contents);
+	void setIIOFunction(uint8_t port, const IIOFunction& function);
+
+	// The size of the image build() returns; it has to fit into the 64 KiB the 16 bit table offsets can reach.
+	size_t size() const;
+	// The image; asserts that it fits.
+	std::vector<uint8_t> build() const;
+
+private:
+	std::map<int, Table> _commands;
+	std::map<int, std::vector<uint8_t>> _dataTables;
+	std::map<uint8_t, IIOFunction> _iioFunctions;
+};
+
+} // namespace AtomRomBuilder
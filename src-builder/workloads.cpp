@@ -0,0 +1,75 @@
+#include "workloads.hpp"
+
+#include <assert.h>
+
+namespace AtomRomBuilder {
+
+Rom callChain(uint32_t depth) {
+	assert(depth <= AtomBios::GetVoltageInfo);
+
+	Rom rom;
+	for(uint32_t i = 0; i <= depth; i++) {
+		Table table(0, 4);
+		table.op(Opcodes::ADD_INTO_REG, OpcodeArgEncoding::ParameterSpace, 0, OpcodeArgEncoding::Imm, 1);
+		if(i < depth) {
+			table.callTable(i + 1);
+		}
+		table.end();
+		rom.setCommand(i, table);
+	}
+	return rom;
+}
+
+Rom largeSwitch(uint32_t cases) {
+	Table table(0, 4);
+	std::vector<std::pair<uint32_t, Label>> labels;
+	for(uint32_t i = 0; i < cases; i++) {
+		labels.push_back({i, table.label()});
+	}
+	Label done = table.label();
+
+	table.switchOn(OpcodeArgEncoding::ParameterSpace, 0, SrcEncoding::SrcWord0, labels);
+	table.jump(Opcodes::JUMP_ALWAYS, done);
+	for(auto& [val, label] : labels) {
+		table.bind(label);
+		table.op(Opcodes::MOVE_TO_REG, OpcodeArgEncoding::ParameterSpace, 0, OpcodeArgEncoding::Imm, val,
+			SrcEncoding::SrcWord0, SrcEncoding::SrcWord0);
+		table.jump(Opcodes::JUMP_ALWAYS, done);
+	}
+	table.bind(done);
+	table.end();
+
+	Rom rom;
+	rom.setCommand(AtomBios::ASIC_Init, table);
+	return rom;
+}
+
+Rom hotLoop(uint32_t iterations) {
+	constexpr auto WS = OpcodeArgEncoding::WorkSpace;
+	constexpr auto Imm = OpcodeArgEncoding::Imm;
+
+	Table table(8, 4);
+	table.op(Opcodes::MOVE_TO_REG, WS, 0, Imm, iterations);
+	table.clear(WS, 1);
+
+	Label loop = table.label();
+	Label done = table.label();
+	table.bind(loop);
+	table.op(Opcodes::COMPARE_FROM_REG, WS, 0, Imm, 0);
+	table.jump(Opcodes::JUMP_EQUAL, done);
+	table.op(Opcodes::ADD_INTO_REG, WS, 1, WS, 0);
+	table.op(Opcodes::XOR_INTO_REG, WS, 1, Imm, 0x5A5A5A5A);
+	table.shiftLeft(WS, 1, 1);
+	table.mask(WS, 1, 0xFFFF00FF, Imm, 0x4200, SrcEncoding::SrcWord0);
+	table.op(Opcodes::SUB_INTO_REG, WS, 0, Imm, 1);
+	table.jump(Opcodes::JUMP_ALWAYS, loop);
+	table.bind(done);
+	table.op(Opcodes::MOVE_TO_REG, OpcodeArgEncoding::ParameterSpace, 0, WS, 1);
+	table.end();
+
+	Rom rom;
+	rom.setCommand(AtomBios::ASIC_Init, table);
+	return rom;
+}
+
+} // namespace AtomRomBuilder
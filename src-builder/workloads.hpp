@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "rom-builder.hpp"
+
+// ROMs whose size scales with a parameter, for performance testing. ASIC_Init is the table to run.
+namespace AtomRomBuilder {
+
+// ASIC_Init calls a chain of depth tables, each of which adds to PS[0] and calls the next; depth is at most the
+// number of command tables after ASIC_Init.
+Rom callChain(uint32_t depth);
+
+// ASIC_Init switches on PS[0] over cases word values, each of which moves its value into PS[0].
+// The image holds up to about 4000 cases.
+Rom largeSwitch(uint32_t cases);
+
+// ASIC_Init adds, masks and shifts in a loop of iterations, and leaves the result in PS[0].
+Rom hotLoop(uint32_t iterations);
+
+} // namespace AtomRomBuilder
@@ -0,0 +1,265 @@
+#include "coverage-file.hpp"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sstream>
+
+namespace {
+
+bool parseNumber(const std::string& token, uint64_t& val) {
+	char* end;
+	errno = 0;
+	unsigned long long parsed = strtoull(token.c_str(), &end, 0);
+	if(token.empty() || *end || errno) {
+		return false;
+	}
+	val = parsed;
+	return true;
+}
+
+bool parseNumber(const std::string& token, uint32_t& val) {
+	uint64_t parsed;
+	if(!parseNumber(token, parsed) || parsed > UINT32_MAX) {
+		return false;
+	}
+	val = parsed;
+	return true;
+}
+
+bool parseBitmap(const std::string& token, size_t size, std::vector<uint8_t>& bitmap) {
+	if(token.size() != 2 * size) {
+		return false;
+	}
+	bitmap.resize(size);
+	for(size_t i = 0; i < size; i++) {
+		char digits[3] = {token[2 * i], token[2 * i + 1], 0};
+		char* end;
+		bitmap[i] = strtoul(digits, &end, 16);
+		if(*end || !isxdigit(digits[0])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string hex(uint64_t val) {
+	char text[20];
+	snprintf(text, sizeof(text), "0x%llx", static_cast<unsigned long long>(val));
+	return text;
+}
+
+uint32_t bitsSet(const std::vector<uint8_t>& bitmap) {
+	uint32_t count = 0;
+	for(uint8_t byte : bitmap) {
+		count += __builtin_popcount(byte);
+	}
+	return count;
+}
+
+} // namespace anonymous
+
+uint32_t CoverageFile::Table::instructions() const {
+	return bitsSet(reachable);
+}
+
+uint32_t CoverageFile::Table::instructionsRun() const {
+	return bitsSet(ran);
+}
+
+uint32_t CoverageFile::Table::directions() const {
+	return 2 * jumps.size() + cases.size() + fallthroughs.size();
+}
+
+uint32_t CoverageFile::Table::directionsTaken() const {
+	uint32_t count = 0;
+	for(const auto& [offset, jump] : jumps) {
+		count += (jump.taken != 0) + (jump.notTaken != 0);
+	}
+	for(const auto& [key, hits] : cases) {
+		count += hits != 0;
+	}
+	for(const auto& [offset, hits] : fallthroughs) {
+		count += hits != 0;
+	}
+	return count;
+}
+
+void CoverageFile::add(AtomBios& atomBios) {
+	for(int i = AtomBios::CommandTables::ASIC_Init; i <= AtomBios::CommandTables::GetVoltageInfo; i++) {
+		AtomBios::CommandTables index = static_cast<AtomBios::CommandTables>(i);
+		if(!atomBios.hasCommand(index)) {
+			continue;
+		}
+
+		AtomBios::CoverageStats stats = atomBios.coverageStats(index);
+		Table table;
+		table.index = i;
+		table.hash = stats.bytecodeHash;
+		table.size = stats.bytecodeSize;
+		table.reachable.resize(atomBios.coverageBitmap(index, false, nullptr, 0));
+		atomBios.coverageBitmap(index, false, table.reachable.data(), table.reachable.size());
+		table.ran.resize(table.reachable.size());
+		atomBios.coverageBitmap(index, true, table.ran.data(), table.ran.size());
+
+		std::vector<AtomBios::BranchCoverage> branches(atomBios.branchCoverage(index, nullptr, 0));
+		atomBios.branchCoverage(index, branches.data(), branches.size());
+		for(const AtomBios::BranchCoverage& branch : branches) {
+			if(!branch.isSwitch) {
+				table.jumps[branch.offset] = Jump{branch.taken, branch.notTaken};
+			} else if(branch.fallthrough) {
+				table.fallthroughs[branch.offset] = branch.taken;
+			} else {
+				table.cases[{branch.offset, branch.value}] = branch.taken;
+			}
+		}
+
+		std::string error;
+		_merge(table, error);
+	}
+}
+
+bool CoverageFile::_merge(const Table& table, std::string& error) {
+	auto [it, inserted] = _tables.try_emplace({table.index, table.hash}, table);
+	if(inserted) {
+		return true;
+	}
+
+	Table& into = it->second;
+	if(into.size != table.size) {
+		error = "table " + hex(table.index) + " with hash " + hex(table.hash) + " has another size";
+		return false;
+	}
+	for(size_t i = 0; i < into.ran.size(); i++) {
+		into.reachable[i] |= table.reachable[i];
+		into.ran[i] |= table.ran[i];
+	}
+	for(const auto& [offset, jump] : table.jumps) {
+		into.jumps[offset].taken += jump.taken;
+		into.jumps[offset].notTaken += jump.notTaken;
+	}
+	for(const auto& [key, hits] : table.cases) {
+		into.cases[key] += hits;
+	}
+	for(const auto& [offset, hits] : table.fallthroughs) {
+		into.fallthroughs[offset] += hits;
+	}
+	return true;
+}
+
+bool CoverageFile::read(const std::string& text, std::string& error) {
+	std::istringstream in(text);
+	std::string lineText;
+	Table table;
+	bool inTable = false;
+	for(int number = 1; std::getline(in, lineText); number++) {
+		size_t comment = lineText.find('#');
+		if(comment != std::string::npos) {
+			lineText.resize(comment);
+		}
+
+		std::istringstream line(lineText);
+		std::vector<std::string> tokens;
+		for(std::string token; line >> token;) {
+			tokens.push_back(token);
+		}
+		if(tokens.empty()) {
+			continue;
+		}
+
+		auto fail = [&error, number](const std::string& message) {
+			error = "line " + std::to_string(number) + ": " + message;
+			return false;
+		};
+
+		if(!inTable) {
+			if(tokens.size() != 4 || tokens[0] != "table" || !parseNumber(tokens[1], table.index)
+					|| !parseNumber(tokens[2], table.hash) || !parseNumber(tokens[3], table.size)) {
+				return fail("expected table <index> <hash> <size>");
+			}
+			size_t bitmapSize = (table.size + 7) / 8;
+			table.reachable.assign(bitmapSize, 0);
+			table.ran.assign(bitmapSize, 0);
+			table.jumps.clear();
+			table.cases.clear();
+			table.fallthroughs.clear();
+			inTable = true;
+			continue;
+		}
+
+		uint32_t offset;
+		uint32_t value;
+		uint64_t taken;
+		uint64_t notTaken;
+		if(tokens[0] == "end" && tokens.size() == 1) {
+			std::string mergeError;
+			if(!_merge(table, mergeError)) {
+				return fail(mergeError);
+			}
+			inTable = false;
+		} else if(tokens[0] == "reachable" || tokens[0] == "ran") {
+			// Empty bitmaps are written without one.
+			if(tokens.size() > 2 || (tokens.size() == 2 && !parseBitmap(tokens[1], table.ran.size(),
+					tokens[0] == "ran" ? table.ran : table.reachable))) {
+				return fail("expected " + tokens[0] + " <bitmap of " + std::to_string(table.ran.size()) + " bytes>");
+			}
+		} else if(tokens[0] == "jump") {
+			if(tokens.size() != 4 || !parseNumber(tokens[1], offset) || !parseNumber(tokens[2], taken)
+					|| !parseNumber(tokens[3], notTaken)) {
+				return fail("expected jump <offset> <taken> <not taken>");
+			}
+			table.jumps[offset] = Jump{taken, notTaken};
+		} else if(tokens[0] == "case") {
+			if(tokens.size() != 4 || !parseNumber(tokens[1], offset) || !parseNumber(tokens[2], value)
+					|| !parseNumber(tokens[3], taken)) {
+				return fail("expected case <offset> <value> <count>");
+			}
+			table.cases[{offset, value}] = taken;
+		} else if(tokens[0] == "fallthrough") {
+			if(tokens.size() != 3 || !parseNumber(tokens[1], offset) || !parseNumber(tokens[2], taken)) {
+				return fail("expected fallthrough <offset> <count>");
+			}
+			table.fallthroughs[offset] = taken;
+		} else {
+			return fail("expected reachable, ran, jump, case, fallthrough or end");
+		}
+	}
+
+	if(inTable) {
+		error = "table " + hex(table.index) + " has no end";
+		return false;
+	}
+	return true;
+}
+
+void CoverageFile::write(std::ostream& out) const {
+	auto bitmap = [&out](const std::vector<uint8_t>& bits) {
+		char digits[3];
+		for(uint8_t byte : bits) {
+			snprintf(digits, sizeof(digits), "%02x", byte);
+			out << digits;
+		}
+	};
+
+	out << "# atombios coverage\n";
+	for(const auto& [key, table] : _tables) {
+		out << "table " << hex(table.index) << " " << hex(table.hash) << " " << table.size << "\n";
+		out << "reachable ";
+		bitmap(table.reachable);
+		out << "\nran ";
+		bitmap(table.ran);
+		out << "\n";
+		for(const auto& [offset, jump] : table.jumps) {
+			out << "jump " << hex(offset) << " " << jump.taken << " " << jump.notTaken << "\n";
+		}
+		for(const auto& [caseKey, hits] : table.cases) {
+			out << "case " << hex(caseKey.first) << " " << hex(caseKey.second) << " " << hits << "\n";
+		}
+		for(const auto& [offset, hits] : table.fallthroughs) {
+			out << "fallthrough " << hex(offset) << " " << hits << "\n";
+		}
+		out << "end\n";
+	}
+}
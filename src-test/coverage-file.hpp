@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <libatombios/atom.hpp>
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Coverage of command tables, collected from runs with AtomBios::setCoverage. Coverage of tables with the same
+// index and bytecode (by its hash) is merged, whether it comes from another run or another ROM: the instructions
+// that ran are joined, and the counts of the jumps and SWITCH cases are added up.
+//
+// As text, a table is written as
+//   table <index> <bytecode hash> <bytecode size>
+//   reachable <bitmap>                              the bitmaps have a bit per bytecode offset, set at the offsets
+//   ran <bitmap>                                    of instructions; as hex bytes, lowest offsets first
+//   jump <offset> <taken> <not taken>               per conditional jump
+//   case <offset> <value> <count>                   per SWITCH case
+//   fallthrough <offset> <count>                    per SWITCH, how often no case matched
+//   end
+// where offsets are into the bytecode. '#' starts comments.
+class CoverageFile {
+public:
+	struct Jump {
+		uint64_t taken = 0;
+		uint64_t notTaken = 0;
+	};
+
+	struct Table {
+		uint32_t index = 0;
+		uint32_t hash = 0;
+		uint32_t size = 0;
+		std::vector<uint8_t> reachable;
+		std::vector<uint8_t> ran;
+		std::map<uint32_t, Jump> jumps;
+		// By offset and value.
+		std::map<std::pair<uint32_t, uint32_t>, uint64_t> cases;
+		std::map<uint32_t, uint64_t> fallthroughs;
+
+		uint32_t instructions() const;
+		uint32_t instructionsRun() const;
+		// Both directions of each jump, each case and each fallthrough; and the ones of them that were taken.
+		uint32_t directions() const;
+		uint32_t directionsTaken() const;
+	};
+
+	// Adds the coverage of the command tables of the ROM.
+	void add(AtomBios& atomBios);
+	// Adds the coverage in the text; on failure, error holds the line and what is wrong with it.
+	bool read(const std::string& text, std::string& error);
+	void write(std::ostream& out) const;
+
+	// Ordered by index and hash.
+	const std::map<std::pair<uint32_t, uint32_t>, Table>& tables() const { return _tables; }
+
+private:
+	// On failure, error holds what is wrong.
+	bool _merge(const Table& table, std::string& error);
+
+	std::map<std::pair<uint32_t, uint32_t>, Table> _tables;
+};
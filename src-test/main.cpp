@@ -1,20 +1,49 @@
 #include <iostream>
 #include <fstream>
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <CLI/CLI.hpp>
 #include <libatombios/atom.hpp>
 #include <libatombios/extern-funcs.hpp>
 
+#include "coverage-file.hpp"
+#include "simulated-card.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <map>
+#include <sstream>
+#include <thread>
 #include <vector>
 
-std::map<uint32_t, uint32_t> readRegisterLog;
-std::map<uint32_t, uint32_t> writeRegisterLog;
+// The card the tables run against, unless --card gives another configuration.
+static const char* defaultCardConfig = R"(
+default reg 0xAA
+default pll 0xAA
+default mc 0xAA
+reg 0x1b9c = 0xFF01FFFF
+reg 0x394 = 0x00001F00
+reg 0x4ccd = 0x00010000
+reg 0x4bcb = 0x00010000
+reg 0x4ccc = 0x00010000
+)";
+
+static SimulatedCard card;
+// The card of the calling thread: the corpus runner gives each ROM a card of its own.
+static thread_local SimulatedCard* currentCard = &card;
 
-constexpr bool suppressLogs = false;
+// The corpus runner suppresses the logs, but counts the warnings and errors of each ROM.
+static bool suppressLogs = false;
+static thread_local uint32_t loggedWarnings = 0;
+static thread_local uint32_t loggedErrors = 0;
 
 const char* logTypeToString(enum LilradLogType type) {
 	switch(type) {
@@ -37,12 +66,17 @@ extern "C" void lilrad_log(enum LilradLogType type, const char* format, ...) {
 	va_list arglist;
 	va_start(arglist, format);
 
+	if(type == WARNING) {
+		loggedWarnings++;
+	} else if(type == ERROR) {
+		loggedErrors++;
+	}
 	if(suppressLogs) {
 		va_end(arglist);
 		return;
 	}
 
-	static char buffer[1024];
+	static thread_local char buffer[1024];
 	strcpy(buffer, logTypeToString(type));
 	strncat(buffer, format, 1023 - strlen(logTypeToString(type)));
 	vprintf(buffer, arglist);
@@ -50,7 +84,11 @@ extern "C" void lilrad_log(enum LilradLogType type, const char* format, ...) {
 	va_end(arglist);
 }
 
+// Allocations the library made on the calling thread, for the bench subcommand.
+static thread_local uint64_t allocations = 0;
+
 extern "C" void* lilrad_alloc(size_t size) {
+	allocations++;
 	return malloc(size);	
 }
 
@@ -58,61 +96,35 @@ extern "C" void lilrad_free(void* ptr) {
 	free(ptr);
 }
 
-extern "C" [[gnu::weak]] void libatombios_card_reg_write(uint32_t reg, uint32_t val) {
-	if(readRegisterLog.count(reg) == 0) {
-		writeRegisterLog[reg] = 1;
-	} else {
-		writeRegisterLog[reg]++;
-	}
+// --write-latency: how long each card write takes, as on hosts where writes go through a slow path.
+static uint32_t writeLatencyMicroseconds = 0;
 
-	if(!suppressLogs) {
-		printf("aaa: reg=%x, val=%x\n", reg, val);
+static void simulateWriteLatency() {
+	if(writeLatencyMicroseconds) {
+		std::this_thread::sleep_for(std::chrono::microseconds(writeLatencyMicroseconds));
 	}
 }
-extern "C" [[gnu::weak]] uint32_t libatombios_card_reg_read(uint32_t reg) {
-	uint32_t val = 0xAA; //0xAA;
-
-	if(reg == 0x1b9c) {
-		val = 0xFF01FFFF;
-		//val = 0;
-	} else if(reg == 0x394) {
-		val = 0x00001F00;
-	} else if(reg == 0x4ccd) {
-		val = 0x00010000;
-	} else if(reg == 0x4bcb) {
-		val = 0x00010000;
-	} else if(reg == 0x4ccc) {
-		val = 0x00010000;
-	} else if(reg == 0x83) {
-		exit(0);
-	}
-
-	if(readRegisterLog.count(reg) == 0) {
-		readRegisterLog[reg] = 1;
-	} else {
-		readRegisterLog[reg]++;
-	}
 
-	if(!suppressLogs) {
-		printf("aaa: reg=%x, val=%x\n", reg, val);
-	}
-	return val;
+extern "C" [[gnu::weak]] void libatombios_card_reg_write(uint32_t reg, uint32_t val) {
+	simulateWriteLatency();
+	currentCard->write(SimulatedCard::Space::Reg, reg, val);
+}
+extern "C" [[gnu::weak]] uint32_t libatombios_card_reg_read(uint32_t reg) {
+	return currentCard->read(SimulatedCard::Space::Reg, reg);
 }
 extern "C" [[gnu::weak]] void libatombios_card_mc_write(uint32_t reg, uint32_t val) {
-	printf("aaa: reg=%x, val=%x\n", reg, val);
+	simulateWriteLatency();
+	currentCard->write(SimulatedCard::Space::MC, reg, val);
 }
 extern "C" [[gnu::weak]] uint32_t libatombios_card_mc_read(uint32_t reg) {
-	uint32_t val = 0xAA;
-	printf("aaa: reg=%x, val=%x\n", reg, val);
-	return val;
+	return currentCard->read(SimulatedCard::Space::MC, reg);
 }
 extern "C" [[gnu::weak]] void libatombios_card_pll_write(uint32_t reg, uint32_t val) {
-	printf("aaa: reg=%x, val=%x\n", reg, val);
+	simulateWriteLatency();
+	currentCard->write(SimulatedCard::Space::PLL, reg, val);
 }
 extern "C" [[gnu::weak]] uint32_t libatombios_card_pll_read(uint32_t reg) {
-	uint32_t val = 0xAA;
-	printf("aaa: reg=%x, val=%x\n", reg, val);
-	return val;
+	return currentCard->read(SimulatedCard::Space::PLL, reg);
 }
 
 extern "C" [[gnu::weak]] void libatombios_delay_microseconds(uint32_t microseconds) {
@@ -122,45 +134,1546 @@ extern "C" [[gnu::weak]] void libatombios_delay_milliseconds(uint32_t millisecon
 	
 }
 
+extern "C" [[gnu::weak]] void* libatombios_jit_alloc(size_t size) {
+	void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return ptr == MAP_FAILED ? nullptr : ptr;
+}
+extern "C" [[gnu::weak]] bool libatombios_jit_seal(void* ptr, size_t size) {
+	return mprotect(ptr, size, PROT_READ | PROT_EXEC) == 0;
+}
+extern "C" [[gnu::weak]] void libatombios_jit_free(void* ptr, size_t size) {
+	munmap(ptr, size);
+}
+
+// Prints a binary trace as text or JSON; from one invocation of a table until it returns, if invocation is set.
+static int dumpTrace(const std::string& path, const std::string& format, int64_t invocation) {
+	if(format != "text" && format != "json") {
+		std::cerr << "unknown trace format " << format << std::endl;
+		return 1;
+	}
+
+	int fd = open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) < 0) {
+		std::cerr << "can not open " << path << std::endl;
+		return 1;
+	}
+	size_t size = st.st_size;
+	void* data = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+	close(fd);
+	if(data == MAP_FAILED) {
+		std::cerr << "can not map " << path << std::endl;
+		return 1;
+	}
+
+	int result = 0;
+	{
+		AtomBiosTrace::Reader reader(static_cast<const uint8_t*>(data), size);
+		if(!reader.valid()) {
+			result = 1;
+		} else if(invocation >= 0 && static_cast<size_t>(invocation) >= reader.invocations()) {
+			std::cerr << "the trace has " << reader.invocations() << " table invocations" << std::endl;
+			result = 1;
+		} else {
+			if(invocation >= 0) {
+				reader.seekInvocation(invocation);
+			}
+
+			const char* spaceNames[] = {"reg", "pll", "mc"};
+			bool json = format == "json";
+			if(json) {
+				std::cout << "[";
+			}
+
+			AtomBiosTrace::Event event;
+			uint32_t depth = 0;
+			for(bool first = true; reader.next(event); first = false) {
+				const char* space = spaceNames[static_cast<int>(event.space)];
+				if(json) {
+					std::cout << (first ? "\n" : ",\n") << "  {\"event\": ";
+				}
+
+				switch(event.type) {
+				case AtomBiosTrace::EventType::TableEnter:
+					depth = event.depth;
+					if(json) {
+						std::cout << "\"enter\", \"table\": " << event.table << ", \"depth\": " << event.depth << "}";
+					} else {
+						std::cout << std::string(2 * depth, ' ') << "enter " << std::hex << event.table << std::dec << std::endl;
+					}
+					break;
+				case AtomBiosTrace::EventType::TableExit:
+					if(json) {
+						std::cout << "\"exit\"}";
+					} else {
+						std::cout << std::string(2 * depth, ' ') << "exit" << std::endl;
+					}
+					break;
+				case AtomBiosTrace::EventType::Read:
+				case AtomBiosTrace::EventType::Write: {
+					const char* name = event.type == AtomBiosTrace::EventType::Read ? "read" : "write";
+					if(json) {
+						std::cout << "\"" << name << "\", \"space\": \"" << space << "\", \"reg\": " << event.reg << ", \"val\": " << event.val << "}";
+					} else {
+						std::cout << std::string(2 * depth + 2, ' ') << name << " " << space << " " << std::hex << event.reg
+							<< " = " << event.val << std::dec << std::endl;
+					}
+					break;
+				}
+				case AtomBiosTrace::EventType::Delay:
+					if(json) {
+						std::cout << "\"delay\", \"microseconds\": " << event.val << "}";
+					} else {
+						std::cout << std::string(2 * depth + 2, ' ') << "delay " << event.val << "us" << std::endl;
+					}
+					break;
+				}
+
+				// The invocation ends with the exit at its own depth.
+				if(event.type == AtomBiosTrace::EventType::TableExit) {
+					if(invocation >= 0 && depth == reader.invocation(invocation).depth) {
+						break;
+					}
+					if(depth) {
+						depth--;
+					}
+				}
+			}
+
+			if(json) {
+				std::cout << "\n]" << std::endl;
+			}
+			if(reader.truncated()) {
+				std::cerr << "the trace is truncated" << std::endl;
+			}
+		}
+	}
+
+	if(size) {
+		munmap(data, size);
+	}
+	return result;
+}
+
+// Writes the spans in the Chrome trace event format, which trace viewers (e.g. Perfetto) load.
+static void writeTimeline(const std::string& path, const std::vector<AtomBios::TableSpan>& spans) {
+	std::ofstream out(path);
+	out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+	for(size_t i = 0; i < spans.size(); i++) {
+		const AtomBios::TableSpan& span = spans[i];
+		const char* name = AtomBios::commandTableName(span.table);
+
+		// Timestamps are in microseconds.
+		out << (i ? ",\n" : "\n") << "  {\"name\": \"";
+		if(name) {
+			out << name;
+		} else {
+			out << "table " << span.table;
+		}
+		out << "\", \"cat\": \"table\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": " << span.begin / 1000.0
+			<< ", \"dur\": " << (span.end - span.begin) / 1000.0 << ", \"args\": {\"table\": " << span.table
+			<< ", \"depth\": " << span.depth << ", \"reads\": " << span.reads << ", \"writes\": " << span.writes
+			<< ", \"delays\": " << span.delays << ", \"delay_us\": " << span.delayMicroseconds << "}}";
+	}
+	out << "\n]}" << std::endl;
+}
+
+// The table is given by its name or its index; -1 if there is no such table.
+static int findTable(const std::string& table) {
+	for(int i = AtomBios::CommandTables::ASIC_Init; i <= AtomBios::CommandTables::GetVoltageInfo; i++) {
+		const char* name = AtomBios::commandTableName(static_cast<AtomBios::CommandTables>(i));
+		if(name && table == name) {
+			return i;
+		}
+	}
+
+	char* end;
+	unsigned long index = strtoul(table.c_str(), &end, 0);
+	if(table.empty() || *end || index > AtomBios::CommandTables::GetVoltageInfo) {
+		return -1;
+	}
+	return index;
+}
+
+static std::string tableName(int table) {
+	const char* name = AtomBios::commandTableName(static_cast<AtomBios::CommandTables>(table));
+	return name ? name : "table " + std::to_string(table);
+}
+
+struct BenchOptions {
+	std::string filename;
+	std::string table;
+	std::vector<std::string> params;
+	uint32_t runs = 1000;
+	uint32_t warmup = 100;
+	bool json = false;
+	std::string optimize = "off";
+	std::string jit = "off";
+	uint32_t jitThreshold = 1;
+};
+
+// Runs a table repeatedly against the simulated card, and prints how long a run takes and what it does.
+static int benchTable(const BenchOptions& options) {
+	std::ifstream fileStream(options.filename, std::ios::in | std::ios::binary | std::ios::ate);
+	if(!fileStream) {
+		std::cerr << "can not open " << options.filename << std::endl;
+		return 1;
+	}
+	std::vector<uint8_t> data(fileStream.tellg());
+	fileStream.seekg(0, std::ios::beg);
+	fileStream.read((char*)data.data(), data.size());
+
+	int table = findTable(options.table);
+	if(table < 0) {
+		std::cerr << "unknown command table " << options.table << std::endl;
+		return 1;
+	}
+
+	// The parameter space is at least as large as the one the linux driver passes.
+	std::vector<uint32_t> params;
+	for(const std::string& param : options.params) {
+		char* end;
+		errno = 0;
+		unsigned long long val = strtoull(param.c_str(), &end, 0);
+		if(param.empty() || *end || errno || val > UINT32_MAX) {
+			std::cerr << "invalid parameter " << param << std::endl;
+			return 1;
+		}
+		params.push_back(val);
+	}
+	size_t paramDwords = std::max<size_t>(params.size(), 16);
+	params.resize(paramDwords);
+
+	if(!options.runs) {
+		std::cerr << "at least one run is needed" << std::endl;
+		return 1;
+	}
+
+	AtomBios atomBios(data.data(), data.size());
+	// Running a table the ROM does not have is an assertion failure.
+	if(!atomBios.hasCommand(static_cast<AtomBios::CommandTables>(table))) {
+		std::cerr << "the ROM has no command table " << options.table << std::endl;
+		return 1;
+	}
+	if(options.optimize == "on") {
+		atomBios.setOptimizerMode(AtomBios::OptimizerMode::On);
+	} else if(options.optimize == "self-check") {
+		atomBios.setOptimizerMode(AtomBios::OptimizerMode::SelfCheck);
+	} else if(options.optimize != "off") {
+		std::cerr << "unknown optimizer mode " << options.optimize << std::endl;
+		return 1;
+	}
+	if(options.jit == "on") {
+		atomBios.setJitMode(AtomBios::JitMode::On, options.jitThreshold);
+	} else if(options.jit != "off") {
+		std::cerr << "unknown JIT mode " << options.jit << std::endl;
+		return 1;
+	}
+
+	std::vector<uint32_t> scratch(20 * 1024 / sizeof(uint32_t));
+	atomBios.setFrameBufferWindow(reinterpret_cast<uint8_t*>(scratch.data()), scratch.size() * sizeof(uint32_t));
+
+	// Every run starts from the same parameters; the table may have written its results into them.
+	std::vector<uint32_t> runParams(paramDwords);
+	auto run = [&]() {
+		std::copy(params.begin(), params.end(), runParams.begin());
+		atomBios.runCommand(static_cast<AtomBios::CommandTables>(table), runParams.data(), runParams.size());
+	};
+	auto instructionsRun = [&atomBios]() {
+		uint64_t instructions = 0;
+		for(int i = AtomBios::CommandTables::ASIC_Init; i <= AtomBios::CommandTables::GetVoltageInfo; i++) {
+			instructions += atomBios.fusionStats(static_cast<AtomBios::CommandTables>(i)).instructionsRun;
+		}
+		return instructions;
+	};
+
+	for(uint32_t i = 0; i < options.warmup; i++) {
+		run();
+	}
+
+	uint64_t instructions = instructionsRun();
+	uint64_t reads = card.reads();
+	uint64_t writes = card.writes();
+	uint64_t allocated = allocations;
+
+	std::vector<uint64_t> samples(options.runs);
+	for(uint32_t i = 0; i < options.runs; i++) {
+		auto begin = std::chrono::steady_clock::now();
+		run();
+		auto end = std::chrono::steady_clock::now();
+		samples[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+	}
+
+	// Per run, over the measured runs.
+	double runs = options.runs;
+	double perRunInstructions = (instructionsRun() - instructions) / runs;
+	double perRunReads = (card.reads() - reads) / runs;
+	double perRunWrites = (card.writes() - writes) / runs;
+	double perRunAllocations = (allocations - allocated) / runs;
+
+	std::sort(samples.begin(), samples.end());
+	uint64_t min = samples.front();
+	uint64_t median = samples[samples.size() / 2];
+	uint64_t p99 = samples[std::min<size_t>(samples.size() * 99 / 100, samples.size() - 1)];
+
+	if(options.json) {
+		std::cout << "{\"table\": \"" << tableName(table) << "\", \"index\": " << table << ", \"runs\": " << options.runs
+			<< ", \"warmup\": " << options.warmup << ", \"min_ns\": " << min << ", \"median_ns\": " << median
+			<< ", \"p99_ns\": " << p99 << ", \"instructions\": " << perRunInstructions << ", \"reads\": " << perRunReads
+			<< ", \"writes\": " << perRunWrites << ", \"allocations\": " << perRunAllocations << "}" << std::endl;
+	} else {
+		std::cout << tableName(table) << ": " << options.runs << " runs after " << options.warmup << " warmup runs" << std::endl;
+		std::cout << "  latency: min " << min << " ns, median " << median << " ns, p99 " << p99 << " ns" << std::endl;
+		std::cout << "  per run: " << perRunInstructions << " instructions, " << perRunReads << " reads, "
+			<< perRunWrites << " writes, " << perRunAllocations << " allocations" << std::endl;
+	}
+	return 0;
+}
+
+struct CostOptions {
+	std::string filename;
+	std::vector<std::string> tables;
+	bool run = false;
+	bool json = false;
+	uint32_t instructionNanoseconds = 10;
+	uint32_t regNanoseconds = 1000;
+	uint32_t pllNanoseconds = 1000;
+	uint32_t mcNanoseconds = 1000;
+	uint32_t fbNanoseconds = 100;
+};
+
+// Prints the estimated cost of tables; with run, also the cost measured by running them against the simulated card.
+static int printCosts(const CostOptions& options) {
+	std::ifstream fileStream(options.filename, std::ios::in | std::ios::binary | std::ios::ate);
+	if(!fileStream) {
+		std::cerr << "can not open " << options.filename << std::endl;
+		return 1;
+	}
+	std::vector<uint8_t> data(fileStream.tellg());
+	fileStream.seekg(0, std::ios::beg);
+	fileStream.read((char*)data.data(), data.size());
+
+	AtomBios atomBios(data.data(), data.size());
+
+	// Without tables, all of the ROM's.
+	std::vector<int> tables;
+	for(const std::string& name : options.tables) {
+		int table = findTable(name);
+		if(table < 0 || !atomBios.hasCommand(static_cast<AtomBios::CommandTables>(table))) {
+			std::cerr << "unknown command table " << name << std::endl;
+			return 1;
+		}
+		tables.push_back(table);
+	}
+	if(options.tables.empty()) {
+		for(int i = AtomBios::CommandTables::ASIC_Init; i <= AtomBios::CommandTables::GetVoltageInfo; i++) {
+			if(atomBios.hasCommand(static_cast<AtomBios::CommandTables>(i))) {
+				tables.push_back(i);
+			}
+		}
+	}
+
+	AtomBios::CostModel model{};
+	model.instructionNanoseconds = options.instructionNanoseconds;
+	model.accessNanoseconds[static_cast<int>(AtomBios::FootprintSpace::Reg)] = options.regNanoseconds;
+	model.accessNanoseconds[static_cast<int>(AtomBios::FootprintSpace::PLL)] = options.pllNanoseconds;
+	model.accessNanoseconds[static_cast<int>(AtomBios::FootprintSpace::MC)] = options.mcNanoseconds;
+	model.accessNanoseconds[static_cast<int>(AtomBios::FootprintSpace::FB)] = options.fbNanoseconds;
+
+	std::vector<uint32_t> scratch(20 * 1024 / sizeof(uint32_t));
+	atomBios.setFrameBufferWindow(reinterpret_cast<uint8_t*>(scratch.data()), scratch.size() * sizeof(uint32_t));
+
+	auto printCounters = [&options](const char* name, const AtomBios::CostCounters& counters, uint64_t nanoseconds) {
+		uint64_t reads = 0;
+		uint64_t writes = 0;
+		for(int space = 0; space < AtomBios::footprintSpaces; space++) {
+			reads += counters.reads[space];
+			writes += counters.writes[space];
+		}
+		if(options.json) {
+			std::cout << "\"" << name << "\": {\"ns\": " << nanoseconds << ", \"instructions\": " << counters.instructions
+				<< ", \"reads\": [";
+			for(int space = 0; space < AtomBios::footprintSpaces; space++) {
+				std::cout << (space ? ", " : "") << counters.reads[space];
+			}
+			std::cout << "], \"writes\": [";
+			for(int space = 0; space < AtomBios::footprintSpaces; space++) {
+				std::cout << (space ? ", " : "") << counters.writes[space];
+			}
+			std::cout << "], \"delay_us\": " << counters.delayMicroseconds << "}";
+		} else {
+			std::cout << "  " << name << ": " << nanoseconds / 1000.0 << " us (" << counters.instructions << " instructions, "
+				<< reads << " reads, " << writes << " writes, " << counters.delayMicroseconds << " us delays)" << std::endl;
+		}
+	};
+
+	if(options.json) {
+		std::cout << "[";
+	}
+	for(size_t i = 0; i < tables.size(); i++) {
+		AtomBios::CommandTables table = static_cast<AtomBios::CommandTables>(tables[i]);
+		AtomBios::CostEstimate estimate = atomBios.estimateCost(table, model);
+
+		if(options.json) {
+			std::cout << (i ? ",\n" : "\n") << "  {\"table\": \"" << tableName(table) << "\", \"bounded\": "
+				<< (estimate.bounded ? "true" : "false") << ", ";
+		} else {
+			std::cout << tableName(table) << (estimate.bounded ? "" : " (may loop; the worst case is not a bound)") << std::endl;
+		}
+		printCounters("best", estimate.best, estimate.bestNanoseconds);
+		if(options.json) {
+			std::cout << ", ";
+		}
+		printCounters("worst", estimate.worst, estimate.worstNanoseconds);
+
+		if(options.run) {
+			AtomBios::CostCounters counters{};
+			std::vector<uint32_t> params(16);
+			atomBios.setCostCounters(&counters);
+			atomBios.runCommand(table, params.data(), params.size());
+			atomBios.setCostCounters(nullptr);
+
+			if(options.json) {
+				std::cout << ", ";
+			}
+			printCounters("measured", counters, AtomBios::predictNanoseconds(model, counters));
+		}
+		if(options.json) {
+			std::cout << "}";
+		}
+	}
+	if(options.json) {
+		std::cout << "\n]" << std::endl;
+	}
+	return 0;
+}
+
+struct CorpusOptions {
+	std::vector<std::string> filenames;
+	std::vector<std::string> tables;
+	uint32_t threads = 0;
+	bool json = false;
+	std::string optimize = "off";
+};
+
+struct CorpusTableResult {
+	int table;
+	// ok, missing (the ROM does not have the table), or invalid (it may reach invalid opcodes or missing tables,
+	// which would fail an assertion, so it is not run).
+	const char* status;
+	uint64_t nanoseconds;
+	uint64_t instructions;
+	uint64_t reads;
+	uint64_t writes;
+	std::vector<uint8_t> invalidOpcodes;
+	uint32_t missingTables;
+};
+
+struct CorpusResult {
+	// ok, unreadable, not-atombios (the header is not that of an ATOM BIOS), or failed (a table was not run).
+	const char* status = "ok";
+	uint64_t nanoseconds = 0;
+	uint32_t warnings = 0;
+	uint32_t errors = 0;
+	std::vector<CorpusTableResult> tables;
+	uint64_t opcodes[256] = {};
+};
+
+// The checks the AtomBios constructor asserts, so that other files are reported instead.
+static bool isAtomBios(const uint8_t* data, size_t size) {
+	if(size < 0x4A || data[0] != 0x55 || data[1] != 0xAA || memcmp(data + 0x30, " 761295520", 10)) {
+		return false;
+	}
+	size_t romTable = data[0x48] | (data[0x49] << 8);
+	return romTable + 8 <= size && !memcmp(data + romTable + 4, "ATOM", 4);
+}
+
+// Runs the tables of one ROM, in order, on a card of its own.
+static void runCorpusRom(const std::string& filename, const std::vector<int>& tables, const CorpusOptions& options,
+		const std::string& config, CorpusResult& result) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) < 0) {
+		if(fd >= 0) {
+			close(fd);
+		}
+		result.status = "unreadable";
+		return;
+	}
+	size_t size = st.st_size;
+	void* data = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+	close(fd);
+	if(data == MAP_FAILED || !isAtomBios(static_cast<const uint8_t*>(data), size)) {
+		if(data && data != MAP_FAILED) {
+			munmap(data, size);
+		}
+		result.status = data == MAP_FAILED ? "unreadable" : "not-atombios";
+		return;
+	}
+
+	SimulatedCard romCard;
+	std::string error;
+	romCard.configure(config, error);
+	currentCard = &romCard;
+	loggedWarnings = 0;
+	loggedErrors = 0;
+
+	// The ROM is copied, so the mapping is only needed while it is loaded.
+	auto begin = std::chrono::steady_clock::now();
+	AtomBios atomBios(const_cast<uint8_t*>(static_cast<const uint8_t*>(data)), size);
+	munmap(data, size);
+
+	if(options.optimize == "on") {
+		atomBios.setOptimizerMode(AtomBios::OptimizerMode::On);
+	}
+	atomBios.setOpcodeProfile(result.opcodes);
+	std::vector<uint32_t> scratch(20 * 1024 / sizeof(uint32_t));
+	atomBios.setFrameBufferWindow(reinterpret_cast<uint8_t*>(scratch.data()), scratch.size() * sizeof(uint32_t));
+
+	for(int table : tables) {
+		CorpusTableResult tableResult{table, "ok"};
+		AtomBios::CommandTables command = static_cast<AtomBios::CommandTables>(table);
+		if(!atomBios.hasCommand(command)) {
+			tableResult.status = "missing";
+			result.tables.push_back(tableResult);
+			continue;
+		}
+
+		AtomBios::FootprintStats footprint = atomBios.footprintStats(command);
+		if(footprint.invalidOpcodes || footprint.missingTables) {
+			tableResult.status = "invalid";
+			tableResult.invalidOpcodes.resize(footprint.invalidOpcodes);
+			atomBios.footprintInvalidOpcodes(command, tableResult.invalidOpcodes.data(), tableResult.invalidOpcodes.size());
+			tableResult.missingTables = footprint.missingTables;
+			result.status = "failed";
+			result.tables.push_back(tableResult);
+			continue;
+		}
+
+		uint64_t instructions = 0;
+		for(int i = AtomBios::CommandTables::ASIC_Init; i <= AtomBios::CommandTables::GetVoltageInfo; i++) {
+			instructions += atomBios.fusionStats(static_cast<AtomBios::CommandTables>(i)).instructionsRun;
+		}
+		uint64_t reads = romCard.reads();
+		uint64_t writes = romCard.writes();
+
+		std::vector<uint32_t> params(16);
+		auto tableBegin = std::chrono::steady_clock::now();
+		atomBios.runCommand(command, params.data(), params.size());
+		auto tableEnd = std::chrono::steady_clock::now();
+
+		tableResult.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(tableEnd - tableBegin).count();
+		for(int i = AtomBios::CommandTables::ASIC_Init; i <= AtomBios::CommandTables::GetVoltageInfo; i++) {
+			tableResult.instructions += atomBios.fusionStats(static_cast<AtomBios::CommandTables>(i)).instructionsRun;
+		}
+		tableResult.instructions -= instructions;
+		tableResult.reads = romCard.reads() - reads;
+		tableResult.writes = romCard.writes() - writes;
+		result.tables.push_back(tableResult);
+	}
+	atomBios.setOpcodeProfile(nullptr);
+
+	result.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+	result.warnings = loggedWarnings;
+	result.errors = loggedErrors;
+	currentCard = &card;
+}
+
+static std::string jsonString(const std::string& str) {
+	std::string out = "\"";
+	for(char c : str) {
+		if(c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if(static_cast<unsigned char>(c) < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out += escaped;
+		} else {
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+// Loads the ROMs on a pool of threads, runs the tables of each against a simulated card, and prints a report of them all.
+static int runCorpus(const CorpusOptions& options, const std::string& config) {
+	std::vector<int> tables;
+	for(const std::string& name : options.tables) {
+		int table = findTable(name);
+		if(table < 0) {
+			std::cerr << "unknown command table " << name << std::endl;
+			return 1;
+		}
+		tables.push_back(table);
+	}
+	if(tables.empty()) {
+		tables.push_back(AtomBios::CommandTables::ASIC_Init);
+	}
+	if(options.optimize != "on" && options.optimize != "off") {
+		std::cerr << "unknown optimizer mode " << options.optimize << std::endl;
+		return 1;
+	}
+
+	size_t threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, options.filenames.size());
+
+	// The ROMs are taken in order by whichever worker is free; each result is written by one worker only.
+	suppressLogs = true;
+	std::vector<CorpusResult> results(options.filenames.size());
+	std::atomic<size_t> next{0};
+	auto begin = std::chrono::steady_clock::now();
+	{
+		std::vector<std::thread> workers;
+		for(size_t i = 0; i < threads; i++) {
+			workers.emplace_back([&]() {
+				for(size_t rom = next++; rom < results.size(); rom = next++) {
+					runCorpusRom(options.filenames[rom], tables, options, config, results[rom]);
+				}
+			});
+		}
+		for(std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+	uint64_t wallNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+	suppressLogs = false;
+
+	// Totals over all ROMs; for the invalid opcodes, the amount of ROMs that may reach each.
+	std::map<std::string, size_t> statuses;
+	uint64_t instructions = 0;
+	uint64_t cpuNanoseconds = 0;
+	uint64_t opcodes[256] = {};
+	size_t invalidOpcodeRoms[256] = {};
+	for(const CorpusResult& result : results) {
+		statuses[result.status]++;
+		cpuNanoseconds += result.nanoseconds;
+		for(int op = 0; op < 256; op++) {
+			opcodes[op] += result.opcodes[op];
+		}
+
+		bool invalid[256] = {};
+		for(const CorpusTableResult& table : result.tables) {
+			instructions += table.instructions;
+			for(uint8_t op : table.invalidOpcodes) {
+				invalid[op] = true;
+			}
+		}
+		for(int op = 0; op < 256; op++) {
+			invalidOpcodeRoms[op] += invalid[op];
+		}
+	}
+
+	auto hex = [](uint64_t val) {
+		std::ostringstream out;
+		out << "0x" << std::hex << val;
+		return out.str();
+	};
+
+	if(options.json) {
+		std::cout << "{\"roms\": [";
+		for(size_t rom = 0; rom < results.size(); rom++) {
+			const CorpusResult& result = results[rom];
+			std::cout << (rom ? ",\n" : "\n") << "  {\"path\": " << jsonString(options.filenames[rom]) << ", \"status\": \""
+				<< result.status << "\", \"ns\": " << result.nanoseconds << ", \"warnings\": " << result.warnings
+				<< ", \"errors\": " << result.errors << ", \"tables\": [";
+			for(size_t i = 0; i < result.tables.size(); i++) {
+				const CorpusTableResult& table = result.tables[i];
+				std::cout << (i ? ", " : "") << "{\"table\": \"" << tableName(table.table) << "\", \"status\": \"" << table.status
+					<< "\", \"ns\": " << table.nanoseconds << ", \"instructions\": " << table.instructions << ", \"reads\": "
+					<< table.reads << ", \"writes\": " << table.writes << ", \"invalid_opcodes\": [";
+				for(size_t j = 0; j < table.invalidOpcodes.size(); j++) {
+					std::cout << (j ? ", " : "") << "\"" << hex(table.invalidOpcodes[j]) << "\"";
+				}
+				std::cout << "], \"missing_tables\": " << table.missingTables << "}";
+			}
+			std::cout << "], \"opcodes\": {";
+			bool first = true;
+			for(int op = 0; op < 256; op++) {
+				if(result.opcodes[op]) {
+					std::cout << (first ? "" : ", ") << "\"" << hex(op) << "\": " << result.opcodes[op];
+					first = false;
+				}
+			}
+			std::cout << "}}";
+		}
+
+		std::cout << "\n], \"summary\": {\"roms\": " << results.size() << ", \"threads\": " << threads << ", \"wall_ns\": "
+			<< wallNanoseconds << ", \"cpu_ns\": " << cpuNanoseconds << ", \"instructions\": " << instructions << ", \"statuses\": {";
+		for(auto it = statuses.begin(); it != statuses.end(); it++) {
+			std::cout << (it == statuses.begin() ? "" : ", ") << "\"" << it->first << "\": " << it->second;
+		}
+		std::cout << "}, \"opcodes\": {";
+		bool first = true;
+		for(int op = 0; op < 256; op++) {
+			if(opcodes[op]) {
+				std::cout << (first ? "" : ", ") << "\"" << hex(op) << "\": " << opcodes[op];
+				first = false;
+			}
+		}
+		std::cout << "}, \"invalid_opcode_roms\": {";
+		first = true;
+		for(int op = 0; op < 256; op++) {
+			if(invalidOpcodeRoms[op]) {
+				std::cout << (first ? "" : ", ") << "\"" << hex(op) << "\": " << invalidOpcodeRoms[op];
+				first = false;
+			}
+		}
+		std::cout << "}}}" << std::endl;
+	} else {
+		for(size_t rom = 0; rom < results.size(); rom++) {
+			const CorpusResult& result = results[rom];
+			std::cout << options.filenames[rom] << ": " << result.status;
+			if(!result.tables.empty()) {
+				std::cout << ", " << result.nanoseconds / 1000 << " us, " << result.warnings << " warnings, " << result.errors << " errors";
+			}
+			std::cout << std::endl;
+
+			for(const CorpusTableResult& table : result.tables) {
+				std::cout << "  " << tableName(table.table) << ": " << table.status;
+				if(table.status == std::string("ok")) {
+					std::cout << ", " << table.instructions << " instructions, " << table.nanoseconds / 1000 << " us, "
+						<< table.reads << " reads, " << table.writes << " writes";
+				}
+				for(uint8_t op : table.invalidOpcodes) {
+					std::cout << ", opcode " << hex(op);
+				}
+				if(table.missingTables) {
+					std::cout << ", " << table.missingTables << " missing tables called";
+				}
+				std::cout << std::endl;
+			}
+		}
+
+		std::cout << results.size() << " ROMs on " << threads << " threads in " << wallNanoseconds / 1000000 << " ms ("
+			<< cpuNanoseconds / 1000000 << " ms in the ROMs), " << instructions << " instructions" << std::endl;
+		for(const auto& [status, count] : statuses) {
+			std::cout << "  " << status << ": " << count << std::endl;
+		}
+		std::cout << "opcodes run:";
+		for(int op = 0; op < 256; op++) {
+			if(opcodes[op]) {
+				std::cout << " " << hex(op) << "=" << opcodes[op];
+			}
+		}
+		std::cout << std::endl;
+		for(int op = 0; op < 256; op++) {
+			if(invalidOpcodeRoms[op]) {
+				std::cout << "invalid opcode " << hex(op) << " in " << invalidOpcodeRoms[op] << " ROMs" << std::endl;
+			}
+		}
+	}
+
+	size_t ok = statuses.count("ok") ? statuses["ok"] : 0;
+	return ok == results.size() ? 0 : 1;
+}
+
+struct DiffOptions {
+	std::string oldFilename;
+	std::string newFilename;
+	std::vector<std::string> tables;
+	double threshold = 5;
+	bool json = false;
+};
+
+// What a table did when it was run on a ROM.
+struct TableProfile {
+	// ok, missing or invalid (as in the corpus report).
+	const char* status = "missing";
+	AtomBios::CostCounters counters{};
+	// The tables that ran, including this one.
+	uint64_t tablesRun = 0;
+	// The calls from one table to another, with how often they were made.
+	std::map<std::pair<int, int>, uint64_t> calls;
+	// The indexes that were written (by space), with how often they were written.
+	std::map<std::pair<int, uint32_t>, uint32_t> writes;
+};
+
+// Runs the tables on the ROM, in order, against a card made from config; false if the ROM can not be loaded.
+static bool profileRom(const std::string& filename, const std::vector<int>& tables, const std::string& config,
+		std::vector<TableProfile>& profiles) {
+	std::ifstream fileStream(filename, std::ios::in | std::ios::binary | std::ios::ate);
+	if(!fileStream) {
+		std::cerr << "can not open " << filename << std::endl;
+		return false;
+	}
+	std::vector<uint8_t> data(fileStream.tellg());
+	fileStream.seekg(0, std::ios::beg);
+	fileStream.read((char*)data.data(), data.size());
+	if(!isAtomBios(data.data(), data.size())) {
+		std::cerr << filename << " is not an ATOM BIOS" << std::endl;
+		return false;
+	}
+
+	SimulatedCard romCard;
+	std::string error;
+	romCard.configure(config, error);
+	currentCard = &romCard;
+
+	AtomBios atomBios(data.data(), data.size());
+	std::vector<uint32_t> scratch(20 * 1024 / sizeof(uint32_t));
+	atomBios.setFrameBufferWindow(reinterpret_cast<uint8_t*>(scratch.data()), scratch.size() * sizeof(uint32_t));
+
+	// The tables that are running, outermost first.
+	struct CallGraph {
+		TableProfile* profile;
+		std::vector<int> stack;
+	} graph;
+	atomBios.setTableEntryHook([](AtomBios::CommandTables table, uint32_t depth, void* context) {
+		CallGraph& graph = *static_cast<CallGraph*>(context);
+		if(graph.stack.size() > depth) {
+			graph.stack.resize(depth);
+		}
+		if(!graph.stack.empty()) {
+			graph.profile->calls[{graph.stack.back(), table}]++;
+		}
+		graph.stack.push_back(table);
+		graph.profile->tablesRun++;
+	}, &graph);
+
+	profiles.resize(tables.size());
+	for(size_t i = 0; i < tables.size(); i++) {
+		TableProfile& profile = profiles[i];
+		AtomBios::CommandTables table = static_cast<AtomBios::CommandTables>(tables[i]);
+		if(!atomBios.hasCommand(table)) {
+			continue;
+		}
+		AtomBios::FootprintStats footprint = atomBios.footprintStats(table);
+		if(footprint.invalidOpcodes || footprint.missingTables) {
+			profile.status = "invalid";
+			continue;
+		}
+
+		profile.status = "ok";
+		graph.profile = &profile;
+		graph.stack.clear();
+		romCard.resetCounters();
+
+		std::vector<uint32_t> params(16);
+		atomBios.setCostCounters(&profile.counters);
+		atomBios.runCommand(table, params.data(), params.size());
+		atomBios.setCostCounters(nullptr);
+
+		for(const SimulatedCard::Counter& counter : romCard.counters()) {
+			if(counter.writes) {
+				profile.writes[{static_cast<int>(counter.space), counter.index}] = counter.writes;
+			}
+		}
+	}
+
+	atomBios.setTableEntryHook(nullptr, nullptr);
+	currentCard = &card;
+	return true;
+}
+
+// Runs the same tables on two ROMs, and prints what changed; tables whose counts grew by more than the threshold
+// (in percent) are regressions, and make the result 1.
+static int diffRoms(const DiffOptions& options, const std::string& config) {
+	std::vector<int> tables;
+	for(const std::string& name : options.tables) {
+		int table = findTable(name);
+		if(table < 0) {
+			std::cerr << "unknown command table " << name << std::endl;
+			return 1;
+		}
+		tables.push_back(table);
+	}
+	if(tables.empty()) {
+		tables.push_back(AtomBios::CommandTables::ASIC_Init);
+	}
+
+	std::vector<TableProfile> oldProfiles;
+	std::vector<TableProfile> newProfiles;
+	if(!profileRom(options.oldFilename, tables, config, oldProfiles) || !profileRom(options.newFilename, tables, config, newProfiles)) {
+		return 1;
+	}
+
+	auto hex = [](uint64_t val) {
+		std::ostringstream out;
+		out << "0x" << std::hex << val;
+		return out.str();
+	};
+
+	bool regressed = false;
+	if(options.json) {
+		std::cout << "[";
+	}
+	for(size_t i = 0; i < tables.size(); i++) {
+		const TableProfile& before = oldProfiles[i];
+		const TableProfile& after = newProfiles[i];
+
+		struct Metric {
+			const char* name;
+			uint64_t before;
+			uint64_t after;
+		};
+		auto sum = [](const uint64_t (&counts)[AtomBios::footprintSpaces]) {
+			uint64_t total = 0;
+			for(uint64_t count : counts) {
+				total += count;
+			}
+			return total;
+		};
+		Metric metrics[] = {
+			{"instructions", before.counters.instructions, after.counters.instructions},
+			{"reads", sum(before.counters.reads), sum(after.counters.reads)},
+			{"writes", sum(before.counters.writes), sum(after.counters.writes)},
+			{"delay_us", before.counters.delayMicroseconds, after.counters.delayMicroseconds},
+			{"tables_run", before.tablesRun, after.tablesRun}
+		};
+		bool compared = before.status == std::string("ok") && after.status == std::string("ok");
+		auto regression = [&options, compared](const Metric& metric) {
+			return compared && metric.after > metric.before
+				&& (metric.after - metric.before) * 100.0 > metric.before * options.threshold;
+		};
+
+		// What only one of the ROMs did.
+		std::vector<std::string> callsAdded;
+		std::vector<std::string> callsRemoved;
+		for(const auto& [call, count] : after.calls) {
+			if(!before.calls.count(call)) {
+				callsAdded.push_back(tableName(call.first) + " -> " + tableName(call.second));
+			}
+		}
+		for(const auto& [call, count] : before.calls) {
+			if(!after.calls.count(call)) {
+				callsRemoved.push_back(tableName(call.first) + " -> " + tableName(call.second));
+			}
+		}
+		std::vector<std::string> writesAdded;
+		std::vector<std::string> writesRemoved;
+		for(const auto& [index, count] : after.writes) {
+			if(!before.writes.count(index)) {
+				writesAdded.push_back(std::string(SimulatedCard::spaceName(static_cast<SimulatedCard::Space>(index.first))) + " " + hex(index.second));
+			}
+		}
+		for(const auto& [index, count] : before.writes) {
+			if(!after.writes.count(index)) {
+				writesRemoved.push_back(std::string(SimulatedCard::spaceName(static_cast<SimulatedCard::Space>(index.first))) + " " + hex(index.second));
+			}
+		}
+
+		auto change = [](const Metric& metric) {
+			std::ostringstream out;
+			if(metric.before) {
+				out.precision(1);
+				out << std::fixed << " (" << (metric.after >= metric.before ? "+" : "")
+					<< (static_cast<double>(metric.after) - metric.before) * 100 / metric.before << "%)";
+			}
+			return out.str();
+		};
+
+		if(options.json) {
+			auto list = [](const std::vector<std::string>& strings) {
+				std::string out = "[";
+				for(size_t j = 0; j < strings.size(); j++) {
+					out += (j ? ", " : "") + jsonString(strings[j]);
+				}
+				return out + "]";
+			};
+
+			std::cout << (i ? ",\n" : "\n") << "  {\"table\": \"" << tableName(tables[i]) << "\", \"old_status\": \"" << before.status
+				<< "\", \"new_status\": \"" << after.status << "\"";
+			std::vector<std::string> regressions;
+			for(const Metric& metric : metrics) {
+				std::cout << ", \"" << metric.name << "\": [" << metric.before << ", " << metric.after << "]";
+				if(regression(metric)) {
+					regressions.push_back(metric.name);
+				}
+			}
+			std::cout << ", \"regressions\": " << list(regressions) << ", \"calls_added\": " << list(callsAdded)
+				<< ", \"calls_removed\": " << list(callsRemoved) << ", \"writes_added\": " << list(writesAdded)
+				<< ", \"writes_removed\": " << list(writesRemoved) << "}";
+			regressed = regressed || !regressions.empty();
+			continue;
+		}
+
+		std::cout << tableName(tables[i]);
+		if(!compared) {
+			std::cout << ": " << before.status << " in the old ROM, " << after.status << " in the new ROM" << std::endl;
+			continue;
+		}
+		std::cout << std::endl;
+		for(const Metric& metric : metrics) {
+			bool regresses = regression(metric);
+			regressed = regressed || regresses;
+			std::cout << "  " << metric.name << ": " << metric.before << " -> " << metric.after << change(metric)
+				<< (regresses ? "  REGRESSION" : "") << std::endl;
+		}
+		for(const std::string& call : callsAdded) {
+			std::cout << "  new call: " << call << std::endl;
+		}
+		for(const std::string& call : callsRemoved) {
+			std::cout << "  removed call: " << call << std::endl;
+		}
+		for(const std::string& write : writesAdded) {
+			std::cout << "  new write: " << write << std::endl;
+		}
+		for(const std::string& write : writesRemoved) {
+			std::cout << "  removed write: " << write << std::endl;
+		}
+	}
+	if(options.json) {
+		std::cout << "\n]" << std::endl;
+	}
+	return regressed ? 1 : 0;
+}
+
+// Parses a watch of --watch: <space>:<first>[-<last>][:r|w|rw], where space is reg, pll or mc.
+static bool parseWatch(const std::string& text, AtomBios::Watch& watch) {
+	size_t colon = text.find(':');
+	if(colon == std::string::npos) {
+		return false;
+	}
+	std::string space = text.substr(0, colon);
+	if(space == "reg") {
+		watch.space = AtomBios::FootprintSpace::Reg;
+	} else if(space == "pll") {
+		watch.space = AtomBios::FootprintSpace::PLL;
+	} else if(space == "mc") {
+		watch.space = AtomBios::FootprintSpace::MC;
+	} else {
+		return false;
+	}
+
+	std::string range = text.substr(colon + 1);
+	std::string access = "rw";
+	colon = range.find(':');
+	if(colon != std::string::npos) {
+		access = range.substr(colon + 1);
+		range.resize(colon);
+	}
+	if(access != "r" && access != "w" && access != "rw") {
+		return false;
+	}
+	watch.reads = access != "w";
+	watch.writes = access != "r";
+
+	char* end;
+	errno = 0;
+	unsigned long first = strtoul(range.c_str(), &end, 0);
+	unsigned long last = first;
+	if(*end == '-') {
+		last = strtoul(end + 1, &end, 0);
+	}
+	if(range.empty() || *end || errno || first > UINT32_MAX || last > UINT32_MAX) {
+		return false;
+	}
+	watch.first = first;
+	watch.last = last;
+	return true;
+}
+
+struct CoverageOptions {
+	std::vector<std::string> filenames;
+	std::string output;
+	bool details = false;
+};
+
+// Merges coverage files from --coverage, and prints how much of each table ran.
+static int printCoverage(const CoverageOptions& options) {
+	CoverageFile coverage;
+	for(const std::string& filename : options.filenames) {
+		std::ifstream file(filename);
+		if(!file) {
+			std::cerr << "can not open " << filename << std::endl;
+			return 1;
+		}
+		std::stringstream contents;
+		contents << file.rdbuf();
+
+		std::string error;
+		if(!coverage.read(contents.str(), error)) {
+			std::cerr << filename << ": " << error << std::endl;
+			return 1;
+		}
+	}
+
+	if(!options.output.empty()) {
+		std::ofstream out(options.output);
+		coverage.write(out);
+		if(!out) {
+			std::cerr << "can not write " << options.output << std::endl;
+			return 1;
+		}
+	}
+
+	auto percent = [](uint64_t part, uint64_t whole) {
+		std::ostringstream out;
+		out.precision(1);
+		out << std::fixed << (whole ? static_cast<double>(part) * 100 / whole : 100.0) << "%";
+		return out.str();
+	};
+
+	uint64_t instructions = 0;
+	uint64_t instructionsRun = 0;
+	uint64_t directions = 0;
+	uint64_t directionsTaken = 0;
+	uint32_t tablesNotRun = 0;
+	for(const auto& [key, table] : coverage.tables()) {
+		instructions += table.instructions();
+		instructionsRun += table.instructionsRun();
+		directions += table.directions();
+		directionsTaken += table.directionsTaken();
+		if(!table.instructionsRun()) {
+			tablesNotRun++;
+			continue;
+		}
+
+		std::cout << std::hex << "table 0x" << table.index << " (" << tableName(table.index) << ", bytecode 0x"
+			<< table.hash << ")" << std::dec << ": " << table.instructionsRun() << " of " << table.instructions()
+			<< " instructions (" << percent(table.instructionsRun(), table.instructions()) << "), "
+			<< table.directionsTaken() << " of " << table.directions() << " branch directions ("
+			<< percent(table.directionsTaken(), table.directions()) << ")" << std::endl;
+		if(!options.details) {
+			continue;
+		}
+
+		std::cout << std::hex;
+		bool printed = false;
+		for(uint32_t offset = 0; offset < table.size; offset++) {
+			if(((table.reachable[offset / 8] & ~table.ran[offset / 8]) >> (offset % 8)) & 1) {
+				std::cout << (printed ? " 0x" : "  not run: 0x") << offset;
+				printed = true;
+			}
+		}
+		if(printed) {
+			std::cout << std::endl;
+		}
+		for(const auto& [offset, jump] : table.jumps) {
+			if(!jump.taken || !jump.notTaken) {
+				std::cout << "  jump 0x" << offset << ": " << (jump.taken ? "always" : jump.notTaken ? "never" : "not") << " taken" << std::endl;
+			}
+		}
+		for(const auto& [caseKey, hits] : table.cases) {
+			if(!hits) {
+				std::cout << "  switch 0x" << caseKey.first << ": case 0x" << caseKey.second << " not taken" << std::endl;
+			}
+		}
+		for(const auto& [offset, hits] : table.fallthroughs) {
+			if(!hits) {
+				std::cout << "  switch 0x" << offset << ": fallthrough not taken" << std::endl;
+			}
+		}
+		std::cout << std::dec;
+	}
+	std::cout << "total: " << instructionsRun << " of " << instructions << " instructions ("
+		<< percent(instructionsRun, instructions) << "), " << directionsTaken << " of " << directions
+		<< " branch directions (" << percent(directionsTaken, directions) << "), " << tablesNotRun
+		<< " tables never ran" << std::endl;
+	return 0;
+}
+
+// Set if the tool was built with translated tables (the aot_sources option).
+extern const AtomBiosAot::Module atombios_aot_module [[gnu::weak]];
+
 int main(int argc, char** argv) {
 	std::string filename{};
 	bool asic_init = false;
+	std::string optimize = "off";
+	std::string jit = "off";
+	uint32_t jitThreshold = 1;
+	std::string translate{};
+	bool aot = false;
+	uint32_t memoize = 0;
+	bool footprints = false;
+	bool replay = false;
+	std::string trace{};
+	bool dumpTraceInput = false;
+	std::string traceFormat = "text";
+	int64_t traceInvocation = -1;
+	std::string timeline{};
+	std::string timelineClock = "real";
+	uint32_t accessNanoseconds = 1000;
+	std::string cardConfig{};
+	bool logAccesses = false;
+	bool accessCounts = false;
+	std::string coverageFile{};
+	std::vector<std::string> watchSpecs;
+	uint32_t postedWrites = 0;
 
 	CLI::App app{"atombios"};
 	argv = app.ensure_utf8(argv);
 
-	app.add_option("input", filename)->required();
+	app.add_option("input", filename);
 	app.add_flag("-a,--asic_init", asic_init, "Dump ASIC_Init");
+	app.add_option("-O,--optimize", optimize, "Optimizer mode: off, on or self-check");
+	app.add_option("-j,--jit", jit, "JIT mode: off, on or differential");
+	app.add_option("--jit-threshold", jitThreshold, "Runs before a table is compiled");
+	app.add_option("-t,--translate", translate, "Translate the tables into C++ (for the aot_sources option)");
+	app.add_flag("--aot", aot, "Run the tables that were translated ahead of time");
+	app.add_option("-m,--memoize", memoize, "Cached results per pure table (0 disables memoization)");
+	app.add_flag("-f,--footprints", footprints, "Print the registers, PLL and MC indexes each table may access");
+	app.add_flag("-r,--replay", replay, "Record ASIC_Init, and replay it from the same state");
+	app.add_option("--trace", trace, "Write a binary trace of ASIC_Init to the file");
+	app.add_flag("--dump-trace", dumpTraceInput, "The input is a binary trace from --trace; print it");
+	app.add_option("--trace-format", traceFormat, "Format of --dump-trace: text or json");
+	app.add_option("--trace-invocation", traceInvocation, "Print only this table invocation of the trace, counting from 0");
+	app.add_option("--timeline", timeline, "Write the tables ASIC_Init runs to the file, as Chrome trace event JSON");
+	app.add_option("--timeline-clock", timelineClock, "Clock of the timeline: real, or simulated from the accesses and delays");
+	app.add_option("--access-ns", accessNanoseconds, "Simulated clock: nanoseconds per register, PLL or MC access");
+
+	app.add_option("--card", cardConfig, "Configuration of the simulated card (see simulated-card.hpp)");
+	app.add_flag("--log-accesses", logAccesses, "Print every register, PLL and MC access");
+	app.add_flag("--access-counts", accessCounts, "Print how often each register, PLL and MC index was accessed");
+	app.add_option("--coverage", coverageFile, "Write the coverage of the tables ASIC_Init runs to the file");
+	app.add_option("--posted-writes", postedWrites, "Post the card writes of ASIC_Init into a queue of this depth, drained by an I/O thread");
+	app.add_option("--write-latency", writeLatencyMicroseconds, "Microseconds each card write takes");
+	app.add_option("--watch", watchSpecs, "Print the accesses to these indexes: <reg|pll|mc>:<first>[-<last>][:r|w|rw]");
+
+	BenchOptions benchOptions;
+	CLI::App* bench = app.add_subcommand("bench", "Run a command table repeatedly, and print its latency and work per run");
+	bench->add_option("input", benchOptions.filename)->required();
+	bench->add_option("table", benchOptions.table, "Name or index of the command table")->required();
+	bench->add_option("params", benchOptions.params, "Parameter space dwords (the rest are 0)");
+	bench->add_option("-n,--runs", benchOptions.runs, "Measured runs");
+	bench->add_option("--warmup", benchOptions.warmup, "Runs before the measured ones");
+	bench->add_flag("--json", benchOptions.json, "Print the results as JSON");
+	bench->add_option("-O,--optimize", benchOptions.optimize, "Optimizer mode: off, on or self-check");
+	bench->add_option("-j,--jit", benchOptions.jit, "JIT mode: off or on");
+	bench->add_option("--jit-threshold", benchOptions.jitThreshold, "Runs before a table is compiled");
+	bench->add_option("--card", cardConfig, "Configuration of the simulated card (see simulated-card.hpp)");
+
+	CostOptions costOptions;
+	CLI::App* cost = app.add_subcommand("cost", "Estimate how long tables take on hardware, from the bytecode or from a run");
+	cost->add_option("input", costOptions.filename)->required();
+	cost->add_option("tables", costOptions.tables, "Names or indexes of the command tables (default: all)");
+	cost->add_flag("--run", costOptions.run, "Also run each table against the simulated card, and measure its cost");
+	cost->add_flag("--json", costOptions.json, "Print the results as JSON");
+	cost->add_option("--instruction-ns", costOptions.instructionNanoseconds, "Nanoseconds per instruction");
+	cost->add_option("--reg-ns", costOptions.regNanoseconds, "Nanoseconds per register access");
+	cost->add_option("--pll-ns", costOptions.pllNanoseconds, "Nanoseconds per PLL access");
+	cost->add_option("--mc-ns", costOptions.mcNanoseconds, "Nanoseconds per MC access");
+	cost->add_option("--fb-ns", costOptions.fbNanoseconds, "Nanoseconds per FB access");
+	cost->add_option("--card", cardConfig, "Configuration of the simulated card (see simulated-card.hpp)");
+
+	DiffOptions diffOptions;
+	CLI::App* diff = app.add_subcommand("diff", "Run the same tables on two ROMs, and print what changed (1 if anything regressed)");
+	diff->add_option("old", diffOptions.oldFilename)->required();
+	diff->add_option("new", diffOptions.newFilename)->required();
+	diff->add_option("-t,--table", diffOptions.tables, "Name or index of a table to run, in order (default: ASIC_Init)");
+	diff->add_option("--threshold", diffOptions.threshold, "Growth in percent above which a count has regressed");
+	diff->add_flag("--json", diffOptions.json, "Print the results as JSON");
+	diff->add_option("--card", cardConfig, "Configuration of the simulated card (see simulated-card.hpp)");
+
+	CorpusOptions corpusOptions;
+	CLI::App* corpus = app.add_subcommand("corpus", "Run tables of many ROMs on a thread pool, and print a report");
+	corpus->add_option("inputs", corpusOptions.filenames, "ROM files")->required();
+	corpus->add_option("-t,--table", corpusOptions.tables, "Name or index of a table to run, in order (default: ASIC_Init)");
+	corpus->add_option("--threads", corpusOptions.threads, "Worker threads (default: one per core)");
+	corpus->add_flag("--json", corpusOptions.json, "Print the report as JSON");
+	corpus->add_option("-O,--optimize", corpusOptions.optimize, "Optimizer mode: off or on");
+	corpus->add_option("--card", cardConfig, "Configuration of the simulated card (see simulated-card.hpp)");
+
+	CoverageOptions coverageOptions;
+	CLI::App* coverage = app.add_subcommand("coverage", "Merge coverage files from --coverage, and print how much of each table ran");
+	coverage->add_option("inputs", coverageOptions.filenames, "Coverage files")->required();
+	coverage->add_option("-o,--output", coverageOptions.output, "Write the merged coverage to the file");
+	coverage->add_flag("--details", coverageOptions.details, "Also print the instructions that did not run, and the branches not taken");
 
 	CLI11_PARSE(app, argc, argv);
 
+	if(!*bench && !*cost && !*corpus && !*diff && !*coverage && filename.empty()) {
+		std::cerr << "input is required" << std::endl;
+		return 1;
+	}
+
+	if(dumpTraceInput) {
+		return dumpTrace(filename, traceFormat, traceInvocation);
+	}
+	if(*coverage) {
+		return printCoverage(coverageOptions);
+	}
+
+	std::string config = defaultCardConfig;
+	{
+		if(!cardConfig.empty()) {
+			std::ifstream file(cardConfig);
+			if(!file) {
+				std::cerr << "can not open " << cardConfig << std::endl;
+				return 1;
+			}
+			std::stringstream contents;
+			contents << file.rdbuf();
+			config = contents.str();
+		}
+
+		std::string error;
+		if(!card.configure(config, error)) {
+			std::cerr << (cardConfig.empty() ? "default card" : cardConfig) << ": " << error << std::endl;
+			return 1;
+		}
+		card.setLogAccesses(logAccesses);
+	}
+
+	if(*bench) {
+		return benchTable(benchOptions);
+	}
+	if(*cost) {
+		return printCosts(costOptions);
+	}
+	if(*corpus) {
+		return runCorpus(corpusOptions, config);
+	}
+	if(*diff) {
+		return diffRoms(diffOptions, config);
+	}
+
 	std::ifstream fileStream(filename, std::ios::in | std::ios::binary | std::ios::ate);
 	size_t fileSize = fileStream.tellg();
 	fileStream.seekg(0, std::ios::beg);
 
+	if(aot && !&atombios_aot_module) {
+		std::cerr << "no translated tables were built into this tool" << std::endl;
+		return 1;
+	}
+
+	if(!translate.empty()) {
+		std::vector<uint8_t> data;
+		data.resize(fileSize);
+		fileStream.read((char*)data.data(), fileSize);
+
+		AtomBios atomBios(data.data(), data.size());
+		if(optimize == "on") {
+			atomBios.setOptimizerMode(AtomBios::OptimizerMode::On);
+		}
+
+		std::ofstream out(translate);
+		atomBios.translateToCpp("atombios_aot_module", [](const char* str, size_t size, void* context) {
+			static_cast<std::ofstream*>(context)->write(str, size);
+		}, &out);
+	}
+
+	if(footprints) {
+		std::vector<uint8_t> data;
+		data.resize(fileSize);
+		fileStream.seekg(0, std::ios::beg);
+		fileStream.read((char*)data.data(), fileSize);
+
+		AtomBios atomBios(data.data(), data.size());
+		const char* spaceNames[] = {"reg", "PLL", "MC", "FB"};
+		for(int table = AtomBios::CommandTables::ASIC_Init; table <= AtomBios::CommandTables::GetVoltageInfo; table++) {
+			AtomBios::FootprintStats stats = atomBios.footprintStats(static_cast<AtomBios::CommandTables>(table));
+
+			bool printed = false;
+			for(int space = 0; space < AtomBios::footprintSpaces; space++) {
+				for(bool write : {false, true}) {
+					uint32_t count = write ? stats.writes[space] : stats.reads[space];
+					bool any = write ? stats.writesAny[space] : stats.readsAny[space];
+					if(!count && !any) {
+						continue;
+					}
+
+					std::vector<uint32_t> indexes(count);
+					atomBios.footprintIndexes(static_cast<AtomBios::CommandTables>(table), static_cast<AtomBios::FootprintSpace>(space),
+						write, indexes.data(), indexes.size());
+
+					std::cout << (printed ? " " : "table ") << (printed ? "" : std::to_string(table) + ": ")
+						<< spaceNames[space] << (write ? " writes" : " reads") << " {" << std::hex;
+					for(size_t i = 0; i < indexes.size(); i++) {
+						std::cout << (i ? " " : "") << indexes[i];
+					}
+					std::cout << std::dec << (any ? (indexes.empty() ? "any" : " any") : "") << "}";
+					printed = true;
+				}
+			}
+			if(printed) {
+				std::cout << std::endl;
+			}
+		}
+	}
+
 	if(asic_init) {
 		std::vector<uint8_t> data;
 		data.resize(fileSize);
+		fileStream.seekg(0, std::ios::beg);
 		fileStream.read((char*)data.data(), fileSize);
 		fileStream.close();
 
 		AtomBios atomBios(data.data(), data.size());
 
+		if(optimize == "on") {
+			atomBios.setOptimizerMode(AtomBios::OptimizerMode::On);
+		} else if(optimize == "self-check") {
+			atomBios.setOptimizerMode(AtomBios::OptimizerMode::SelfCheck);
+		} else if(optimize != "off") {
+			std::cerr << "unknown optimizer mode " << optimize << std::endl;
+			return 1;
+		}
+
+		if(aot) {
+			atomBios.setAotModule(&atombios_aot_module);
+		}
+
+		if(jit == "on") {
+			atomBios.setJitMode(AtomBios::JitMode::On, jitThreshold);
+		} else if(jit == "differential") {
+			atomBios.setJitMode(AtomBios::JitMode::Differential, jitThreshold);
+		} else if(jit != "off") {
+			std::cerr << "unknown JIT mode " << jit << std::endl;
+			return 1;
+		}
+
+		atomBios.setMemoization(memoize);
+		atomBios.setCoverage(!coverageFile.empty());
+
+		std::vector<AtomBios::Watch> watches(watchSpecs.size());
+		for(size_t i = 0; i < watchSpecs.size(); i++) {
+			if(!parseWatch(watchSpecs[i], watches[i])) {
+				std::cerr << "invalid watch " << watchSpecs[i] << std::endl;
+				return 1;
+			}
+		}
+		bool watched = atomBios.setWatches(watches.data(), watches.size(),
+			[](AtomBios::FootprintSpace space, bool write, uint32_t index, uint32_t val, void*) {
+				const char* spaceNames[] = {"reg", "pll", "mc"};
+				printf("watch: %s %s %x = %x\n", spaceNames[static_cast<int>(space)], write ? "write" : "read", index, val);
+			}, nullptr);
+		if(!watched) {
+			std::cerr << "the watched indexes of a space span more than 0x" << std::hex << AtomBios::maxWatchSpan << std::dec
+				<< " indexes" << std::endl;
+			return 1;
+		}
+
+		// Back the FB space with a plain buffer, sized like the scratch area the linux driver reserves.
+		std::vector<uint32_t> scratch(20 * 1024 / sizeof(uint32_t));
+		atomBios.setFrameBufferWindow(reinterpret_cast<uint8_t*>(scratch.data()), scratch.size() * sizeof(uint32_t));
+
+		std::ofstream traceStream;
+		if(!trace.empty()) {
+			traceStream.open(trace, std::ios::out | std::ios::binary);
+			atomBios.setTraceWriter([](const uint8_t* data, size_t size, void* context) {
+				static_cast<std::ofstream*>(context)->write(reinterpret_cast<const char*>(data), size);
+			}, &traceStream, 64 * 1024);
+		}
+
+		std::vector<AtomBios::TableSpan> spans;
+		if(!timeline.empty()) {
+			uint64_t (*clock)(void* context) = nullptr;
+			if(timelineClock == "real") {
+				clock = [](void*) -> uint64_t {
+					return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+				};
+			} else if(timelineClock != "simulated") {
+				std::cerr << "unknown timeline clock " << timelineClock << std::endl;
+				return 1;
+			}
+
+			atomBios.setTimeline([](const AtomBios::TableSpan& span, void* context) {
+				static_cast<std::vector<AtomBios::TableSpan>*>(context)->push_back(span);
+			}, clock, accessNanoseconds, &spans);
+		}
+
+		std::atomic<bool> stopIOThread = false;
+		std::thread ioThread;
+		if(postedWrites) {
+			atomBios.setPostedWrites(postedWrites, [](void*) {
+				std::this_thread::yield();
+			}, nullptr);
+			ioThread = std::thread([&atomBios, &stopIOThread] {
+				while(!stopIOThread.load(std::memory_order_relaxed)) {
+					if(!atomBios.drainPostedWrites(64)) {
+						std::this_thread::yield();
+					}
+				}
+			});
+		}
+
 		//std::vector<uint32_t> params = {0xAABBCCDD, 0xEEFF0011};
 		std::vector<uint32_t> params = {0, 0};
-		atomBios.runCommand(AtomBios::CommandTables::ASIC_Init, params.data(), params.size());
+		if(replay) {
+			// Like a resume, which runs ASIC_Init again.
+			AtomBios::Snapshot* startState = atomBios.takeSnapshot();
+			std::vector<uint32_t> startScratch = scratch;
+			AtomBios::Recording* recording = atomBios.recordCommand(AtomBios::CommandTables::ASIC_Init, params.data(), params.size());
+
+			atomBios.restoreSnapshot(startState, params.data(), params.size());
+			std::copy(startScratch.begin(), startScratch.end(), scratch.begin());
+			params = {0, 0};
+			bool replayed = atomBios.replayCommand(recording, params.data(), params.size());
+			std::cout << "ASIC_Init replay: " << (replayed ? "replayed" : "ran the bytecode") << std::endl;
+
+			atomBios.freeRecording(recording);
+			atomBios.freeSnapshot(startState);
+		} else {
+			atomBios.runCommand(AtomBios::CommandTables::ASIC_Init, params.data(), params.size());
+		}
+
+		if(postedWrites) {
+			// The runs return with the queue drained.
+			stopIOThread = true;
+			ioThread.join();
 
-		std::cout << "Read register log:" << std::endl;
-		for(auto const& [reg, count] : readRegisterLog) {
-			std::cout << std::hex << reg << ": " << std::dec << count << std::endl;
+			AtomBios::PostedWriteStats stats = atomBios.postedWriteStats();
+			std::cout << "posted writes: " << stats.writes << " (average depth "
+				<< (stats.writes ? static_cast<double>(stats.depthSum) / stats.writes : 0) << ", max " << stats.maxDepth
+				<< "), " << stats.fullStalls << " stalls on a full queue, " << stats.drainStalls
+				<< " waits for the queue to drain, " << stats.waitCalls << " waits" << std::endl;
+			atomBios.setPostedWrites(0, nullptr, nullptr);
 		}
+		if(!trace.empty()) {
+			atomBios.setTraceWriter(nullptr, nullptr, 0);
+		}
+		if(!timeline.empty()) {
+			atomBios.setTimeline(nullptr, nullptr, 0, nullptr);
 
-		std::cout << "Write register log:" << std::endl;
-		for(auto const& [reg, count] : writeRegisterLog) {
-			std::cout << std::hex << reg << ": " << std::dec << count << std::endl;
+			// The real clock starts anywhere.
+			uint64_t start = UINT64_MAX;
+			for(const AtomBios::TableSpan& span : spans) {
+				start = std::min(start, span.begin);
+			}
+			for(AtomBios::TableSpan& span : spans) {
+				span.begin -= start;
+				span.end -= start;
+			}
+			writeTimeline(timeline, spans);
+		}
+		if(!coverageFile.empty()) {
+			CoverageFile coverage;
+			coverage.add(atomBios);
+			std::ofstream out(coverageFile);
+			coverage.write(out);
+		}
+
+		std::cout << "card accesses: " << card.reads() << " reads, " << card.writes() << " writes" << std::endl;
+		if(accessCounts) {
+			card.printCounters(std::cout);
 		}
 
 		std::cout << "psMax: " << atomBios.maxPSIndex() << std::endl;
 		std::cout << "wsMax: " << atomBios.maxWSIndex() << std::endl;
+
+		AtomBios::FusionStats fusionStats = atomBios.fusionStats(AtomBios::CommandTables::ASIC_Init);
+		std::cout << "ASIC_Init superinstructions: " << fusionStats.superinstructions
+			<< " (covering " << fusionStats.fusedInstructions << " of " << fusionStats.instructions << " instructions, run "
+			<< fusionStats.superinstructionsRun << " times)" << std::endl;
+
+		AtomBios::OptimizerStats optimizerStats = atomBios.optimizerStats(AtomBios::CommandTables::ASIC_Init);
+		std::cout << "ASIC_Init optimizer: " << optimizerStats.foldedRegBlocks << " reg blocks folded, "
+			<< optimizerStats.forwardedSources << " sources forwarded, " << optimizerStats.deadStores << " dead stores, "
+			<< optimizerStats.reducedDivisions << " divisions reduced" << std::endl;
+		if(jit != "off" || aot) {
+			AtomBios::JitStats jitStats = atomBios.jitStats(AtomBios::CommandTables::ASIC_Init);
+			std::cout << "ASIC_Init JIT: " << (jitStats.translated ? "translated" : jitStats.compiled ? "compiled" : "not compiled") << " (" << jitStats.codeSize
+				<< " bytes, " << jitStats.nativeRuns << " of " << jitStats.runs << " runs native)" << std::endl;
+		}
+		if(memoize) {
+			uint32_t pure = 0;
+			uint32_t hits = 0;
+			uint32_t misses = 0;
+			for(int table = AtomBios::CommandTables::ASIC_Init; table <= AtomBios::CommandTables::GetVoltageInfo; table++) {
+				AtomBios::MemoStats memoStats = atomBios.memoStats(static_cast<AtomBios::CommandTables>(table));
+				pure += memoStats.pure;
+				hits += memoStats.hits;
+				misses += memoStats.misses;
+			}
+			std::cout << "memoization: " << pure << " pure tables run, " << hits << " hits, " << misses << " misses" << std::endl;
+		}
+		if(jit == "differential") {
+			std::cout << "JIT mismatches: " << atomBios.jitMismatches() << std::endl;
+		}
+		if(optimize == "self-check") {
+			std::cout << "self-check mismatches: " << atomBios.selfCheckMismatches() << std::endl;
+		}
 	}
 }
@@ -0,0 +1,222 @@
+#include "simulated-card.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sstream>
+
+namespace {
+
+const char* spaceNames[] = {"reg", "pll", "mc"};
+
+bool parseNumber(const std::string& token, uint32_t& val) {
+	char* end;
+	errno = 0;
+	unsigned long long parsed = strtoull(token.c_str(), &end, 0);
+	if(token.empty() || *end || errno || parsed > UINT32_MAX) {
+		return false;
+	}
+	val = parsed;
+	return true;
+}
+
+bool parseSpace(const std::string& token, SimulatedCard::Space& space) {
+	for(int i = 0; i < SimulatedCard::spaces; i++) {
+		if(token == spaceNames[i]) {
+			space = static_cast<SimulatedCard::Space>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace anonymous
+
+SimulatedCard::SimulatedCard() = default;
+SimulatedCard::~SimulatedCard() = default;
+
+SimulatedCard::Page& SimulatedCard::_newPage(Space space, uint32_t i) {
+	std::vector<std::unique_ptr<Page>>& pages = _pages[static_cast<int>(space)];
+	if(i >= pages.size()) {
+		pages.resize(i + 1);
+	}
+
+	pages[i] = std::make_unique<Page>();
+	Page& page = *pages[i];
+	for(uint32_t offset = 0; offset < pageSize; offset++) {
+		page.values[offset] = _defaults[static_cast<int>(space)];
+		page.reads[offset] = 0;
+		page.writes[offset] = 0;
+		page.rules[offset] = noRule;
+	}
+	return page;
+}
+
+void SimulatedCard::_applyRules(Page& page, uint32_t offset, bool write) {
+	for(uint32_t i = page.rules[offset]; i != noRule; i = _rules[i].next) {
+		Rule& rule = _rules[i];
+		if(write && !rule.onWrites) {
+			// Reads are counted from the last write.
+			rule.count = 0;
+			continue;
+		}
+		if(rule.onWrites != write || rule.count >= rule.after) {
+			continue;
+		}
+
+		if(++rule.count == rule.after) {
+			page.values[offset] = (page.values[offset] | rule.set) & ~rule.clear;
+		}
+	}
+}
+
+uint32_t SimulatedCard::read(Space space, uint32_t index) {
+	Page& page = _page(space, index);
+	uint32_t offset = index & (pageSize - 1);
+
+	uint32_t val = page.values[offset];
+	page.reads[offset]++;
+	_reads++;
+	if(page.rules[offset] != noRule) {
+		_applyRules(page, offset, false);
+	}
+
+	if(_logAccesses) {
+		printf("card: %s read %x = %x\n", spaceNames[static_cast<int>(space)], index, val);
+	}
+	return val;
+}
+
+void SimulatedCard::write(Space space, uint32_t index, uint32_t val) {
+	Page& page = _page(space, index);
+	uint32_t offset = index & (pageSize - 1);
+
+	page.values[offset] = val;
+	page.writes[offset]++;
+	_writes++;
+	if(page.rules[offset] != noRule) {
+		_applyRules(page, offset, true);
+	}
+
+	if(_logAccesses) {
+		printf("card: %s write %x = %x\n", spaceNames[static_cast<int>(space)], index, val);
+	}
+}
+
+bool SimulatedCard::configure(const std::string& config, std::string& error) {
+	std::istringstream in(config);
+	std::string text;
+	for(int number = 1; std::getline(in, text); number++) {
+		size_t comment = text.find_first_of(";#");
+		if(comment != std::string::npos) {
+			text.resize(comment);
+		}
+
+		std::istringstream line(text);
+		std::vector<std::string> tokens;
+		for(std::string token; line >> token;) {
+			tokens.push_back(token);
+		}
+		if(tokens.empty()) {
+			continue;
+		}
+
+		auto fail = [&error, number](const std::string& message) {
+			error = "line " + std::to_string(number) + ": " + message;
+			return false;
+		};
+
+		Space space;
+		uint32_t index;
+		uint32_t val;
+		if(tokens[0] == "default") {
+			if(tokens.size() != 3 || !parseSpace(tokens[1], space) || !parseNumber(tokens[2], val)) {
+				return fail("expected default <space> <value>");
+			}
+			if(!_pages[static_cast<int>(space)].empty()) {
+				return fail("the default of a space comes before its indexes");
+			}
+			_defaults[static_cast<int>(space)] = val;
+			continue;
+		}
+
+		if(tokens.size() < 2 || !parseSpace(tokens[0], space) || !parseNumber(tokens[1], index)) {
+			return fail("expected <space> <index>");
+		}
+		Page& page = _page(space, index);
+		uint32_t offset = index & (pageSize - 1);
+
+		if(tokens.size() == 4 && tokens[2] == "=") {
+			if(!parseNumber(tokens[3], val)) {
+				return fail("invalid value " + tokens[3]);
+			}
+			page.values[offset] = val;
+			continue;
+		}
+
+		uint32_t after;
+		if(tokens.size() != 7 || tokens[2] != "after" || !parseNumber(tokens[3], after) || !after
+				|| (tokens[4] != "reads" && tokens[4] != "writes") || (tokens[5] != "set" && tokens[5] != "clear")
+				|| !parseNumber(tokens[6], val)) {
+			return fail("expected <space> <index> = <value>, or <space> <index> after <n> reads|writes set|clear <mask>");
+		}
+
+		Rule rule{};
+		rule.onWrites = tokens[4] == "writes";
+		rule.after = after;
+		(tokens[5] == "set" ? rule.set : rule.clear) = val;
+		rule.next = page.rules[offset];
+		page.rules[offset] = _rules.size();
+		_rules.push_back(rule);
+	}
+	return true;
+}
+
+const char* SimulatedCard::spaceName(Space space) {
+	return spaceNames[static_cast<int>(space)];
+}
+
+std::vector<SimulatedCard::Counter> SimulatedCard::counters() const {
+	std::vector<Counter> counters;
+	for(int space = 0; space < spaces; space++) {
+		const std::vector<std::unique_ptr<Page>>& pages = _pages[space];
+		for(size_t i = 0; i < pages.size(); i++) {
+			if(!pages[i]) {
+				continue;
+			}
+			for(uint32_t offset = 0; offset < pageSize; offset++) {
+				const Page& page = *pages[i];
+				if(!page.reads[offset] && !page.writes[offset]) {
+					continue;
+				}
+				counters.push_back(Counter{static_cast<Space>(space), static_cast<uint32_t>((i << pageShift) | offset),
+					page.reads[offset], page.writes[offset]});
+			}
+		}
+	}
+	return counters;
+}
+
+void SimulatedCard::printCounters(std::ostream& out) const {
+	for(const Counter& counter : counters()) {
+		out << spaceName(counter.space) << " " << std::hex << counter.index << std::dec << ": "
+			<< counter.reads << " reads, " << counter.writes << " writes\n";
+	}
+}
+
+void SimulatedCard::resetCounters() {
+	for(int space = 0; space < spaces; space++) {
+		for(std::unique_ptr<Page>& page : _pages[space]) {
+			if(!page) {
+				continue;
+			}
+			for(uint32_t offset = 0; offset < pageSize; offset++) {
+				page->reads[offset] = 0;
+				page->writes[offset] = 0;
+			}
+		}
+	}
+	_reads = 0;
+	_writes = 0;
+}
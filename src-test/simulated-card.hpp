@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// A simulated card for the tool: the registers, PLL and MC indexes are kept in paged stores, along with how often
+// each was read and written, so that tables run without real hardware and at the speed of the interpreter.
+//
+// What the card holds at the start, and how it reacts to accesses, is given by a configuration:
+//   default <space> <value>                          unwritten indexes of the space read as value (0 otherwise)
+//   <space> <index> = <value>                        the index holds value
+//   <space> <index> after <n> reads|writes set|clear <mask>
+//                                                    the bits in mask are set or cleared after the index was read
+//                                                    (or written) n times; for reads, counting from its last write
+// where space is reg, pll or mc. ';' and '#' start comments.
+class SimulatedCard {
+public:
+	enum class Space : uint8_t {
+		Reg = 0,
+		PLL,
+		MC
+	};
+	static constexpr int spaces = 3;
+
+	SimulatedCard();
+	~SimulatedCard();
+
+	// Adds the configuration to what the card holds; on failure, error holds the line and what is wrong with it.
+	bool configure(const std::string& config, std::string& error);
+
+	uint32_t read(Space space, uint32_t index);
+	void write(Space space, uint32_t index, uint32_t val);
+
+	// Prints every access to stdout.
+	void setLogAccesses(bool log) { _logAccesses = log; }
+
+	// The accesses over all indexes.
+	uint64_t reads() const { return _reads; }
+	uint64_t writes() const { return _writes; }
+
+	struct Counter {
+		Space space;
+		uint32_t index;
+		uint32_t reads;
+		uint32_t writes;
+	};
+	// The indexes that were accessed, ordered by space and index.
+	std::vector<Counter> counters() const;
+	// Prints the indexes that were accessed, with their counts.
+	void printCounters(std::ostream& out) const;
+	void resetCounters();
+
+	static const char* spaceName(Space space);
+
+private:
+	static constexpr int pageShift = 10;
+	static constexpr uint32_t pageSize = 1 << pageShift;
+	static constexpr uint32_t noRule = UINT32_MAX;
+
+	struct Page {
+		uint32_t values[pageSize];
+		uint32_t reads[pageSize];
+		uint32_t writes[pageSize];
+		// The first rule of each index, or noRule.
+		uint32_t rules[pageSize];
+	};
+
+	struct Rule {
+		bool onWrites;
+		uint32_t after;
+		uint32_t set;
+		uint32_t clear;
+		// Accesses since the rule was armed.
+		uint32_t count;
+		// The next rule of the same index.
+		uint32_t next;
+	};
+
+	Page& _page(Space space, uint32_t index) {
+		std::vector<std::unique_ptr<Page>>& pages = _pages[static_cast<int>(space)];
+		uint32_t i = index >> pageShift;
+		if(i < pages.size() && pages[i]) {
+			return *pages[i];
+		}
+		return _newPage(space, i);
+	}
+	Page& _newPage(Space space, uint32_t i);
+	void _applyRules(Page& page, uint32_t offset, bool write);
+
+	std::vector<std::unique_ptr<Page>> _pages[spaces];
+	uint32_t _defaults[spaces] = {};
+	std::vector<Rule> _rules;
+
+	bool _logAccesses = false;
+	uint64_t _reads = 0;
+	uint64_t _writes = 0;
+};
@@ -0,0 +1,682 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Ahead-of-time translation of command tables and IIO functions into C++.
+// The decoded form of a command is translated the same way the JIT translates it; jumps become gotos,
+// and SWITCH becomes a C++ switch. The generated code reaches libatombios through AtomBiosAot only.
+
+static_assert(AtomBiosAot::Reg == static_cast<uint32_t>(OpcodeArgEncoding::Reg));
+static_assert(AtomBiosAot::WorkSpace == static_cast<uint32_t>(OpcodeArgEncoding::WorkSpace));
+static_assert(AtomBiosAot::FrameBuffer == static_cast<uint32_t>(OpcodeArgEncoding::FrameBuffer));
+static_assert(AtomBiosAot::ID == static_cast<uint32_t>(OpcodeArgEncoding::ID));
+static_assert(AtomBiosAot::PLL == static_cast<uint32_t>(OpcodeArgEncoding::PLL));
+static_assert(AtomBiosAot::MC == static_cast<uint32_t>(OpcodeArgEncoding::MC));
+static_assert(AtomBiosAot::AbsoluteReg == jitAbsoluteReg);
+
+namespace {
+
+const char* operandName(uint32_t arg) {
+	switch(arg) {
+	case OpcodeArgEncoding::Reg: return "AtomBiosAot::Reg";
+	case OpcodeArgEncoding::Reg | jitAbsoluteReg: return "AtomBiosAot::AbsoluteReg";
+	case OpcodeArgEncoding::WorkSpace: return "AtomBiosAot::WorkSpace";
+	case OpcodeArgEncoding::FrameBuffer: return "AtomBiosAot::FrameBuffer";
+	case OpcodeArgEncoding::ID: return "AtomBiosAot::ID";
+	case OpcodeArgEncoding::PLL: return "AtomBiosAot::PLL";
+	case OpcodeArgEncoding::MC: return "AtomBiosAot::MC";
+	}
+	return nullptr;
+}
+
+// Passes the generated source to the write function of the host.
+struct Writer {
+	void (*write)(const char* data, size_t size, void* context);
+	void* context;
+
+	Writer& operator<<(const char* str) {
+		size_t size = 0;
+		while(str[size]) {
+			size++;
+		}
+		write(str, size, context);
+		return *this;
+	}
+
+	// Hexadecimal, without a prefix.
+	Writer& digits(uint32_t val) {
+		char buf[8];
+		int n = 0;
+		do {
+			buf[7 - n++] = "0123456789abcdef"[val & 0xF];
+			val >>= 4;
+		} while(val);
+		write(buf + 8 - n, n, context);
+		return *this;
+	}
+
+	Writer& hex(uint32_t val) {
+		return *this << "0x", digits(val);
+	}
+};
+
+struct CommandTranslator {
+	Writer& w;
+	DecodedCommand& decoded;
+
+	// Instructions that are jumped to, and need a label.
+	libatombios_vector<bool> labels;
+
+	uint32_t maxWorkSpace = 0;
+	uint32_t maxParameterSpace = 0;
+	bool usesWorkSpace = false;
+	bool usesParameterSpace = false;
+
+	CommandTranslator(Writer& w, DecodedCommand& decoded) : w{w}, decoded{decoded} {}
+
+	static bool endsBlock(const Instruction& instr) {
+		return instr.opcode == Opcodes::END_OF_TABLE || instr.opcode == Opcodes::JUMP_ALWAYS || instr.opcode == Opcodes::SWITCH;
+	}
+
+	static bool translatable(uint8_t op) {
+		return (op >= Opcodes::MOVE_TO_REG && op <= Opcodes::SET_REG_BLOCK)
+			|| (op >= Opcodes::COMPARE_FROM_REG && op <= Opcodes::TEST_FROM_MC)
+			|| (op >= Opcodes::CLEAR_IN_REG && op <= Opcodes::CLEAR_IN_MC)
+			|| (op >= Opcodes::MASK_INTO_REG && op <= Opcodes::MASK_INTO_MC)
+			|| (op >= Opcodes::XOR_INTO_REG && op <= Opcodes::XOR_INTO_MC)
+			|| op == Opcodes::DELAY_MICROSECONDS || op == Opcodes::CALL_TABLE || op == Opcodes::END_OF_TABLE
+			|| op == Opcodes::SET_DATA_TABLE || op == FusedOpcodes::COMPARE_AND_JUMP || op == FusedOpcodes::TEST_AND_JUMP
+			|| op == FusedOpcodes::MASKED_REG_UPDATE || op == FusedOpcodes::DIV_BY_CONSTANT;
+	}
+
+	// Marks the instruction as a jump target; returns false if it lies outside of the command.
+	bool target(uint32_t idx) {
+		if(idx == instructionInvalid) {
+			return false;
+		}
+		if(idx != instructionExit) {
+			labels[idx] = true;
+		}
+		return true;
+	}
+
+	// Checks that everything can be translated, and finds the labels.
+	// Returns the index of the first instruction that can not be translated, or instructionExit.
+	uint32_t prepare() {
+		labels.resize(decoded.code.size(), false);
+		labels[decoded.entry] = decoded.entry != 0;
+
+		for(uint32_t i = 0; i < decoded.code.size(); i++) {
+			const Instruction& instr = decoded.code[i];
+			if(!instr.valid || !translatable(instr.opcode)) {
+				return i;
+			}
+
+			bool ok = true;
+			if((instr.opcode >= Opcodes::JUMP_ALWAYS && instr.opcode <= Opcodes::JUMP_NOTEQUAL)
+					|| instr.opcode == FusedOpcodes::COMPARE_AND_JUMP || instr.opcode == FusedOpcodes::TEST_AND_JUMP) {
+				ok = target(instr.target);
+			} else if(instr.opcode == Opcodes::SWITCH) {
+				for(uint32_t t : decoded.switches[instr.target].targets) {
+					ok = ok && target(t);
+				}
+				ok = ok && target(instr.next);
+			}
+			if(!endsBlock(instr) && instr.next != i + 1) {
+				ok = ok && target(instr.next);
+			}
+			if(!ok) {
+				return i;
+			}
+		}
+		return instructionExit;
+	}
+
+	void jumpTo(uint32_t idx) {
+		if(idx == instructionExit) {
+			w << "return;";
+		} else {
+			w << "goto i_", w.digits(idx), w << ";";
+		}
+	}
+
+	uint32_t helperArg(OpcodeArgEncoding arg, const Instruction& instr) {
+		if(arg == OpcodeArgEncoding::Reg && (instr.optFlags & OptimizerFlags::OptRegBlockFolded)) {
+			return arg | jitAbsoluteReg;
+		}
+		return arg;
+	}
+
+	// Operands in the WorkSpace and parameter space are accessed directly.
+	bool direct(OpcodeArgEncoding arg, uint32_t idx) {
+		return arg == OpcodeArgEncoding::Imm || arg == OpcodeArgEncoding::ParameterSpace
+			|| (arg == OpcodeArgEncoding::WorkSpace && !isSpecialWorkSpace(idx));
+	}
+
+	void load(const Instruction& instr, OpcodeArgEncoding arg, uint32_t idx, uint32_t imm) {
+		switch(arg) {
+		case OpcodeArgEncoding::Imm:
+			w.hex(imm);
+			return;
+		case OpcodeArgEncoding::ParameterSpace:
+			usesParameterSpace = true;
+			if(idx > maxParameterSpace) { maxParameterSpace = idx; }
+			w << "f->params[", w.hex(idx), w << "]";
+			return;
+		case OpcodeArgEncoding::WorkSpace:
+			if(!isSpecialWorkSpace(idx)) {
+				usesWorkSpace = true;
+				if(idx > maxWorkSpace) { maxWorkSpace = idx; }
+				w << "ws[", w.hex(idx), w << "]";
+				return;
+			}
+			break;
+		default:
+			break;
+		}
+
+		w << "AtomBiosAot::read(impl, " << operandName(helperArg(arg, instr)) << ", ", w.hex(idx), w << ")";
+	}
+
+	// Stores the expression that is written by value.
+	template<typename F>
+	void store(const Instruction& instr, OpcodeArgEncoding arg, uint32_t idx, F value) {
+		if(direct(arg, idx)) {
+			w << "\t\t";
+			load(instr, arg, idx, 0);
+			w << " = ";
+			value();
+			w << ";\n";
+			return;
+		}
+
+		w << "\t\tAtomBiosAot::write(impl, " << operandName(helperArg(arg, instr)) << ", ", w.hex(idx), w << ", ";
+		value();
+		w << ");\n";
+	}
+
+	void swizzled(const char* name, SrcEncoding align) {
+		if(align == SrcEncoding::SrcDword) {
+			w << name;
+			return;
+		}
+		if(!atom_arg_shift[align]) {
+			w << "(" << name << " & ", w.hex(atom_arg_mask[align]), w << ")";
+			return;
+		}
+		w << "((" << name << " & ", w.hex(atom_arg_mask[align]), w << ") >> ", w.hex(atom_arg_shift[align]), w << ")";
+	}
+
+	// Stores val into the destination, keeping the bytes of saved that are not part of it.
+	void storeCombined(const Instruction& instr) {
+		SrcEncoding align = instr.attrByte.dstAlign;
+		store(instr, instr.dstArg, instr.dstIdx, [&] {
+			if(align == SrcEncoding::SrcDword) {
+				w << "val";
+				return;
+			}
+			if(atom_arg_shift[align]) {
+				w << "((val << ", w.hex(atom_arg_shift[align]), w << ") & ", w.hex(atom_arg_mask[align]), w << ")";
+			} else {
+				w << "(val & ", w.hex(atom_arg_mask[align]), w << ")";
+			}
+			w << " | (saved & ", w.hex(~atom_arg_mask[align]), w << ")";
+		});
+	}
+
+	// saved = the destination, if it is needed, src = the swizzled source; the destination is read first.
+	void operands(const Instruction& instr, bool needSaved) {
+		if(needSaved) {
+			w << "\t\tuint32_t saved = ";
+			load(instr, instr.dstArg, instr.dstIdx, 0);
+			w << ";\n";
+		}
+
+		w << "\t\tuint32_t src = ";
+		if(instr.attrByte.srcAlign == SrcEncoding::SrcDword) {
+			load(instr, instr.attrByte.srcArg, instr.srcIdx, instr.imm);
+		} else {
+			w << "(";
+			load(instr, instr.attrByte.srcArg, instr.srcIdx, instr.imm);
+			w << " & ", w.hex(atom_arg_mask[instr.attrByte.srcAlign]), w << ")";
+			if(atom_arg_shift[instr.attrByte.srcAlign]) {
+				w << " >> ", w.hex(atom_arg_shift[instr.attrByte.srcAlign]);
+			}
+		}
+		w << ";\n";
+	}
+
+	void binaryOp(const Instruction& instr, const char* op) {
+		operands(instr, true);
+		w << "\t\tuint32_t val = ", swizzled("saved", instr.attrByte.dstAlign), w << " " << op << " src;\n";
+		storeCombined(instr);
+	}
+
+	void compare(const Instruction& instr, bool setOrder) {
+		operands(instr, true);
+		w << "\t\tuint32_t dst = ", swizzled("saved", instr.attrByte.dstAlign), w << ";\n";
+		w << "\t\tequal = dst == src;\n";
+		if(setOrder) {
+			w << "\t\tabove = dst > src;\n";
+			w << "\t\tbelow = dst < src;\n";
+		}
+	}
+
+	void jump(uint8_t opcode, uint32_t target) {
+		switch(opcode) {
+		case Opcodes::JUMP_ALWAYS:
+			w << "\t";
+			break;
+		case Opcodes::JUMP_EQUAL:
+			w << "\tif(equal) ";
+			break;
+		case Opcodes::JUMP_NOTEQUAL:
+			w << "\tif(!equal) ";
+			break;
+		case Opcodes::JUMP_ABOVE:
+			w << "\tif(above) ";
+			break;
+		case Opcodes::JUMP_BELOW:
+			w << "\tif(below) ";
+			break;
+		case Opcodes::JUMP_ABOVEOREQUAL:
+			w << "\tif(above || equal) ";
+			break;
+		case Opcodes::JUMP_BELOWOREQUAL:
+			w << "\tif(below || equal) ";
+			break;
+		}
+		jumpTo(target);
+		w << "\n";
+	}
+
+	void translate(const Instruction& instr) {
+		uint8_t op = instr.opcode;
+
+		w << "\t{\n";
+		if(op >= Opcodes::MOVE_TO_REG && op <= Opcodes::MOVE_TO_MC) {
+			// Like the interpreter, dword moves do not read their destination.
+			operands(instr, readsDst(instr));
+			w << "\t\tuint32_t val = src;\n";
+			storeCombined(instr);
+		} else if(op >= Opcodes::AND_INTO_REG && op <= Opcodes::AND_INTO_MC) {
+			binaryOp(instr, "&");
+		} else if(op >= Opcodes::OR_INTO_REG && op <= Opcodes::OR_INTO_MC) {
+			binaryOp(instr, "|");
+		} else if(op >= Opcodes::XOR_INTO_REG && op <= Opcodes::XOR_INTO_MC) {
+			binaryOp(instr, "^");
+		} else if(op >= Opcodes::ADD_INTO_REG && op <= Opcodes::ADD_INTO_MC) {
+			binaryOp(instr, "+");
+		} else if(op >= Opcodes::SUB_INTO_REG && op <= Opcodes::SUB_INTO_MC) {
+			binaryOp(instr, "-");
+		} else if((op >= Opcodes::SHIFT_LEFT_IN_REG && op <= Opcodes::SHIFT_LEFT_IN_MC)
+				|| (op >= Opcodes::SHIFT_RIGHT_IN_REG && op <= Opcodes::SHIFT_RIGHT_IN_MC)) {
+			w << "\t\tuint32_t saved = ";
+			load(instr, instr.dstArg, instr.dstIdx, 0);
+			w << ";\n";
+			// Like the interpreter on x86, the count is taken mod 32.
+			w << "\t\tuint32_t val = ", swizzled("saved", instr.attrByte.dstAlign);
+			w << (op <= Opcodes::SHIFT_LEFT_IN_MC ? " << " : " >> "), w.hex(instr.imm & 31), w << ";\n";
+			storeCombined(instr);
+		} else if(op >= Opcodes::CLEAR_IN_REG && op <= Opcodes::CLEAR_IN_MC) {
+			if(readsDst(instr)) {
+				w << "\t\tuint32_t saved = ";
+				load(instr, instr.dstArg, instr.dstIdx, 0);
+				w << ";\n";
+			}
+			w << "\t\tuint32_t val = 0;\n";
+			storeCombined(instr);
+		} else if(op >= Opcodes::MASK_INTO_REG && op <= Opcodes::MASK_INTO_MC) {
+			operands(instr, true);
+			w << "\t\tuint32_t val = (", swizzled("saved", instr.attrByte.dstAlign), w << " & ", w.hex(instr.mask), w << ") | src;\n";
+			storeCombined(instr);
+		} else if(op >= Opcodes::MUL_WITH_REG && op <= Opcodes::MUL_WITH_MC) {
+			operands(instr, true);
+			w << "\t\tquotient = ", swizzled("saved", instr.attrByte.dstAlign), w << " * src;\n";
+		} else if((op >= Opcodes::DIV_WITH_REG && op <= Opcodes::DIV_WITH_MC) || op == FusedOpcodes::DIV_BY_CONSTANT) {
+			// The host compiler reduces divisions by immediates itself.
+			// A div by 0 in atombios results in a 0.
+			operands(instr, true);
+			w << "\t\tuint32_t dst = ", swizzled("saved", instr.attrByte.dstAlign), w << ";\n";
+			w << "\t\tquotient = src ? dst / src : 0;\n";
+			w << "\t\tremainder = src ? dst % src : 0;\n";
+		} else if(op >= Opcodes::COMPARE_FROM_REG && op <= Opcodes::COMPARE_FROM_MC) {
+			compare(instr, true);
+		} else if(op >= Opcodes::TEST_FROM_REG && op <= Opcodes::TEST_FROM_MC) {
+			compare(instr, false);
+		} else if(op == FusedOpcodes::COMPARE_AND_JUMP) {
+			compare(instr, true);
+		} else if(op == FusedOpcodes::TEST_AND_JUMP) {
+			compare(instr, false);
+		} else if(op == FusedOpcodes::MASKED_REG_UPDATE) {
+			// Performs the same register accesses as the original sequence.
+			usesWorkSpace = true;
+			if(instr.srcIdx > maxWorkSpace) { maxWorkSpace = instr.srcIdx; }
+			w << "\t\tuint32_t val = (";
+			load(instr, OpcodeArgEncoding::Reg, instr.dstIdx, 0);
+			w << " & ", w.hex(instr.mask), w << ") | ", w.hex(instr.imm), w << ";\n";
+			w << "\t\tws[", w.hex(instr.srcIdx), w << "] = val;\n";
+			w << "\t\t";
+			load(instr, OpcodeArgEncoding::Reg, instr.dstIdx, 0);
+			w << ";\n";
+			store(instr, OpcodeArgEncoding::Reg, instr.dstIdx, [&] { w << "val"; });
+		} else if(op == Opcodes::SWITCH) {
+			// Like the interpreter, the cases are compared against the source as it is read.
+			SwitchTable& table = decoded.switches[instr.target];
+			w << "\t\tswitch(";
+			load(instr, instr.attrByte.srcArg, instr.srcIdx, instr.imm);
+			w << ") {\n";
+			for(size_t i = 0; i < table.targets.size(); i++) {
+				if(table.targets[i] == instr.next) {
+					continue;
+				}
+				w << "\t\tcase ", w.hex(table.dense ? table.base + i : table.keys[i]), w << ": ";
+				jumpTo(table.targets[i]);
+				w << "\n";
+			}
+			w << "\t\t}\n";
+		} else if(op == Opcodes::CALL_TABLE) {
+			w << "\t\tAtomBiosAot::callTable(f, ", w.hex(instr.imm), w << ");\n";
+		} else if(op == Opcodes::SET_DATA_TABLE || op == Opcodes::SET_ATI_PORT || op == Opcodes::SET_PCI_PORT
+				|| op == Opcodes::SET_SYSIO_PORT || op == Opcodes::SET_REG_BLOCK || op == Opcodes::DELAY_MICROSECONDS) {
+			w << "\t\tAtomBiosAot::misc(impl, ", w.hex(op), w << ", ", w.hex(instr.imm), w << ");\n";
+		}
+		w << "\t}\n";
+
+		if(op >= Opcodes::JUMP_ALWAYS && op <= Opcodes::JUMP_NOTEQUAL) {
+			jump(op, instr.target);
+		} else if(op == FusedOpcodes::COMPARE_AND_JUMP || op == FusedOpcodes::TEST_AND_JUMP) {
+			jump(instr.fusedOpcode, instr.target);
+		} else if(op == Opcodes::SWITCH) {
+			w << "\t";
+			jumpTo(instr.next);
+			w << "\n";
+		} else if(op == Opcodes::END_OF_TABLE) {
+			w << "\treturn;\n";
+		}
+	}
+
+	void function(int table) {
+		w << "void command_", w.digits(table), w << "(AtomBiosAot::Frame* f) {\n";
+		w << "\t[[maybe_unused]] AtomBiosImpl* impl = f->impl;\n";
+		w << "\t[[maybe_unused]] uint32_t* ws = f->workSpace;\n";
+		w << "\t[[maybe_unused]] bool& above = AtomBiosAot::flagAbove(impl);\n";
+		w << "\t[[maybe_unused]] bool& equal = AtomBiosAot::flagEqual(impl);\n";
+		w << "\t[[maybe_unused]] bool& below = AtomBiosAot::flagBelow(impl);\n";
+		w << "\t[[maybe_unused]] uint32_t& quotient = AtomBiosAot::divMulQuotient(impl);\n";
+		w << "\t[[maybe_unused]] uint32_t& remainder = AtomBiosAot::divMulRemainder(impl);\n";
+		if(decoded.entry != 0) {
+			w << "\t";
+			jumpTo(decoded.entry);
+			w << "\n";
+		}
+
+		for(uint32_t i = 0; i < decoded.code.size(); i++) {
+			const Instruction& instr = decoded.code[i];
+			w << "\n";
+			if(labels[i]) {
+				w << "i_", w.digits(i), w << ":\n";
+			}
+			w << "\t// ", w.hex(instr.ip + 0x6), w << ": opcode ", w.hex(instr.opcode), w << "\n";
+			translate(instr);
+
+			if(!endsBlock(instr) && instr.next != i + 1) {
+				w << "\t";
+				jumpTo(instr.next);
+				w << "\n";
+			}
+		}
+		w << "}\n\n";
+	}
+};
+
+}
+
+///
+/// Called from generated code.
+///
+
+uint32_t AtomBiosAot::read(AtomBiosImpl* impl, uint32_t operand, uint32_t idx) {
+	return AtomBiosImpl::_jitRead(impl, operand, idx);
+}
+void AtomBiosAot::write(AtomBiosImpl* impl, uint32_t operand, uint32_t idx, uint32_t val) {
+	AtomBiosImpl::_jitWrite(impl, operand, idx, val);
+}
+
+bool& AtomBiosAot::flagAbove(AtomBiosImpl* impl) {
+	return impl->_flagAbove;
+}
+bool& AtomBiosAot::flagEqual(AtomBiosImpl* impl) {
+	return impl->_flagEqual;
+}
+bool& AtomBiosAot::flagBelow(AtomBiosImpl* impl) {
+	return impl->_flagBelow;
+}
+uint32_t& AtomBiosAot::divMulQuotient(AtomBiosImpl* impl) {
+	return impl->_divMulQuotient;
+}
+uint32_t& AtomBiosAot::divMulRemainder(AtomBiosImpl* impl) {
+	return impl->_divMulRemainder;
+}
+
+void AtomBiosAot::callTable(Frame* frame, uint32_t table) {
+	AtomBiosImpl::_jitCallTable(frame, table);
+}
+void AtomBiosAot::misc(AtomBiosImpl* impl, uint32_t opcode, uint32_t imm) {
+	AtomBiosImpl::_jitMisc(impl, opcode, imm);
+}
+
+uint32_t AtomBiosAot::cardRead(AtomBiosImpl* impl, uint32_t reg) {
+	return impl->_cardRead(AtomBiosImpl::CardSpace::Reg, reg);
+}
+void AtomBiosAot::cardWrite(AtomBiosImpl* impl, uint32_t reg, uint32_t val) {
+	impl->_cardWrite(AtomBiosImpl::CardSpace::Reg, reg, val);
+}
+uint32_t AtomBiosAot::iioAttributes(AtomBiosImpl* impl) {
+	return impl->_iioIOAttr;
+}
+
+///
+/// Loading translated modules.
+///
+
+bool AtomBiosImpl::_aotSourceMatches(const AtomBiosAot::Source& source) {
+	if(source.offset > _data.size() || source.size > _data.size() - source.offset) {
+		return false;
+	}
+	return fnv1a(_data.data() + source.offset, source.size) == source.checksum;
+}
+
+void AtomBiosImpl::setAotModule(const AtomBiosAot::Module* module) {
+	_aotModule = module;
+	_aotCommands.clear();
+	_aotIIOFunctions.clear();
+
+	if(module) {
+		_aotCommands.resize(_commandTable.count, nullptr);
+		for(size_t i = 0; i < module->commandCount; i++) {
+			const AtomBiosAot::Command& translated = module->commands[i];
+			Command* command = _commandTable.commands.get(translated.table);
+			if(!command || !command->exists() || translated.source.offset != command->offset()
+					|| translated.source.size != command->bytecodeSize() || !_aotSourceMatches(translated.source)) {
+				lilrad_log(WARNING, "aot: command 0x%x does not match this ROM, it is not used\n", translated.table);
+				continue;
+			}
+			_aotCommands[translated.table] = &translated;
+		}
+
+		_aotIIOFunctions.resize(_iioIndexes.size(), nullptr);
+		for(size_t i = 0; i < module->iioFunctionCount; i++) {
+			const AtomBiosAot::IIOFunction& translated = module->iioFunctions[i];
+			if(translated.port >= _iioIndexes.size() || translated.source.offset != _iioIndexes[translated.port]
+					|| translated.source.size != _iioFunctionSize(translated.source.offset) || !_aotSourceMatches(translated.source)) {
+				lilrad_log(WARNING, "aot: IIO function 0x%x does not match this ROM, it is not used\n", translated.port);
+				continue;
+			}
+			_aotIIOFunctions[translated.port] = &translated;
+		}
+	}
+
+	// Commands that were already decoded would keep their old code.
+	_dropDecodedCommands();
+}
+
+JitCode* AtomBiosImpl::_aotCode(Command& command) {
+	if(command.i() >= static_cast<int>(_aotCommands.size()) || !_aotCommands[command.i()]) {
+		return nullptr;
+	}
+
+	const AtomBiosAot::Command* translated = _aotCommands[command.i()];
+	JitCode* code = new JitCode;
+	code->entry = translated->run;
+	code->workSpaceDwords = translated->workSpaceDwords;
+	code->parameterDwords = translated->parameterDwords;
+	return code;
+}
+
+uint32_t AtomBiosImpl::_runIIOPort(uint32_t index, uint32_t data) {
+	// Like the commands, translated functions are not used by the reference side of differential runs, or in self-check mode.
+	bool translated = !_jitSuspended && _optimizerMode != AtomBios::OptimizerMode::SelfCheck;
+	if(translated && _iioPort < _aotIIOFunctions.size() && _aotIIOFunctions[_iioPort]) {
+		return _aotIIOFunctions[_iioPort]->run(this, index, data);
+	}
+	return _runIIO(_iioIndexes[_iioPort], index, data);
+}
+
+///
+/// Translation.
+///
+
+void AtomBiosImpl::translateToCpp(const char* moduleName, void (*write)(const char* data, size_t size, void* context), void* context) {
+	Writer w{write, context};
+
+	struct Translated {
+		uint32_t id;
+		AtomBiosAot::Source source;
+		uint32_t workSpaceDwords;
+		uint32_t parameterDwords;
+	};
+	libatombios_vector<Translated> commands;
+	libatombios_vector<Translated> iioFunctions;
+
+	w << "// Generated by libatombios (AtomBios::translateToCpp); do not edit.\n";
+	w << "// Pass " << moduleName << " to AtomBios::setAotModule.\n\n";
+	w << "#include <libatombios/aot.hpp>\n\n";
+	w << "namespace {\n\n";
+
+	for(int i = 0; i < _commandTable.count; i++) {
+		Command* command = _commandTable.commands.get(i);
+		if(!command || !command->exists()) {
+			continue;
+		}
+
+		DecodedCommand& decoded = _decoded(*command);
+		if(decoded.code.empty()) {
+			continue;
+		}
+
+		CommandTranslator t{w, decoded};
+		uint32_t failed = t.prepare();
+		if(failed != instructionExit) {
+			lilrad_log(WARNING, "aot: opcode 0x%x at %x can not be translated, command 0x%x stays with the interpreter\n",
+				decoded.code[failed].opcode, decoded.code[failed].ip + 0x6, i);
+			continue;
+		}
+		t.function(i);
+
+		AtomBiosAot::Source source{command->offset(), command->bytecodeSize(), 0};
+		source.checksum = fnv1a(_data.data() + source.offset, source.size);
+		commands.push_back(Translated{static_cast<uint32_t>(i), source,
+			t.usesWorkSpace ? t.maxWorkSpace + 1 : 0, t.usesParameterSpace ? t.maxParameterSpace + 1 : 0});
+	}
+
+	for(uint32_t port = 0; port < _iioIndexes.size(); port++) {
+		uint32_t offset = _iioIndexes[port];
+		if(!offset) {
+			continue;
+		}
+
+		uint32_t size = _iioFunctionSize(offset);
+		if(!size) {
+			lilrad_log(WARNING, "aot: IIO function 0x%x contains invalid opcodes, it stays with the interpreter\n", port);
+			continue;
+		}
+
+		w << "uint32_t iio_", w.digits(port), w << "(AtomBiosImpl* impl, uint32_t index, uint32_t data) {\n";
+		w << "\tuint32_t temp = 0xcdcdcdcd;\n";
+		for(uint32_t ip = offset; _data[ip] != IIOOpcodes::END; ip += _iioInstructionLength(_data[ip])) {
+			// See _runIIO; the masks are computed here in the same way.
+			switch(_data[ip]) {
+			case IIOOpcodes::READ:
+				w << "\ttemp = AtomBiosAot::cardRead(impl, ", w.hex(read16(ip + 1)), w << ");\n";
+				break;
+			case IIOOpcodes::WRITE:
+				w << "\tAtomBiosAot::cardWrite(impl, ", w.hex(read16(ip + 1)), w << ", temp);\n";
+				break;
+			case IIOOpcodes::CLEAR:
+				w << "\ttemp &= ", w.hex(~((0xFFFFFFFF >> (32 - _data[ip + 1]))) << _data[ip + 2]), w << ";\n";
+				break;
+			case IIOOpcodes::SET:
+				w << "\ttemp |= ", w.hex((0xFFFFFFFF >> (32 - _data[ip + 1])) << _data[ip + 2]), w << ";\n";
+				break;
+			case IIOOpcodes::MOVE_INDEX:
+			case IIOOpcodes::MOVE_DATA:
+			case IIOOpcodes::MOVE_ATTR: {
+				uint32_t a = _data[ip + 1];
+				uint32_t b = _data[ip + 2];
+				uint32_t c = _data[ip + 3];
+				const char* val = _data[ip] == IIOOpcodes::MOVE_INDEX ? "index"
+					: _data[ip] == IIOOpcodes::MOVE_DATA ? "data" : "AtomBiosAot::iioAttributes(impl)";
+				w << "\ttemp &= ", w.hex(~((0xFFFFFFFF >> (32 - a)) << c)), w << ";\n";
+				// Like the interpreter on x86, the shift count is taken mod 32.
+				w << "\ttemp |= (" << val << " >> ", w.hex(b & 31), w << ") & ", w.hex((0xFFFFFFFF >> (32 - a)) << c), w << ";\n";
+				break;
+			}
+			}
+		}
+		w << "\treturn temp;\n";
+		w << "}\n\n";
+
+		AtomBiosAot::Source source{offset, size, fnv1a(_data.data() + offset, size)};
+		iioFunctions.push_back(Translated{port, source, 0, 0});
+	}
+
+	auto writeSource = [&w](const AtomBiosAot::Source& source) {
+		w << "{", w.hex(source.offset), w << ", ", w.hex(source.size), w << ", ", w.hex(source.checksum), w << "}";
+	};
+
+	if(!commands.empty()) {
+		w << "const AtomBiosAot::Command commands[] = {\n";
+		for(const Translated& command : commands) {
+			w << "\t{", w.hex(command.id), w << ", ";
+			writeSource(command.source);
+			w << ", ", w.hex(command.workSpaceDwords), w << ", ", w.hex(command.parameterDwords), w << ", command_", w.digits(command.id), w << "},\n";
+		}
+		w << "};\n\n";
+	}
+	if(!iioFunctions.empty()) {
+		w << "const AtomBiosAot::IIOFunction iioFunctions[] = {\n";
+		for(const Translated& function : iioFunctions) {
+			w << "\t{", w.hex(function.id), w << ", ";
+			writeSource(function.source);
+			w << ", iio_", w.digits(function.id), w << "},\n";
+		}
+		w << "};\n\n";
+	}
+	w << "}\n\n";
+
+	w << "extern const AtomBiosAot::Module " << moduleName << " = {\n";
+	if(commands.empty()) {
+		w << "\tnullptr, 0,\n";
+	} else {
+		w << "\tcommands, ", w.hex(commands.size()), w << ",\n";
+	}
+	if(iioFunctions.empty()) {
+		w << "\tnullptr, 0\n";
+	} else {
+		w << "\tiioFunctions, ", w.hex(iioFunctions.size()), w << "\n";
+	}
+	w << "};\n";
+}
@@ -49,6 +49,11 @@ enum WorkSpaceSpecialAddresses {
 	WS_REGPTR = 0x48
 };
 
+// WorkSpace indexes that map to interpreter state, instead of the WorkSpace itself.
+constexpr bool isSpecialWorkSpace(uint32_t idx) {
+	return idx >= WS_QUOTIENT && idx <= WS_REGPTR;
+}
+
 enum Opcodes {
 	MOVE_TO_REG = 0x01,
 	MOVE_TO_PS = 0x02,
@@ -170,6 +175,30 @@ enum Opcodes {
 	XOR_INTO_MC = 0x6C
 };
 
+// Superinstructions, formed out of common opcode sequences after a command was decoded.
+// These use opcode values that do not exist in the bytecode.
+enum FusedOpcodes {
+	// COMPARE_* / TEST_* followed by a JUMP_*.
+	COMPARE_AND_JUMP = 0xF0,
+	TEST_AND_JUMP = 0xF1,
+	// MOVE_TO_WS from a register, ANDs / ORs of immediates into that WS, and a MOVE_TO_REG back into the register.
+	MASKED_REG_UPDATE = 0xF2,
+
+	// Formed by the optimizer: DIV_WITH_* by an immediate, done with a multiplication and shifts.
+	DIV_BY_CONSTANT = 0xF8
+};
+
+// Changes the optimizer made to an instruction.
+enum OptimizerFlags {
+	// The reg block was known, and has been added to the Reg operands.
+	OptRegBlockFolded = 1 << 0,
+	// The source was a WorkSpace value, which was replaced by what was stored into it.
+	OptSrcForwarded = 1 << 1,
+	// The instruction only stores into the WorkSpace, and the value is never read.
+	// Dead stores are removed, unless the optimizer runs in self-check mode.
+	OptDeadStore = 1 << 2
+};
+
 enum IIOOpcodes {
 	NOP = 0,
 	START = 1,
@@ -210,19 +239,19 @@ struct AttrByte {
 	SrcEncoding srcAlign;
 	OpcodeArgEncoding srcArg;
 
-	constexpr uint32_t swizleSrc(uint32_t in) {
+	constexpr uint32_t swizleSrc(uint32_t in) const {
 		in &= atom_arg_mask[srcAlign];
 		in >>= atom_arg_shift[srcAlign];
 		return in;
 	}
 
-	constexpr uint32_t swizleDst(uint32_t in) {
+	constexpr uint32_t swizleDst(uint32_t in) const {
 		in &= atom_arg_mask[dstAlign];
 		in >>= atom_arg_shift[dstAlign];
 		return in;
 	}
 
-	constexpr uint32_t combineSaved(uint32_t in, uint32_t saved) {
+	constexpr uint32_t combineSaved(uint32_t in, uint32_t saved) const {
 		if(dstAlign == SrcEncoding::SrcDword) {
 			return in;
 		}
@@ -238,9 +267,348 @@ struct AttrByte {
 const char* OpcodeArgEncodingToString(OpcodeArgEncoding arg);
 const char* SrcEncodingToString(SrcEncoding align);
 
+/// Decoded bytecode.
+/// Commands are decoded once, the first time they are run; the interpreter only works on the decoded form.
+
+// Instruction index that ends the command when reached.
+static constexpr uint32_t instructionExit = 0xFFFFFFFF;
+// Instruction index of a jump target that lies outside of the command.
+static constexpr uint32_t instructionInvalid = 0xFFFFFFFE;
+
+struct Instruction {
+	// The opcode byte; valid is cleared if the instruction could not be decoded.
+	uint8_t opcode;
+	bool valid;
+
+	OpcodeArgEncoding dstArg;
+	AttrByte attrByte;
+	uint32_t dstIdx;
+	uint32_t srcIdx;
+	// The source value if the source is an immediate; otherwise the single operand of
+	// opcodes without an attribute byte (jump target, shift count, delay, table, port or reg block).
+	uint32_t imm;
+	// MASK only: the mask applied to the destination.
+	uint32_t mask;
+
+	// COMPARE_AND_JUMP / TEST_AND_JUMP only: the opcode and raw target of the fused jump.
+	uint8_t fusedOpcode;
+	uint16_t fusedJumpTarget;
+
+	// OptimizerFlags.
+	uint8_t optFlags;
+	// OptRegBlockFolded: the reg block that was folded in.
+	uint16_t foldedRegBlock;
+	// OptSrcForwarded: the WorkSpace index the source used to be.
+	uint8_t forwardedFrom;
+	// DIV_BY_CONSTANT: quotient = (t + ((x - t) >> 1)) >> divShift, with t = (x * divMagic) >> 32.
+	uint32_t divMagic;
+	uint8_t divShift;
+
+	// Offset of the opcode into the bytecode.
+	uint16_t ip;
+	// Index of the instruction that follows, if no jump is taken.
+	uint32_t next;
+	// JUMP_*: index of the instruction jumped to; SWITCH: index into the switch tables.
+	uint32_t target;
+};
+
+// What decoded instructions do, for the passes that walk them.
+constexpr bool inRange(uint8_t opcode, uint8_t first, uint8_t last) {
+	return opcode >= first && opcode <= last;
+}
+
+// Opcodes with a source operand (given by the attribute byte).
+constexpr bool hasSrc(const Instruction& instr) {
+	uint8_t op = instr.opcode;
+	return inRange(op, Opcodes::MOVE_TO_REG, Opcodes::OR_INTO_MC)
+		|| inRange(op, Opcodes::MUL_WITH_REG, Opcodes::SUB_INTO_MC)
+		|| inRange(op, Opcodes::COMPARE_FROM_REG, Opcodes::COMPARE_FROM_MC)
+		|| inRange(op, Opcodes::TEST_FROM_REG, Opcodes::TEST_FROM_MC)
+		|| inRange(op, Opcodes::MASK_INTO_REG, Opcodes::MASK_INTO_MC)
+		|| inRange(op, Opcodes::XOR_INTO_REG, Opcodes::XOR_INTO_MC)
+		|| op == Opcodes::SWITCH
+		|| op == FusedOpcodes::COMPARE_AND_JUMP || op == FusedOpcodes::TEST_AND_JUMP
+		|| op == FusedOpcodes::DIV_BY_CONSTANT;
+}
+
+// Opcodes with a destination operand.
+constexpr bool hasDst(const Instruction& instr) {
+	return hasSrc(instr) ? instr.opcode != Opcodes::SWITCH
+		: (inRange(instr.opcode, Opcodes::SHIFT_LEFT_IN_REG, Opcodes::SHIFT_RIGHT_IN_MC)
+			|| inRange(instr.opcode, Opcodes::CLEAR_IN_REG, Opcodes::CLEAR_IN_MC));
+}
+
+// Whether the written value does not depend on the previous value of the destination.
+constexpr bool overwritesDst(const Instruction& instr) {
+	if(instr.attrByte.dstAlign != SrcEncoding::SrcDword) {
+		return false;
+	}
+	return inRange(instr.opcode, Opcodes::MOVE_TO_REG, Opcodes::MOVE_TO_MC)
+		|| inRange(instr.opcode, Opcodes::CLEAR_IN_REG, Opcodes::CLEAR_IN_MC);
+}
+
+// Opcodes that read their destination. Like the Linux interpreter, dword MOVEs and CLEARs do not, so a register
+// write is not preceded by a read of the register.
+constexpr bool readsDst(const Instruction& instr) {
+	return hasDst(instr) && !overwritesDst(instr);
+}
+
+// Opcodes that write to their destination.
+constexpr bool writesDst(const Instruction& instr) {
+	uint8_t op = instr.opcode;
+	return hasDst(instr)
+		&& !inRange(op, Opcodes::MUL_WITH_REG, Opcodes::DIV_WITH_MC)
+		&& !inRange(op, Opcodes::COMPARE_FROM_REG, Opcodes::COMPARE_FROM_MC)
+		&& !inRange(op, Opcodes::TEST_FROM_REG, Opcodes::TEST_FROM_MC)
+		&& op != FusedOpcodes::COMPARE_AND_JUMP && op != FusedOpcodes::TEST_AND_JUMP
+		&& op != FusedOpcodes::DIV_BY_CONSTANT;
+}
+
+// JUMP_* and the superinstructions with a jump fused in.
+constexpr bool jumps(const Instruction& instr) {
+	return inRange(instr.opcode, Opcodes::JUMP_ALWAYS, Opcodes::JUMP_NOTEQUAL)
+		|| instr.opcode == FusedOpcodes::COMPARE_AND_JUMP || instr.opcode == FusedOpcodes::TEST_AND_JUMP;
+}
+
+// The opcode of the jump, for fused ones that of the jump that was fused in.
+constexpr uint8_t jumpOpcode(const Instruction& instr) {
+	return instr.opcode == FusedOpcodes::COMPARE_AND_JUMP || instr.opcode == FusedOpcodes::TEST_AND_JUMP
+		? instr.fusedOpcode : instr.opcode;
+}
+
+constexpr bool jumpsAlways(const Instruction& instr) {
+	return jumps(instr) && jumpOpcode(instr) == Opcodes::JUMP_ALWAYS;
+}
+
+// FNV-1a; checksums of bytecode.
+constexpr uint32_t fnv1a(const uint8_t* data, size_t size) {
+	uint32_t hash = 0x811C9DC5;
+	for(size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+// The cases of a SWITCH, parsed into either a dense jump table or a sorted key array.
+struct SwitchTable {
+	bool dense;
+	// Dense: the value of targets[0].
+	uint32_t base;
+	// Sparse: sorted case values, parallel to targets.
+	libatombios_vector<uint32_t> keys;
+	// Instruction indexes; holes in dense tables hold the fallthrough.
+	libatombios_vector<uint32_t> targets;
+
+	// Coverage: how often each of the targets was taken, followed by how often no case matched.
+	libatombios_vector<uint32_t> hits;
+
+	// The index into targets; targets.size() if no case matches.
+	uint32_t slot(uint32_t val) {
+		if(dense) {
+			return val - base < targets.size() ? val - base : targets.size();
+		}
+
+		size_t lo = 0;
+		size_t hi = keys.size();
+		while(lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+			if(keys[mid] < val) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		return (lo < keys.size() && keys[lo] == val) ? lo : targets.size();
+	}
+
+	uint32_t lookup(uint32_t val, uint32_t fallthrough) {
+		uint32_t i = slot(val);
+		return i < targets.size() ? targets[i] : fallthrough;
+	}
+};
+
+/// Native code for hot commands.
+
+// What a run of native code works on; shared with the functions that were translated ahead of time.
+// The generated code keeps it in a callee-saved register.
+using JitFrame = AtomBiosAot::Frame;
+
+// Set in the arg of _jitRead / _jitWrite for Reg operands that already include the reg block.
+constexpr uint32_t jitAbsoluteReg = 0x100;
+
+struct JitCode {
+	void (*entry)(JitFrame* frame) = nullptr;
+	// Executable memory from libatombios_jit_alloc; nullptr for functions that were translated ahead of time.
+	void* memory = nullptr;
+	size_t size = 0;
+
+	// The WorkSpace and parameter space (from params_shift on) the code accesses, in dwords.
+	// Both are allocated up front, so the code does not need to check the indexes.
+	uint32_t workSpaceDwords = 0;
+	uint32_t parameterDwords = 0;
+};
+
+// A set of WorkSpace indexes.
+struct WorkSpaceSet {
+	uint64_t bits[4] = {};
+
+	bool test(uint32_t idx) const { return bits[idx / 64] & (uint64_t(1) << (idx % 64)); }
+	void set(uint32_t idx) { bits[idx / 64] |= uint64_t(1) << (idx % 64); }
+	void reset(uint32_t idx) { bits[idx / 64] &= ~(uint64_t(1) << (idx % 64)); }
+
+	// Returns whether anything was added.
+	bool merge(const WorkSpaceSet& other) {
+		bool changed = false;
+		for(int i = 0; i < 4; i++) {
+			uint64_t merged = bits[i] | other.bits[i];
+			changed |= merged != bits[i];
+			bits[i] = merged;
+		}
+		return changed;
+	}
+};
+
+/// Memoization of pure commands.
+
+// Interpreter state that pure commands may use; a command that touches anything else is not pure.
+enum MemoState : uint8_t {
+	MemoFlagAbove = 1 << 0,
+	MemoFlagEqual = 1 << 1,
+	MemoFlagBelow = 1 << 2,
+	MemoQuotient = 1 << 3,
+	MemoRemainder = 1 << 4,
+	MemoDataBlock = 1 << 5,
+	MemoMaskShift = 1 << 6
+};
+constexpr int memoStateCount = 7;
+constexpr uint8_t memoStateAll = (1 << memoStateCount) - 1;
+
+enum class MemoPurity : uint8_t {
+	Unknown,
+	// Being analyzed; commands that (indirectly) call themselves are not pure.
+	Analyzing,
+	Pure,
+	Impure
+};
+
+// The result of a run of a pure command.
+struct MemoEntry {
+	// The parameter space from params_shift on, followed by the state in DecodedCommand::memoKeyState.
+	libatombios_vector<uint32_t> key;
+	uint32_t hash = 0;
+	// DecodedCommand::memoClock when the entry was last used; the least recently used entry is replaced first.
+	uint32_t lastUse = 0;
+
+	// The parameter space from params_shift on after the run, and the state in DecodedCommand::memoWrittenState
+	// (indexed by bit).
+	libatombios_vector<uint32_t> params;
+	uint32_t state[memoStateCount] = {};
+
+	// Telemetry: the parameter space (in dwords from params_shift on) and WorkSpace the run reached.
+	uint32_t psDwords = 0;
+	uint32_t maxWSIndex = 0;
+};
+
+// The amount of parameter blocks the lockstep interpreter runs at once.
+constexpr size_t lockstepLanes = 8;
+
+/// Footprints.
+
+// The card accesses a command may make, including the commands and IIO functions it calls.
+struct CommandFootprint {
+	// Indexed by AtomBios::FootprintSpace; sorted, without duplicates.
+	libatombios_vector<uint32_t> reads[AtomBios::footprintSpaces];
+	libatombios_vector<uint32_t> writes[AtomBios::footprintSpaces];
+	// Any index of the space may be read / written; the indexes above are then not complete.
+	bool readsAny[AtomBios::footprintSpaces] = {};
+	bool writesAny[AtomBios::footprintSpaces] = {};
+	// Invalid opcodes that may be reached, and tables that are called but do not exist; sorted, without duplicates.
+	libatombios_vector<uint32_t> invalidOpcodes;
+	libatombios_vector<uint32_t> missingTables;
+
+	// What the footprint was found for: the reg block and IO mode the command starts with,
+	// and AtomBiosImpl::_footprintGeneration.
+	bool valid = false;
+	uint16_t regBlock = 0;
+	uint8_t ioMode = 0;
+	uint16_t iioPort = 0;
+	uint32_t generation = 0;
+
+	void clear();
+	bool conflictsWith(const CommandFootprint& other) const;
+};
+
+struct DecodedCommand {
+	// Sorted by ip.
+	libatombios_vector<Instruction> code;
+	libatombios_vector<SwitchTable> switches;
+	// Index of the first instruction to run; this is code[0] unless the optimizer removed it.
+	uint32_t entry = 0;
+
+	// Optimizer statistics.
+	uint32_t foldedRegBlocks = 0;
+	uint32_t forwardedSources = 0;
+	uint32_t deadStores = 0;
+	uint32_t reducedDivisions = 0;
+
+	// JIT state: the amount of runs until now, and the native code once it is compiled.
+	uint32_t runs = 0;
+	bool jitFailed = false;
+	JitCode* jit = nullptr;
+	uint32_t nativeRuns = 0;
+
+	// Superinstruction statistics.
+	uint32_t superinstructions = 0;
+	// The amount of instructions that are covered by the superinstructions.
+	uint32_t fusedInstructions = 0;
+	// The amount of times a superinstruction was run.
+	uint32_t superinstructionsRun = 0;
+	// The amount of instructions that were run by the interpreter.
+	uint64_t instructionsRun = 0;
+
+	// Coverage, allocated when the command is first run with coverage enabled: a bit per instruction that ran, and
+	// per conditional jump, how often it was not taken and taken (two counters per instruction).
+	libatombios_vector<uint64_t> coverage;
+	libatombios_vector<uint32_t> jumpCounts;
+
+	// Memoization: found on the first run with memoization enabled, including the commands that are called.
+	MemoPurity purity = MemoPurity::Unknown;
+	// MemoState the result depends on: what is read before it is written, and what is only written along some paths.
+	uint8_t memoKeyState = 0;
+	// MemoState that may be written, and MemoState that is written along all paths.
+	uint8_t memoWrittenState = 0;
+	uint8_t memoMustWriteState = 0;
+	// Pure commands only; at most AtomBiosImpl::_memoEntries.
+	libatombios_vector<MemoEntry> memo;
+	uint32_t memoClock = 0;
+	uint32_t memoHits = 0;
+	uint32_t memoMisses = 0;
+
+	// Found when it is first asked for, and again when the reg block or IO mode the command starts with changes.
+	CommandFootprint footprint;
+};
+
+/// Watchpoints.
+
+// The watched indexes of a space, for either reads or writes: a bit per index from base on.
+struct WatchBitmap {
+	uint32_t base = 0;
+	// The amount of indexes the bits cover; 0 if nothing is watched.
+	uint32_t count = 0;
+	libatombios_vector<uint64_t> bits;
+
+	bool test(uint32_t idx) const {
+		uint32_t offset = idx - base;
+		return offset < count && (bits[offset / 64] >> (offset % 64)) & 1;
+	}
+};
+
 
 // The actual AtomBios implementation.
 class AtomBiosImpl {
+	// The interface of the code that was translated ahead of time.
+	friend class AtomBiosAot;
 public:
 	AtomBiosImpl(uint8_t* data, size_t size);
 
@@ -354,6 +722,9 @@ public:
 			return _exists;
 		}
 
+		// Filled in the first time the command is run.
+		DecodedCommand* decoded = nullptr;
+
 	private:
 		int _i;
 		uint16_t _offset;
@@ -367,6 +738,8 @@ public:
 
 		void readCommands(const libatombios_vector<uint8_t>& data, uint16_t offset);
 		libatombios_hashmap<int, Command> commands;
+		// The amount of entries in the table (including the ones that do not exist).
+		int count = 0;
 	};
 
 	// This follows the linux driver numbering, however this is not technically needed.
@@ -379,11 +752,82 @@ public:
 	};
 
 	// TODO: this should lock
-	void runCommand(AtomBios::CommandTables table, libatombios_vector<uint32_t> params);
+	void runCommand(AtomBios::CommandTables table, libatombios_vector<uint32_t>& params);
+	bool hasCommand(int table) {
+		Command* command = _commandTable.commands.get(table);
+		return command && command->exists();
+	}
+	void runCommandBatch(AtomBios::CommandTables table, uint32_t* params, size_t size, size_t count);
+	void setBatchWorkers(size_t workers, void (*run)(void (*task)(void* taskContext, size_t worker), void* taskContext,
+		size_t workers, void* context), void* context);
+	void setLockstepBatches(bool enabled) { _lockstepBatches = enabled; }
+
+	AtomBios::FootprintStats footprintStats(int table);
+	size_t footprintIndexes(int table, AtomBios::FootprintSpace space, bool write, uint32_t* indexes, size_t max);
+	size_t footprintInvalidOpcodes(int table, uint8_t* opcodes, size_t max);
+	bool commandsConflict(int a, int b);
+	void runCommands(AtomBios::CommandRequest* requests, size_t count);
+
+	void setTableEntryHook(void (*hook)(AtomBios::CommandTables table, uint32_t depth, void* context), void* context) {
+		_tableEntryHook = hook;
+		_tableEntryHookContext = context;
+	}
+	AtomBios::Snapshot* takeSnapshot();
+	void restoreSnapshot(const AtomBios::Snapshot& snapshot, libatombios_vector<uint32_t>& params);
+
+	void setTraceWriter(void (*write)(const uint8_t* data, size_t size, void* context), void* context, size_t bufferSize);
+	void flushTrace();
+
+	void setTimeline(void (*span)(const AtomBios::TableSpan& span, void* context), uint64_t (*clock)(void* context),
+		uint32_t accessNanoseconds, void* context);
+	AtomBios::CostEstimate estimateCost(int table, const AtomBios::CostModel& model);
+	void setCostCounters(AtomBios::CostCounters* counters) { _costCounters = counters; }
+
+	AtomBios::Recording* recordCommand(AtomBios::CommandTables table, libatombios_vector<uint32_t>& params);
+	bool replayCommand(const AtomBios::Recording& recording, libatombios_vector<uint32_t>& params);
+
+	// Route PLL / MC accesses through an index/data register pair.
+	void setPLLIndexDataPair(uint32_t indexReg, uint32_t dataReg);
+	void setMCIndexDataPair(uint32_t indexReg, uint32_t dataReg);
+	// Forget the cached PLL / MC indexes, e.g. after the host touched the index registers itself.
+	void invalidateIndexCache();
+
+	bool setWatches(const AtomBios::Watch* watches, size_t count,
+		void (*callback)(AtomBios::FootprintSpace space, bool write, uint32_t index, uint32_t val, void* context), void* context);
+
+	void setPostedWrites(uint32_t depth, void (*wait)(void* context), void* context);
+	size_t drainPostedWrites(size_t max);
+	AtomBios::PostedWriteStats postedWriteStats() { return _postedStats; }
+
+	// Back the FB space with host memory.
+	void setFrameBufferWindow(uint8_t* base, size_t size);
+
+	AtomBios::FusionStats fusionStats(int table);
+	void setOpcodeProfile(uint64_t* counts) { _opcodeProfile = counts; }
+
+	void setCoverage(bool enabled) { _coverage = enabled; }
+	AtomBios::CoverageStats coverageStats(int table);
+	size_t coverageBitmap(int table, bool ran, uint8_t* bitmap, size_t max);
+	size_t branchCoverage(int table, AtomBios::BranchCoverage* branches, size_t max);
+
+	void setJitMode(AtomBios::JitMode mode, uint32_t threshold);
+	AtomBios::JitStats jitStats(int table);
+	constexpr uint32_t jitMismatches() { return _jitMismatches; }
+
+	void translateToCpp(const char* moduleName, void (*write)(const char* data, size_t size, void* context), void* context);
+	void setAotModule(const AtomBiosAot::Module* module);
+
+	void setMemoization(uint32_t entries);
+	AtomBios::MemoStats memoStats(int table);
+
+	void setOptimizerMode(AtomBios::OptimizerMode mode);
+	AtomBios::OptimizerStats optimizerStats(int table);
+	constexpr uint32_t selfCheckMismatches() { return _selfCheckMismatches; }
 
 	/// Get various telementry metrics.
 	constexpr uint32_t maxPSIndex() { return _maxPSIndex; }
 	constexpr uint32_t maxWSIndex() { return _maxWSIndex; }
+	constexpr uint32_t skippedIndexWrites() { return _skippedIndexWrites; }
 
 private:
 	constexpr uint16_t read16(size_t offset) {
@@ -395,7 +839,289 @@ private:
 	}
 
 	void copyStructure(void* dest, size_t offset, size_t maxSize);
+	// Decodes the command on its first use.
+	DecodedCommand& _decoded(Command& command);
+	DecodedCommand* _decodeCommand(Command& command);
+	void _optimizeInstructions(DecodedCommand& decoded);
+	void _fuseInstructions(DecodedCommand& decoded);
+	// Drops the decoded form of all commands; they are decoded again when they are run next.
+	void _dropDecodedCommands();
+
+	// Shared by the interpreter and the native code.
+	uint32_t _getSpecialWorkSpace(uint32_t offset);
+	void _setSpecialWorkSpace(uint32_t offset, uint32_t data);
+	void _setDataTable(uint8_t table);
+	void _setATIPort(uint16_t port);
+
+	/// JIT (jit.cpp, jit-x86_64.cpp).
+	AtomBios::JitMode _jitMode = AtomBios::JitMode::Off;
+	uint32_t _jitThreshold = 16;
+	// Set while the interpreter runs the reference side of a differential run.
+	bool _jitSuspended = false;
+	// Differential mode: the amount of runs in which the native code did not match the interpreter.
+	uint32_t _jitMismatches = 0;
+
+	// Returns nullptr if the command can not be compiled; it then stays with the interpreter.
+	JitCode* _jitCompile(Command& command, DecodedCommand& decoded);
+	void _jitFree(JitCode* code);
+	void _runNative(Command& command, DecodedCommand& decoded, libatombios_vector<uint32_t>& params, int params_shift);
+	void _runDifferential(Command& command, libatombios_vector<uint32_t>& params);
+
+	// Called from native code.
+	// Reads and writes of operands that are not in the WorkSpace or parameter space.
+	static uint32_t _jitRead(AtomBiosImpl* impl, uint32_t arg, uint32_t idx);
+	static void _jitWrite(AtomBiosImpl* impl, uint32_t arg, uint32_t idx, uint32_t val);
+	static void _jitDivide(AtomBiosImpl* impl, uint32_t dividend, uint32_t divisor);
+	static uint32_t _jitSwitch(SwitchTable* table, uint32_t val, uint32_t fallthrough);
+	static void _jitCallTable(JitFrame* frame, uint32_t table);
+	// Opcodes without operands: SET_DATA_TABLE, SET_ATI_PORT, SET_PCI_PORT, SET_SYSIO_PORT, SET_REG_BLOCK and DELAY_MICROSECONDS.
+	static void _jitMisc(AtomBiosImpl* impl, uint32_t opcode, uint32_t imm);
+
+	/// Code translated ahead of time (aot.cpp).
+	const AtomBiosAot::Module* _aotModule = nullptr;
+	// By table and by IIO port; entries are only set for functions whose bytecode matches the ROM.
+	libatombios_vector<const AtomBiosAot::Command*> _aotCommands;
+	libatombios_vector<const AtomBiosAot::IIOFunction*> _aotIIOFunctions;
+
+	bool _aotSourceMatches(const AtomBiosAot::Source& source);
+	// Native code for a translated command, or nullptr.
+	JitCode* _aotCode(Command& command);
+	// Size of the IIO function at offset, including the END opcode; 0 if it contains invalid opcodes.
+	uint32_t _iioFunctionSize(uint32_t offset);
+	static uint32_t _iioInstructionLength(uint8_t opcode);
+	// Runs the IIO function of the current port.
+	uint32_t _runIIOPort(uint32_t index, uint32_t data);
+
+	/// Batches (batch.cpp).
+	void _runCommand(Command& command, libatombios_vector<uint32_t>& params);
+	// Runs the blocks from first up to end, one after the other.
+	void _runBatchBlocks(Command& command, uint32_t* params, size_t size, size_t first, size_t end);
+
+	size_t _batchWorkerCount = 0;
+	void (*_batchRun)(void (*task)(void* taskContext, size_t worker), void* taskContext, size_t workers, void* context) = nullptr;
+	void* _batchRunContext = nullptr;
+	// Created on their first use; each one only runs on one thread at a time.
+	libatombios_vector<AtomBiosImpl*> _batchWorkers;
+
+	struct BatchTask;
+	static void _runBatchTask(void* taskContext, size_t worker);
+	// Takes over the modes (and the translated module) of this AtomBios.
+	void _configureWorker(AtomBiosImpl* worker);
+
+	/// The lockstep interpreter (lockstep.cpp).
+	bool _lockstepBatches = false;
+
+	bool _lockstepSupported(Command& command, DecodedCommand& decoded);
+	// Runs the blocks from first up to end (at most lockstepLanes of them) together.
+	void _runLockstep(Command& command, DecodedCommand& decoded, uint32_t* params, size_t size, size_t first, size_t end);
+
+	/// Footprints (footprint.cpp) and running commands by them (schedule.cpp).
+	// Changed along with the index/data pairs, which footprints include.
+	uint32_t _footprintGeneration = 0;
+
+	struct FootprintAnalysis;
+	// The footprint of the command, for the current reg block and IO mode.
+	const CommandFootprint& _footprint(Command& command);
+
+	struct ScheduleTask;
+	static void _runScheduleTask(void* taskContext, size_t worker);
+	// Runs a request from the start state of the task.
+	void _runScheduled(ScheduleTask& task, size_t request);
+
+	/// Recordings (replay.cpp).
+	friend struct AtomBios::Recording;
+
+	// Copies the FB window, or overwrites it.
+	void _saveFrameBuffer(libatombios_vector<uint8_t>& fb);
+	void _restoreFrameBuffer(const libatombios_vector<uint8_t>& fb);
+
+	/// Snapshots (snapshot.cpp).
+	friend struct AtomBios::Snapshot;
+
+	void (*_tableEntryHook)(AtomBios::CommandTables table, uint32_t depth, void* context) = nullptr;
+	void* _tableEntryHookContext = nullptr;
+	// Set while runCommand (or restoreSnapshot) runs.
+	bool _runActive = false;
+	// The command being entered, while the hook runs.
+	Command* _enteredCommand = nullptr;
+	libatombios_vector<uint32_t>* _enteredParams = nullptr;
+	int _enteredParamsShift = 0;
+	// restoreSnapshot enters the command again; the hook is not called for it.
+	bool _resumingEntry = false;
+
+	// A command that waits for the command it called.
+	struct CallFrame {
+		// nullptr for native code, which can not be continued.
+		Command* command;
+		const libatombios_vector<uint32_t>* workSpace;
+		// Offset into the bytecode of the instruction that follows the call; instructionExit if there is none.
+		uint32_t resumeIp;
+		int paramsShift;
+	};
+	libatombios_vector<CallFrame> _callStack;
+
+	// Calls the table entry hook.
+	void _enterTable(Command& command, libatombios_vector<uint32_t>& params, int params_shift);
+	// The index of the instruction at the given offset into the bytecode.
+	uint32_t _instructionAt(DecodedCommand& decoded, uint32_t ip);
+
+	/// Memoization (memo.cpp).
+	// Cached results per pure command; 0 disables memoization.
+	uint32_t _memoEntries = 0;
+
+	// Fills in the purity of the command, and the MemoState it uses.
+	void _analyzePurity(Command& command, DecodedCommand& decoded);
+	uint32_t _memoState(int bit);
+	void _setMemoState(int bit, uint32_t val);
+	// Runs a pure command, or takes its result from the cache.
+	void _runMemoized(Command& command, DecodedCommand& decoded, libatombios_vector<uint32_t>& params, int params_shift);
+
+	// The state a command run changes, besides the parameter space and FB window.
+	// Used to run a command twice from the same starting point.
+	struct RunState {
+		uint32_t dataBlock;
+		IOMode ioMode;
+		uint16_t iioPort;
+		uint16_t regBlock;
+		bool pllIndexValid;
+		uint32_t pllIndex;
+		bool mcIndexValid;
+		uint32_t mcIndex;
+		uint32_t fbBlock;
+		bool flagAbove;
+		bool flagEqual;
+		bool flagBelow;
+		uint32_t divMulQuotient;
+		uint32_t divMulRemainder;
+		uint32_t iioIOAttr;
+		uint32_t workSpaceMaskShift;
+
+		// Telemetry; restored, but not compared.
+		uint32_t maxPSIndex;
+		uint32_t maxWSIndex;
+		uint32_t skippedIndexWrites;
+
+		bool sameAs(const RunState& other) const;
+	};
+	RunState _saveRunState();
+	void _restoreRunState(const RunState& state);
+	// Parameter spaces may differ in size, as native code allocates everything it could access up front.
+	static bool _sameParameterSpace(const libatombios_vector<uint32_t>& a, const libatombios_vector<uint32_t>& b);
+
+	/// Card accesses.
+	// Everything that reaches the libatombios_card_* / libatombios_delay_* functions goes through these,
+	// so that the accesses of a run can be recorded, and replayed to another run.
+	enum class CardSpace : uint8_t {
+		Reg,
+		PLL,
+		MC,
+		// Written to only; the value is the delay in microseconds.
+		Delay
+	};
+	uint32_t _cardRead(CardSpace space, uint32_t reg);
+	void _cardWrite(CardSpace space, uint32_t reg, uint32_t val);
+
+	/// Posted writes (posted.cpp).
+	// A single-producer single-consumer ring: the thread that runs commands pushes at the tail, the I/O thread
+	// pops at the head. Both only ever grow; the writes between them are pending.
+	struct PostedWrite {
+		CardSpace space;
+		uint32_t reg;
+		uint32_t val;
+	};
+	libatombios_vector<PostedWrite> _postedQueue;
+	// The size of the queue minus 1; 0 while writes are not posted.
+	uint32_t _postedMask = 0;
+	uint64_t _postedTail = 0;
+	// Keeps the head, which the I/O thread writes, off the cache line of the tail.
+	uint8_t _postedPadding[64];
+	uint64_t _postedHead = 0;
+	void (*_postedWait)(void* context) = nullptr;
+	void* _postedWaitContext = nullptr;
+	AtomBios::PostedWriteStats _postedStats{};
+	void _postWrite(CardSpace space, uint32_t reg, uint32_t val);
+	// Waits until the I/O thread made all posted writes.
+	void _waitPostedWrites();
+
+	struct CardAccess {
+		CardSpace space;
+		bool write;
+		uint32_t reg;
+		uint32_t val;
+	};
+	enum class CardTraceMode {
+		Off,
+		// Accesses are made, and appended to _cardTrace.
+		Record,
+		// Accesses are checked against _cardTrace instead of being made; reads return the recorded values.
+		Replay,
+		// Like Replay, until the end of _cardTrace is reached; the accesses after that are made again.
+		FastForward
+	};
+	CardTraceMode _cardTraceMode = CardTraceMode::Off;
+	libatombios_vector<CardAccess> _cardTrace;
+	size_t _cardTracePos = 0;
+	// Replay: set on the first access that differs from the trace.
+	bool _cardTraceDiverged = false;
+	uint32_t _replayCardAccess(CardSpace space, bool write, uint32_t reg, uint32_t val);
+	// Whether the access is taken from the trace, rather than made.
+	bool _cardAccessReplayed(CardSpace space, bool write, uint32_t reg, uint32_t val);
+
+	/// Binary traces (trace.cpp).
+	void (*_traceWrite)(const uint8_t* data, size_t size, void* context) = nullptr;
+	void* _traceWriteContext = nullptr;
+	libatombios_vector<uint8_t> _traceBuffer;
+	size_t _traceUsed = 0;
+	// The register and value of the last Read / Write event, which the next one is encoded against.
+	uint32_t _traceReg = 0;
+	uint32_t _traceVal = 0;
+
+	// Room for the next event; flushes the buffer if needed.
+	uint8_t* _traceReserve();
+	void _traceTableEnter(int table);
+	void _traceTableExit();
+	void _traceAccess(CardSpace space, bool write, uint32_t reg, uint32_t val);
+
+	/// Timeline (timeline.cpp).
+	void (*_timelineSpan)(const AtomBios::TableSpan& span, void* context) = nullptr;
+	uint64_t (*_timelineClock)(void* context) = nullptr;
+	void* _timelineContext = nullptr;
+	uint32_t _timelineAccessNanoseconds = 0;
+	// Without a clock: the simulated time.
+	uint64_t _timelineTime = 0;
+	// The spans of the tables that are running, innermost last.
+	libatombios_vector<AtomBios::TableSpan> _timelineSpans;
+
+	uint64_t _timelineNow();
+	void _timelineEnter(int table);
+	void _timelineExit();
+	void _timelineAccess(CardSpace space, bool write, uint32_t val);
+
+	/// Cost model (cost.cpp).
+	struct CostAnalysis;
+	// Measured costs, while set (setCostCounters).
+	AtomBios::CostCounters* _costCounters = nullptr;
+	void _costAccess(CardSpace space, bool write, uint32_t val);
+
+	AtomBios::OptimizerMode _optimizerMode = AtomBios::OptimizerMode::Off;
+	// Self-check mode: the amount of optimized instructions whose result differed from the plain interpreter.
+	uint32_t _selfCheckMismatches = 0;
+
+	// Instructions run per opcode, while set (setOpcodeProfile).
+	uint64_t* _opcodeProfile = nullptr;
+
+	/// Coverage (coverage.cpp).
+	bool _coverage = false;
+	void _allocCoverage(DecodedCommand& decoded);
+	// The bytecode offsets of the instructions that are reachable (or that ran), as a bitmap.
+	void _coverageBits(Command& command, bool ran, libatombios_vector<uint8_t>& bitmap);
+
 	void _runBytecode(Command& command, libatombios_vector<uint32_t>& params, int params_shift);
+	// Runs the command as native code or with the interpreter; _runBytecode may take the result from the memo cache instead.
+	void _runDecoded(Command& command, DecodedCommand& decoded, libatombios_vector<uint32_t>& params, int params_shift);
+	// Runs the command with the interpreter, from the instruction at start; the WorkSpace is zeroed unless it is given.
+	void _interpret(Command& command, DecodedCommand& decoded, libatombios_vector<uint32_t>& params, int params_shift,
+		uint32_t start, const libatombios_vector<uint32_t>* startWorkSpace);
 
 	libatombios_vector<uint8_t> _data;
 	size_t _atomRomTableBase = 0;
@@ -421,8 +1147,54 @@ private:
 	uint16_t _regBlock = 0;
 	uint32_t _doIORead(uint32_t reg);
 	void _doIOWrite(uint32_t reg, uint32_t val);
-	// Current FB block.
-	uint16_t _fbBlock = 0;
+
+	// An index/data register pair in the MM space, through which an indirect register space is reached.
+	struct IndexDataPair {
+		bool enabled = false;
+		uint32_t indexReg = 0;
+		uint32_t dataReg = 0;
+
+		// The index that was last written into indexReg.
+		// Used to skip the index write when the same index is accessed repeatedly.
+		bool indexValid = false;
+		uint32_t index = 0;
+	};
+
+	// PLL and MC spaces.
+	// By default these are forwarded to the libatombios_card_pll_* / libatombios_card_mc_* functions;
+	// if an index/data pair is configured, they are accessed through it instead.
+	IndexDataPair _pllIndexData;
+	IndexDataPair _mcIndexData;
+	void _selectIndex(IndexDataPair& pair, uint32_t index);
+	uint32_t _doPLLRead(uint32_t reg);
+	void _doPLLWrite(uint32_t reg, uint32_t val);
+	uint32_t _doMCRead(uint32_t reg);
+	void _doMCWrite(uint32_t reg, uint32_t val);
+
+	// Watchpoints, by space (reg, PLL, MC) and by reads / writes; checked by the _do* functions above.
+	static constexpr int watchSpaces = 3;
+	WatchBitmap _watchBits[watchSpaces][2];
+	void (*_watchCallback)(AtomBios::FootprintSpace space, bool write, uint32_t index, uint32_t val, void* context) = nullptr;
+	void* _watchContext = nullptr;
+	void _watchHit(AtomBios::FootprintSpace space, bool write, uint32_t index, uint32_t val) {
+		_watchCallback(space, write, index, val, _watchContext);
+	}
+
+	// Host memory backing the FB space; usually the BIOS scratch area in VRAM.
+	uint8_t* _fbWindow = nullptr;
+	size_t _fbWindowSize = 0;
+	// Current FB block (in bytes); FB indexes are dwords relative to this.
+	// Mapped into the WorkSpace.
+	uint32_t _fbBlock = 0;
+	// Amount of dwords that are inside the window from _fbBlock on.
+	// This is recomputed whenever the block or the window changes, so accesses only need a single compare.
+	uint32_t _fbBlockDwords = 0;
+	// Whether an access outside of the current window was logged.
+	bool _fbOutsideLogged = false;
+	void _setFBBlock(uint32_t block);
+	void _logFBOutside(bool write, uint32_t idx);
+	uint32_t _doFBRead(uint32_t idx);
+	void _doFBWrite(uint32_t idx, uint32_t val);
 
 	// Flags.
 	bool _flagAbove = false;
@@ -448,6 +1220,42 @@ private:
 	uint32_t _maxPSIndex = 0;
 	// The highest index into the work space reached.
 	uint32_t _maxWSIndex = 0;
+	// The amount of PLL / MC index writes that were skipped, as the index was already selected.
+	uint32_t _skippedIndexWrites = 0;
+};
+
+// A snapshot of the interpreter state, and possibly of a run; see AtomBios::takeSnapshot.
+struct AtomBios::Snapshot {
+	AtomBiosImpl::RunState state;
+
+	// The parameter space of the run, including the one of the calling commands.
+	libatombios_vector<uint32_t> params;
+
+	struct Frame {
+		int table;
+		// See AtomBiosImpl::CallFrame.
+		uint32_t resumeIp;
+		int paramsShift;
+		libatombios_vector<uint32_t> workSpace;
+	};
+	// Outermost first; the last one is the command that was entered, which starts from its beginning.
+	// Empty outside of runs.
+	libatombios_vector<Frame> frames;
+};
+
+// The card accesses of a run, and what it started from and left behind; see AtomBios::recordCommand.
+struct AtomBios::Recording {
+	int table;
+
+	AtomBiosImpl::RunState startState;
+	libatombios_vector<uint32_t> startParams;
+	libatombios_vector<uint8_t> startFB;
+
+	libatombios_vector<AtomBiosImpl::CardAccess> accesses;
+
+	AtomBiosImpl::RunState endState;
+	libatombios_vector<uint32_t> endParams;
+	libatombios_vector<uint8_t> endFB;
 };
 
 void* operator new(size_t size);
@@ -19,12 +19,191 @@ void AtomBios::runCommand(CommandTables table, uint32_t* params, size_t size) {
 	memcpy(params, paramVector.data(), size * sizeof(uint32_t));
 }
 
+void AtomBios::runCommandBatch(CommandTables table, uint32_t* params, size_t size, size_t count) {
+	_impl->runCommandBatch(table, params, size, count);
+}
+void AtomBios::setBatchWorkers(size_t workers, void (*run)(void (*task)(void* taskContext, size_t worker), void* taskContext,
+		size_t workers, void* context), void* context) {
+	_impl->setBatchWorkers(workers, run, context);
+}
+
+void AtomBios::setLockstepBatches(bool enabled) {
+	_impl->setLockstepBatches(enabled);
+}
+
+bool AtomBios::hasCommand(CommandTables table) {
+	return _impl->hasCommand(table);
+}
+
+AtomBios::FootprintStats AtomBios::footprintStats(CommandTables table) {
+	return _impl->footprintStats(table);
+}
+size_t AtomBios::footprintIndexes(CommandTables table, FootprintSpace space, bool write, uint32_t* indexes, size_t max) {
+	return _impl->footprintIndexes(table, space, write, indexes, max);
+}
+size_t AtomBios::footprintInvalidOpcodes(CommandTables table, uint8_t* opcodes, size_t max) {
+	return _impl->footprintInvalidOpcodes(table, opcodes, max);
+}
+bool AtomBios::commandsConflict(CommandTables a, CommandTables b) {
+	return _impl->commandsConflict(a, b);
+}
+void AtomBios::runCommands(CommandRequest* requests, size_t count) {
+	_impl->runCommands(requests, count);
+}
+
+void AtomBios::setTableEntryHook(void (*hook)(CommandTables table, uint32_t depth, void* context), void* context) {
+	_impl->setTableEntryHook(hook, context);
+}
+AtomBios::Snapshot* AtomBios::takeSnapshot() {
+	return _impl->takeSnapshot();
+}
+void AtomBios::restoreSnapshot(const Snapshot* snapshot, uint32_t* params, size_t size) {
+	libatombios_vector<uint32_t> paramVector;
+	paramVector.resize(size);
+	memcpy(paramVector.data(), params, size * sizeof(uint32_t));
+
+	_impl->restoreSnapshot(*snapshot, paramVector);
+
+	memcpy(params, paramVector.data(), size * sizeof(uint32_t));
+}
+void AtomBios::freeSnapshot(Snapshot* snapshot) {
+	delete snapshot;
+}
+
+AtomBios::Recording* AtomBios::recordCommand(CommandTables table, uint32_t* params, size_t size) {
+	libatombios_vector<uint32_t> paramVector;
+	paramVector.resize(size);
+	memcpy(paramVector.data(), params, size * sizeof(uint32_t));
+
+	Recording* recording = _impl->recordCommand(table, paramVector);
+
+	memcpy(params, paramVector.data(), size * sizeof(uint32_t));
+	return recording;
+}
+bool AtomBios::replayCommand(const Recording* recording, uint32_t* params, size_t size) {
+	libatombios_vector<uint32_t> paramVector;
+	paramVector.resize(size);
+	memcpy(paramVector.data(), params, size * sizeof(uint32_t));
+
+	bool replayed = _impl->replayCommand(*recording, paramVector);
+
+	memcpy(params, paramVector.data(), size * sizeof(uint32_t));
+	return replayed;
+}
+void AtomBios::freeRecording(Recording* recording) {
+	delete recording;
+}
+
+void AtomBios::setTraceWriter(void (*write)(const uint8_t* data, size_t size, void* context), void* context, size_t bufferSize) {
+	_impl->setTraceWriter(write, context, bufferSize);
+}
+void AtomBios::flushTrace() {
+	_impl->flushTrace();
+}
+
+AtomBios::CostEstimate AtomBios::estimateCost(CommandTables table, const CostModel& model) {
+	return _impl->estimateCost(table, model);
+}
+void AtomBios::setCostCounters(CostCounters* counters) {
+	_impl->setCostCounters(counters);
+}
+
+bool AtomBios::setWatches(const Watch* watches, size_t count,
+		void (*callback)(FootprintSpace space, bool write, uint32_t index, uint32_t val, void* context), void* context) {
+	return _impl->setWatches(watches, count, callback, context);
+}
+
+void AtomBios::setPostedWrites(uint32_t depth, void (*wait)(void* context), void* context) {
+	_impl->setPostedWrites(depth, wait, context);
+}
+size_t AtomBios::drainPostedWrites(size_t max) {
+	return _impl->drainPostedWrites(max);
+}
+AtomBios::PostedWriteStats AtomBios::postedWriteStats() {
+	return _impl->postedWriteStats();
+}
+
+void AtomBios::setTimeline(void (*span)(const TableSpan& span, void* context), uint64_t (*clock)(void* context),
+		uint32_t accessNanoseconds, void* context) {
+	_impl->setTimeline(span, clock, accessNanoseconds, context);
+}
+
+void AtomBios::setPLLIndexDataPair(uint32_t indexReg, uint32_t dataReg) {
+	_impl->setPLLIndexDataPair(indexReg, dataReg);
+}
+void AtomBios::setMCIndexDataPair(uint32_t indexReg, uint32_t dataReg) {
+	_impl->setMCIndexDataPair(indexReg, dataReg);
+}
+void AtomBios::invalidateIndexCache() {
+	_impl->invalidateIndexCache();
+}
+void AtomBios::setFrameBufferWindow(uint8_t* base, size_t size) {
+	_impl->setFrameBufferWindow(base, size);
+}
+
+AtomBios::FusionStats AtomBios::fusionStats(CommandTables table) {
+	return _impl->fusionStats(table);
+}
+void AtomBios::setOpcodeProfile(uint64_t* counts) {
+	_impl->setOpcodeProfile(counts);
+}
+
+void AtomBios::setCoverage(bool enabled) {
+	_impl->setCoverage(enabled);
+}
+AtomBios::CoverageStats AtomBios::coverageStats(CommandTables table) {
+	return _impl->coverageStats(table);
+}
+size_t AtomBios::coverageBitmap(CommandTables table, bool ran, uint8_t* bitmap, size_t max) {
+	return _impl->coverageBitmap(table, ran, bitmap, max);
+}
+size_t AtomBios::branchCoverage(CommandTables table, BranchCoverage* branches, size_t max) {
+	return _impl->branchCoverage(table, branches, max);
+}
+
+void AtomBios::setJitMode(JitMode mode, uint32_t threshold) {
+	_impl->setJitMode(mode, threshold);
+}
+AtomBios::JitStats AtomBios::jitStats(CommandTables table) {
+	return _impl->jitStats(table);
+}
+uint32_t AtomBios::jitMismatches() {
+	return _impl->jitMismatches();
+}
+
+void AtomBios::translateToCpp(const char* moduleName, void (*write)(const char* data, size_t size, void* context), void* context) {
+	_impl->translateToCpp(moduleName, write, context);
+}
+void AtomBios::setAotModule(const AtomBiosAot::Module* module) {
+	_impl->setAotModule(module);
+}
+
+void AtomBios::setMemoization(uint32_t entries) {
+	_impl->setMemoization(entries);
+}
+AtomBios::MemoStats AtomBios::memoStats(CommandTables table) {
+	return _impl->memoStats(table);
+}
+
+void AtomBios::setOptimizerMode(OptimizerMode mode) {
+	_impl->setOptimizerMode(mode);
+}
+AtomBios::OptimizerStats AtomBios::optimizerStats(CommandTables table) {
+	return _impl->optimizerStats(table);
+}
+uint32_t AtomBios::selfCheckMismatches() {
+	return _impl->selfCheckMismatches();
+}
+
 const uint32_t AtomBios::maxPSIndex() {
 	return _impl->maxPSIndex();
 }
 const uint32_t AtomBios::maxWSIndex() {
 	return _impl->maxWSIndex();
 }
+uint32_t AtomBios::skippedIndexWrites() {
+	return _impl->skippedIndexWrites();
+}
 
 AtomBiosImpl::AtomBiosImpl(uint8_t* data, size_t size) {
 	// Copy the bios data.
@@ -92,31 +271,41 @@ void AtomBiosImpl::copyStructure(void* dest, size_t offset, size_t maxSize) {
 
 /// TODO: this is not the way we should do this lol
 uint32_t AtomBiosImpl::_doIORead(uint32_t reg) {
+	uint32_t val = 0;
 	switch(_ioMode) {
-	case IOMode::MM: return libatombios_card_reg_read(reg);
+	case IOMode::MM:
+		val = _cardRead(CardSpace::Reg, reg);
+		break;
 
 	case IOMode::PCI:
 		lilrad_log(WARNING, "PCI reads are not implemented (requested reg: 0x%x)\n", reg);
-		return 0;
+		break;
 	case IOMode::SYSIO:
 		lilrad_log(WARNING, "SYSIO reads are not implemented (requested reg: 0x%x)\n", reg);
-		return 0;
+		break;
 	case IOMode::IIO:
 		if(_iioIndexes[_iioPort]) {
-			return _runIIO(_iioIndexes[_iioPort], reg, 0);
+			val = _runIIOPort(reg, 0);
 		} else {
 			lilrad_log(WARNING, "Invalid IIO port %02x (function does not exist, requested reg: %04x)\n", _iioPort, reg);
 		}
-		return 0;
+		break;
 	}
 
-	return 0;
+	if(_watchBits[0][false].test(reg)) {
+		_watchHit(AtomBios::FootprintSpace::Reg, false, reg, val);
+	}
+	return val;
 }
 
 void AtomBiosImpl::_doIOWrite(uint32_t reg, uint32_t val) {
+	if(_watchBits[0][true].test(reg)) {
+		_watchHit(AtomBios::FootprintSpace::Reg, true, reg, val);
+	}
+
 	switch(_ioMode) {
 	case IOMode::MM:
-		libatombios_card_reg_write(reg, val);
+		_cardWrite(CardSpace::Reg, reg, val);
 		return;
 	case IOMode::PCI:
 	case IOMode::SYSIO:
@@ -124,7 +313,7 @@ void AtomBiosImpl::_doIOWrite(uint32_t reg, uint32_t val) {
 		return;
 	case IOMode::IIO:
 		if(_iioIndexes[_iioPort]) {
-			_runIIO(_iioIndexes[_iioPort], reg, val);
+			_runIIOPort(reg, val);
 		} else {
 			lilrad_log(WARNING, "Invalid IIO port %02x (function does not exist, requested reg/val: %04x <- %x)\n", _iioPort, reg, val);
 		}
@@ -132,6 +321,330 @@ void AtomBiosImpl::_doIOWrite(uint32_t reg, uint32_t val) {
 	}
 }
 
+bool AtomBiosImpl::_cardAccessReplayed(CardSpace space, bool write, uint32_t reg, uint32_t val) {
+	switch(_cardTraceMode) {
+	case CardTraceMode::Off:
+	case CardTraceMode::Record:
+		return false;
+	case CardTraceMode::Replay:
+		return true;
+	case CardTraceMode::FastForward:
+		if(_cardTracePos < _cardTrace.size()) {
+			const CardAccess& expected = _cardTrace[_cardTracePos];
+			if(expected.space == space && expected.write == write && expected.reg == reg && (!write || expected.val == val)) {
+				return true;
+			}
+			lilrad_log(ERROR, "replay: access %zu is %s %x (space %i, val %x), but the recording has %s %x (space %i, val %x)\n",
+				_cardTracePos, write ? "write" : "read", reg, static_cast<int>(space), val,
+				expected.write ? "write" : "read", expected.reg, static_cast<int>(expected.space), expected.val);
+		}
+
+		// This access, and the ones after it, are made again.
+		_cardTraceMode = CardTraceMode::Off;
+		return false;
+	}
+
+	return false;
+}
+
+uint32_t AtomBiosImpl::_cardRead(CardSpace space, uint32_t reg) {
+	if(_cardAccessReplayed(space, false, reg, 0)) {
+		return _replayCardAccess(space, false, reg, 0);
+	}
+
+	if(_postedMask) {
+		_waitPostedWrites();
+	}
+
+	uint32_t val = 0;
+	switch(space) {
+	case CardSpace::Reg:
+		val = libatombios_card_reg_read(reg);
+		break;
+	case CardSpace::PLL:
+		val = libatombios_card_pll_read(reg);
+		break;
+	case CardSpace::MC:
+		val = libatombios_card_mc_read(reg);
+		break;
+	case CardSpace::Delay:
+		assert(false && "delays can not be read");
+		break;
+	}
+
+	if(_cardTraceMode == CardTraceMode::Record) {
+		_cardTrace.push_back(CardAccess{space, false, reg, val});
+	}
+	if(_traceWrite) {
+		_traceAccess(space, false, reg, val);
+	}
+	if(_timelineSpan) {
+		_timelineAccess(space, false, val);
+	}
+	if(_costCounters) {
+		_costAccess(space, false, val);
+	}
+	return val;
+}
+
+void AtomBiosImpl::_cardWrite(CardSpace space, uint32_t reg, uint32_t val) {
+	// The bytecode may select an index itself, with a MOVE in MM mode or from an IIO function.
+	if(space == CardSpace::Reg) {
+		if(_pllIndexData.enabled && reg == _pllIndexData.indexReg) {
+			_pllIndexData.indexValid = true;
+			_pllIndexData.index = val;
+		}
+		if(_mcIndexData.enabled && reg == _mcIndexData.indexReg) {
+			_mcIndexData.indexValid = true;
+			_mcIndexData.index = val;
+		}
+	}
+
+	if(_cardAccessReplayed(space, true, reg, val)) {
+		_replayCardAccess(space, true, reg, val);
+		return;
+	}
+	if(_cardTraceMode == CardTraceMode::Record) {
+		_cardTrace.push_back(CardAccess{space, true, reg, val});
+	}
+	if(_traceWrite) {
+		_traceAccess(space, true, reg, val);
+	}
+	if(_timelineSpan) {
+		_timelineAccess(space, true, val);
+	}
+	if(_costCounters) {
+		_costAccess(space, true, val);
+	}
+	if(_postedMask) {
+		if(space != CardSpace::Delay) {
+			_postWrite(space, reg, val);
+			return;
+		}
+		_waitPostedWrites();
+	}
+
+	switch(space) {
+	case CardSpace::Reg:
+		libatombios_card_reg_write(reg, val);
+		break;
+	case CardSpace::PLL:
+		libatombios_card_pll_write(reg, val);
+		break;
+	case CardSpace::MC:
+		libatombios_card_mc_write(reg, val);
+		break;
+	case CardSpace::Delay:
+		libatombios_delay_microseconds(val);
+		break;
+	}
+}
+
+void AtomBiosImpl::setPLLIndexDataPair(uint32_t indexReg, uint32_t dataReg) {
+	_pllIndexData.enabled = true;
+	_pllIndexData.indexReg = indexReg;
+	_pllIndexData.dataReg = dataReg;
+	_pllIndexData.indexValid = false;
+	_footprintGeneration++;
+}
+
+void AtomBiosImpl::setMCIndexDataPair(uint32_t indexReg, uint32_t dataReg) {
+	_mcIndexData.enabled = true;
+	_mcIndexData.indexReg = indexReg;
+	_mcIndexData.dataReg = dataReg;
+	_mcIndexData.indexValid = false;
+	_footprintGeneration++;
+}
+
+void AtomBiosImpl::invalidateIndexCache() {
+	_pllIndexData.indexValid = false;
+	_mcIndexData.indexValid = false;
+}
+
+bool AtomBiosImpl::setWatches(const AtomBios::Watch* watches, size_t count,
+		void (*callback)(AtomBios::FootprintSpace space, bool write, uint32_t index, uint32_t val, void* context), void* context) {
+	// The range each bitmap has to cover.
+	uint32_t first[watchSpaces][2];
+	uint32_t last[watchSpaces][2];
+	bool any[watchSpaces][2] = {};
+	for(size_t i = 0; i < count; i++) {
+		const AtomBios::Watch& watch = watches[i];
+		int space = static_cast<int>(watch.space);
+		if(space >= watchSpaces || watch.first > watch.last) {
+			lilrad_log(WARNING, "watch %zu is not a range of registers, PLL or MC indexes\n", i);
+			return false;
+		}
+		for(bool write : {false, true}) {
+			if(!(write ? watch.writes : watch.reads)) {
+				continue;
+			}
+			if(!any[space][write] || watch.first < first[space][write]) {
+				first[space][write] = watch.first;
+			}
+			if(!any[space][write] || watch.last > last[space][write]) {
+				last[space][write] = watch.last;
+			}
+			any[space][write] = true;
+		}
+	}
+	for(int space = 0; space < watchSpaces; space++) {
+		for(bool write : {false, true}) {
+			if(any[space][write] && last[space][write] - first[space][write] >= AtomBios::maxWatchSpan) {
+				lilrad_log(WARNING, "watched indexes of space %i span 0x%x indexes, more than 0x%x\n", space,
+					last[space][write] - first[space][write] + 1, AtomBios::maxWatchSpan);
+				return false;
+			}
+		}
+	}
+
+	for(int space = 0; space < watchSpaces; space++) {
+		for(bool write : {false, true}) {
+			WatchBitmap& bitmap = _watchBits[space][write];
+			bitmap.base = any[space][write] ? first[space][write] : 0;
+			bitmap.count = any[space][write] ? last[space][write] - first[space][write] + 1 : 0;
+			bitmap.bits.clear();
+			bitmap.bits.resize((bitmap.count + 63) / 64, 0);
+		}
+	}
+	for(size_t i = 0; i < count; i++) {
+		const AtomBios::Watch& watch = watches[i];
+		for(bool write : {false, true}) {
+			if(!(write ? watch.writes : watch.reads)) {
+				continue;
+			}
+			WatchBitmap& bitmap = _watchBits[static_cast<int>(watch.space)][write];
+			for(uint32_t offset = watch.first - bitmap.base; offset <= watch.last - bitmap.base; offset++) {
+				bitmap.bits[offset / 64] |= static_cast<uint64_t>(1) << (offset % 64);
+			}
+		}
+	}
+	_watchCallback = callback;
+	_watchContext = context;
+	return true;
+}
+
+void AtomBiosImpl::setFrameBufferWindow(uint8_t* base, size_t size) {
+	_fbWindow = base;
+	_fbWindowSize = base ? size : 0;
+	_fbOutsideLogged = false;
+	_setFBBlock(_fbBlock);
+}
+
+void AtomBiosImpl::_setFBBlock(uint32_t block) {
+	_fbBlock = block;
+	_fbBlockDwords = block < _fbWindowSize ? (_fbWindowSize - block) / sizeof(uint32_t) : 0;
+}
+
+// ROMs may use the FB scratch area in loops, so only the first access outside of a window is logged.
+void AtomBiosImpl::_logFBOutside(bool write, uint32_t idx) {
+	if(_fbOutsideLogged) {
+		return;
+	}
+	_fbOutsideLogged = true;
+	lilrad_log(WARNING, "FB %s outside of the window (block: 0x%x, idx: 0x%x, window size: 0x%zx); further ones are not logged\n",
+		write ? "write" : "read", _fbBlock, idx, _fbWindowSize);
+}
+
+// The bounds are checked on each access rather than when the command is decoded: the block is set at run time, by
+// writes to WS_FB_WINDOW, and the window may be replaced between runs, while the decoded command is kept.
+// _setFBBlock folds both into a single dword count, so the check is one comparison.
+uint32_t AtomBiosImpl::_doFBRead(uint32_t idx) {
+	if(idx >= _fbBlockDwords) {
+		_logFBOutside(false, idx);
+		return 0;
+	}
+
+	if(_costCounters) {
+		_costCounters->reads[static_cast<int>(AtomBios::FootprintSpace::FB)]++;
+	}
+
+	uint32_t val;
+	memcpy(&val, _fbWindow + _fbBlock + idx * sizeof(uint32_t), sizeof(uint32_t));
+	return val;
+}
+
+void AtomBiosImpl::_doFBWrite(uint32_t idx, uint32_t val) {
+	if(idx >= _fbBlockDwords) {
+		_logFBOutside(true, idx);
+		return;
+	}
+
+	if(_costCounters) {
+		_costCounters->writes[static_cast<int>(AtomBios::FootprintSpace::FB)]++;
+	}
+
+	memcpy(_fbWindow + _fbBlock + idx * sizeof(uint32_t), &val, sizeof(uint32_t));
+}
+
+void AtomBiosImpl::_selectIndex(IndexDataPair& pair, uint32_t index) {
+	if(pair.indexValid && pair.index == index) {
+		_skippedIndexWrites++;
+		return;
+	}
+
+	_cardWrite(CardSpace::Reg, pair.indexReg, index);
+	pair.indexValid = true;
+	pair.index = index;
+}
+
+uint32_t AtomBiosImpl::_doPLLRead(uint32_t reg) {
+	uint32_t val;
+	if(!_pllIndexData.enabled) {
+		val = _cardRead(CardSpace::PLL, reg);
+	} else {
+		_selectIndex(_pllIndexData, reg);
+		val = _cardRead(CardSpace::Reg, _pllIndexData.dataReg);
+	}
+
+	if(_watchBits[1][false].test(reg)) {
+		_watchHit(AtomBios::FootprintSpace::PLL, false, reg, val);
+	}
+	return val;
+}
+
+void AtomBiosImpl::_doPLLWrite(uint32_t reg, uint32_t val) {
+	if(_watchBits[1][true].test(reg)) {
+		_watchHit(AtomBios::FootprintSpace::PLL, true, reg, val);
+	}
+
+	if(!_pllIndexData.enabled) {
+		_cardWrite(CardSpace::PLL, reg, val);
+		return;
+	}
+
+	_selectIndex(_pllIndexData, reg);
+	_cardWrite(CardSpace::Reg, _pllIndexData.dataReg, val);
+}
+
+uint32_t AtomBiosImpl::_doMCRead(uint32_t reg) {
+	uint32_t val;
+	if(!_mcIndexData.enabled) {
+		val = _cardRead(CardSpace::MC, reg);
+	} else {
+		_selectIndex(_mcIndexData, reg);
+		val = _cardRead(CardSpace::Reg, _mcIndexData.dataReg);
+	}
+
+	if(_watchBits[2][false].test(reg)) {
+		_watchHit(AtomBios::FootprintSpace::MC, false, reg, val);
+	}
+	return val;
+}
+
+void AtomBiosImpl::_doMCWrite(uint32_t reg, uint32_t val) {
+	if(_watchBits[2][true].test(reg)) {
+		_watchHit(AtomBios::FootprintSpace::MC, true, reg, val);
+	}
+
+	if(!_mcIndexData.enabled) {
+		_cardWrite(CardSpace::MC, reg, val);
+		return;
+	}
+
+	_selectIndex(_mcIndexData, reg);
+	_cardWrite(CardSpace::Reg, _mcIndexData.dataReg, val);
+}
+
 // TODO: make this more pretty
 //   Putting them into the class definiton makes the class a bit more ugly,
 //   but having them not be namespaced in any way also isn't the best.
@@ -0,0 +1,140 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Running one command over many parameter blocks.
+// Blocks are normally run one after the other, on a single parameter space vector. Pure commands whose result
+// only depends on their parameters are instead split over the workers the host runs in parallel; as each run
+// starts from scratch, the blocks do not need to see the state the previous block left behind.
+
+struct AtomBiosImpl::BatchTask {
+	int table;
+	uint32_t* params;
+	size_t size;
+	size_t count;
+	size_t workers;
+	AtomBiosImpl** impls;
+};
+
+void AtomBiosImpl::setBatchWorkers(size_t workers, void (*run)(void (*task)(void* taskContext, size_t worker), void* taskContext,
+		size_t workers, void* context), void* context) {
+	_batchWorkerCount = run ? workers : 0;
+	_batchRun = run;
+	_batchRunContext = context;
+
+	// Workers that are no longer needed.
+	while(_batchWorkers.size() > _batchWorkerCount) {
+		AtomBiosImpl* worker = _batchWorkers.pop();
+		worker->_dropDecodedCommands();
+		delete worker;
+	}
+}
+
+void AtomBiosImpl::_configureWorker(AtomBiosImpl* worker) {
+	worker->setOptimizerMode(_optimizerMode);
+	worker->setJitMode(_jitMode, _jitThreshold);
+	worker->setMemoization(_memoEntries);
+	worker->setLockstepBatches(_lockstepBatches);
+	if(worker->_aotModule != _aotModule) {
+		worker->setAotModule(_aotModule);
+	}
+
+	// Only needed by runCommands; pure commands do not access the card.
+	worker->_pllIndexData = _pllIndexData;
+	worker->_mcIndexData = _mcIndexData;
+	worker->setFrameBufferWindow(_fbWindow, _fbWindowSize);
+	for(int space = 0; space < watchSpaces; space++) {
+		worker->_watchBits[space][false] = _watchBits[space][false];
+		worker->_watchBits[space][true] = _watchBits[space][true];
+	}
+	worker->_watchCallback = _watchCallback;
+	worker->_watchContext = _watchContext;
+}
+
+void AtomBiosImpl::_runBatchBlocks(Command& command, uint32_t* params, size_t size, size_t first, size_t end) {
+	// The mismatch counters of the self-check and differential modes need the usual path.
+	if(_lockstepBatches && end - first >= 2 && _optimizerMode != AtomBios::OptimizerMode::SelfCheck
+			&& _jitMode != AtomBios::JitMode::Differential) {
+		DecodedCommand& decoded = _decoded(command);
+		if(_lockstepSupported(command, decoded)) {
+			for(size_t i = first; i < end; i += lockstepLanes) {
+				_runLockstep(command, decoded, params, size, i, end - i < lockstepLanes ? end : i + lockstepLanes);
+			}
+			return;
+		}
+	}
+
+	// The vector keeps its memory from one block to the next.
+	libatombios_vector<uint32_t> paramVector;
+	for(size_t i = first; i < end; i++) {
+		uint32_t* block = params + i * size;
+		paramVector.resize(size);
+		memcpy(paramVector.data(), block, size * sizeof(uint32_t));
+
+		_runCommand(command, paramVector);
+
+		memcpy(block, paramVector.data(), size * sizeof(uint32_t));
+	}
+}
+
+void AtomBiosImpl::_runBatchTask(void* taskContext, size_t worker) {
+	BatchTask* task = static_cast<BatchTask*>(taskContext);
+	AtomBiosImpl* impl = task->impls[worker];
+	Command* command = impl->_commandTable.commands.get(task->table);
+
+	impl->_maxPSIndex = 0;
+	impl->_maxWSIndex = 0;
+	impl->_runBatchBlocks(*command, task->params, task->size,
+		worker * task->count / task->workers, (worker + 1) * task->count / task->workers);
+}
+
+void AtomBiosImpl::runCommandBatch(AtomBios::CommandTables table, uint32_t* params, size_t size, size_t count) {
+	Command* command = _commandTable.commands.get(table);
+	assert(command && command->exists());
+
+	size_t workers = _batchWorkerCount < count ? _batchWorkerCount : count;
+	// The mismatch counters of the self-check and differential modes are only kept here.
+	bool parallel = workers >= 2 && _optimizerMode != AtomBios::OptimizerMode::SelfCheck
+		&& _jitMode != AtomBios::JitMode::Differential;
+
+	DecodedCommand* decoded = nullptr;
+	if(parallel) {
+		decoded = &_decoded(*command);
+		if(decoded->purity == MemoPurity::Unknown) {
+			_analyzePurity(*command, *decoded);
+		}
+		parallel = decoded->purity == MemoPurity::Pure && !decoded->memoKeyState;
+	}
+
+	if(!parallel) {
+		_runBatchBlocks(*command, params, size, 0, count);
+		return;
+	}
+
+	while(_batchWorkers.size() < workers) {
+		_batchWorkers.push_back(new AtomBiosImpl(_data.data(), _data.size()));
+	}
+	for(size_t i = 0; i < workers; i++) {
+		_configureWorker(_batchWorkers[i]);
+	}
+
+	if(AtomBIOSDebugSettings::logCommands) {
+		lilrad_log(DEBUG, "batch: command %x, %zu blocks over %zu workers\n", command->i(), count, workers);
+	}
+	BatchTask task{table, params, size, count, workers, _batchWorkers.data()};
+	_batchRun(_runBatchTask, &task, workers, _batchRunContext);
+
+	// The state is the one the last block left behind; the telemetry covers all of them.
+	AtomBiosImpl* last = _batchWorkers[workers - 1];
+	for(int bit = 0; bit < memoStateCount; bit++) {
+		if(decoded->memoWrittenState & (1 << bit)) {
+			_setMemoState(bit, last->_memoState(bit));
+		}
+	}
+	for(size_t i = 0; i < workers; i++) {
+		if(_batchWorkers[i]->_maxPSIndex > _maxPSIndex) { _maxPSIndex = _batchWorkers[i]->_maxPSIndex; }
+		if(_batchWorkers[i]->_maxWSIndex > _maxWSIndex) { _maxWSIndex = _batchWorkers[i]->_maxWSIndex; }
+	}
+}
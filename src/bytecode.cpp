@@ -4,19 +4,208 @@
 
 #include "atom-private.hpp"
 
+static JumpArgEncoding jumpCondition(uint8_t opcode) {
+	switch(opcode) {
+	case Opcodes::JUMP_ALWAYS:
+		return JumpArgEncoding::Always;
+	case Opcodes::JUMP_EQUAL:
+		return JumpArgEncoding::Equal;
+	case Opcodes::JUMP_BELOW:
+		return JumpArgEncoding::Below;
+	case Opcodes::JUMP_ABOVE:
+		return JumpArgEncoding::Above;
+	case Opcodes::JUMP_BELOWOREQUAL:
+		return JumpArgEncoding::BelowOrEqual;
+	case Opcodes::JUMP_ABOVEOREQUAL:
+		return JumpArgEncoding::AboveOrEqual;
+	case Opcodes::JUMP_NOTEQUAL:
+		return JumpArgEncoding::NotEqual;
+	}
+
+	assert(false && "not a jump opcode");
+	__builtin_unreachable();
+}
+
+uint32_t AtomBiosImpl::_getSpecialWorkSpace(uint32_t offset) {
+	switch(static_cast<WorkSpaceSpecialAddresses>(offset)) {
+	case WS_QUOTIENT:
+		return _divMulQuotient;
+	case WS_REMAINDER:
+		return _divMulRemainder;
+	case WS_DATAPTR:
+		return _dataBlock;
+	case WS_SHIFT:
+		return _workSpaceMaskShift;
+	case WS_OR_MASK:
+		return 1 << _workSpaceMaskShift;
+	case WS_AND_MASK:
+		return ~(1 << _workSpaceMaskShift);
+	case WS_FB_WINDOW:
+		return _fbBlock;
+	case WS_ATTRIBUTES:
+		return _iioIOAttr;
+	case WS_REGPTR:
+		return _regBlock;
+	}
+
+	lilrad_log(WARNING, "getWorkspace: special address 0x%02x not implemented\n", offset);
+	return 0;
+}
+
+void AtomBiosImpl::_setSpecialWorkSpace(uint32_t offset, uint32_t data) {
+	switch(static_cast<WorkSpaceSpecialAddresses>(offset)) {
+	case WS_QUOTIENT:
+		_divMulQuotient = data;
+		return;
+	case WS_REMAINDER:
+		_divMulRemainder = data;
+		return;
+	case WS_DATAPTR:
+		_dataBlock = data;
+		return;
+	case WS_SHIFT:
+		_workSpaceMaskShift = data;
+		return;
+	case WS_FB_WINDOW:
+		_setFBBlock(data);
+		return;
+	case WS_ATTRIBUTES:
+		_iioIOAttr = data;
+		return;
+	case WS_REGPTR:
+		_regBlock = data;
+		return;
+	case WS_OR_MASK:
+	case WS_AND_MASK:
+		lilrad_log(WARNING, "setWorkSpace: write to special address 0x%02x is not defined\n", offset);
+		return;
+	}
+}
+
+void AtomBiosImpl::_setDataTable(uint8_t table) {
+	if(table == 255) {
+		lilrad_log(WARNING, "handling of SET_DATA_TABLE(255) may not be correct\n");
+		_dataBlock = 0;
+	} else if(table >= ((sizeof(DataTable) - sizeof(CommonHeader)) / 2)) {
+		lilrad_log(WARNING, "SET_DATA_TABLE(0x%x) is outside of the data table, setting _dataBlock to 0!\n", table);
+		_dataBlock = 0;
+	} else {
+		_dataBlock = _dataTable.dataTables[table];
+	}
+}
+
+void AtomBiosImpl::_setATIPort(uint16_t port) {
+	if(!port) {
+		_ioMode = IOMode::MM;
+	} else {
+		_ioMode = IOMode::IIO;
+		_iioPort = port;
+	}
+}
+
+DecodedCommand& AtomBiosImpl::_decoded(Command& command) {
+	if(!command.decoded) {
+		command.decoded = _decodeCommand(command);
+		if(_optimizerMode != AtomBios::OptimizerMode::Off) {
+			_optimizeInstructions(*command.decoded);
+		}
+		_fuseInstructions(*command.decoded);
+		command.decoded->jit = _aotCode(command);
+	}
+	return *command.decoded;
+}
+
 void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>& params, int params_shift) {
 	assert(command.workSpaceSize % sizeof(uint32_t) == 0);
 	assert(command.parameterSpaceSize % sizeof(uint32_t) == 0);
 
-	lilrad_log(DEBUG, "running command %x (params_shift = %i)\n", command.i(), params_shift);
+	if(AtomBIOSDebugSettings::logCommands) {
+		lilrad_log(DEBUG, "running command %x (params_shift = %i)\n", command.i(), params_shift);
+	}
+
+	// Not for the second run of differential mode, which repeats the first one.
+	bool traced = _traceWrite && _cardTraceMode != CardTraceMode::Replay;
+	if(traced) {
+		_traceTableEnter(command.i());
+	}
+	bool timed = _timelineSpan && _cardTraceMode != CardTraceMode::Replay;
+	if(timed) {
+		_timelineEnter(command.i());
+	}
+	if(_tableEntryHook && _cardTraceMode != CardTraceMode::Replay) {
+		_enterTable(command, params, params_shift);
+	}
+
+	DecodedCommand& decoded = _decoded(command);
+
+	// Like the native code, memoized results are not used by the reference side of differential runs, or in self-check mode.
+	if(_memoEntries && !_jitSuspended && _optimizerMode != AtomBios::OptimizerMode::SelfCheck) {
+		if(decoded.purity == MemoPurity::Unknown) {
+			_analyzePurity(command, decoded);
+		}
+		if(decoded.purity == MemoPurity::Pure) {
+			_runMemoized(command, decoded, params, params_shift);
+			if(traced && _traceWrite) {
+				_traceTableExit();
+			}
+			if(timed && _timelineSpan) {
+				_timelineExit();
+			}
+			return;
+		}
+	}
+
+	_runDecoded(command, decoded, params, params_shift);
+	// The hook may have stopped tracing.
+	if(traced && _traceWrite) {
+		_traceTableExit();
+	}
+	if(timed && _timelineSpan) {
+		_timelineExit();
+	}
+}
+
+void AtomBiosImpl::_runDecoded(Command& command, DecodedCommand& decoded, libatombios_vector<uint32_t>& params, int params_shift) {
+	bool selfCheck = _optimizerMode == AtomBios::OptimizerMode::SelfCheck;
+
+	// Hot commands (and the ones that were translated ahead of time) are run as native code;
+	// self-checking is only done by the interpreter.
+	if(!selfCheck && !_jitSuspended) {
+		if(_jitMode != AtomBios::JitMode::Off && !decoded.jit && !decoded.jitFailed && ++decoded.runs >= _jitThreshold) {
+			decoded.jit = _jitCompile(command, decoded);
+			decoded.jitFailed = !decoded.jit;
+		}
+		if(decoded.jit && (_jitMode != AtomBios::JitMode::Off || !decoded.jit->memory)) {
+			_runNative(command, decoded, params, params_shift);
+			return;
+		}
+	}
+
+	_interpret(command, decoded, params, params_shift, decoded.code.empty() ? instructionExit : decoded.entry, nullptr);
+}
+
+void AtomBiosImpl::_interpret(Command& command, DecodedCommand& decoded, libatombios_vector<uint32_t>& params, int params_shift,
+		uint32_t start, const libatombios_vector<uint32_t>* startWorkSpace) {
+	bool selfCheck = _optimizerMode == AtomBios::OptimizerMode::SelfCheck;
+
+	// The instruction being run, and the reg block its Reg operands are relative to.
+	const Instruction* current = nullptr;
+	uint32_t regBlock = _regBlock;
+	// Self-check mode: WorkSpace indexes whose value was stored by a dead store.
+	WorkSpaceSet deadStoreValues;
 
 	libatombios_vector<uint32_t> workSpace;
-	workSpace.resize(command.workSpaceSize / sizeof(uint32_t));
+	if(startWorkSpace) {
+		workSpace.resize(startWorkSpace->size());
+		memcpy(workSpace.data(), startWorkSpace->data(), startWorkSpace->size() * sizeof(uint32_t));
+	} else {
+		workSpace.resize(command.workSpaceSize / sizeof(uint32_t));
+	}
 
 	auto getParameterSpace = [this, &params, &params_shift](uint32_t offset) -> uint32_t {
 		assert(offset >= 0);
-		if(offset >= params.size()) {
-			params.resize(offset + 1);
+		if((offset + params_shift) >= params.size()) {
+			params.resize(offset + params_shift + 1);
 		}
 
 		if((offset + params_shift) > _maxPSIndex) { _maxPSIndex = offset + params_shift; }
@@ -25,8 +214,8 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 	};
 	auto setParameterSpace = [this, &params, &params_shift](uint32_t offset, uint32_t data) {
 		assert(offset >= 0);
-		if(offset >= params.size()) {
-			params.resize(offset + 1);
+		if((offset + params_shift) >= params.size()) {
+			params.resize(offset + params_shift + 1);
 		}
 
 		if((offset + params_shift) > _maxPSIndex) { _maxPSIndex = offset + params_shift; }
@@ -34,30 +223,11 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		params[offset + params_shift] = data;
 	};
 
-	auto getWorkSpace = [this, &workSpace](uint32_t offset) -> uint32_t {
+	auto getWorkSpace = [this, selfCheck, &workSpace, &current, &deadStoreValues](uint32_t offset) -> uint32_t {
 		assert(offset >= 0);
 
-		switch(static_cast<WorkSpaceSpecialAddresses>(offset)) {
-		case WS_QUOTIENT:
-			return _divMulQuotient;
-		case WS_REMAINDER:
-			return _divMulRemainder;
-		case WS_DATAPTR:
-			return _dataBlock;
-		case WS_SHIFT:
-			return _workSpaceMaskShift;
-		case WS_OR_MASK:
-			return 1 << _workSpaceMaskShift;
-		case WS_AND_MASK:
-			return ~(1 << _workSpaceMaskShift);
-		case WS_FB_WINDOW:
-			return _fbBlock;
-		case WS_ATTRIBUTES:
-			return _iioIOAttr;
-		case WS_REGPTR:
-			return _regBlock;
-			lilrad_log(WARNING, "getWorkspace: special address 0x%02x not implemented\n", offset);
-			break;
+		if(isSpecialWorkSpace(offset)) {
+			return _getSpecialWorkSpace(offset);
 		}
 
         if(offset >= workSpace.size()) {
@@ -65,36 +235,19 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		}
 		if(offset > _maxWSIndex) { _maxWSIndex = offset; }
 
+		if(selfCheck && deadStoreValues.test(offset) && !(current->optFlags & OptimizerFlags::OptDeadStore)) {
+			lilrad_log(ERROR, "optimizer self-check: WS[%02x] read at %x was stored by a dead store\n", offset, current->ip + 0x6);
+			_selfCheckMismatches++;
+			deadStoreValues.reset(offset);
+		}
+
 		return workSpace[offset];
 	};
-	auto setWorkSpace = [this, &workSpace](uint32_t offset, uint32_t data) {
+	auto setWorkSpace = [this, selfCheck, &workSpace, &current, &deadStoreValues](uint32_t offset, uint32_t data) {
 		assert(offset >= 0);
 
-		switch(static_cast<WorkSpaceSpecialAddresses>(offset)) {
-		case WS_QUOTIENT:
-			_divMulQuotient = data;
-			return;
-		case WS_REMAINDER:
-			_divMulRemainder = data;
-			return;
-		case WS_DATAPTR:
-			_dataBlock = data;
-			return;
-		case WS_SHIFT:
-			_workSpaceMaskShift = data;
-			return;
-		case WS_FB_WINDOW:
-			_fbBlock = data;
-			return;
-		case WS_ATTRIBUTES:
-			_iioIOAttr = data;
-			return;
-		case WS_REGPTR:
-			_regBlock = data;
-			return;
-		case WS_OR_MASK:
-		case WS_AND_MASK:
-			lilrad_log(WARNING, "setWorkSpace: write to special address 0x%02x is not defined\n", offset);
+		if(isSpecialWorkSpace(offset)) {
+			_setSpecialWorkSpace(offset, data);
 			return;
 		}
 
@@ -104,86 +257,35 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 
 		if(offset > _maxWSIndex) { _maxWSIndex = offset; }
 
+		if(selfCheck) {
+			if(current->optFlags & OptimizerFlags::OptDeadStore) {
+				deadStoreValues.set(offset);
+			} else {
+				deadStoreValues.reset(offset);
+			}
+		}
+
 		workSpace[offset] = data;
 	};
 
-	uint32_t ip = 0;
+	// Index of the next instruction to run.
+	uint32_t next = start;
 
 	// Safely change the IP.
-	auto performJump = [&command, &ip](uint32_t bytecodeIP) {
-		assert((bytecodeIP - 0x6) < command.bytecodeSize());
-		assert(((int32_t)bytecodeIP - 0x6) > 0);
-		ip = bytecodeIP - 0x6;
-	};
-
-	// Safely consume command data.
-	auto consumeByte = [this, &command, &ip]() -> uint8_t {
-		assert(ip < command.bytecodeSize());
-		return _data[command.offset() + ip++];
-	};
-	auto consumeShort = [this, &command, &ip]() -> uint16_t {
-		assert(ip < static_cast<uint32_t>(command.bytecodeSize() - 1));
-		uint8_t a = _data[command.offset() + ip++];
-		uint8_t b = _data[command.offset() + ip++];
-		return static_cast<uint16_t>(a) | (static_cast<uint16_t>(b) << 8);
-	};
-	auto consumeLong = [this, &command, &ip]() -> uint32_t {
-		assert(ip < static_cast<uint32_t>(command.bytecodeSize() - 3));
-		uint8_t a = _data[command.offset() + ip++];
-		uint8_t b = _data[command.offset() + ip++];
-		uint8_t c = _data[command.offset() + ip++];
-		uint8_t d = _data[command.offset() + ip++];
-		return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) | (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
-	};
-
-	auto consumeAlignSize = [&consumeByte, &consumeShort, &consumeLong](SrcEncoding align) -> uint32_t {
-		switch(align) {
-		case SrcEncoding::SrcByte0 ... SrcEncoding::SrcByte24:
-			return consumeByte();
-		case SrcEncoding::SrcWord0 ... SrcEncoding::SrcWord16:
-			return consumeShort();
-		case SrcEncoding::SrcDword:
-			return consumeLong();
+	auto performJump = [&command, &next](const Instruction& instr, uint32_t target) {
+		if(target == instructionInvalid) {
+			lilrad_log(ERROR, "jump from %x is outside of command table 0x%x\n", instr.ip + 0x6, command.i());
+			assert(false && "jump outside of command");
+			next = instructionExit;
+			return;
 		}
-
-		__builtin_unreachable();
-	};
-
-	auto consumeAttrByte = [&consumeByte]() -> AttrByte {
-		uint8_t byte = consumeByte();
-		AttrByte attrByte;
-		attrByte.srcArg = static_cast<OpcodeArgEncoding>(byte & 0b111);
-		attrByte.srcAlign = static_cast<SrcEncoding>((byte >> 3) & 0b111);
-		attrByte.dstAlign = static_cast<SrcEncoding>(atom_dst_to_src[attrByte.srcAlign][(byte >> 6) & 0b11]);
-		return attrByte;
+		next = target;
 	};
-	auto consumeIdx = [&consumeByte, &consumeShort](OpcodeArgEncoding arg) -> uint32_t {
-		uint32_t idx;
-		switch(arg) {
-		case OpcodeArgEncoding::Reg:
-		case OpcodeArgEncoding::ID:
-			idx = consumeShort();
-			break;
 
-		case OpcodeArgEncoding::ParameterSpace:
-		case OpcodeArgEncoding::WorkSpace:
-		case OpcodeArgEncoding::FrameBuffer:
-		case OpcodeArgEncoding::PLL:
-		case OpcodeArgEncoding::MC:
-			idx = consumeByte();
-			break;
-
-		case OpcodeArgEncoding::Imm:
-			// No Idx is needed
-			idx = 0;
-			break;
-		}
-		return idx;
-	};
-	auto consumeVal = [this, &getParameterSpace, &getWorkSpace, &consumeByte, &consumeShort, &consumeLong](OpcodeArgEncoding arg, AttrByte attrByte, uint32_t idx) -> uint32_t {
+	auto getVal = [this, &regBlock, &getParameterSpace, &getWorkSpace](OpcodeArgEncoding arg, uint32_t idx, uint32_t imm) -> uint32_t {
 		switch(arg) {
 		case OpcodeArgEncoding::Reg:
-			return _doIORead(idx + _regBlock);
+			return _doIORead(idx + regBlock);
 
 		case OpcodeArgEncoding::ParameterSpace:
 			return getParameterSpace(idx);
@@ -192,37 +294,28 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 			return read32(idx + _dataBlock);
 
 		case OpcodeArgEncoding::Imm:
-			// Immideates only make sense for source values.
-			switch(static_cast<SrcEncoding>(attrByte.srcAlign)) {
-			case SrcEncoding::SrcDword:
-				return consumeLong();
-			case SrcEncoding::SrcWord0:
-			case SrcEncoding::SrcWord8:
-			case SrcEncoding::SrcWord16:
-				return consumeShort();
-			case SrcEncoding::SrcByte0:
-			case SrcEncoding::SrcByte8:
-			case SrcEncoding::SrcByte16:
-			case SrcEncoding::SrcByte24:
-				return consumeByte();
-			}
-			break;
+			// Immediates are decoded along with the instruction.
+			return imm;
+
 		case OpcodeArgEncoding::WorkSpace:
 			return getWorkSpace(idx);
 
-		case OpcodeArgEncoding::FrameBuffer:
 		case OpcodeArgEncoding::PLL:
+			return _doPLLRead(idx);
+
 		case OpcodeArgEncoding::MC:
-			lilrad_log(ERROR, "consumeVal with arg=%i (%s) is not implemented\n", arg, OpcodeArgEncodingToString(arg));
-			return 0xCDCDCDCD;
+			return _doMCRead(idx);
+
+		case OpcodeArgEncoding::FrameBuffer:
+			return _doFBRead(idx);
 		};
 		__builtin_unreachable();
 	};
 
-	auto putVal = [this, &setParameterSpace, &setWorkSpace](OpcodeArgEncoding arg, uint32_t idx, uint32_t val) {
+	auto putVal = [this, &regBlock, &setParameterSpace, &setWorkSpace](OpcodeArgEncoding arg, uint32_t idx, uint32_t val) {
 		switch(arg) {
 		case OpcodeArgEncoding::Reg:
-			_doIOWrite(idx + _regBlock, val);
+			_doIOWrite(idx + regBlock, val);
 			break;
 
 		case OpcodeArgEncoding::ParameterSpace:
@@ -231,56 +324,70 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		case OpcodeArgEncoding::WorkSpace:
 			setWorkSpace(idx, val);
 			break;
+		case OpcodeArgEncoding::PLL:
+			_doPLLWrite(idx, val);
+			break;
+		case OpcodeArgEncoding::MC:
+			_doMCWrite(idx, val);
+			break;
+		case OpcodeArgEncoding::FrameBuffer:
+			_doFBWrite(idx, val);
+			break;
 
 		case OpcodeArgEncoding::ID:
-		case OpcodeArgEncoding::FrameBuffer:
 		case OpcodeArgEncoding::Imm:
-		case OpcodeArgEncoding::PLL:
-		case OpcodeArgEncoding::MC:
 			lilrad_log(ERROR, "putVal with arg=%i is not implemented\n", arg);
 			break;
 		}
 	};
 
-	// Safely skip command data.
-	auto skip = [&command, &ip](uint32_t count) {
-		if(!count) {
-			return;
+	// Folded instructions have the reg block added to their Reg operands already.
+	auto regBlockOf = [this, selfCheck](const Instruction& instr) -> uint32_t {
+		if(!(instr.optFlags & OptimizerFlags::OptRegBlockFolded)) {
+			return _regBlock;
+		}
+		if(selfCheck && instr.foldedRegBlock != _regBlock) {
+			lilrad_log(ERROR, "optimizer self-check: reg block at %x is %x, but %x was folded in\n", instr.ip + 0x6, _regBlock, instr.foldedRegBlock);
+			_selfCheckMismatches++;
+			return _regBlock - instr.foldedRegBlock;
 		}
-		assert(ip < (command.bytecodeSize() - (count - 1)));
-		ip += count;
+		return 0;
 	};
 
-	// Safely peek into command data.
-	auto peekByte = [this, &command, &ip]() -> uint8_t {
-		assert(ip < command.bytecodeSize());
-		return _data[command.offset() + ip];
-	};
-	auto peekShort = [this, &command, &ip]() -> uint16_t {
-		assert(ip < static_cast<uint32_t>(command.bytecodeSize() - 1));
-		uint8_t a = _data[command.offset() + ip];
-		uint8_t b = _data[command.offset() + ip + 1];
-		return static_cast<uint16_t>(a) | (static_cast<uint16_t>(b) << 8);
+	// Reads the (unswizzled) source of an instruction.
+	auto getSrc = [this, selfCheck, &workSpace, &getVal](const Instruction& instr) -> uint32_t {
+		uint32_t val = getVal(instr.attrByte.srcArg, instr.srcIdx, instr.imm);
+
+		if(selfCheck && (instr.optFlags & OptimizerFlags::OptSrcForwarded)) {
+			// Not through getWorkSpace; the store into it may be a dead one.
+			uint32_t stored = instr.forwardedFrom < workSpace.size() ? workSpace[instr.forwardedFrom] : 0;
+			if(stored != val) {
+				lilrad_log(ERROR, "optimizer self-check: forwarded source at %x is %x, but WS[%02x] is %x\n", instr.ip + 0x6, val, instr.forwardedFrom, stored);
+				_selfCheckMismatches++;
+				val = stored;
+			}
+		}
+		return val;
 	};
-	__attribute__((unused)) auto peekLong = [this, &command, &ip]() -> uint32_t {
-		assert(ip < static_cast<uint32_t>(command.bytecodeSize() - 3));
-		uint8_t a = _data[command.offset() + ip];
-		uint8_t b = _data[command.offset() + ip + 1];
-		uint8_t c = _data[command.offset() + ip + 2];
-		uint8_t d = _data[command.offset() + ip + 3];
-		return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) | (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+
+	// Reads the destination (unless the instruction does not use it) and the (swizzled) source of an instruction,
+	// in the order the bytecode does.
+	auto getOperands = [&getVal, &getSrc](const Instruction& instr, uint32_t& saved, uint32_t& val) {
+		saved = readsDst(instr) ? getVal(instr.dstArg, instr.dstIdx, 0) : 0;
+		val = instr.attrByte.swizleSrc(getSrc(instr));
 	};
 
 	///
 	/// Opcodes
 	///
-	auto moveOpcode = [this, &consumeAttrByte, &consumeIdx, &consumeVal, &putVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
-
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
-		uint32_t val = attrByte.swizleSrc(consumeVal(attrByte.srcArg, attrByte, srcIdx));
+	auto moveOpcode = [&regBlock, &getOperands, &putVal](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
+
+		uint32_t saved, val;
+		getOperands(instr, saved, val);
 		uint32_t newVal = val;
 
 		LOG_OPCODE("MOVE");
@@ -288,13 +395,14 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		putVal(arg, dstIdx, attrByte.combineSaved(val, saved));
 	};
 
-	auto andOpcode = [this, &consumeAttrByte, &consumeIdx, &consumeVal, &putVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
+	auto andOpcode = [&regBlock, &getOperands, &putVal](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
 
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
-		uint32_t val = attrByte.swizleSrc(consumeVal(attrByte.srcArg, attrByte, srcIdx));
+		uint32_t saved, val;
+		getOperands(instr, saved, val);
 		uint32_t newVal = attrByte.swizleDst(saved) & val;
 
 		LOG_OPCODE("AND");
@@ -302,13 +410,14 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		putVal(arg, dstIdx, attrByte.combineSaved(newVal, saved));
 	};
 
-	auto orOpcode = [this, &consumeAttrByte, &consumeIdx, &consumeVal, &putVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
+	auto orOpcode = [&regBlock, &getOperands, &putVal](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
 
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
-		uint32_t val = attrByte.swizleSrc(consumeVal(attrByte.srcArg, attrByte, srcIdx));
+		uint32_t saved, val;
+		getOperands(instr, saved, val);
 		uint32_t newVal = attrByte.swizleDst(saved) | val;
 
 		LOG_OPCODE("OR");
@@ -316,13 +425,14 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		putVal(arg, dstIdx, attrByte.combineSaved(newVal, saved));
 	};
 
-	auto xorOpcode = [this, &consumeAttrByte, &consumeIdx, &consumeVal, &putVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
+	auto xorOpcode = [&regBlock, &getOperands, &putVal](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
 
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
-		uint32_t val = attrByte.swizleSrc(consumeVal(attrByte.srcArg, attrByte, srcIdx));
+		uint32_t saved, val;
+		getOperands(instr, saved, val);
 		uint32_t newVal = attrByte.swizleDst(saved) ^ val;
 
 		LOG_OPCODE("XOR");
@@ -330,24 +440,24 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		putVal(arg, dstIdx, attrByte.combineSaved(newVal, saved));
 	};
 
-	auto testOpcode = [this, &consumeAttrByte, &consumeIdx, &consumeVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
+	auto testOpcode = [this, &regBlock, &getOperands](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
 
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
-		uint32_t val = attrByte.swizleSrc(consumeVal(attrByte.srcArg, attrByte, srcIdx));
+		uint32_t saved, val;
+		getOperands(instr, saved, val);
 		_flagEqual = attrByte.swizleDst(saved) == val;
 
 		// Keep the generic opcode logger happy
 		uint32_t newVal = attrByte.swizleDst(saved);
-		
+
 		LOG_OPCODE("TEST");
 		LOG_FLAGS();
 	};
 
-	auto jumpOpcode = [this, &ip, &consumeShort, &performJump](JumpArgEncoding jumpCond) {
-		uint16_t target = consumeShort();
+	auto jumpOpcode = [this, &decoded, &performJump](const Instruction& instr, JumpArgEncoding jumpCond, uint16_t rawTarget) {
 		bool shouldJump;
 
 		switch(jumpCond) {
@@ -389,19 +499,24 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 			assert(jumpCond <= JumpArgEncoding::NotEqual);
 
 			lilrad_log(DEBUG, "opcode %s (shouldJump = %i, oldIP = %x, newIP = %x)\n",
-				jumpOpcodeNames[jumpCond], shouldJump, ip, shouldJump ? target : ip);
+				jumpOpcodeNames[jumpCond], shouldJump, instr.ip + 0x6, shouldJump ? rawTarget : instr.ip + 0x6);
+		}
+
+		if(_coverage && jumpCond != JumpArgEncoding::Always) {
+			decoded.jumpCounts[2 * (&instr - decoded.code.data()) + shouldJump]++;
 		}
 
         if(shouldJump) {
-			performJump(target);
+			performJump(instr, instr.target);
 		}
 	};
 
-	auto clearOpcode = [this, &consumeAttrByte, &consumeIdx, &consumeVal, &putVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
+	auto clearOpcode = [&regBlock, &getVal, &putVal](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
 
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
+		uint32_t saved = readsDst(instr) ? getVal(arg, dstIdx, 0) : 0;
 		uint32_t newVal = attrByte.combineSaved(0, saved);
 
 		// Keep the logger happy
@@ -412,15 +527,16 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 	};
 
 	// TODO: might be bugged, should test
-	auto maskOpcode = [&consumeAttrByte, &consumeIdx, &consumeVal, &consumeAlignSize, &putVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
+	auto maskOpcode = [&getVal, &getSrc, &putVal](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
+		uint32_t saved = getVal(arg, dstIdx, 0);
 
-		uint32_t mask = consumeAlignSize(attrByte.dstAlign);
+		uint32_t mask = instr.mask;
 
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
-		uint32_t val = attrByte.swizleSrc(consumeVal(attrByte.srcArg, attrByte, srcIdx));
+		uint32_t val = attrByte.swizleSrc(getSrc(instr));
 		uint32_t newVal = (attrByte.swizleDst(saved) & mask) | val;
 
 		if(AtomBIOSDebugSettings::logOpcodes) { \
@@ -434,30 +550,32 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		putVal(arg, dstIdx, attrByte.combineSaved(newVal, saved));
 	};
 
-	auto compareOpcode = [this, &consumeAttrByte, &consumeIdx, &consumeVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
+	auto compareOpcode = [this, &regBlock, &getOperands](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
 
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
-		uint32_t val = attrByte.swizleSrc(consumeVal(attrByte.srcArg, attrByte, srcIdx));
+		uint32_t saved, val;
+		getOperands(instr, saved, val);
 		_flagEqual = attrByte.swizleDst(saved) == val;
 		_flagAbove = attrByte.swizleDst(saved) > val;
 		_flagBelow = attrByte.swizleDst(saved) < val;
 
 		// Keep the generic opcode logger happy
 		uint32_t newVal = attrByte.swizleDst(saved);
-		
+
 		LOG_OPCODE("COMPARE");
 		LOG_FLAGS();
 	};
 
-	auto shiftLeftOpcode = [&consumeAttrByte, &consumeByte, &consumeIdx, &consumeVal, &putVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
+	auto shiftLeftOpcode = [&getVal, &putVal](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t saved = getVal(arg, dstIdx, 0);
 
-		uint32_t shift = consumeByte();
+		uint32_t shift = instr.imm;
 		uint32_t newVal = attrByte.swizleDst(saved) << shift;
 
 		if(AtomBIOSDebugSettings::logOpcodes) {
@@ -470,12 +588,13 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		putVal(arg, dstIdx, attrByte.combineSaved(newVal, saved));
 	};
 
-	auto shiftRightOpcode = [&consumeAttrByte, &consumeByte, &consumeIdx, &consumeVal, &putVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
+	auto shiftRightOpcode = [&getVal, &putVal](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t saved = getVal(arg, dstIdx, 0);
 
-		uint32_t shift = consumeByte();
+		uint32_t shift = instr.imm;
 		uint32_t newVal = attrByte.swizleDst(saved) >> shift;
 
 		if(AtomBIOSDebugSettings::logOpcodes) {
@@ -488,13 +607,14 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		putVal(arg, dstIdx, attrByte.combineSaved(newVal, saved));
 	};
 
-	auto addOpcode = [this, &consumeAttrByte, &consumeIdx, &consumeVal, &putVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
+	auto addOpcode = [&regBlock, &getOperands, &putVal](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
 
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
-		uint32_t val = attrByte.swizleSrc(consumeVal(attrByte.srcArg, attrByte, srcIdx));
+		uint32_t saved, val;
+		getOperands(instr, saved, val);
 		uint32_t newVal = attrByte.swizleDst(saved) + val;
 
 		LOG_OPCODE("ADD");
@@ -502,13 +622,14 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		putVal(arg, dstIdx, attrByte.combineSaved(newVal, saved));
 	};
 
-	auto subOpcode = [this, &consumeAttrByte, &consumeIdx, &consumeVal, &putVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
+	auto subOpcode = [&regBlock, &getOperands, &putVal](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
 
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
-		uint32_t val = attrByte.swizleSrc(consumeVal(attrByte.srcArg, attrByte, srcIdx));
+		uint32_t saved, val;
+		getOperands(instr, saved, val);
 		uint32_t newVal = attrByte.swizleDst(saved) - val;
 
 		LOG_OPCODE("SUB");
@@ -516,57 +637,36 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		putVal(arg, dstIdx, attrByte.combineSaved(newVal, saved));
 	};
 
-	auto switchOpcode = [&consumeAttrByte, &consumeIdx, &consumeVal, &consumeAlignSize, &consumeShort, &skip, &peekByte, &peekShort, &performJump]() {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
-		uint32_t switchVal = consumeVal(attrByte.srcArg, attrByte, srcIdx);
+	// The cases were parsed into a jump table when the command was decoded.
+	auto switchOpcode = [this, &decoded, &getSrc, &performJump](const Instruction& instr) {
+		AttrByte attrByte = instr.attrByte;
+		uint32_t srcIdx = instr.srcIdx;
+		uint32_t switchVal = getSrc(instr);
 
-		constexpr uint8_t caseMagic = 0x63;
-		constexpr uint16_t caseEnd = 0x5A5A;
-
-		if(AtomBIOSDebugSettings::logOpcodes) {
-			lilrad_log(DEBUG, "opcode SWITCH(%s[%02x] %s, switchVal = %x, ...\n",
-				OpcodeArgEncodingToString(attrByte.srcArg), srcIdx, SrcEncodingToString(attrByte.srcAlign),switchVal);
+		SwitchTable& cases = decoded.switches[instr.target];
+		uint32_t slot = cases.slot(switchVal);
+		uint32_t target = slot < cases.targets.size() ? cases.targets[slot] : instr.next;
+		if(_coverage) {
+			cases.hits[slot]++;
 		}
 
-		while(peekShort() != caseEnd) {
-			// This is a peek, because we bail out instantly if this is not taken.
-			// The linux intepreter does this, so we do too.
-			if(peekByte() == caseMagic) {
-				skip(1);
-				uint32_t caseVal = consumeAlignSize(attrByte.srcAlign);
-				uint16_t target = consumeShort();
-
-				if(caseVal == switchVal) {
-					performJump(target);
-
-					if(AtomBIOSDebugSettings::logOpcodes) {
-						lilrad_log(DEBUG, "   ... caseVal=%x, target=%x; taken)\n", caseVal, target);
-					}
-
-					return;
-				} else if(AtomBIOSDebugSettings::logOpcodes) {
-					lilrad_log(DEBUG, "   ... caseVal=%x, target=%x; not taken ...\n", caseVal, target);
-				}
-			} else {
-				lilrad_log(WARNING, "switchOpcode: invalid case magic seen, bailing out!");
-				return;
-			}
-		}
 		if(AtomBIOSDebugSettings::logOpcodes) {
-			lilrad_log(DEBUG, "   ... no path taken.)\n");
+			lilrad_log(DEBUG, "opcode SWITCH(%s[%02x] %s, switchVal = %x) %s\n",
+				OpcodeArgEncodingToString(attrByte.srcArg), srcIdx, SrcEncodingToString(attrByte.srcAlign), switchVal,
+				target == instr.next ? "no path taken" : "taken");
 		}
-		// No jump was taken, skip past the end magic
-		skip(2);	
+
+		performJump(instr, target);
 	};
 
-	auto mulOpcode = [this, &consumeAttrByte, &consumeIdx, &consumeVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
+	auto mulOpcode = [this, &regBlock, &getOperands](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
 
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
-		uint32_t val = attrByte.swizleSrc(consumeVal(attrByte.srcArg, attrByte, srcIdx));
+		uint32_t saved, val;
+		getOperands(instr, saved, val);
 		uint32_t newVal = attrByte.swizleDst(saved) * val;
 
 		LOG_OPCODE("MUL");
@@ -575,13 +675,14 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 	};
 
 	// TODO: log both the quotient and the remainder here
-	auto divOpcode = [this, &consumeAttrByte, &consumeIdx, &consumeVal](OpcodeArgEncoding arg) {
-		AttrByte attrByte = consumeAttrByte();
-		uint32_t dstIdx = consumeIdx(arg);
-		uint32_t srcIdx = consumeIdx(attrByte.srcArg);
-
-		uint32_t saved = consumeVal(arg, attrByte, dstIdx);
-		uint32_t val = attrByte.swizleSrc(consumeVal(attrByte.srcArg, attrByte, srcIdx));
+	auto divOpcode = [this, &regBlock, &getOperands](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
+
+		uint32_t saved, val;
+		getOperands(instr, saved, val);
 		uint32_t newVal = 0;
 		uint32_t remainder = 0;
 		// Do not accidently divide by zero; a div by 0 in atombios results in a 0.
@@ -596,45 +697,121 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 		_divMulRemainder = remainder;
 	};
 
-	while(ip < command.bytecodeSize()) {
-		uint8_t opcode = consumeByte();
-		switch(opcode) {
+	// Formed by the optimizer; the immediate divisor is at least 2.
+	auto divByConstantOpcode = [this, selfCheck, &regBlock, &getOperands](const Instruction& instr) {
+		OpcodeArgEncoding arg = instr.dstArg;
+		AttrByte attrByte = instr.attrByte;
+		uint32_t dstIdx = instr.dstIdx;
+		uint32_t srcIdx = instr.srcIdx;
+
+		uint32_t saved, val;
+		getOperands(instr, saved, val);
+		uint32_t dividend = attrByte.swizleDst(saved);
+		uint32_t t = (static_cast<uint64_t>(dividend) * instr.divMagic) >> 32;
+		uint32_t newVal = (t + ((dividend - t) >> 1)) >> instr.divShift;
+		uint32_t remainder = dividend - newVal * val;
+
+		if(selfCheck && (newVal != dividend / val || remainder != dividend % val)) {
+			lilrad_log(ERROR, "optimizer self-check: %x / %x at %x gave %x remainder %x\n", dividend, val, instr.ip + 0x6, newVal, remainder);
+			_selfCheckMismatches++;
+			newVal = dividend / val;
+			remainder = dividend % val;
+		}
+
+		LOG_OPCODE("DIV");
+
+		_divMulQuotient = newVal;
+		_divMulRemainder = remainder;
+	};
+
+	///
+	/// Superinstructions
+	///
+	auto compareAndJumpOpcode = [&decoded, &compareOpcode, &jumpOpcode](const Instruction& instr) {
+		decoded.superinstructionsRun++;
+		compareOpcode(instr);
+		jumpOpcode(instr, jumpCondition(instr.fusedOpcode), instr.fusedJumpTarget);
+	};
+
+	auto testAndJumpOpcode = [&decoded, &testOpcode, &jumpOpcode](const Instruction& instr) {
+		decoded.superinstructionsRun++;
+		testOpcode(instr);
+		jumpOpcode(instr, jumpCondition(instr.fusedOpcode), instr.fusedJumpTarget);
+	};
+
+	// Performs the same register accesses as the original sequence, and leaves the result in the WorkSpace as well.
+	auto maskedRegUpdateOpcode = [this, &decoded, &regBlock, &setWorkSpace](const Instruction& instr) {
+		decoded.superinstructionsRun++;
+
+		uint32_t saved = _doIORead(instr.dstIdx + regBlock);
+		uint32_t newVal = (saved & instr.mask) | instr.imm;
+		setWorkSpace(instr.srcIdx, newVal);
+
+		if(AtomBIOSDebugSettings::logOpcodes) {
+			lilrad_log(DEBUG, "opcode MASKED_REG_UPDATE(REG[%02x] (savedVal: %x) & %x | %x via WS[%02x] (newVal: %x))\n",
+				instr.dstIdx + regBlock, saved, instr.mask, instr.imm, instr.srcIdx, newVal);
+		}
+
+		_doIORead(instr.dstIdx + regBlock);
+		_doIOWrite(instr.dstIdx + regBlock, newVal);
+	};
+
+	while(next != instructionExit) {
+		const Instruction& instr = decoded.code[next];
+		next = instr.next;
+
+		if(!instr.valid) {
+			lilrad_log(ERROR, "unexpected opcode 0x%x, in command table 0x%x, ip %x (%x including header)\n", instr.opcode, command.i(), instr.ip, instr.ip + 6);
+			assert(false && "unexpected atom opcode");
+			break;
+		}
+
+		current = &instr;
+		regBlock = regBlockOf(instr);
+		decoded.instructionsRun++;
+		if(_opcodeProfile) {
+			_opcodeProfile[instr.opcode]++;
+		}
+		if(_costCounters) {
+			_costCounters->instructions++;
+		}
+		if(_coverage) {
+			if(decoded.coverage.empty()) {
+				_allocCoverage(decoded);
+			}
+			uint32_t idx = &instr - decoded.code.data();
+			decoded.coverage[idx / 64] |= static_cast<uint64_t>(1) << (idx % 64);
+		}
+
+		switch(instr.opcode) {
 		/// Misc. opcodes
 		case Opcodes::CALL_TABLE: {
-			uint8_t table = consumeByte();
+			uint8_t table = instr.imm;
 
 			if(AtomBIOSDebugSettings::logOpcodes) {
 				lilrad_log(DEBUG, "opcode CALL_TABLE(%x)\n", table);
 			}
-			assert(_commandTable.commands[table].exists());
-			_runBytecode(_commandTable.commands[table], params, params_shift + (command.parameterSpaceSize / 4));
+			Command* callee = _commandTable.commands.get(table);
+			assert(callee && callee->exists());
+
+			// Snapshots taken in the callee continue this command after the call.
+			_callStack.push_back(CallFrame{&command, &workSpace, next == instructionExit ? instructionExit : decoded.code[next].ip, params_shift});
+			_runBytecode(*callee, params, params_shift + (command.parameterSpaceSize / 4));
+			_callStack.pop();
 			break;
 		}
 		case Opcodes::SET_DATA_TABLE: {
-			uint8_t table = consumeByte();
+			uint8_t table = instr.imm;
 
 			if(AtomBIOSDebugSettings::logOpcodes) {
 				lilrad_log(DEBUG, "opcode SET_DATA_TABLE(%i)\n", table);
 			}
-			if(table == 255) {
-				lilrad_log(WARNING, "handling of SET_DATA_TABLE(255) may not be correct\n");
-				_dataBlock = 0;
-			} else if(table >= ((sizeof(DataTable) - sizeof(CommonHeader)) / 2)) {
-				lilrad_log(WARNING, "SET_DATA_TABLE(0x%x) is outside of the data table, setting _dataBlock to 0!\n", table);
-				_dataBlock = 0;
-			} else {
-				_dataBlock = _dataTable.dataTables[table];
-			}
+			_setDataTable(table);
 			break;
-		} 
+		}
 		case Opcodes::SET_ATI_PORT: {
-			uint16_t port = consumeShort();
-			if(!port) {
-				_ioMode = IOMode::MM;
-			} else {
-				_ioMode = IOMode::IIO;
-				_iioPort = port;
-			}
+			uint16_t port = instr.imm;
+			_setATIPort(port);
 
 			if(AtomBIOSDebugSettings::logOpcodes) {
 				lilrad_log(DEBUG, "opcode SET_ATI_PORT(%x)\n", port);
@@ -648,340 +825,98 @@ void AtomBiosImpl::_runBytecode(Command& command, libatombios_vector<uint32_t>&
 			_ioMode = IOMode::SYSIO;
 			break;
 		case Opcodes::SET_REG_BLOCK:
-			_regBlock = consumeShort();
+			_regBlock = instr.imm;
 			if(AtomBIOSDebugSettings::logOpcodes) {
 				lilrad_log(DEBUG, "opcode SET_REG_BLOCK(%02x)\n", _regBlock);
 			}
 			break;
 		case Opcodes::SWITCH:
-			switchOpcode();
+			switchOpcode(instr);
 			break;
 
 		/// Delays
 		case Opcodes::DELAY_MICROSECONDS: {
-			uint8_t delay = consumeByte();
+			uint8_t delay = instr.imm;
 			if(AtomBIOSDebugSettings::logOpcodes) {
 				lilrad_log(DEBUG, "opcode DELAY_MICROSECONDS(%02x)\n", delay);
 			}
-			libatombios_delay_microseconds(delay);
+			_cardWrite(CardSpace::Delay, 0, delay);
 			break;
 		}
 
-		/// Moves
-		case Opcodes::MOVE_TO_REG:
-			moveOpcode(OpcodeArgEncoding::Reg);
+		/// Opcode families; the destination was decoded into the instruction.
+		case Opcodes::MOVE_TO_REG ... Opcodes::MOVE_TO_MC:
+			moveOpcode(instr);
 			break;
-		case Opcodes::MOVE_TO_PS:
-			moveOpcode(OpcodeArgEncoding::ParameterSpace);
+		case Opcodes::AND_INTO_REG ... Opcodes::AND_INTO_MC:
+			andOpcode(instr);
 			break;
-		case Opcodes::MOVE_TO_WS:
-			moveOpcode(OpcodeArgEncoding::WorkSpace);
+		case Opcodes::OR_INTO_REG ... Opcodes::OR_INTO_MC:
+			orOpcode(instr);
 			break;
-		case Opcodes::MOVE_TO_FB:
-			moveOpcode(OpcodeArgEncoding::FrameBuffer);
+		case Opcodes::SHIFT_LEFT_IN_REG ... Opcodes::SHIFT_LEFT_IN_MC:
+			shiftLeftOpcode(instr);
 			break;
-		case Opcodes::MOVE_TO_PLL:
-			moveOpcode(OpcodeArgEncoding::PLL);
+		case Opcodes::SHIFT_RIGHT_IN_REG ... Opcodes::SHIFT_RIGHT_IN_MC:
+			shiftRightOpcode(instr);
 			break;
-		case Opcodes::MOVE_TO_MC:
-			moveOpcode(OpcodeArgEncoding::MC);
+		case Opcodes::MUL_WITH_REG ... Opcodes::MUL_WITH_MC:
+			mulOpcode(instr);
 			break;
-
-		/// AND
-		case Opcodes::AND_INTO_REG:
-			andOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::AND_INTO_PS:
-			andOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::AND_INTO_WS:
-			andOpcode(OpcodeArgEncoding::WorkSpace);
-			break;
-		case Opcodes::AND_INTO_FB:
-			andOpcode(OpcodeArgEncoding::FrameBuffer);
+		case Opcodes::DIV_WITH_REG ... Opcodes::DIV_WITH_MC:
+			divOpcode(instr);
 			break;
-		case Opcodes::AND_INTO_PLL:
-			andOpcode(OpcodeArgEncoding::PLL);
+		case Opcodes::ADD_INTO_REG ... Opcodes::ADD_INTO_MC:
+			addOpcode(instr);
 			break;
-		case Opcodes::AND_INTO_MC:
-			andOpcode(OpcodeArgEncoding::MC);
+		case Opcodes::SUB_INTO_REG ... Opcodes::SUB_INTO_MC:
+			subOpcode(instr);
 			break;
-
-		/// OR
-		case Opcodes::OR_INTO_REG:
-			orOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::OR_INTO_PS:
-			orOpcode(OpcodeArgEncoding::ParameterSpace);
+		case Opcodes::COMPARE_FROM_REG ... Opcodes::COMPARE_FROM_MC:
+			compareOpcode(instr);
 			break;
-		case Opcodes::OR_INTO_WS:
-			orOpcode(OpcodeArgEncoding::WorkSpace);
+		case Opcodes::TEST_FROM_REG ... Opcodes::TEST_FROM_MC:
+			testOpcode(instr);
 			break;
-		case Opcodes::OR_INTO_FB:
-			orOpcode(OpcodeArgEncoding::FrameBuffer);
+		case Opcodes::CLEAR_IN_REG ... Opcodes::CLEAR_IN_MC:
+			clearOpcode(instr);
 			break;
-		case Opcodes::OR_INTO_PLL:
-			orOpcode(OpcodeArgEncoding::PLL);
+		case Opcodes::MASK_INTO_REG ... Opcodes::MASK_INTO_MC:
+			maskOpcode(instr);
 			break;
-		case Opcodes::OR_INTO_MC:
-			orOpcode(OpcodeArgEncoding::MC);
-			break;
-
-		/// SHIFT_LEFT
-		case Opcodes::SHIFT_LEFT_IN_REG:
-			shiftLeftOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::SHIFT_LEFT_IN_PS:
-			shiftLeftOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::SHIFT_LEFT_IN_WS:
-			shiftLeftOpcode(OpcodeArgEncoding::WorkSpace);
-			break;
-		case Opcodes::SHIFT_LEFT_IN_FB:
-			shiftLeftOpcode(OpcodeArgEncoding::FrameBuffer);
-			break;
-		case Opcodes::SHIFT_LEFT_IN_PLL:
-			shiftLeftOpcode(OpcodeArgEncoding::PLL);
-			break;
-		case Opcodes::SHIFT_LEFT_IN_MC:
-			shiftLeftOpcode(OpcodeArgEncoding::MC);
-			break;
-
-		/// SHIFT_RIGHT
-		case Opcodes::SHIFT_RIGHT_IN_REG:
-			shiftRightOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::SHIFT_RIGHT_IN_PS:
-			shiftRightOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::SHIFT_RIGHT_IN_WS:
-			shiftRightOpcode(OpcodeArgEncoding::WorkSpace);
-			break;
-		case Opcodes::SHIFT_RIGHT_IN_FB:
-			shiftRightOpcode(OpcodeArgEncoding::FrameBuffer);
-			break;
-		case Opcodes::SHIFT_RIGHT_IN_PLL:
-			shiftRightOpcode(OpcodeArgEncoding::PLL);
-			break;
-		case Opcodes::SHIFT_RIGHT_IN_MC:
-			shiftRightOpcode(OpcodeArgEncoding::MC);
-			break;
-
-		/// MUL
-		case Opcodes::MUL_WITH_REG:
-			mulOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::MUL_WITH_PS:
-			mulOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::MUL_WITH_WS:
-			mulOpcode(OpcodeArgEncoding::WorkSpace);
-			break;
-		case Opcodes::MUL_WITH_FB:
-			mulOpcode(OpcodeArgEncoding::FrameBuffer);
-			break;
-		case Opcodes::MUL_WITH_PLL:
-			mulOpcode(OpcodeArgEncoding::PLL);
-			break;
-		case Opcodes::MUL_WITH_MC:
-			mulOpcode(OpcodeArgEncoding::MC);
-			break;
-
-		/// DIV
-		case Opcodes::DIV_WITH_REG:
-			divOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::DIV_WITH_PS:
-			divOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::DIV_WITH_WS:
-			divOpcode(OpcodeArgEncoding::WorkSpace);
-			break;
-		case Opcodes::DIV_WITH_FB:
-			divOpcode(OpcodeArgEncoding::FrameBuffer);
-			break;
-		case Opcodes::DIV_WITH_PLL:
-			divOpcode(OpcodeArgEncoding::PLL);
-			break;
-		case Opcodes::DIV_WITH_MC:
-			divOpcode(OpcodeArgEncoding::MC);
-			break;
-
-
-		/// ADD
-		case Opcodes::ADD_INTO_REG:
-			addOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::ADD_INTO_PS:
-			addOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::ADD_INTO_WS:
-			addOpcode(OpcodeArgEncoding::WorkSpace);
-			break;
-		case Opcodes::ADD_INTO_FB:
-			addOpcode(OpcodeArgEncoding::FrameBuffer);
-			break;
-		case Opcodes::ADD_INTO_PLL:
-			addOpcode(OpcodeArgEncoding::PLL);
-			break;
-		case Opcodes::ADD_INTO_MC:
-			addOpcode(OpcodeArgEncoding::MC);
-			break;
-
-		/// SUB
-		case Opcodes::SUB_INTO_REG:
-			subOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::SUB_INTO_PS:
-			subOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::SUB_INTO_WS:
-			subOpcode(OpcodeArgEncoding::WorkSpace);
-			break;
-		case Opcodes::SUB_INTO_FB:
-			subOpcode(OpcodeArgEncoding::FrameBuffer);
-			break;
-		case Opcodes::SUB_INTO_PLL:
-			subOpcode(OpcodeArgEncoding::PLL);
-			break;
-		case Opcodes::SUB_INTO_MC:
-			subOpcode(OpcodeArgEncoding::MC);
-			break;
-
-		/// COMPARE
-		case Opcodes::COMPARE_FROM_REG:
-			compareOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::COMPARE_FROM_PS:
-			compareOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::COMPARE_FROM_WS:
-			compareOpcode(OpcodeArgEncoding::WorkSpace);
-			break;
-		case Opcodes::COMPARE_FROM_FB:
-			compareOpcode(OpcodeArgEncoding::FrameBuffer);
-			break;
-		case Opcodes::COMPARE_FROM_PLL:
-			compareOpcode(OpcodeArgEncoding::PLL);
-			break;
-		case Opcodes::COMPARE_FROM_MC:
-			compareOpcode(OpcodeArgEncoding::MC);
+		case Opcodes::XOR_INTO_REG ... Opcodes::XOR_INTO_MC:
+			xorOpcode(instr);
 			break;
 
 		/// JUMP_*
-		case Opcodes::JUMP_ALWAYS:
-			jumpOpcode(JumpArgEncoding::Always);
-			break;
-		case Opcodes::JUMP_EQUAL:
-			jumpOpcode(JumpArgEncoding::Equal);
-			break;
-		case Opcodes::JUMP_BELOW:
-			jumpOpcode(JumpArgEncoding::Below);
-			break;
-		case Opcodes::JUMP_ABOVE:
-			jumpOpcode(JumpArgEncoding::Above);
-			break;
-		case Opcodes::JUMP_BELOWOREQUAL:
-			jumpOpcode(JumpArgEncoding::BelowOrEqual);
-			break;
-		case Opcodes::JUMP_ABOVEOREQUAL:
-			jumpOpcode(JumpArgEncoding::AboveOrEqual);
-			break;
-		case Opcodes::JUMP_NOTEQUAL:
-			jumpOpcode(JumpArgEncoding::NotEqual);
+		case Opcodes::JUMP_ALWAYS ... Opcodes::JUMP_NOTEQUAL:
+			jumpOpcode(instr, jumpCondition(instr.opcode), instr.imm);
 			break;
 
-		/// TEST
-		case Opcodes::TEST_FROM_REG:
-			testOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::TEST_FROM_PS:
-			testOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::TEST_FROM_WS:
-			testOpcode(OpcodeArgEncoding::WorkSpace);
-			break;
-		case Opcodes::TEST_FROM_FB:
-			testOpcode(OpcodeArgEncoding::FrameBuffer);
-			break;
-		case Opcodes::TEST_FROM_PLL:
-			testOpcode(OpcodeArgEncoding::PLL);
-			break;
-		case Opcodes::TEST_FROM_MC:
-			testOpcode(OpcodeArgEncoding::MC);
-			break;
-
-		/// CLEAR
-		case Opcodes::CLEAR_IN_REG:
-			clearOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::CLEAR_IN_PS:
-			clearOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::CLEAR_IN_WS:
-			clearOpcode(OpcodeArgEncoding::WorkSpace);
-			break;
-		case Opcodes::CLEAR_IN_FB:
-			clearOpcode(OpcodeArgEncoding::FrameBuffer);
-			break;
-		case Opcodes::CLEAR_IN_PLL:
-			clearOpcode(OpcodeArgEncoding::PLL);
-			break;
-		case Opcodes::CLEAR_IN_MC:
-			clearOpcode(OpcodeArgEncoding::MC);
-			break;
-
-		/// MASK
-		case Opcodes::MASK_INTO_REG:
-			maskOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::MASK_INTO_PS:
-			maskOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::MASK_INTO_WS:
-			maskOpcode(OpcodeArgEncoding::WorkSpace);
-			break;
-		case Opcodes::MASK_INTO_FB:
-			maskOpcode(OpcodeArgEncoding::FrameBuffer);
-			break;
-		case Opcodes::MASK_INTO_PLL:
-			maskOpcode(OpcodeArgEncoding::PLL);
-			break;
-		case Opcodes::MASK_INTO_MC:
-			maskOpcode(OpcodeArgEncoding::MC);
-			break;
-
-		/// XOR
-		case Opcodes::XOR_INTO_REG:
-			xorOpcode(OpcodeArgEncoding::Reg);
-			break;
-		case Opcodes::XOR_INTO_PS:
-			xorOpcode(OpcodeArgEncoding::ParameterSpace);
-			break;
-		case Opcodes::XOR_INTO_WS:
-			xorOpcode(OpcodeArgEncoding::WorkSpace);
+		/// Superinstructions
+		case FusedOpcodes::COMPARE_AND_JUMP:
+			compareAndJumpOpcode(instr);
 			break;
-		case Opcodes::XOR_INTO_FB:
-			xorOpcode(OpcodeArgEncoding::FrameBuffer);
+		case FusedOpcodes::TEST_AND_JUMP:
+			testAndJumpOpcode(instr);
 			break;
-		case Opcodes::XOR_INTO_PLL:
-			xorOpcode(OpcodeArgEncoding::PLL);
+		case FusedOpcodes::MASKED_REG_UPDATE:
+			maskedRegUpdateOpcode(instr);
 			break;
-		case Opcodes::XOR_INTO_MC:
-			xorOpcode(OpcodeArgEncoding::MC);
+		case FusedOpcodes::DIV_BY_CONSTANT:
+			divByConstantOpcode(instr);
 			break;
 
 		case Opcodes::END_OF_TABLE: {
 			if(AtomBIOSDebugSettings::logOpcodes) {
 				lilrad_log(DEBUG, "opcode END_OF_TABLE\n");
 			}
-			// Force a drop out by setting IP to a really high value
-			ip = INT32_MAX;
+			next = instructionExit;
 			break;
 		}
 
 		default: {
-			lilrad_log(ERROR, "unexpected opcode 0x%x, in command table 0x%x, ip %x (%x including header)\n", opcode, command.i(), ip - 1, ip + 6 - 1);
+			lilrad_log(ERROR, "unexpected opcode 0x%x, in command table 0x%x, ip %x (%x including header)\n", instr.opcode, command.i(), instr.ip, instr.ip + 6);
 			assert(false && "unexpected atom opcode");
 			__builtin_unreachable();
 		}
@@ -6,7 +6,7 @@
 
 AtomBiosImpl::Command::Command(const libatombios_vector<uint8_t>& data, int index, uint16_t offset)
 : _i{index}, _offset{static_cast<uint16_t>(offset + 0x6)} {
-	memcpy(&commonHeader, data.data() + offset - 0x6, sizeof(CommonHeader));
+	memcpy(&commonHeader, data.data() + offset, sizeof(CommonHeader));
 
 	uint16_t infoShort = static_cast<uint16_t>(data[offset + sizeof(CommonHeader)]) |
 			(static_cast<uint16_t>(data[offset + sizeof(CommonHeader) + 1]) << 8);
@@ -38,10 +38,168 @@ void AtomBiosImpl::CommandTable::readCommands(const libatombios_vector<uint8_t>&
 		if(commandOffset) {
 			commands[i] = Command(data, i, commandOffset);
 		}
+		count = i + 1;
+	}
+}
+
+// Indexed by AtomBios::CommandTables.
+static const char* commandTableNames[] = {
+	"ASIC_Init",
+	"GetDisplaySurfaceSize",
+	"ASIC_RegistersInit",
+	"VRAM_BlockVenderDetection",
+	"DIGxEncoderControl",
+	"MemoryControllerInit",
+	"EnableCRTCMemReq",
+	"MemoryParamAdjust",
+	"DVOEncoderControl",
+	"GPIOPinControl",
+	"SetEngineClock",
+	"SetMemoryClock",
+	"SetPixelClock",
+	"EnableDispPowerGating",
+	"ResetMemoryDLL",
+	"ResetMemoryDevice",
+	"MemoryPLLInit",
+	"AdjustDisplayPll",
+	"AdjustMemoryController",
+	"EnableASIC_StaticPwrMgt",
+	"SetUniphyInstance",
+	"DAC_LoadDetection",
+	"LVTMAEncoderControl",
+	"HW_Misc_Operation",
+	"DAC1EncoderControl",
+	"DAC2EncoderControl",
+	"DVOOutputControl",
+	"CV1OutputControl",
+	"GetConditionalGoldenSetting",
+	"TVEncoderControl",
+	"PatchMCSetting",
+	"MC_SEQ_Control",
+	"Gfx_Harvesting",
+	"EnableScaler",
+	"BlankCRTC",
+	"EnableCRTC",
+	"GetPixelClock",
+	"EnableVGA_Render",
+	"GetSCLKOverMCLKRatio",
+	"SetCRTC_Timing",
+	"SetCRTC_OverScan",
+	"SetCRTC_Replication",
+	"SelectCRTC_Source",
+	"EnableGraphSurfaces",
+	"UpdateCRTC_DoubleBufferRegisters",
+	"LUT_AutoFill",
+	"EnableHW_IconCursor",
+	"GetMemoryClock",
+	"GetEngineClock",
+	"SetCRTC_UsingDTDTiming",
+	"ExternalEncoderControl",
+	"LVTMAOutputControl",
+	"VRAM_BlockDetectionByStrap",
+	"MemoryCleanUp",
+	"ProcessI2cChannelTransaction",
+	"WriteOneByteToHWAssistedI2C",
+	"ReadHWAssistedI2CStatus",
+	"SpeedFanControl",
+	"PowerConnectorDetection",
+	"MC_Synchronization",
+	"ComputeMemoryEnginePLL",
+	"MemoryRefreshConversion",
+	"VRAM_GetCurrentInfoBlock",
+	"DynamicMemorySettings",
+	"MemoryTraining",
+	"EnableSpreadSpectrumOnPPLL",
+	"TMDSAOutputControl",
+	"SetVoltage",
+	"DAC1OutputControl",
+	"DAC2OutputControl",
+	"ComputeMemoryClockParam",
+	"ClockSource",
+	"MemoryDeviceInit",
+	"GetDispObjectInfo",
+	"DIG1EncoderControl",
+	"DIG2EncoderControl",
+	"DIG1TransmitterControl",
+	"DIG2TransmitterControl",
+	"ProcessAuxChannelTransaction",
+	"DPEncoderService",
+	"GetVoltageInfo",
+};
+
+const char* AtomBios::commandTableName(CommandTables table) {
+	if(table < 0 || static_cast<size_t>(table) >= sizeof(commandTableNames) / sizeof(commandTableNames[0])) {
+		return nullptr;
+	}
+	return commandTableNames[table];
+}
+
+void AtomBiosImpl::runCommand(AtomBios::CommandTables table, libatombios_vector<uint32_t>& params) {
+	Command* command = _commandTable.commands.get(table);
+	assert(command && command->exists());
+
+	_runCommand(*command, params);
+}
+
+void AtomBiosImpl::_runCommand(Command& command, libatombios_vector<uint32_t>& params) {
+	// The host may have accessed the index registers since the last command.
+	invalidateIndexCache();
+
+	_runActive = true;
+	if(_jitMode == AtomBios::JitMode::Differential && _optimizerMode != AtomBios::OptimizerMode::SelfCheck) {
+		_runDifferential(command, params);
+	} else {
+		_runBytecode(command, params, 0);
+	}
+	if(_postedMask) {
+		_waitPostedWrites();
 	}
+	_runActive = false;
 }
 
-void AtomBiosImpl::runCommand(AtomBios::CommandTables table, libatombios_vector<uint32_t> params) {
-	assert(_commandTable.commands[table].exists());
-	_runBytecode(_commandTable.commands[table], params, 0);
+AtomBios::FusionStats AtomBiosImpl::fusionStats(int table) {
+	AtomBios::FusionStats stats{};
+
+	Command* command = _commandTable.commands.get(table);
+	if(command && command->decoded) {
+		stats.instructions = command->decoded->code.size();
+		stats.superinstructions = command->decoded->superinstructions;
+		stats.fusedInstructions = command->decoded->fusedInstructions;
+		stats.superinstructionsRun = command->decoded->superinstructionsRun;
+		stats.instructionsRun = command->decoded->instructionsRun;
+	}
+	return stats;
+}
+
+void AtomBiosImpl::setOptimizerMode(AtomBios::OptimizerMode mode) {
+	if(mode == _optimizerMode) {
+		return;
+	}
+
+	_optimizerMode = mode;
+	_dropDecodedCommands();
+}
+
+AtomBios::OptimizerStats AtomBiosImpl::optimizerStats(int table) {
+	AtomBios::OptimizerStats stats{};
+
+	Command* command = _commandTable.commands.get(table);
+	if(command && command->decoded) {
+		stats.foldedRegBlocks = command->decoded->foldedRegBlocks;
+		stats.forwardedSources = command->decoded->forwardedSources;
+		stats.deadStores = command->decoded->deadStores;
+		stats.reducedDivisions = command->decoded->reducedDivisions;
+	}
+	return stats;
+}
+
+void AtomBiosImpl::_dropDecodedCommands() {
+	for(int i = 0; i < _commandTable.count; i++) {
+		Command* command = _commandTable.commands.get(i);
+		if(command && command->decoded) {
+			_jitFree(command->decoded->jit);
+			delete command->decoded;
+			command->decoded = nullptr;
+		}
+	}
 }
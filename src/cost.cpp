@@ -0,0 +1,442 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Cost model: the static estimate walks the decoded command like the footprints do, following the IO port (the
+// reg block does not change the cost) through the command and into the commands it calls. Every instruction gets
+// the counters of what it does; the cheapest and the most expensive path to the end of the command are then found
+// over the graph of instructions, with the jumps back to instructions on the path taken out for the latter.
+
+namespace {
+
+// IO port values: a known port (0 being the MM space), or one of these.
+constexpr int32_t portUnvisited = -2;
+constexpr int32_t portUnknown = -1;
+// The PCI and SYSIO spaces, which are not implemented, so their accesses do not reach the card.
+constexpr int32_t portNotImplemented = -3;
+
+int32_t mergePort(int32_t a, int32_t b) {
+	return a == portUnvisited || a == b ? b : portUnknown;
+}
+
+void addCounters(AtomBios::CostCounters& to, const AtomBios::CostCounters& from) {
+	to.instructions += from.instructions;
+	for(int space = 0; space < AtomBios::footprintSpaces; space++) {
+		to.reads[space] += from.reads[space];
+		to.writes[space] += from.writes[space];
+	}
+	to.delayMicroseconds += from.delayMicroseconds;
+}
+
+}
+
+uint64_t AtomBios::predictNanoseconds(const CostModel& model, const CostCounters& counters) {
+	uint64_t nanoseconds = counters.instructions * model.instructionNanoseconds + counters.delayMicroseconds * 1000;
+	for(int space = 0; space < footprintSpaces; space++) {
+		nanoseconds += (counters.reads[space] + counters.writes[space]) * model.accessNanoseconds[space];
+	}
+	return nanoseconds;
+}
+
+struct AtomBiosImpl::CostAnalysis {
+	AtomBiosImpl* impl;
+	const AtomBios::CostModel& model;
+
+	// A path to the end of the command.
+	struct Path {
+		AtomBios::CostCounters counters;
+		uint64_t nanoseconds;
+	};
+
+	struct Result {
+		Path best;
+		Path worst;
+		bool bounded;
+		// The IO port the command leaves behind.
+		int32_t exitPort;
+	};
+
+	// The commands that were analyzed for an entry port. Commands that are still being analyzed (as they call
+	// themselves) cost nothing more, and leave an unknown port.
+	struct Call {
+		int table;
+		int32_t entryPort;
+		Result result;
+		bool done;
+	};
+	libatombios_vector<Call> calls;
+
+	Path pathOf(const AtomBios::CostCounters& counters) {
+		return Path{counters, AtomBios::predictNanoseconds(model, counters)};
+	}
+
+	// Like the interpreter, stop at invalid opcodes.
+	void addIIO(AtomBios::CostCounters& counters, int32_t port) {
+		if(static_cast<uint32_t>(port) >= impl->_iioIndexes.size() || !impl->_iioIndexes[port]) {
+			return;
+		}
+		uint32_t ip = impl->_iioIndexes[port];
+		while(ip + 2 < impl->_data.size()) {
+			uint8_t opcode = impl->_data[ip];
+			if(opcode > IIOOpcodes::END || opcode == IIOOpcodes::START || opcode == IIOOpcodes::END) {
+				return;
+			}
+			if(opcode == IIOOpcodes::READ) {
+				counters.reads[static_cast<int>(AtomBios::FootprintSpace::Reg)]++;
+			} else if(opcode == IIOOpcodes::WRITE) {
+				counters.writes[static_cast<int>(AtomBios::FootprintSpace::Reg)]++;
+			}
+			ip += _iioInstructionLength(opcode);
+		}
+	}
+
+	void addAccess(AtomBios::CostCounters& counters, AtomBios::FootprintSpace space, bool write) {
+		(write ? counters.writes : counters.reads)[static_cast<int>(space)]++;
+	}
+
+	void addIndexed(AtomBios::CostCounters& counters, AtomBios::FootprintSpace space, const IndexDataPair& pair, bool write) {
+		if(!pair.enabled) {
+			addAccess(counters, space, write);
+			return;
+		}
+		addAccess(counters, AtomBios::FootprintSpace::Reg, true);
+		addAccess(counters, AtomBios::FootprintSpace::Reg, write);
+	}
+
+	void addOperand(AtomBios::CostCounters& counters, OpcodeArgEncoding arg, int32_t port, bool write) {
+		switch(arg) {
+		case OpcodeArgEncoding::Reg:
+			if(port == portNotImplemented) {
+				return;
+			}
+			// An IIO function runs for reads and writes alike.
+			if(port > 0) {
+				addIIO(counters, port);
+				return;
+			}
+			addAccess(counters, AtomBios::FootprintSpace::Reg, write);
+			return;
+		case OpcodeArgEncoding::PLL:
+			addIndexed(counters, AtomBios::FootprintSpace::PLL, impl->_pllIndexData, write);
+			return;
+		case OpcodeArgEncoding::MC:
+			addIndexed(counters, AtomBios::FootprintSpace::MC, impl->_mcIndexData, write);
+			return;
+		case OpcodeArgEncoding::FrameBuffer:
+			addAccess(counters, AtomBios::FootprintSpace::FB, write);
+			return;
+		default:
+			return;
+		}
+	}
+
+	// Everything but CALL_TABLE.
+	AtomBios::CostCounters countersOf(const Instruction& instr, int32_t port) {
+		AtomBios::CostCounters counters{};
+		counters.instructions = 1;
+
+		// Reads the register twice, and writes it once.
+		if(instr.opcode == FusedOpcodes::MASKED_REG_UPDATE) {
+			addOperand(counters, OpcodeArgEncoding::Reg, port, false);
+			addOperand(counters, OpcodeArgEncoding::Reg, port, false);
+			addOperand(counters, OpcodeArgEncoding::Reg, port, true);
+			return counters;
+		}
+		if(instr.opcode == Opcodes::DELAY_MICROSECONDS) {
+			counters.delayMicroseconds = static_cast<uint8_t>(instr.imm);
+			return counters;
+		}
+
+		if(hasSrc(instr)) {
+			addOperand(counters, instr.attrByte.srcArg, port, false);
+		}
+		if(readsDst(instr)) {
+			addOperand(counters, instr.dstArg, port, false);
+		}
+		if(writesDst(instr)) {
+			addOperand(counters, instr.dstArg, port, true);
+		}
+		return counters;
+	}
+
+	int32_t portAfter(const Instruction& instr, int32_t port) {
+		switch(instr.opcode) {
+		case Opcodes::SET_ATI_PORT:
+			return instr.imm;
+		case Opcodes::SET_PCI_PORT:
+		case Opcodes::SET_SYSIO_PORT:
+			return portNotImplemented;
+		}
+		return port;
+	}
+
+	// The instructions that may run after instr; instructionExit (or instructionInvalid) ends the command.
+	template<typename F>
+	void forSuccessors(const DecodedCommand& decoded, const Instruction& instr, F f) {
+		// The interpreter stops at invalid opcodes.
+		if(!instr.valid || instr.opcode == Opcodes::END_OF_TABLE) {
+			f(instructionExit);
+			return;
+		}
+		if(jumps(instr)) {
+			f(instr.target);
+			if(jumpsAlways(instr)) {
+				return;
+			}
+		}
+		if(instr.opcode == Opcodes::SWITCH) {
+			for(uint32_t target : decoded.switches[instr.target].targets) {
+				f(target);
+			}
+		}
+		f(instr.next);
+	}
+
+	static bool ends(uint32_t idx) {
+		return idx == instructionExit || idx == instructionInvalid;
+	}
+
+	Result run(Command& command, int32_t entryPort) {
+		for(const Call& call : calls) {
+			if(call.table == command.i() && call.entryPort == entryPort) {
+				if(call.done) {
+					return call.result;
+				}
+				return Result{pathOf({}), pathOf({}), false, portUnknown};
+			}
+		}
+		size_t callIndex = calls.size();
+		calls.push_back(Call{command.i(), entryPort, {}, false});
+
+		DecodedCommand& decoded = impl->_decoded(command);
+		size_t size = decoded.code.size();
+		bool bounded = true;
+
+		// The IO port each instruction starts with.
+		libatombios_vector<int32_t> ports;
+		ports.resize(size);
+		for(size_t i = 0; i < size; i++) {
+			ports[i] = portUnvisited;
+		}
+		// What each instruction costs, along the cheapest and the most expensive path through its callee.
+		libatombios_vector<AtomBios::CostCounters> best;
+		libatombios_vector<AtomBios::CostCounters> worst;
+		best.resize(size);
+		worst.resize(size);
+		int32_t exitPort = portUnvisited;
+
+		libatombios_vector<uint32_t> worklist;
+		auto reach = [&](uint32_t idx, int32_t port) {
+			if(ends(idx)) {
+				exitPort = mergePort(exitPort, port);
+				return;
+			}
+			int32_t merged = mergePort(ports[idx], port);
+			if(merged != ports[idx]) {
+				ports[idx] = merged;
+				worklist.push_back(idx);
+			}
+		};
+
+		uint32_t entry = decoded.entry < size ? decoded.entry : instructionExit;
+		reach(entry, entryPort);
+		while(!worklist.empty()) {
+			uint32_t idx = worklist.pop();
+			const Instruction& instr = decoded.code[idx];
+			int32_t port = ports[idx];
+
+			if(instr.valid && instr.opcode == Opcodes::CALL_TABLE) {
+				best[idx] = AtomBios::CostCounters{};
+				best[idx].instructions = 1;
+				worst[idx] = best[idx];
+
+				Command* callee = impl->_commandTable.commands.get(instr.imm);
+				if(callee && callee->exists()) {
+					Result result = run(*callee, port);
+					addCounters(best[idx], result.best.counters);
+					addCounters(worst[idx], result.worst.counters);
+					bounded = bounded && result.bounded;
+					port = result.exitPort;
+				}
+			} else if(instr.valid) {
+				best[idx] = countersOf(instr, port);
+				worst[idx] = best[idx];
+				port = portAfter(instr, port);
+			} else {
+				best[idx] = AtomBios::CostCounters{};
+				worst[idx] = best[idx];
+			}
+
+			forSuccessors(decoded, instr, [&](uint32_t next) {
+				reach(next, port);
+			});
+		}
+
+		// The cheapest path from each instruction to the end: relaxed until nothing changes, back to front, as most
+		// jumps go forward. Instructions that can not reach the end have no path.
+		constexpr uint64_t noPath = UINT64_MAX;
+		libatombios_vector<Path> cheapest;
+		cheapest.resize(size);
+		for(size_t i = 0; i < size; i++) {
+			cheapest[i].nanoseconds = noPath;
+		}
+		for(bool changed = true; changed;) {
+			changed = false;
+			for(size_t i = size; i-- > 0;) {
+				if(ports[i] == portUnvisited) {
+					continue;
+				}
+				const Path* next = nullptr;
+				Path end = pathOf({});
+				forSuccessors(decoded, decoded.code[i], [&](uint32_t idx) {
+					const Path* path = ends(idx) ? &end : &cheapest[idx];
+					if(path->nanoseconds != noPath && (!next || path->nanoseconds < next->nanoseconds)) {
+						next = path;
+					}
+				});
+				if(!next) {
+					continue;
+				}
+
+				Path path = pathOf(best[i]);
+				addCounters(path.counters, next->counters);
+				path.nanoseconds += next->nanoseconds;
+				if(path.nanoseconds < cheapest[i].nanoseconds) {
+					cheapest[i] = path;
+					changed = true;
+				}
+			}
+		}
+
+		// The most expensive path, found depth first: jumps to instructions on the current path are loops, which
+		// are left out, so each path counts the instructions of a loop once.
+		libatombios_vector<Path> costliest;
+		costliest.resize(size);
+		// 0: not visited yet, 1: on the current path, 2: done.
+		libatombios_vector<uint8_t> visit;
+		visit.resize(size);
+		for(size_t i = 0; i < size; i++) {
+			visit[i] = 0;
+		}
+		struct Frame {
+			uint32_t idx;
+			bool expanded;
+		};
+		libatombios_vector<Frame> stack;
+		if(!ends(entry)) {
+			stack.push_back(Frame{entry, false});
+		}
+		while(!stack.empty()) {
+			Frame& frame = stack[stack.size() - 1];
+			uint32_t idx = frame.idx;
+			if(!frame.expanded) {
+				// Pushed by another predecessor as well, and visited from there.
+				if(visit[idx]) {
+					stack.pop();
+					continue;
+				}
+				frame.expanded = true;
+				visit[idx] = 1;
+				forSuccessors(decoded, decoded.code[idx], [&](uint32_t next) {
+					if(ends(next)) {
+						return;
+					}
+					if(visit[next] == 1) {
+						bounded = false;
+					} else if(visit[next] == 0) {
+						stack.push_back(Frame{next, false});
+					}
+				});
+				continue;
+			}
+			stack.pop();
+
+			const Path* next = nullptr;
+			Path end = pathOf({});
+			forSuccessors(decoded, decoded.code[idx], [&](uint32_t succ) {
+				if(!ends(succ) && visit[succ] != 2) {
+					return;
+				}
+				const Path* path = ends(succ) ? &end : &costliest[succ];
+				if(!next || path->nanoseconds > next->nanoseconds) {
+					next = path;
+				}
+			});
+			visit[idx] = 2;
+
+			Path path = pathOf(worst[idx]);
+			if(next) {
+				addCounters(path.counters, next->counters);
+				path.nanoseconds += next->nanoseconds;
+			}
+			costliest[idx] = path;
+		}
+
+		Result result{pathOf({}), pathOf({}), bounded, exitPort == portUnvisited ? portUnknown : exitPort};
+		if(!ends(entry)) {
+			// Commands that never return have no cheapest path; count what the most expensive one runs until it loops.
+			if(cheapest[entry].nanoseconds == noPath) {
+				result.bounded = false;
+				result.best = costliest[entry];
+			} else {
+				result.best = cheapest[entry];
+			}
+			result.worst = costliest[entry];
+		}
+
+		calls[callIndex].result = result;
+		calls[callIndex].done = true;
+		return result;
+	}
+};
+
+AtomBios::CostEstimate AtomBiosImpl::estimateCost(int table, const AtomBios::CostModel& model) {
+	AtomBios::CostEstimate estimate{};
+
+	Command* command = _commandTable.commands.get(table);
+	if(!command || !command->exists()) {
+		return estimate;
+	}
+
+	int32_t entryPort = 0;
+	switch(_ioMode) {
+	case IOMode::MM:
+		entryPort = 0;
+		break;
+	case IOMode::IIO:
+		entryPort = _iioPort;
+		break;
+	case IOMode::PCI:
+	case IOMode::SYSIO:
+		entryPort = portNotImplemented;
+		break;
+	}
+
+	CostAnalysis analysis{this, model};
+	CostAnalysis::Result result = analysis.run(*command, entryPort);
+	estimate.best = result.best.counters;
+	estimate.worst = result.worst.counters;
+	estimate.bestNanoseconds = result.best.nanoseconds;
+	estimate.worstNanoseconds = result.worst.nanoseconds;
+	estimate.bounded = result.bounded;
+	return estimate;
+}
+
+void AtomBiosImpl::_costAccess(CardSpace space, bool write, uint32_t val) {
+	switch(space) {
+	case CardSpace::Reg:
+		(write ? _costCounters->writes : _costCounters->reads)[static_cast<int>(AtomBios::FootprintSpace::Reg)]++;
+		break;
+	case CardSpace::PLL:
+		(write ? _costCounters->writes : _costCounters->reads)[static_cast<int>(AtomBios::FootprintSpace::PLL)]++;
+		break;
+	case CardSpace::MC:
+		(write ? _costCounters->writes : _costCounters->reads)[static_cast<int>(AtomBios::FootprintSpace::MC)]++;
+		break;
+	case CardSpace::Delay:
+		_costCounters->delayMicroseconds += val;
+		break;
+	}
+}
@@ -0,0 +1,199 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Coverage: the interpreter sets a bit per instruction index it runs, and counts the directions of conditional jumps
+// and the cases of SWITCHes; here, these are turned back into bytecode offsets. A superinstruction stands for the
+// instructions it replaced, so when it ran, these did; the directions of a fused jump are reported at the jump.
+
+namespace {
+
+bool isFused(const Instruction& instr) {
+	return instr.opcode == FusedOpcodes::COMPARE_AND_JUMP || instr.opcode == FusedOpcodes::TEST_AND_JUMP
+		|| instr.opcode == FusedOpcodes::MASKED_REG_UPDATE;
+}
+
+// The last instruction replaced by the superinstruction at idx; the ones in between were replaced as well.
+uint32_t lastFused(const DecodedCommand& decoded, uint32_t idx) {
+	uint32_t last = idx + 1;
+	while(last + 1 < decoded.code.size() && decoded.code[last].next != decoded.code[idx].next) {
+		last++;
+	}
+	return last;
+}
+
+bool test(const libatombios_vector<uint64_t>& bits, uint32_t idx) {
+	return idx / 64 < bits.size() && (bits[idx / 64] >> (idx % 64)) & 1;
+}
+
+void set(libatombios_vector<uint64_t>& bits, uint32_t idx) {
+	bits[idx / 64] |= static_cast<uint64_t>(1) << (idx % 64);
+}
+
+// The instructions that can be reached from the entry of the command, as a bit per instruction index.
+void reachable(const DecodedCommand& decoded, libatombios_vector<uint64_t>& bits) {
+	bits.resize((decoded.code.size() + 63) / 64, 0);
+
+	libatombios_vector<uint32_t> pending;
+	pending.push_back(decoded.entry);
+	while(!pending.empty()) {
+		uint32_t idx = pending.pop();
+		if(idx >= decoded.code.size() || test(bits, idx)) {
+			continue;
+		}
+		set(bits, idx);
+
+		const Instruction& instr = decoded.code[idx];
+		// The interpreter stops at invalid opcodes.
+		if(!instr.valid || instr.opcode == Opcodes::END_OF_TABLE) {
+			continue;
+		}
+		if(jumps(instr)) {
+			pending.push_back(instr.target);
+			if(jumpOpcode(instr) == Opcodes::JUMP_ALWAYS) {
+				continue;
+			}
+		}
+		if(instr.opcode == Opcodes::SWITCH) {
+			for(uint32_t target : decoded.switches[instr.target].targets) {
+				pending.push_back(target);
+			}
+		}
+		pending.push_back(instr.next);
+	}
+}
+
+} // namespace anonymous
+
+void AtomBiosImpl::_allocCoverage(DecodedCommand& decoded) {
+	decoded.coverage.resize((decoded.code.size() + 63) / 64, 0);
+	decoded.jumpCounts.resize(2 * decoded.code.size(), 0);
+	for(SwitchTable& cases : decoded.switches) {
+		cases.hits.resize(cases.targets.size() + 1, 0);
+	}
+}
+
+void AtomBiosImpl::_coverageBits(Command& command, bool ran, libatombios_vector<uint8_t>& bitmap) {
+	bitmap.resize((command.bytecodeSize() + 7) / 8, 0);
+
+	DecodedCommand& decoded = _decoded(command);
+	libatombios_vector<uint64_t> reached;
+	if(!ran) {
+		reachable(decoded, reached);
+	}
+	const libatombios_vector<uint64_t>& bits = ran ? decoded.coverage : reached;
+
+	auto mark = [&bitmap](uint16_t ip) {
+		if(ip / 8u < bitmap.size()) {
+			bitmap[ip / 8] |= 1 << (ip % 8);
+		}
+	};
+	for(uint32_t idx = 0; idx < decoded.code.size(); idx++) {
+		if(!test(bits, idx)) {
+			continue;
+		}
+		mark(decoded.code[idx].ip);
+		if(isFused(decoded.code[idx])) {
+			for(uint32_t i = idx + 1; i <= lastFused(decoded, idx); i++) {
+				mark(decoded.code[i].ip);
+			}
+		}
+	}
+}
+
+AtomBios::CoverageStats AtomBiosImpl::coverageStats(int table) {
+	AtomBios::CoverageStats stats{};
+
+	Command* command = _commandTable.commands.get(table);
+	if(!command || !command->exists()) {
+		return stats;
+	}
+	stats.bytecodeSize = command->bytecodeSize();
+	stats.bytecodeHash = fnv1a(_data.data() + command->offset() + 6, command->bytecodeSize());
+
+	libatombios_vector<uint8_t> reached;
+	libatombios_vector<uint8_t> ran;
+	_coverageBits(*command, false, reached);
+	_coverageBits(*command, true, ran);
+	for(size_t i = 0; i < reached.size(); i++) {
+		stats.instructions += __builtin_popcount(reached[i]);
+		stats.instructionsRun += __builtin_popcount(ran[i]);
+	}
+	return stats;
+}
+
+size_t AtomBiosImpl::coverageBitmap(int table, bool ran, uint8_t* bitmap, size_t max) {
+	Command* command = _commandTable.commands.get(table);
+	if(!command || !command->exists()) {
+		return 0;
+	}
+
+	libatombios_vector<uint8_t> bits;
+	_coverageBits(*command, ran, bits);
+	for(size_t i = 0; i < bits.size() && i < max; i++) {
+		bitmap[i] = bits[i];
+	}
+	return bits.size();
+}
+
+size_t AtomBiosImpl::branchCoverage(int table, AtomBios::BranchCoverage* branches, size_t max) {
+	Command* command = _commandTable.commands.get(table);
+	if(!command || !command->exists()) {
+		return 0;
+	}
+	DecodedCommand& decoded = _decoded(*command);
+	libatombios_vector<uint8_t> reached;
+	_coverageBits(*command, false, reached);
+
+	size_t count = 0;
+	uint32_t lastJump = UINT32_MAX;
+	auto add = [&](const AtomBios::BranchCoverage& branch) {
+		// A fused jump and the jump it replaced (when that is jumped to) are the same one.
+		if(!branch.isSwitch && branch.offset == lastJump) {
+			if(count - 1 < max) {
+				branches[count - 1].taken += branch.taken;
+				branches[count - 1].notTaken += branch.notTaken;
+			}
+			return;
+		}
+		lastJump = branch.isSwitch ? UINT32_MAX : branch.offset;
+		if(count < max) {
+			branches[count] = branch;
+		}
+		count++;
+	};
+
+	for(uint32_t idx = 0; idx < decoded.code.size(); idx++) {
+		const Instruction& instr = decoded.code[idx];
+		if(!instr.valid || !((reached[instr.ip / 8] >> (instr.ip % 8)) & 1)) {
+			continue;
+		}
+
+		if(jumps(instr) && jumpOpcode(instr) != Opcodes::JUMP_ALWAYS) {
+			AtomBios::BranchCoverage branch{};
+			// Fused jumps are reported at the offset of the jump, which follows the compare or test.
+			branch.offset = instr.opcode == jumpOpcode(instr) ? instr.ip : decoded.code[idx + 1].ip;
+			if(!decoded.jumpCounts.empty()) {
+				branch.notTaken = decoded.jumpCounts[2 * idx];
+				branch.taken = decoded.jumpCounts[2 * idx + 1];
+			}
+			add(branch);
+		} else if(instr.opcode == Opcodes::SWITCH) {
+			const SwitchTable& cases = decoded.switches[instr.target];
+			uint32_t fallthrough = cases.hits.empty() ? 0 : cases.hits[cases.targets.size()];
+			for(uint32_t i = 0; i < cases.targets.size(); i++) {
+				uint32_t hits = cases.hits.empty() ? 0 : cases.hits[i];
+				// Holes of dense tables are no cases; they fall through.
+				if(cases.dense && cases.targets[i] == instr.next) {
+					fallthrough += hits;
+					continue;
+				}
+				add(AtomBios::BranchCoverage{instr.ip, true, false, cases.dense ? cases.base + i : cases.keys[i], hits, 0});
+			}
+			add(AtomBios::BranchCoverage{instr.ip, true, true, 0, fallthrough, 0});
+		}
+	}
+	return count;
+}
@@ -0,0 +1,365 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+#include <span>
+
+namespace {
+
+// Index into ipToIndex of bytecode that has not been decoded (yet).
+constexpr uint32_t notDecoded = 0xFFFFFFFF;
+
+// Destination operands of the opcode families that come in REG/PS/WS/FB/PLL/MC variants.
+constexpr OpcodeArgEncoding familyArgs[] = {
+	OpcodeArgEncoding::Reg,
+	OpcodeArgEncoding::ParameterSpace,
+	OpcodeArgEncoding::WorkSpace,
+	OpcodeArgEncoding::FrameBuffer,
+	OpcodeArgEncoding::PLL,
+	OpcodeArgEncoding::MC
+};
+
+bool inFamily(uint8_t opcode, uint8_t base, OpcodeArgEncoding& arg) {
+	if(opcode < base || opcode >= base + std::size(familyArgs)) {
+		return false;
+	}
+	arg = familyArgs[opcode - base];
+	return true;
+}
+
+// Reads the bytecode of a single command.
+// Reading past the end does not assert (as the interpreter would), but marks the reader as overrun.
+struct BytecodeReader {
+	const uint8_t* code;
+	uint32_t size;
+	uint32_t ip;
+	bool overrun = false;
+
+	uint8_t byte() {
+		if(ip >= size) {
+			overrun = true;
+			return 0;
+		}
+		return code[ip++];
+	}
+	uint16_t word() {
+		uint16_t a = byte();
+		return a | (static_cast<uint16_t>(byte()) << 8);
+	}
+	uint32_t dword() {
+		uint32_t a = word();
+		return a | (static_cast<uint32_t>(word()) << 16);
+	}
+
+	uint32_t alignSize(SrcEncoding align) {
+		switch(align) {
+		case SrcEncoding::SrcByte0 ... SrcEncoding::SrcByte24:
+			return byte();
+		case SrcEncoding::SrcWord0 ... SrcEncoding::SrcWord16:
+			return word();
+		case SrcEncoding::SrcDword:
+			return dword();
+		}
+		__builtin_unreachable();
+	}
+
+	AttrByte attrByte() {
+		uint8_t b = byte();
+		AttrByte attrByte;
+		attrByte.srcArg = static_cast<OpcodeArgEncoding>(b & 0b111);
+		attrByte.srcAlign = static_cast<SrcEncoding>((b >> 3) & 0b111);
+		attrByte.dstAlign = static_cast<SrcEncoding>(atom_dst_to_src[attrByte.srcAlign][(b >> 6) & 0b11]);
+		return attrByte;
+	}
+
+	uint32_t idx(OpcodeArgEncoding arg) {
+		switch(arg) {
+		case OpcodeArgEncoding::Reg:
+		case OpcodeArgEncoding::ID:
+			return word();
+		case OpcodeArgEncoding::ParameterSpace:
+		case OpcodeArgEncoding::WorkSpace:
+		case OpcodeArgEncoding::FrameBuffer:
+		case OpcodeArgEncoding::PLL:
+		case OpcodeArgEncoding::MC:
+			return byte();
+		case OpcodeArgEncoding::Imm:
+			// No Idx is needed
+			return 0;
+		}
+		__builtin_unreachable();
+	}
+
+	// Immediate sources are stored inline, after the source index.
+	uint32_t srcImm(AttrByte attrByte) {
+		if(attrByte.srcArg != OpcodeArgEncoding::Imm) {
+			return 0;
+		}
+		return alignSize(attrByte.srcAlign);
+	}
+};
+
+// Turns a jump target (which is relative to the start of the command, including its header) into an ip.
+uint32_t jumpTargetIP(uint32_t target, uint32_t size) {
+	if(target < 0x6 || (target - 0x6) >= size) {
+		return instructionInvalid;
+	}
+	return target - 0x6;
+}
+
+// Switches whose cases cover at least this fraction (1 / n) of their value range get a dense table.
+constexpr uint32_t denseSwitchFillDivisor = 2;
+
+}
+
+DecodedCommand* AtomBiosImpl::_decodeCommand(Command& command) {
+	BytecodeReader reader{_data.data() + command.offset(), command.bytecodeSize(), 0};
+	if(command.offset() + reader.size > _data.size()) {
+		lilrad_log(WARNING, "command %02x extends past the end of the ROM, truncating\n", command.i());
+		reader.size = command.offset() < _data.size() ? _data.size() - command.offset() : 0;
+	}
+
+	// Raw case lists, before they are turned into SwitchTables.
+	struct SwitchCases {
+		libatombios_vector<uint32_t> values;
+		libatombios_vector<uint32_t> targets;
+	};
+
+	libatombios_vector<Instruction> found;
+	libatombios_vector<SwitchCases> foundCases;
+	libatombios_vector<uint32_t> ipToIndex;
+	ipToIndex.resize(reader.size, notDecoded);
+
+	// Decode everything reachable from the entry point; next and target hold ips until the end.
+	libatombios_vector<uint32_t> worklist;
+	if(reader.size) {
+		worklist.push_back(0);
+	}
+
+	auto enqueue = [&worklist](uint32_t ip) {
+		if(ip != instructionExit && ip != instructionInvalid) {
+			worklist.push_back(ip);
+		}
+	};
+
+	while(!worklist.empty()) {
+		uint32_t ip = worklist.back();
+		worklist.resize(worklist.size() - 1);
+		if(ipToIndex[ip] != notDecoded) {
+			continue;
+		}
+
+		reader.ip = ip;
+		reader.overrun = false;
+
+		Instruction instr{};
+		instr.ip = ip;
+		instr.valid = true;
+		instr.opcode = reader.byte();
+		instr.next = instructionExit;
+		instr.target = instructionExit;
+
+		bool fallsThrough = true;
+		OpcodeArgEncoding arg;
+		if(inFamily(instr.opcode, Opcodes::MOVE_TO_REG, arg)
+				|| inFamily(instr.opcode, Opcodes::AND_INTO_REG, arg)
+				|| inFamily(instr.opcode, Opcodes::OR_INTO_REG, arg)
+				|| inFamily(instr.opcode, Opcodes::MUL_WITH_REG, arg)
+				|| inFamily(instr.opcode, Opcodes::DIV_WITH_REG, arg)
+				|| inFamily(instr.opcode, Opcodes::ADD_INTO_REG, arg)
+				|| inFamily(instr.opcode, Opcodes::SUB_INTO_REG, arg)
+				|| inFamily(instr.opcode, Opcodes::COMPARE_FROM_REG, arg)
+				|| inFamily(instr.opcode, Opcodes::TEST_FROM_REG, arg)
+				|| inFamily(instr.opcode, Opcodes::XOR_INTO_REG, arg)) {
+			instr.dstArg = arg;
+			instr.attrByte = reader.attrByte();
+			instr.dstIdx = reader.idx(arg);
+			instr.srcIdx = reader.idx(instr.attrByte.srcArg);
+			instr.imm = reader.srcImm(instr.attrByte);
+		} else if(inFamily(instr.opcode, Opcodes::SHIFT_LEFT_IN_REG, arg)
+				|| inFamily(instr.opcode, Opcodes::SHIFT_RIGHT_IN_REG, arg)) {
+			instr.dstArg = arg;
+			instr.attrByte = reader.attrByte();
+			instr.dstIdx = reader.idx(arg);
+			instr.imm = reader.byte();
+		} else if(inFamily(instr.opcode, Opcodes::CLEAR_IN_REG, arg)) {
+			instr.dstArg = arg;
+			instr.attrByte = reader.attrByte();
+			instr.dstIdx = reader.idx(arg);
+		} else if(inFamily(instr.opcode, Opcodes::MASK_INTO_REG, arg)) {
+			instr.dstArg = arg;
+			instr.attrByte = reader.attrByte();
+			instr.dstIdx = reader.idx(arg);
+			instr.mask = reader.alignSize(instr.attrByte.dstAlign);
+			instr.srcIdx = reader.idx(instr.attrByte.srcArg);
+			instr.imm = reader.srcImm(instr.attrByte);
+		} else {
+			switch(instr.opcode) {
+			case Opcodes::JUMP_ALWAYS ... Opcodes::JUMP_NOTEQUAL:
+				instr.imm = reader.word();
+				instr.target = jumpTargetIP(instr.imm, reader.size);
+				fallsThrough = instr.opcode != Opcodes::JUMP_ALWAYS;
+				enqueue(instr.target);
+				break;
+			case Opcodes::CALL_TABLE:
+			case Opcodes::SET_DATA_TABLE:
+			case Opcodes::DELAY_MICROSECONDS:
+				instr.imm = reader.byte();
+				break;
+			case Opcodes::SET_ATI_PORT:
+			case Opcodes::SET_REG_BLOCK:
+				instr.imm = reader.word();
+				break;
+			case Opcodes::SET_PCI_PORT:
+			case Opcodes::SET_SYSIO_PORT:
+				break;
+			case Opcodes::END_OF_TABLE:
+				fallsThrough = false;
+				break;
+			case Opcodes::SWITCH: {
+				constexpr uint8_t caseMagic = 0x63;
+				constexpr uint16_t caseEnd = 0x5A5A;
+
+				instr.attrByte = reader.attrByte();
+				instr.srcIdx = reader.idx(instr.attrByte.srcArg);
+				instr.imm = reader.srcImm(instr.attrByte);
+
+				SwitchCases cases;
+				while(!reader.overrun) {
+					uint32_t caseIP = reader.ip;
+					if(reader.word() == caseEnd) {
+						break;
+					}
+					reader.ip = caseIP;
+
+					if(reader.byte() != caseMagic) {
+						// The linux intepreter bails out here, and continues from the invalid case.
+						lilrad_log(WARNING, "switchOpcode: invalid case magic seen, bailing out!\n");
+						reader.ip = caseIP;
+						break;
+					}
+					cases.values.push_back(reader.alignSize(instr.attrByte.srcAlign));
+					cases.targets.push_back(jumpTargetIP(reader.word(), reader.size));
+					enqueue(cases.targets.back());
+				}
+
+				instr.target = foundCases.size();
+				foundCases.push_back(cases);
+				break;
+			}
+			default:
+				instr.valid = false;
+				break;
+			}
+		}
+
+		if(reader.overrun) {
+			instr.valid = false;
+		}
+		if(!instr.valid) {
+			fallsThrough = false;
+		}
+		if(fallsThrough && reader.ip < reader.size) {
+			instr.next = reader.ip;
+			enqueue(instr.next);
+		}
+
+		ipToIndex[ip] = found.size();
+		found.push_back(instr);
+	}
+
+	// Lay the instructions out in bytecode order, and resolve the ips into indexes.
+	DecodedCommand* decoded = new DecodedCommand;
+	for(uint32_t ip = 0; ip < reader.size; ip++) {
+		if(ipToIndex[ip] != notDecoded) {
+			uint32_t index = decoded->code.size();
+			decoded->code.push_back(found[ipToIndex[ip]]);
+			ipToIndex[ip] = index;
+		}
+	}
+
+	auto resolve = [&ipToIndex](uint32_t ip) -> uint32_t {
+		if(ip == instructionExit || ip == instructionInvalid) {
+			return ip;
+		}
+		return ipToIndex[ip];
+	};
+
+	for(Instruction& instr : decoded->code) {
+		instr.next = resolve(instr.next);
+		if(instr.valid && instr.opcode >= Opcodes::JUMP_ALWAYS && instr.opcode <= Opcodes::JUMP_NOTEQUAL) {
+			instr.target = resolve(instr.target);
+		}
+	}
+
+	// Build the switch tables.
+	for(Instruction& instr : decoded->code) {
+		if(!instr.valid || instr.opcode != Opcodes::SWITCH) {
+			continue;
+		}
+
+		SwitchCases& cases = foundCases[instr.target];
+		instr.target = decoded->switches.size();
+		SwitchTable& table = decoded->switches.emplace_back();
+
+		// Only the first case with a given value can be taken; keep the values sorted.
+		for(size_t i = 0; i < cases.values.size(); i++) {
+			uint32_t val = cases.values[i];
+			size_t pos = table.keys.size();
+			bool duplicate = false;
+			for(size_t j = 0; j < table.keys.size(); j++) {
+				if(table.keys[j] == val) {
+					duplicate = true;
+					break;
+				}
+				if(table.keys[j] > val) {
+					pos = j;
+					break;
+				}
+			}
+			if(duplicate) {
+				continue;
+			}
+
+			table.keys.push_back(0);
+			table.targets.push_back(0);
+			for(size_t j = table.keys.size() - 1; j > pos; j--) {
+				table.keys[j] = table.keys[j - 1];
+				table.targets[j] = table.targets[j - 1];
+			}
+			table.keys[pos] = val;
+			table.targets[pos] = resolve(cases.targets[i]);
+		}
+
+		table.dense = false;
+		table.base = 0;
+		if(!table.keys.empty()) {
+			uint32_t span = table.keys.back() - table.keys[0];
+			if(span / denseSwitchFillDivisor < table.keys.size()) {
+				libatombios_vector<uint32_t> dense;
+				dense.resize(span + 1, instr.next);
+				for(size_t j = 0; j < table.keys.size(); j++) {
+					dense[table.keys[j] - table.keys[0]] = table.targets[j];
+				}
+
+				table.dense = true;
+				table.base = table.keys[0];
+				table.targets = dense;
+				table.keys.clear();
+			}
+		}
+
+		if(AtomBIOSDebugSettings::logCommandTableCreation) {
+			lilrad_log(DEBUG, "command %02x: SWITCH at %04x has %zu cases (%s)\n", command.i(), instr.ip + 0x6,
+				cases.values.size(), table.dense ? "dense" : "sparse");
+		}
+	}
+
+	if(AtomBIOSDebugSettings::logCommandTableCreation) {
+		lilrad_log(DEBUG, "command %02x: decoded %zu instructions\n", command.i(), decoded->code.size());
+	}
+
+	return decoded;
+}
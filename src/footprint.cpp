@@ -0,0 +1,431 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Footprints: the card accesses a command may make.
+// The reg block and IO mode are followed through the decoded command, like the optimizer folds reg blocks, but
+// starting from the ones the command is run with. CALL_TABLE continues into the callee with the state at the call,
+// and Reg operands in IIO mode access the registers of the IIO function. The WorkSpace, parameter space and ROM
+// are private to each run, so they are not part of the footprint.
+
+namespace {
+
+// State values: a known reg block or IO port (0 being the MM space), or one of these.
+constexpr int32_t stateUnvisited = -2;
+constexpr int32_t stateUnknown = -1;
+// IO port only: the PCI and SYSIO spaces, which are not implemented, so their accesses do not reach the card.
+constexpr int32_t ioNotImplemented = -3;
+
+int32_t mergeValue(int32_t a, int32_t b) {
+	return a == stateUnvisited || a == b ? b : stateUnknown;
+}
+
+// What the card accesses of an instruction depend on.
+struct State {
+	int32_t regBlock = stateUnvisited;
+	int32_t ioPort = stateUnvisited;
+
+	bool operator==(const State& other) const = default;
+
+	// Returns whether anything changed.
+	bool merge(const State& other) {
+		State merged{mergeValue(regBlock, other.regBlock), mergeValue(ioPort, other.ioPort)};
+		bool changed = merged != *this;
+		*this = merged;
+		return changed;
+	}
+};
+
+// Everything but CALL_TABLE.
+State stateAfter(const Instruction& instr, State state) {
+	switch(instr.opcode) {
+	case Opcodes::SET_REG_BLOCK:
+		state.regBlock = instr.imm;
+		break;
+	case Opcodes::SET_ATI_PORT:
+		state.ioPort = instr.imm;
+		break;
+	case Opcodes::SET_PCI_PORT:
+	case Opcodes::SET_SYSIO_PORT:
+		state.ioPort = ioNotImplemented;
+		break;
+	}
+	if(writesDst(instr) && instr.dstArg == OpcodeArgEncoding::WorkSpace && instr.dstIdx == WS_REGPTR) {
+		state.regBlock = stateUnknown;
+	}
+	return state;
+}
+
+void addIndex(libatombios_vector<uint32_t>& indexes, uint32_t idx) {
+	size_t lo = 0;
+	size_t hi = indexes.size();
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if(indexes[mid] < idx) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if(lo < indexes.size() && indexes[lo] == idx) {
+		return;
+	}
+
+	indexes.push_back(0);
+	for(size_t j = indexes.size() - 1; j > lo; j--) {
+		indexes[j] = indexes[j - 1];
+	}
+	indexes[lo] = idx;
+}
+
+// Whether two sorted index lists share an index.
+bool overlaps(const libatombios_vector<uint32_t>& a, const libatombios_vector<uint32_t>& b) {
+	size_t i = 0;
+	size_t j = 0;
+	while(i < a.size() && j < b.size()) {
+		if(a[i] == b[j]) {
+			return true;
+		}
+		if(a[i] < b[j]) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+	return false;
+}
+
+}
+
+void CommandFootprint::clear() {
+	for(int space = 0; space < AtomBios::footprintSpaces; space++) {
+		reads[space].clear();
+		writes[space].clear();
+		readsAny[space] = false;
+		writesAny[space] = false;
+	}
+	invalidOpcodes.clear();
+	missingTables.clear();
+	valid = false;
+}
+
+bool CommandFootprint::conflictsWith(const CommandFootprint& other) const {
+	for(int space = 0; space < AtomBios::footprintSpaces; space++) {
+		bool reads = readsAny[space] || !this->reads[space].empty();
+		bool writes = writesAny[space] || !this->writes[space].empty();
+		bool otherReads = other.readsAny[space] || !other.reads[space].empty();
+		bool otherWrites = other.writesAny[space] || !other.writes[space].empty();
+
+		if((writesAny[space] && (otherReads || otherWrites)) || (other.writesAny[space] && (reads || writes))
+				|| (readsAny[space] && otherWrites) || (other.readsAny[space] && writes)) {
+			return true;
+		}
+		if(overlaps(this->writes[space], other.writes[space]) || overlaps(this->writes[space], other.reads[space])
+				|| overlaps(this->reads[space], other.writes[space])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+struct AtomBiosImpl::FootprintAnalysis {
+	AtomBiosImpl* impl;
+	CommandFootprint& footprint;
+
+	// The commands that were analyzed for an entry state, and the state they leave behind.
+	// Commands that are still being analyzed (as they call themselves) leave an unknown state.
+	struct Call {
+		int table;
+		State entry;
+		State exit;
+		bool done;
+	};
+	libatombios_vector<Call> calls;
+	// IIO ports whose function was added already.
+	libatombios_vector<uint32_t> iioPorts;
+
+	void add(AtomBios::FootprintSpace space, bool write, uint32_t idx) {
+		int i = static_cast<int>(space);
+		addIndex(write ? footprint.writes[i] : footprint.reads[i], idx);
+	}
+
+	void addAny(AtomBios::FootprintSpace space, bool write) {
+		int i = static_cast<int>(space);
+		(write ? footprint.writesAny : footprint.readsAny)[i] = true;
+	}
+
+	// Whatever the access, the IIO function makes the register accesses it contains.
+	void addIIO(uint32_t port) {
+		for(uint32_t added : iioPorts) {
+			if(added == port) {
+				return;
+			}
+		}
+		iioPorts.push_back(port);
+
+		// Like the interpreter, stop at invalid opcodes.
+		if(port >= impl->_iioIndexes.size() || !impl->_iioIndexes[port]) {
+			return;
+		}
+		uint32_t ip = impl->_iioIndexes[port];
+		while(ip + 2 < impl->_data.size()) {
+			uint8_t opcode = impl->_data[ip];
+			if(opcode > IIOOpcodes::END || opcode == IIOOpcodes::START || opcode == IIOOpcodes::END) {
+				return;
+			}
+			if(opcode == IIOOpcodes::READ || opcode == IIOOpcodes::WRITE) {
+				add(AtomBios::FootprintSpace::Reg, opcode == IIOOpcodes::WRITE, impl->read16(ip + 1));
+			}
+			ip += _iioInstructionLength(opcode);
+		}
+	}
+
+	void addIndexed(AtomBios::FootprintSpace space, const IndexDataPair& pair, uint32_t idx, bool write) {
+		add(space, write, idx);
+		if(pair.enabled) {
+			add(AtomBios::FootprintSpace::Reg, true, pair.indexReg);
+			add(AtomBios::FootprintSpace::Reg, write, pair.dataReg);
+		}
+	}
+
+	void addOperand(const Instruction& instr, const State& state, OpcodeArgEncoding arg, uint32_t idx, bool write) {
+		switch(arg) {
+		case OpcodeArgEncoding::Reg: {
+			if(state.ioPort == ioNotImplemented) {
+				return;
+			}
+			// Either space may be accessed, and IIO functions may read and write.
+			if(state.ioPort == stateUnknown) {
+				addAny(AtomBios::FootprintSpace::Reg, false);
+				addAny(AtomBios::FootprintSpace::Reg, true);
+				return;
+			}
+			if(state.ioPort) {
+				addIIO(state.ioPort);
+				return;
+			}
+
+			// Folded instructions have the reg block added to their Reg operands already.
+			if(instr.optFlags & OptimizerFlags::OptRegBlockFolded) {
+				add(AtomBios::FootprintSpace::Reg, write, idx);
+			} else if(state.regBlock == stateUnknown) {
+				addAny(AtomBios::FootprintSpace::Reg, write);
+			} else {
+				add(AtomBios::FootprintSpace::Reg, write, idx + state.regBlock);
+			}
+			return;
+		}
+		case OpcodeArgEncoding::PLL:
+			addIndexed(AtomBios::FootprintSpace::PLL, impl->_pllIndexData, idx, write);
+			return;
+		case OpcodeArgEncoding::MC:
+			addIndexed(AtomBios::FootprintSpace::MC, impl->_mcIndexData, idx, write);
+			return;
+		case OpcodeArgEncoding::FrameBuffer:
+			addAny(AtomBios::FootprintSpace::FB, write);
+			return;
+		default:
+			return;
+		}
+	}
+
+	void addInstruction(const Instruction& instr, const State& state) {
+		// Reads the register, and writes it back along with the WorkSpace.
+		if(instr.opcode == FusedOpcodes::MASKED_REG_UPDATE) {
+			addOperand(instr, state, OpcodeArgEncoding::Reg, instr.dstIdx, false);
+			addOperand(instr, state, OpcodeArgEncoding::Reg, instr.dstIdx, true);
+			return;
+		}
+
+		if(hasSrc(instr)) {
+			addOperand(instr, state, instr.attrByte.srcArg, instr.srcIdx, false);
+		}
+		if(readsDst(instr)) {
+			addOperand(instr, state, instr.dstArg, instr.dstIdx, false);
+		}
+		if(writesDst(instr)) {
+			addOperand(instr, state, instr.dstArg, instr.dstIdx, true);
+		}
+	}
+
+	// Adds the accesses of the command when it starts with the given state; returns the state it leaves behind.
+	State run(Command& command, const State& entry) {
+		for(const Call& call : calls) {
+			if(call.table == command.i() && call.entry == entry) {
+				return call.done ? call.exit : State{stateUnknown, stateUnknown};
+			}
+		}
+		size_t callIndex = calls.size();
+		calls.push_back(Call{command.i(), entry, State{}, false});
+
+		DecodedCommand& decoded = impl->_decoded(command);
+
+		// Per instruction: the state it starts with.
+		libatombios_vector<State> states;
+		states.resize(decoded.code.size());
+		libatombios_vector<uint32_t> worklist;
+		State exit;
+
+		auto reach = [&](uint32_t idx, const State& state) {
+			// Jumps outside of the command end it.
+			if(idx == instructionExit || idx == instructionInvalid) {
+				exit.merge(state);
+				return;
+			}
+			if(states[idx].merge(state)) {
+				worklist.push_back(idx);
+			}
+		};
+
+		reach(decoded.entry < decoded.code.size() ? decoded.entry : instructionExit, entry);
+		while(!worklist.empty()) {
+			uint32_t idx = worklist.pop();
+			const Instruction& instr = decoded.code[idx];
+			State state = states[idx];
+
+			// The interpreter stops at invalid opcodes.
+			if(!instr.valid || instr.opcode == Opcodes::END_OF_TABLE) {
+				if(!instr.valid) {
+					addIndex(footprint.invalidOpcodes, instr.opcode);
+				}
+				reach(instructionExit, state);
+				continue;
+			}
+
+			if(instr.opcode == Opcodes::CALL_TABLE) {
+				Command* callee = impl->_commandTable.commands.get(instr.imm);
+				if(callee && callee->exists()) {
+					state = run(*callee, state);
+				} else {
+					addIndex(footprint.missingTables, instr.imm);
+				}
+			} else {
+				state = stateAfter(instr, state);
+			}
+
+			if(jumps(instr)) {
+				reach(instr.target, state);
+				if(jumpsAlways(instr)) {
+					continue;
+				}
+			}
+			if(instr.opcode == Opcodes::SWITCH) {
+				for(uint32_t target : decoded.switches[instr.target].targets) {
+					reach(target, state);
+				}
+			}
+			reach(instr.next, state);
+		}
+
+		for(size_t i = 0; i < decoded.code.size(); i++) {
+			if(states[i].regBlock != stateUnvisited && decoded.code[i].valid) {
+				addInstruction(decoded.code[i], states[i]);
+			}
+		}
+
+		// Commands that never return leave nothing behind; keep the caller going anyway.
+		if(exit.regBlock == stateUnvisited) {
+			exit = State{stateUnknown, stateUnknown};
+		}
+		calls[callIndex].exit = exit;
+		calls[callIndex].done = true;
+		return exit;
+	}
+};
+
+const CommandFootprint& AtomBiosImpl::_footprint(Command& command) {
+	CommandFootprint& footprint = _decoded(command).footprint;
+	if(footprint.valid && footprint.regBlock == _regBlock && footprint.ioMode == _ioMode
+			&& footprint.iioPort == _iioPort && footprint.generation == _footprintGeneration) {
+		return footprint;
+	}
+
+	footprint.clear();
+	footprint.regBlock = _regBlock;
+	footprint.ioMode = _ioMode;
+	footprint.iioPort = _iioPort;
+	footprint.generation = _footprintGeneration;
+
+	State entry;
+	entry.regBlock = _regBlock;
+	switch(_ioMode) {
+	case IOMode::MM:
+		entry.ioPort = 0;
+		break;
+	case IOMode::IIO:
+		entry.ioPort = _iioPort;
+		break;
+	case IOMode::PCI:
+	case IOMode::SYSIO:
+		entry.ioPort = ioNotImplemented;
+		break;
+	}
+
+	FootprintAnalysis analysis{this, footprint};
+	analysis.run(command, entry);
+	footprint.valid = true;
+
+	if(AtomBIOSDebugSettings::logCommandTableCreation) {
+		lilrad_log(DEBUG, "footprint: command %x reads %zu registers%s, writes %zu registers%s\n", command.i(),
+			footprint.reads[0].size(), footprint.readsAny[0] ? " (or any)" : "",
+			footprint.writes[0].size(), footprint.writesAny[0] ? " (or any)" : "");
+	}
+	return footprint;
+}
+
+AtomBios::FootprintStats AtomBiosImpl::footprintStats(int table) {
+	AtomBios::FootprintStats stats{};
+
+	Command* command = _commandTable.commands.get(table);
+	if(command && command->exists()) {
+		const CommandFootprint& footprint = _footprint(*command);
+		for(int space = 0; space < AtomBios::footprintSpaces; space++) {
+			stats.reads[space] = footprint.reads[space].size();
+			stats.writes[space] = footprint.writes[space].size();
+			stats.readsAny[space] = footprint.readsAny[space];
+			stats.writesAny[space] = footprint.writesAny[space];
+		}
+		stats.invalidOpcodes = footprint.invalidOpcodes.size();
+		stats.missingTables = footprint.missingTables.size();
+	}
+	return stats;
+}
+
+size_t AtomBiosImpl::footprintIndexes(int table, AtomBios::FootprintSpace space, bool write, uint32_t* indexes, size_t max) {
+	Command* command = _commandTable.commands.get(table);
+	if(!command || !command->exists()) {
+		return 0;
+	}
+
+	const CommandFootprint& footprint = _footprint(*command);
+	const libatombios_vector<uint32_t>& found = (write ? footprint.writes : footprint.reads)[static_cast<int>(space)];
+	for(size_t i = 0; i < found.size() && i < max; i++) {
+		indexes[i] = found[i];
+	}
+	return found.size();
+}
+
+size_t AtomBiosImpl::footprintInvalidOpcodes(int table, uint8_t* opcodes, size_t max) {
+	Command* command = _commandTable.commands.get(table);
+	if(!command || !command->exists()) {
+		return 0;
+	}
+
+	const CommandFootprint& footprint = _footprint(*command);
+	for(size_t i = 0; i < footprint.invalidOpcodes.size() && i < max; i++) {
+		opcodes[i] = footprint.invalidOpcodes[i];
+	}
+	return footprint.invalidOpcodes.size();
+}
+
+bool AtomBiosImpl::commandsConflict(int a, int b) {
+	Command* commandA = _commandTable.commands.get(a);
+	Command* commandB = _commandTable.commands.get(b);
+	if(!commandA || !commandA->exists() || !commandB || !commandB->exists()) {
+		return false;
+	}
+
+	return _footprint(*commandA).conflictsWith(_footprint(*commandB));
+}
@@ -0,0 +1,128 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Superinstructions replace the first instruction of a sequence, and continue after its last one.
+// The other instructions of the sequence are left in place, as they may still be reached by jumps.
+
+namespace {
+
+bool isDword(const AttrByte& attrByte) {
+	return attrByte.srcAlign == SrcEncoding::SrcDword && attrByte.dstAlign == SrcEncoding::SrcDword;
+}
+
+const Instruction* follower(DecodedCommand& decoded, const Instruction& instr) {
+	if(instr.next == instructionExit) {
+		return nullptr;
+	}
+
+	const Instruction* next = &decoded.code[instr.next];
+	return next->valid ? next : nullptr;
+}
+
+bool fuseCompareAndJump(DecodedCommand& decoded, Instruction& instr) {
+	uint8_t fusedOpcode;
+	if(instr.opcode >= Opcodes::COMPARE_FROM_REG && instr.opcode <= Opcodes::COMPARE_FROM_MC) {
+		fusedOpcode = FusedOpcodes::COMPARE_AND_JUMP;
+	} else if(instr.opcode >= Opcodes::TEST_FROM_REG && instr.opcode <= Opcodes::TEST_FROM_MC) {
+		fusedOpcode = FusedOpcodes::TEST_AND_JUMP;
+	} else {
+		return false;
+	}
+
+	const Instruction* jump = follower(decoded, instr);
+	if(!jump || jump->opcode < Opcodes::JUMP_ALWAYS || jump->opcode > Opcodes::JUMP_NOTEQUAL) {
+		return false;
+	}
+
+	instr.opcode = fusedOpcode;
+	instr.fusedOpcode = jump->opcode;
+	instr.fusedJumpTarget = jump->imm;
+	instr.target = jump->target;
+	instr.next = jump->next;
+	decoded.fusedInstructions += 2;
+	return true;
+}
+
+// Folds an AND / OR of an immediate into the masks of a masked update, which computes (x & andMask) | orMask.
+bool foldMask(const Instruction& instr, uint32_t& andMask, uint32_t& orMask) {
+	bool isAnd = instr.opcode == Opcodes::AND_INTO_WS;
+	if(!isAnd && instr.opcode != Opcodes::OR_INTO_WS) {
+		return false;
+	}
+	if(instr.attrByte.srcArg != OpcodeArgEncoding::Imm) {
+		return false;
+	}
+
+	// Apply the alignment of the instruction, so the masks work on the full dword.
+	uint32_t alignMask = atom_arg_mask[instr.attrByte.dstAlign];
+	uint32_t val = (instr.attrByte.swizleSrc(instr.imm) << atom_arg_shift[instr.attrByte.dstAlign]) & alignMask;
+
+	if(isAnd) {
+		andMask &= val | ~alignMask;
+		orMask &= val | ~alignMask;
+	} else {
+		orMask |= val;
+	}
+	return true;
+}
+
+bool fuseMaskedRegUpdate(DecodedCommand& decoded, Instruction& instr) {
+	if(instr.opcode != Opcodes::MOVE_TO_WS || instr.attrByte.srcArg != OpcodeArgEncoding::Reg || !isDword(instr.attrByte)) {
+		return false;
+	}
+	// The special WorkSpace addresses have side effects.
+	if(instr.dstIdx >= WorkSpaceSpecialAddresses::WS_QUOTIENT) {
+		return false;
+	}
+
+	uint32_t reg = instr.srcIdx;
+	uint32_t ws = instr.dstIdx;
+	uint32_t andMask = 0xFFFFFFFF;
+	uint32_t orMask = 0;
+	uint32_t count = 1;
+
+	const Instruction* cur = follower(decoded, instr);
+	while(cur && cur->dstIdx == ws && foldMask(*cur, andMask, orMask)) {
+		cur = follower(decoded, *cur);
+		count++;
+	}
+
+	if(count < 2 || !cur) {
+		return false;
+	}
+	if(cur->opcode != Opcodes::MOVE_TO_REG || cur->dstIdx != reg || cur->attrByte.srcArg != OpcodeArgEncoding::WorkSpace
+			|| cur->srcIdx != ws || !isDword(cur->attrByte)) {
+		return false;
+	}
+	// Both register accesses have to be relative to the same reg block.
+	if((cur->optFlags ^ instr.optFlags) & OptimizerFlags::OptRegBlockFolded) {
+		return false;
+	}
+
+	instr.opcode = FusedOpcodes::MASKED_REG_UPDATE;
+	instr.dstArg = OpcodeArgEncoding::Reg;
+	instr.dstIdx = reg;
+	instr.srcIdx = ws;
+	instr.mask = andMask;
+	instr.imm = orMask;
+	instr.next = cur->next;
+	decoded.fusedInstructions += count + 1;
+	return true;
+}
+
+}
+
+void AtomBiosImpl::_fuseInstructions(DecodedCommand& decoded) {
+	for(Instruction& instr : decoded.code) {
+		if(!instr.valid) {
+			continue;
+		}
+
+		if(fuseCompareAndJump(decoded, instr) || fuseMaskedRegUpdate(decoded, instr)) {
+			decoded.superinstructions++;
+		}
+	}
+}
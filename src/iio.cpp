@@ -32,6 +32,24 @@ void AtomBiosImpl::_indexIIO(uint32_t base) {
 	}
 }
 
+uint32_t AtomBiosImpl::_iioInstructionLength(uint8_t opcode) {
+	return iioInstructionLengths[opcode];
+}
+
+uint32_t AtomBiosImpl::_iioFunctionSize(uint32_t offset) {
+	uint32_t ip = offset;
+	while(ip < _data.size() && _data[ip] != IIOOpcodes::END) {
+		if(_data[ip] > IIOOpcodes::END || _data[ip] == IIOOpcodes::START) {
+			return 0;
+		}
+		ip += iioInstructionLengths[_data[ip]];
+	}
+	if(ip >= _data.size()) {
+		return 0;
+	}
+	return ip + iioInstructionLengths[IIOOpcodes::END] - offset;
+}
+
 uint32_t AtomBiosImpl::_runIIO(uint32_t offset, uint32_t index, uint32_t data) {
 	uint32_t temp = 0xCDCDCDCD;
 	uint32_t ip = offset;
@@ -67,13 +85,13 @@ uint32_t AtomBiosImpl::_runIIO(uint32_t offset, uint32_t index, uint32_t data) {
 			if(AtomBIOSDebugSettings::logIIOOpcodes) {
 				lilrad_log(DEBUG, "  IIO: opcode READ(%04x)\n", read16(ip + 1));
 			}
-			temp = libatombios_card_reg_read(read16(ip + 1));
+			temp = _cardRead(CardSpace::Reg, read16(ip + 1));
 			break;
 		case IIOOpcodes::WRITE:
 			if(AtomBIOSDebugSettings::logIIOOpcodes) {
 				lilrad_log(DEBUG, "  IIO: opcode WRITE(%04x)\n", read16(ip + 1));
 			}
-			libatombios_card_reg_write(read16(ip + 1), temp);
+			_cardWrite(CardSpace::Reg, read16(ip + 1), temp);
 			break;
 		case IIOOpcodes::CLEAR:
 			if(AtomBIOSDebugSettings::logIIOOpcodes) {
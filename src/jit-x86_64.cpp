@@ -0,0 +1,626 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Translates decoded commands into x86-64 code (System V ABI).
+// Each instruction becomes a straight-line sequence; WorkSpace, parameter space and immediate operands are
+// accessed directly, everything else (and all interpreter state with side effects) through the _jit* functions.
+// The generated code does not log opcodes.
+
+#if defined(__x86_64__)
+
+namespace {
+
+// Registers, by their encoding.
+enum Reg {
+	EAX = 0,
+	ECX = 1,
+	EDX = 2,
+	EBX = 3,
+	ESI = 6,
+	EDI = 7
+};
+
+// Layout of the generated code:
+//   rbx: WorkSpace, r12: parameter space, r13: JitFrame, r14: AtomBiosImpl, r15d: the destination value that was read.
+//   eax holds the value being worked on; ecx, edx, esi and edi are scratch.
+class Emitter {
+public:
+	libatombios_vector<uint8_t> code;
+
+	size_t pos() {
+		return code.size();
+	}
+
+	template<typename... T>
+	void bytes(T... b) {
+		(code.push_back(static_cast<uint8_t>(b)), ...);
+	}
+
+	void dword(uint32_t val) {
+		bytes(val, val >> 8, val >> 16, val >> 24);
+	}
+
+	void qword(uint64_t val) {
+		dword(val);
+		dword(val >> 32);
+	}
+
+	void patchDword(size_t at, uint32_t val) {
+		code[at] = val;
+		code[at + 1] = val >> 8;
+		code[at + 2] = val >> 16;
+		code[at + 3] = val >> 24;
+	}
+
+	static uint8_t modrm(uint8_t mod, uint8_t reg, uint8_t rm) {
+		return (mod << 6) | ((reg & 7) << 3) | (rm & 7);
+	}
+
+	// mov reg, imm32
+	void movImm(Reg reg, uint32_t imm) {
+		bytes(0xB8 + reg);
+		dword(imm);
+	}
+
+	// mov reg, imm64
+	void movAbs(Reg reg, uint64_t imm) {
+		bytes(0x48, 0xB8 + reg);
+		qword(imm);
+	}
+
+	// mov reg, [rbx + idx * 4] / mov [rbx + idx * 4], reg
+	void loadWorkSpace(Reg reg, uint32_t idx) {
+		bytes(0x8B, modrm(2, reg, EBX));
+		dword(idx * 4);
+	}
+	void storeWorkSpace(Reg reg, uint32_t idx) {
+		bytes(0x89, modrm(2, reg, EBX));
+		dword(idx * 4);
+	}
+
+	// mov reg, [r12 + idx * 4] / mov [r12 + idx * 4], reg
+	void loadParameterSpace(Reg reg, uint32_t idx) {
+		bytes(0x41, 0x8B, modrm(2, reg, 4), 0x24);
+		dword(idx * 4);
+	}
+	void storeParameterSpace(Reg reg, uint32_t idx) {
+		bytes(0x41, 0x89, modrm(2, reg, 4), 0x24);
+		dword(idx * 4);
+	}
+
+	// dst <- src, for the 32 bit registers below r8
+	void mov(Reg dst, Reg src) {
+		bytes(0x89, modrm(3, src, dst));
+	}
+
+	void andImm(Reg reg, uint32_t imm) {
+		bytes(0x81, modrm(3, 4, reg));
+		dword(imm);
+	}
+	void orImm(Reg reg, uint32_t imm) {
+		bytes(0x81, modrm(3, 1, reg));
+		dword(imm);
+	}
+	void shlImm(Reg reg, uint8_t count) {
+		bytes(0xC1, modrm(3, 4, reg), count);
+	}
+	void shrImm(Reg reg, uint8_t count) {
+		bytes(0xC1, modrm(3, 5, reg), count);
+	}
+
+	// The saved destination value.
+	void saveToR15() {
+		bytes(0x41, 0x89, 0xC7);
+	}
+	void loadFromR15(Reg reg) {
+		bytes(0x44, 0x89, modrm(3, 7, reg));
+	}
+
+	// Calls a function; the arguments are expected in rdi, rsi, rdx and rcx.
+	void call(const void* fn) {
+		movAbs(EAX, reinterpret_cast<uint64_t>(fn));
+		bytes(0xFF, 0xD0);
+	}
+	void implToRdi() {
+		bytes(0x4C, 0x89, 0xF7);
+	}
+	void frameToRdi() {
+		bytes(0x4C, 0x89, 0xEF);
+	}
+
+	// setcc into a bool.
+	void setFlag(uint8_t setccOpcode, bool* flag) {
+		movAbs(EDX, reinterpret_cast<uint64_t>(flag));
+		bytes(0x0F, setccOpcode, 0x02);
+	}
+	void storeDword(uint32_t* target) {
+		movAbs(EDX, reinterpret_cast<uint64_t>(target));
+		bytes(0x89, 0x02);
+	}
+};
+
+struct Translator {
+	Emitter e;
+	DecodedCommand& decoded;
+	AtomBiosImpl* impl;
+
+	// Addresses of interpreter state the code accesses directly.
+	bool* flagAbove;
+	bool* flagEqual;
+	bool* flagBelow;
+	uint32_t* divMulQuotient;
+	uint32_t* divMulRemainder;
+
+	// Helpers.
+	const void* read;
+	const void* write;
+	const void* divide;
+	const void* switchLookup;
+	const void* callTable;
+	const void* misc;
+
+	// Code offsets of the instructions, and rel32 fields to patch.
+	libatombios_vector<size_t> labels;
+	struct Fixup {
+		size_t at;
+		uint32_t target;
+	};
+	libatombios_vector<Fixup> fixups;
+	// lea fields of switches, to point at the address table.
+	libatombios_vector<size_t> tableFixups;
+
+	uint32_t maxWorkSpace = 0;
+	uint32_t maxParameterSpace = 0;
+	bool usesWorkSpace = false;
+	bool usesParameterSpace = false;
+
+	Translator(DecodedCommand& decoded) : decoded{decoded} {}
+
+	void rel32(uint32_t target) {
+		fixups.push_back(Fixup{e.pos(), target});
+		e.dword(0);
+	}
+
+	void jumpTo(uint32_t target) {
+		e.bytes(0xE9);
+		rel32(target);
+	}
+
+	// jcc rel32 on the bool at flag being set (or clear).
+	void jumpIfFlag(bool* flag, bool set, uint32_t target) {
+		e.movAbs(EDX, reinterpret_cast<uint64_t>(flag));
+		e.bytes(0x80, 0x3A, 0x00);
+		e.bytes(0x0F, set ? 0x85 : 0x84);
+		rel32(target);
+	}
+
+	void noteWorkSpace(uint32_t idx) {
+		usesWorkSpace = true;
+		if(idx > maxWorkSpace) { maxWorkSpace = idx; }
+	}
+	void noteParameterSpace(uint32_t idx) {
+		usesParameterSpace = true;
+		if(idx > maxParameterSpace) { maxParameterSpace = idx; }
+	}
+
+	uint32_t helperArg(OpcodeArgEncoding arg, const Instruction& instr) {
+		if(arg == OpcodeArgEncoding::Reg && (instr.optFlags & OptimizerFlags::OptRegBlockFolded)) {
+			return arg | jitAbsoluteReg;
+		}
+		return arg;
+	}
+
+	// Loads an operand into eax.
+	void load(const Instruction& instr, OpcodeArgEncoding arg, uint32_t idx, uint32_t imm) {
+		switch(arg) {
+		case OpcodeArgEncoding::Imm:
+			e.movImm(EAX, imm);
+			return;
+		case OpcodeArgEncoding::ParameterSpace:
+			noteParameterSpace(idx);
+			e.loadParameterSpace(EAX, idx);
+			return;
+		case OpcodeArgEncoding::WorkSpace:
+			if(!isSpecialWorkSpace(idx)) {
+				noteWorkSpace(idx);
+				e.loadWorkSpace(EAX, idx);
+				return;
+			}
+			break;
+		default:
+			break;
+		}
+
+		e.implToRdi();
+		e.movImm(ESI, helperArg(arg, instr));
+		e.movImm(EDX, idx);
+		e.call(read);
+	}
+
+	// Stores eax into an operand.
+	void store(const Instruction& instr, OpcodeArgEncoding arg, uint32_t idx) {
+		switch(arg) {
+		case OpcodeArgEncoding::ParameterSpace:
+			noteParameterSpace(idx);
+			e.storeParameterSpace(EAX, idx);
+			return;
+		case OpcodeArgEncoding::WorkSpace:
+			if(!isSpecialWorkSpace(idx)) {
+				noteWorkSpace(idx);
+				e.storeWorkSpace(EAX, idx);
+				return;
+			}
+			break;
+		default:
+			break;
+		}
+
+		e.mov(ECX, EAX);
+		e.implToRdi();
+		e.movImm(ESI, helperArg(arg, instr));
+		e.movImm(EDX, idx);
+		e.call(write);
+	}
+
+	void swizzle(Reg reg, SrcEncoding align) {
+		if(align == SrcEncoding::SrcDword) {
+			return;
+		}
+		e.andImm(reg, atom_arg_mask[align]);
+		if(atom_arg_shift[align]) {
+			e.shrImm(reg, atom_arg_shift[align]);
+		}
+	}
+
+	// eax = attrByte.combineSaved(eax, r15d)
+	void combineSaved(const AttrByte& attrByte) {
+		if(attrByte.dstAlign == SrcEncoding::SrcDword) {
+			return;
+		}
+		if(atom_arg_shift[attrByte.dstAlign]) {
+			e.shlImm(EAX, atom_arg_shift[attrByte.dstAlign]);
+		}
+		e.andImm(EAX, atom_arg_mask[attrByte.dstAlign]);
+		e.loadFromR15(ECX);
+		e.andImm(ECX, ~atom_arg_mask[attrByte.dstAlign]);
+		e.bytes(0x09, 0xC8); // or eax, ecx
+	}
+
+	// r15d = destination, eax = swizzled source, ecx = swizzled destination.
+	void operands(const Instruction& instr) {
+		load(instr, instr.dstArg, instr.dstIdx, 0);
+		e.saveToR15();
+		load(instr, instr.attrByte.srcArg, instr.srcIdx, instr.imm);
+		swizzle(EAX, instr.attrByte.srcAlign);
+		e.loadFromR15(ECX);
+		swizzle(ECX, instr.attrByte.dstAlign);
+	}
+
+	// eax = ecx <op> eax, stored back into the destination.
+	void binaryOp(const Instruction& instr, uint8_t opcode) {
+		operands(instr);
+		if(opcode == 0x29) {
+			// sub ecx, eax; mov eax, ecx
+			e.bytes(0x29, 0xC1);
+			e.mov(EAX, ECX);
+		} else {
+			e.bytes(opcode, 0xC8);
+		}
+		combineSaved(instr.attrByte);
+		store(instr, instr.dstArg, instr.dstIdx);
+	}
+
+	void compare(const Instruction& instr, bool setOrder) {
+		operands(instr);
+		e.bytes(0x39, 0xC1); // cmp ecx, eax
+		e.setFlag(0x94, flagEqual);
+		if(setOrder) {
+			e.setFlag(0x97, flagAbove);
+			e.setFlag(0x92, flagBelow);
+		}
+	}
+
+	bool jump(uint8_t opcode, uint32_t target) {
+		if(target >= instructionInvalid) {
+			return false;
+		}
+
+		switch(opcode) {
+		case Opcodes::JUMP_ALWAYS:
+			jumpTo(target);
+			break;
+		case Opcodes::JUMP_EQUAL:
+			jumpIfFlag(flagEqual, true, target);
+			break;
+		case Opcodes::JUMP_NOTEQUAL:
+			jumpIfFlag(flagEqual, false, target);
+			break;
+		case Opcodes::JUMP_ABOVE:
+			jumpIfFlag(flagAbove, true, target);
+			break;
+		case Opcodes::JUMP_BELOW:
+			jumpIfFlag(flagBelow, true, target);
+			break;
+		case Opcodes::JUMP_ABOVEOREQUAL:
+			jumpIfFlag(flagAbove, true, target);
+			jumpIfFlag(flagEqual, true, target);
+			break;
+		case Opcodes::JUMP_BELOWOREQUAL:
+			jumpIfFlag(flagBelow, true, target);
+			jumpIfFlag(flagEqual, true, target);
+			break;
+		default:
+			return false;
+		}
+		return true;
+	}
+
+	// Returns false if the instruction can not be translated.
+	bool translate(const Instruction& instr) {
+		uint8_t op = instr.opcode;
+
+		if(op >= Opcodes::MOVE_TO_REG && op <= Opcodes::MOVE_TO_MC) {
+			// Like the interpreter, dword moves do not read their destination.
+			if(readsDst(instr)) {
+				operands(instr);
+			} else {
+				load(instr, instr.attrByte.srcArg, instr.srcIdx, instr.imm);
+				swizzle(EAX, instr.attrByte.srcAlign);
+			}
+			combineSaved(instr.attrByte);
+			store(instr, instr.dstArg, instr.dstIdx);
+		} else if(op >= Opcodes::AND_INTO_REG && op <= Opcodes::AND_INTO_MC) {
+			binaryOp(instr, 0x21);
+		} else if(op >= Opcodes::OR_INTO_REG && op <= Opcodes::OR_INTO_MC) {
+			binaryOp(instr, 0x09);
+		} else if(op >= Opcodes::XOR_INTO_REG && op <= Opcodes::XOR_INTO_MC) {
+			binaryOp(instr, 0x31);
+		} else if(op >= Opcodes::ADD_INTO_REG && op <= Opcodes::ADD_INTO_MC) {
+			binaryOp(instr, 0x01);
+		} else if(op >= Opcodes::SUB_INTO_REG && op <= Opcodes::SUB_INTO_MC) {
+			binaryOp(instr, 0x29);
+		} else if((op >= Opcodes::SHIFT_LEFT_IN_REG && op <= Opcodes::SHIFT_LEFT_IN_MC)
+				|| (op >= Opcodes::SHIFT_RIGHT_IN_REG && op <= Opcodes::SHIFT_RIGHT_IN_MC)) {
+			load(instr, instr.dstArg, instr.dstIdx, 0);
+			e.saveToR15();
+			swizzle(EAX, instr.attrByte.dstAlign);
+			// Like the interpreter on x86, the count is taken mod 32.
+			if(op <= Opcodes::SHIFT_LEFT_IN_MC) {
+				e.shlImm(EAX, instr.imm & 31);
+			} else {
+				e.shrImm(EAX, instr.imm & 31);
+			}
+			combineSaved(instr.attrByte);
+			store(instr, instr.dstArg, instr.dstIdx);
+		} else if(op >= Opcodes::CLEAR_IN_REG && op <= Opcodes::CLEAR_IN_MC) {
+			if(readsDst(instr)) {
+				load(instr, instr.dstArg, instr.dstIdx, 0);
+				e.saveToR15();
+			}
+			e.bytes(0x31, 0xC0); // xor eax, eax
+			combineSaved(instr.attrByte);
+			store(instr, instr.dstArg, instr.dstIdx);
+		} else if(op >= Opcodes::MASK_INTO_REG && op <= Opcodes::MASK_INTO_MC) {
+			operands(instr);
+			e.andImm(ECX, instr.mask);
+			e.bytes(0x09, 0xC8); // or eax, ecx
+			combineSaved(instr.attrByte);
+			store(instr, instr.dstArg, instr.dstIdx);
+		} else if(op >= Opcodes::MUL_WITH_REG && op <= Opcodes::MUL_WITH_MC) {
+			operands(instr);
+			e.bytes(0x0F, 0xAF, 0xC1); // imul eax, ecx
+			e.storeDword(divMulQuotient);
+		} else if(op >= Opcodes::DIV_WITH_REG && op <= Opcodes::DIV_WITH_MC) {
+			operands(instr);
+			e.mov(ESI, ECX);
+			e.mov(EDX, EAX);
+			e.implToRdi();
+			e.call(divide);
+		} else if(op == FusedOpcodes::DIV_BY_CONSTANT) {
+			// See DIV_BY_CONSTANT in the interpreter.
+			uint32_t divisor = instr.attrByte.swizleSrc(instr.imm);
+			operands(instr);
+			e.mov(EAX, ECX);
+			e.movImm(EDX, instr.divMagic);
+			e.bytes(0xF7, 0xE2); // mul edx
+			e.mov(EAX, ECX);
+			e.bytes(0x29, 0xD0); // sub eax, edx
+			e.shrImm(EAX, 1);
+			e.bytes(0x01, 0xD0); // add eax, edx
+			if(instr.divShift) {
+				e.shrImm(EAX, instr.divShift);
+			}
+			e.storeDword(divMulQuotient);
+			e.bytes(0x69, 0xD0); // imul edx, eax, divisor
+			e.dword(divisor);
+			e.mov(EAX, ECX);
+			e.bytes(0x29, 0xD0); // sub eax, edx
+			e.storeDword(divMulRemainder);
+		} else if(op >= Opcodes::COMPARE_FROM_REG && op <= Opcodes::COMPARE_FROM_MC) {
+			compare(instr, true);
+		} else if(op >= Opcodes::TEST_FROM_REG && op <= Opcodes::TEST_FROM_MC) {
+			compare(instr, false);
+		} else if(op >= Opcodes::JUMP_ALWAYS && op <= Opcodes::JUMP_NOTEQUAL) {
+			return jump(op, instr.target);
+		} else if(op == FusedOpcodes::COMPARE_AND_JUMP) {
+			compare(instr, true);
+			return jump(instr.fusedOpcode, instr.target);
+		} else if(op == FusedOpcodes::TEST_AND_JUMP) {
+			compare(instr, false);
+			return jump(instr.fusedOpcode, instr.target);
+		} else if(op == FusedOpcodes::MASKED_REG_UPDATE) {
+			load(instr, OpcodeArgEncoding::Reg, instr.dstIdx, 0);
+			e.andImm(EAX, instr.mask);
+			e.orImm(EAX, instr.imm);
+			noteWorkSpace(instr.srcIdx);
+			e.storeWorkSpace(EAX, instr.srcIdx);
+			e.saveToR15();
+			load(instr, OpcodeArgEncoding::Reg, instr.dstIdx, 0);
+			e.loadFromR15(EAX);
+			store(instr, OpcodeArgEncoding::Reg, instr.dstIdx);
+		} else if(op == Opcodes::SWITCH) {
+			SwitchTable& table = decoded.switches[instr.target];
+			for(uint32_t target : table.targets) {
+				if(target >= instructionInvalid) {
+					return false;
+				}
+			}
+
+			load(instr, instr.attrByte.srcArg, instr.srcIdx, instr.imm);
+			e.movAbs(EDI, reinterpret_cast<uint64_t>(&table));
+			e.mov(ESI, EAX);
+			e.movImm(EDX, instr.next);
+			e.call(switchLookup);
+			e.mov(EAX, EAX); // zero-extend into rax
+			e.bytes(0x3D); // cmp eax, instructionExit
+			e.dword(instructionExit);
+			e.bytes(0x0F, 0x84); // je exit
+			rel32(instructionExit);
+			e.bytes(0x48, 0x8D, 0x0D); // lea rcx, [rip + table]
+			tableFixups.push_back(e.pos());
+			e.dword(0);
+			e.bytes(0xFF, 0x24, 0xC1); // jmp [rcx + rax * 8]
+		} else if(op == Opcodes::CALL_TABLE) {
+			e.frameToRdi();
+			e.movImm(ESI, instr.imm);
+			e.call(callTable);
+			e.bytes(0x4D, 0x8B, 0x65, offsetof(JitFrame, params)); // mov r12, [r13 + params]
+		} else if(op == Opcodes::SET_DATA_TABLE || op == Opcodes::SET_ATI_PORT || op == Opcodes::SET_PCI_PORT
+				|| op == Opcodes::SET_SYSIO_PORT || op == Opcodes::SET_REG_BLOCK || op == Opcodes::DELAY_MICROSECONDS) {
+			e.implToRdi();
+			e.movImm(ESI, op);
+			e.movImm(EDX, instr.imm);
+			e.call(misc);
+		} else if(op == Opcodes::END_OF_TABLE) {
+			jumpTo(instructionExit);
+		} else {
+			return false;
+		}
+		return true;
+	}
+};
+
+}
+
+JitCode* AtomBiosImpl::_jitCompile(Command& command, DecodedCommand& decoded) {
+	if(!libatombios_jit_alloc || !libatombios_jit_seal || !libatombios_jit_free) {
+		lilrad_log(WARNING, "jit: no executable memory functions, command 0x%x stays with the interpreter\n", command.i());
+		return nullptr;
+	}
+	if(decoded.code.empty()) {
+		return nullptr;
+	}
+
+	Translator t{decoded};
+	t.impl = this;
+	t.flagAbove = &_flagAbove;
+	t.flagEqual = &_flagEqual;
+	t.flagBelow = &_flagBelow;
+	t.divMulQuotient = &_divMulQuotient;
+	t.divMulRemainder = &_divMulRemainder;
+	t.read = reinterpret_cast<const void*>(&AtomBiosImpl::_jitRead);
+	t.write = reinterpret_cast<const void*>(&AtomBiosImpl::_jitWrite);
+	t.divide = reinterpret_cast<const void*>(&AtomBiosImpl::_jitDivide);
+	t.switchLookup = reinterpret_cast<const void*>(&AtomBiosImpl::_jitSwitch);
+	t.callTable = reinterpret_cast<const void*>(&AtomBiosImpl::_jitCallTable);
+	t.misc = reinterpret_cast<const void*>(&AtomBiosImpl::_jitMisc);
+
+	Emitter& e = t.e;
+
+	// push rbx, r12, r13, r14, r15; this also aligns the stack for calls.
+	e.bytes(0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);
+	e.bytes(0x49, 0x89, 0xFD); // mov r13, rdi
+	e.bytes(0x49, 0x8B, 0x5D, offsetof(JitFrame, workSpace)); // mov rbx, [r13 + workSpace]
+	e.bytes(0x4D, 0x8B, 0x65, offsetof(JitFrame, params)); // mov r12, [r13 + params]
+	e.bytes(0x4D, 0x8B, 0x75, offsetof(JitFrame, impl)); // mov r14, [r13 + impl]
+	if(decoded.entry != 0) {
+		t.jumpTo(decoded.entry);
+	}
+
+	t.labels.resize(decoded.code.size());
+	for(size_t i = 0; i < decoded.code.size(); i++) {
+		const Instruction& instr = decoded.code[i];
+		t.labels[i] = e.pos();
+
+		if(!instr.valid || !t.translate(instr)) {
+			lilrad_log(WARNING, "jit: opcode 0x%x at %x is not supported, command 0x%x stays with the interpreter\n",
+				instr.opcode, instr.ip + 0x6, command.i());
+			return nullptr;
+		}
+
+		bool endsBlock = instr.opcode == Opcodes::END_OF_TABLE || instr.opcode == Opcodes::JUMP_ALWAYS || instr.opcode == Opcodes::SWITCH;
+		if(!endsBlock && instr.next != i + 1) {
+			t.jumpTo(instr.next);
+		}
+	}
+
+	size_t exitLabel = e.pos();
+	e.bytes(0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B); // pop r15, r14, r13, r12, rbx
+	e.bytes(0xC3);
+
+	for(const Translator::Fixup& fixup : t.fixups) {
+		size_t target = fixup.target == instructionExit ? exitLabel : t.labels[fixup.target];
+		e.patchDword(fixup.at, target - (fixup.at + 4));
+	}
+
+	// Address table for switches: the absolute address of every instruction.
+	size_t tableOffset = 0;
+	if(!t.tableFixups.empty()) {
+		while(e.pos() % 8) {
+			e.bytes(0xCC);
+		}
+		tableOffset = e.pos();
+		for(size_t i = 0; i < decoded.code.size(); i++) {
+			e.qword(0);
+		}
+		for(size_t at : t.tableFixups) {
+			e.patchDword(at, tableOffset - (at + 4));
+		}
+	}
+
+	JitCode* code = new JitCode;
+	code->size = e.code.size();
+	code->memory = libatombios_jit_alloc(code->size);
+	if(!code->memory) {
+		lilrad_log(WARNING, "jit: could not allocate %zu bytes, command 0x%x stays with the interpreter\n", code->size, command.i());
+		delete code;
+		return nullptr;
+	}
+
+	uint8_t* base = static_cast<uint8_t*>(code->memory);
+	if(!t.tableFixups.empty()) {
+		for(size_t i = 0; i < decoded.code.size(); i++) {
+			uint64_t address = reinterpret_cast<uint64_t>(base + t.labels[i]);
+			memcpy(e.code.data() + tableOffset + i * 8, &address, sizeof(address));
+		}
+	}
+	memcpy(base, e.code.data(), code->size);
+
+	if(!libatombios_jit_seal(code->memory, code->size)) {
+		lilrad_log(WARNING, "jit: could not make the code of command 0x%x executable\n", command.i());
+		libatombios_jit_free(code->memory, code->size);
+		delete code;
+		return nullptr;
+	}
+
+	code->entry = reinterpret_cast<void (*)(JitFrame*)>(code->memory);
+	code->workSpaceDwords = t.usesWorkSpace ? t.maxWorkSpace + 1 : 0;
+	code->parameterDwords = t.usesParameterSpace ? t.maxParameterSpace + 1 : 0;
+
+	if(AtomBIOSDebugSettings::logCommandTableCreation) {
+		lilrad_log(DEBUG, "jit: compiled command 0x%x into %zu bytes\n", command.i(), code->size);
+	}
+	return code;
+}
+
+#else
+
+JitCode* AtomBiosImpl::_jitCompile(Command& command, DecodedCommand&) {
+	lilrad_log(WARNING, "jit: no code generator for this architecture, command 0x%x stays with the interpreter\n", command.i());
+	return nullptr;
+}
+
+#endif
@@ -0,0 +1,329 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// The parts of the JIT that do not depend on the target: promotion, running native code,
+// the functions native code calls into, and differential runs.
+// The code generator is in jit-x86_64.cpp.
+
+void AtomBiosImpl::setJitMode(AtomBios::JitMode mode, uint32_t threshold) {
+	_jitMode = mode;
+	_jitThreshold = threshold ? threshold : 1;
+}
+
+AtomBios::JitStats AtomBiosImpl::jitStats(int table) {
+	AtomBios::JitStats stats{};
+
+	Command* command = _commandTable.commands.get(table);
+	if(command && command->decoded) {
+		stats.compiled = command->decoded->jit;
+		stats.translated = command->decoded->jit && !command->decoded->jit->memory;
+		stats.codeSize = command->decoded->jit ? command->decoded->jit->size : 0;
+		stats.runs = command->decoded->runs;
+		stats.nativeRuns = command->decoded->nativeRuns;
+	}
+	return stats;
+}
+
+void AtomBiosImpl::_jitFree(JitCode* code) {
+	if(!code) {
+		return;
+	}
+
+	if(code->memory) {
+		libatombios_jit_free(code->memory, code->size);
+	}
+	delete code;
+}
+
+void AtomBiosImpl::_runNative(Command& command, DecodedCommand& decoded, libatombios_vector<uint32_t>& params, int params_shift) {
+	JitCode* code = decoded.jit;
+
+	libatombios_vector<uint32_t> workSpace;
+	workSpace.resize(code->workSpaceDwords ? code->workSpaceDwords : 1);
+
+	// The telemetry is updated for everything the command could access, not only what it does access in this run.
+	if(code->parameterDwords) {
+		if(params.size() < params_shift + code->parameterDwords) {
+			params.resize(params_shift + code->parameterDwords);
+		}
+		if(params_shift + code->parameterDwords - 1 > _maxPSIndex) { _maxPSIndex = params_shift + code->parameterDwords - 1; }
+	}
+	if(code->workSpaceDwords && code->workSpaceDwords - 1 > _maxWSIndex) { _maxWSIndex = code->workSpaceDwords - 1; }
+
+	JitFrame frame;
+	frame.workSpace = workSpace.data();
+	frame.params = params.data() + params_shift;
+	frame.impl = this;
+	frame.paramsVector = &params;
+	frame.paramsShift = params_shift;
+	frame.parameterDwords = command.parameterSpaceSize / 4;
+
+	decoded.nativeRuns++;
+	code->entry(&frame);
+}
+
+///
+/// Called from native code.
+///
+
+uint32_t AtomBiosImpl::_jitRead(AtomBiosImpl* impl, uint32_t arg, uint32_t idx) {
+	switch(arg) {
+	case OpcodeArgEncoding::Reg:
+		return impl->_doIORead(idx + impl->_regBlock);
+	case OpcodeArgEncoding::Reg | jitAbsoluteReg:
+		return impl->_doIORead(idx);
+	case OpcodeArgEncoding::ID:
+		return impl->read32(idx + impl->_dataBlock);
+	case OpcodeArgEncoding::WorkSpace:
+		return impl->_getSpecialWorkSpace(idx);
+	case OpcodeArgEncoding::PLL:
+		return impl->_doPLLRead(idx);
+	case OpcodeArgEncoding::MC:
+		return impl->_doMCRead(idx);
+	case OpcodeArgEncoding::FrameBuffer:
+		return impl->_doFBRead(idx);
+	}
+
+	assert(false && "operand is not read through _jitRead");
+	return 0;
+}
+
+void AtomBiosImpl::_jitWrite(AtomBiosImpl* impl, uint32_t arg, uint32_t idx, uint32_t val) {
+	switch(arg) {
+	case OpcodeArgEncoding::Reg:
+		impl->_doIOWrite(idx + impl->_regBlock, val);
+		return;
+	case OpcodeArgEncoding::Reg | jitAbsoluteReg:
+		impl->_doIOWrite(idx, val);
+		return;
+	case OpcodeArgEncoding::WorkSpace:
+		impl->_setSpecialWorkSpace(idx, val);
+		return;
+	case OpcodeArgEncoding::PLL:
+		impl->_doPLLWrite(idx, val);
+		return;
+	case OpcodeArgEncoding::MC:
+		impl->_doMCWrite(idx, val);
+		return;
+	case OpcodeArgEncoding::FrameBuffer:
+		impl->_doFBWrite(idx, val);
+		return;
+	}
+
+	assert(false && "operand is not written through _jitWrite");
+}
+
+void AtomBiosImpl::_jitDivide(AtomBiosImpl* impl, uint32_t dividend, uint32_t divisor) {
+	// A div by 0 in atombios results in a 0.
+	impl->_divMulQuotient = divisor ? dividend / divisor : 0;
+	impl->_divMulRemainder = divisor ? dividend % divisor : 0;
+}
+
+uint32_t AtomBiosImpl::_jitSwitch(SwitchTable* table, uint32_t val, uint32_t fallthrough) {
+	return table->lookup(val, fallthrough);
+}
+
+void AtomBiosImpl::_jitCallTable(JitFrame* frame, uint32_t table) {
+	AtomBiosImpl* impl = frame->impl;
+	auto params = static_cast<libatombios_vector<uint32_t>*>(frame->paramsVector);
+
+	Command* callee = impl->_commandTable.commands.get(table);
+	assert(callee && callee->exists());
+
+	// Native code can not be continued by a snapshot.
+	impl->_callStack.push_back(CallFrame{nullptr, nullptr, instructionExit, frame->paramsShift});
+	impl->_runBytecode(*callee, *params, frame->paramsShift + frame->parameterDwords);
+	impl->_callStack.pop();
+
+	frame->params = params->data() + frame->paramsShift;
+}
+
+void AtomBiosImpl::_jitMisc(AtomBiosImpl* impl, uint32_t opcode, uint32_t imm) {
+	switch(opcode) {
+	case Opcodes::SET_DATA_TABLE:
+		impl->_setDataTable(imm);
+		return;
+	case Opcodes::SET_ATI_PORT:
+		impl->_setATIPort(imm);
+		return;
+	case Opcodes::SET_PCI_PORT:
+		impl->_ioMode = IOMode::PCI;
+		return;
+	case Opcodes::SET_SYSIO_PORT:
+		impl->_ioMode = IOMode::SYSIO;
+		return;
+	case Opcodes::SET_REG_BLOCK:
+		impl->_regBlock = imm;
+		return;
+	case Opcodes::DELAY_MICROSECONDS:
+		impl->_cardWrite(CardSpace::Delay, 0, imm);
+		return;
+	}
+
+	assert(false && "opcode is not run through _jitMisc");
+}
+
+///
+/// Differential runs.
+///
+
+bool AtomBiosImpl::RunState::sameAs(const RunState& other) const {
+	return dataBlock == other.dataBlock
+		&& ioMode == other.ioMode
+		&& iioPort == other.iioPort
+		&& regBlock == other.regBlock
+		&& pllIndexValid == other.pllIndexValid
+		&& pllIndex == other.pllIndex
+		&& mcIndexValid == other.mcIndexValid
+		&& mcIndex == other.mcIndex
+		&& fbBlock == other.fbBlock
+		&& flagAbove == other.flagAbove
+		&& flagEqual == other.flagEqual
+		&& flagBelow == other.flagBelow
+		&& divMulQuotient == other.divMulQuotient
+		&& divMulRemainder == other.divMulRemainder
+		&& iioIOAttr == other.iioIOAttr
+		&& workSpaceMaskShift == other.workSpaceMaskShift;
+}
+
+AtomBiosImpl::RunState AtomBiosImpl::_saveRunState() {
+	RunState state;
+	state.dataBlock = _dataBlock;
+	state.ioMode = _ioMode;
+	state.iioPort = _iioPort;
+	state.regBlock = _regBlock;
+	state.pllIndexValid = _pllIndexData.indexValid;
+	state.pllIndex = _pllIndexData.index;
+	state.mcIndexValid = _mcIndexData.indexValid;
+	state.mcIndex = _mcIndexData.index;
+	state.fbBlock = _fbBlock;
+	state.flagAbove = _flagAbove;
+	state.flagEqual = _flagEqual;
+	state.flagBelow = _flagBelow;
+	state.divMulQuotient = _divMulQuotient;
+	state.divMulRemainder = _divMulRemainder;
+	state.iioIOAttr = _iioIOAttr;
+	state.workSpaceMaskShift = _workSpaceMaskShift;
+	state.maxPSIndex = _maxPSIndex;
+	state.maxWSIndex = _maxWSIndex;
+	state.skippedIndexWrites = _skippedIndexWrites;
+	return state;
+}
+
+void AtomBiosImpl::_restoreRunState(const RunState& state) {
+	_dataBlock = state.dataBlock;
+	_ioMode = state.ioMode;
+	_iioPort = state.iioPort;
+	_regBlock = state.regBlock;
+	_pllIndexData.indexValid = state.pllIndexValid;
+	_pllIndexData.index = state.pllIndex;
+	_mcIndexData.indexValid = state.mcIndexValid;
+	_mcIndexData.index = state.mcIndex;
+	_setFBBlock(state.fbBlock);
+	_flagAbove = state.flagAbove;
+	_flagEqual = state.flagEqual;
+	_flagBelow = state.flagBelow;
+	_divMulQuotient = state.divMulQuotient;
+	_divMulRemainder = state.divMulRemainder;
+	_iioIOAttr = state.iioIOAttr;
+	_workSpaceMaskShift = state.workSpaceMaskShift;
+	_maxPSIndex = state.maxPSIndex;
+	_maxWSIndex = state.maxWSIndex;
+	_skippedIndexWrites = state.skippedIndexWrites;
+}
+
+uint32_t AtomBiosImpl::_replayCardAccess(CardSpace space, bool write, uint32_t reg, uint32_t val) {
+	if(_cardTraceDiverged) {
+		return 0;
+	}
+
+	if(_cardTracePos >= _cardTrace.size()) {
+		lilrad_log(ERROR, "jit differential: access %zu (space %i, reg %x) is past the end of the interpreter trace\n",
+			_cardTracePos, static_cast<int>(space), reg);
+		_cardTraceDiverged = true;
+		return 0;
+	}
+
+	const CardAccess& expected = _cardTrace[_cardTracePos];
+	if(expected.space != space || expected.write != write || expected.reg != reg || (write && expected.val != val)) {
+		lilrad_log(ERROR, "jit differential: access %zu is %s %x (space %i, val %x), but the interpreter did %s %x (space %i, val %x)\n",
+			_cardTracePos, write ? "write" : "read", reg, static_cast<int>(space), val,
+			expected.write ? "write" : "read", expected.reg, static_cast<int>(expected.space), expected.val);
+		_cardTraceDiverged = true;
+		return 0;
+	}
+
+	_cardTracePos++;
+	return expected.val;
+}
+
+bool AtomBiosImpl::_sameParameterSpace(const libatombios_vector<uint32_t>& a, const libatombios_vector<uint32_t>& b) {
+	for(size_t i = 0; i < a.size() || i < b.size(); i++) {
+		uint32_t valA = i < a.size() ? a[i] : 0;
+		uint32_t valB = i < b.size() ? b[i] : 0;
+		if(valA != valB) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void AtomBiosImpl::_runDifferential(Command& command, libatombios_vector<uint32_t>& params) {
+	RunState startState = _saveRunState();
+	libatombios_vector<uint32_t> startParams = params;
+	libatombios_vector<uint8_t> startFB;
+	startFB.resize(_fbWindowSize);
+	if(_fbWindowSize) {
+		memcpy(startFB.data(), _fbWindow, _fbWindowSize);
+	}
+
+	// The interpreter makes the real accesses.
+	_cardTrace.clear();
+	_cardTraceMode = CardTraceMode::Record;
+	_jitSuspended = true;
+	_runBytecode(command, params, 0);
+	_jitSuspended = false;
+
+	RunState interpreterState = _saveRunState();
+	libatombios_vector<uint32_t> interpreterParams = params;
+	libatombios_vector<uint8_t> interpreterFB;
+	interpreterFB.resize(_fbWindowSize);
+	if(_fbWindowSize) {
+		memcpy(interpreterFB.data(), _fbWindow, _fbWindowSize);
+	}
+
+	// Run again from the same state, against the recorded accesses.
+	_restoreRunState(startState);
+	params = startParams;
+	if(_fbWindowSize) {
+		memcpy(_fbWindow, startFB.data(), _fbWindowSize);
+	}
+
+	_cardTraceMode = CardTraceMode::Replay;
+	_cardTracePos = 0;
+	_cardTraceDiverged = false;
+	_runBytecode(command, params, 0);
+	_cardTraceMode = CardTraceMode::Off;
+
+	bool sameTrace = !_cardTraceDiverged && _cardTracePos == _cardTrace.size();
+	bool sameState = _saveRunState().sameAs(interpreterState);
+	bool sameParams = _sameParameterSpace(params, interpreterParams);
+	bool sameFB = !_fbWindowSize || memcmp(_fbWindow, interpreterFB.data(), _fbWindowSize) == 0;
+	if(!sameTrace || !sameState || !sameParams || !sameFB) {
+		lilrad_log(ERROR, "jit differential: command 0x%x differs from the interpreter (accesses: %s, state: %s, parameters: %s, FB: %s)\n",
+			command.i(), sameTrace ? "same" : "differ", sameState ? "same" : "differs",
+			sameParams ? "same" : "differ", sameFB ? "same" : "differs");
+		_jitMismatches++;
+	}
+
+	// The accesses the card saw are the ones of the interpreter.
+	_restoreRunState(interpreterState);
+	params = interpreterParams;
+	if(_fbWindowSize) {
+		memcpy(_fbWindow, interpreterFB.data(), _fbWindowSize);
+	}
+	_cardTrace.clear();
+}
@@ -0,0 +1,309 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// The lockstep interpreter runs a pure command over several parameter blocks at once, one block per lane.
+// The parameter space, WorkSpace and MemoState are kept as one vector per dword, so ALU opcodes work on all
+// lanes together. Each lane has its own instruction index; the instruction with the lowest index among the lanes
+// that did not exit is run next, by the lanes that are at it. Lanes that branched apart thereby meet again at
+// the first instruction that they share.
+
+namespace {
+
+constexpr int lanes = lockstepLanes;
+typedef uint32_t Lanes __attribute__((vector_size(lanes * sizeof(uint32_t))));
+typedef int32_t LaneMask __attribute__((vector_size(lanes * sizeof(int32_t))));
+
+// The spaces live in libatombios_vectors, which do not align their elements as Lanes need; they are kept as words
+// and copied into and out of Lanes on each access.
+struct LaneWords {
+	uint32_t lane[lanes];
+};
+
+// Lanes never cross a call by value: helpers take and fill them by reference, so the ABI of vectors that are wider
+// than the target registers does not come into it.
+
+struct LaneState {
+	// By dword.
+	libatombios_vector<LaneWords> params;
+	libatombios_vector<LaneWords> workSpace;
+
+	Lanes flagAbove;
+	Lanes flagEqual;
+	Lanes flagBelow;
+	Lanes divMulQuotient;
+	Lanes divMulRemainder;
+	Lanes dataBlock;
+	Lanes workSpaceMaskShift;
+
+	// The instruction each lane runs next.
+	uint32_t next[lanes];
+};
+
+}
+
+bool AtomBiosImpl::_lockstepSupported(Command& command, DecodedCommand& decoded) {
+	if(decoded.purity == MemoPurity::Unknown) {
+		_analyzePurity(command, decoded);
+	}
+	// Every lane starts from scratch; the blocks can not see what the previous ones left behind.
+	if(decoded.purity != MemoPurity::Pure || decoded.memoKeyState) {
+		return false;
+	}
+	// Callees are left to the scalar interpreter.
+	for(const Instruction& instr : decoded.code) {
+		if(instr.valid && instr.opcode == Opcodes::CALL_TABLE) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void AtomBiosImpl::_runLockstep(Command& command, DecodedCommand& decoded, uint32_t* params, size_t size, size_t first, size_t end) {
+	assert(end - first <= lanes);
+
+	LaneState state;
+	state.params.resize(size);
+	for(size_t i = 0; i < size; i++) {
+		for(size_t lane = 0; lane < end - first; lane++) {
+			state.params[i].lane[lane] = params[(first + lane) * size + i];
+		}
+	}
+	state.workSpace.resize(command.workSpaceSize / sizeof(uint32_t));
+	state.flagAbove = Lanes{} + _flagAbove;
+	state.flagEqual = Lanes{} + _flagEqual;
+	state.flagBelow = Lanes{} + _flagBelow;
+	state.divMulQuotient = Lanes{} + _divMulQuotient;
+	state.divMulRemainder = Lanes{} + _divMulRemainder;
+	state.dataBlock = Lanes{} + _dataBlock;
+	state.workSpaceMaskShift = Lanes{} + _workSpaceMaskShift;
+	for(size_t lane = 0; lane < lanes; lane++) {
+		state.next[lane] = lane < end - first ? decoded.entry : instructionExit;
+	}
+
+	// Like the interpreter, the spaces grow on their first access behind their end.
+	auto paramSlot = [this, &state](uint32_t idx) -> void* {
+		if(idx >= state.params.size()) {
+			state.params.resize(idx + 1);
+		}
+		if(idx > _maxPSIndex) { _maxPSIndex = idx; }
+		return &state.params[idx];
+	};
+	auto workSpaceSlot = [this, &state](uint32_t idx) -> void* {
+		switch(idx) {
+		case WS_QUOTIENT: return &state.divMulQuotient;
+		case WS_REMAINDER: return &state.divMulRemainder;
+		case WS_DATAPTR: return &state.dataBlock;
+		case WS_SHIFT: return &state.workSpaceMaskShift;
+		}
+		assert(!isSpecialWorkSpace(idx));
+
+		if(idx >= state.workSpace.size()) {
+			state.workSpace.resize(idx + 1);
+		}
+		if(idx > _maxWSIndex) { _maxWSIndex = idx; }
+		return &state.workSpace[idx];
+	};
+
+	auto getVal = [this, &state, &paramSlot, &workSpaceSlot](OpcodeArgEncoding arg, uint32_t idx, uint32_t imm, const LaneMask& active, Lanes& val) {
+		switch(arg) {
+		case OpcodeArgEncoding::Imm:
+			val = Lanes{} + imm;
+			break;
+		case OpcodeArgEncoding::ParameterSpace:
+			__builtin_memcpy(&val, paramSlot(idx), sizeof(val));
+			break;
+		case OpcodeArgEncoding::WorkSpace:
+			// The masks are the only special addresses that are not backed by state.
+			if(idx == WS_OR_MASK) {
+				val = (Lanes{} + 1) << (state.workSpaceMaskShift & 31);
+			} else if(idx == WS_AND_MASK) {
+				val = ~((Lanes{} + 1) << (state.workSpaceMaskShift & 31));
+			} else {
+				__builtin_memcpy(&val, workSpaceSlot(idx), sizeof(val));
+			}
+			break;
+		case OpcodeArgEncoding::ID:
+			// Only for the lanes that run the instruction, the others may have a data block that is not valid.
+			val = Lanes{};
+			for(int lane = 0; lane < lanes; lane++) {
+				if(active[lane]) {
+					val[lane] = read32(idx + state.dataBlock[lane]);
+				}
+			}
+			break;
+		default:
+			assert(false && "pure commands do not access this operand");
+			val = Lanes{};
+			break;
+		}
+	};
+	// Writes result to the destination bits of the active lanes, like AttrByte::combineSaved.
+	auto putVal = [&paramSlot, &workSpaceSlot](const Instruction& instr, const Lanes& result, const Lanes& saved, const LaneMask& active) {
+		SrcEncoding align = instr.attrByte.dstAlign;
+		Lanes combined = result;
+		if(align != SrcEncoding::SrcDword) {
+			combined = ((result << atom_arg_shift[align]) & atom_arg_mask[align]) | (saved & ~atom_arg_mask[align]);
+		}
+		void* slot = instr.dstArg == OpcodeArgEncoding::ParameterSpace ? paramSlot(instr.dstIdx) : workSpaceSlot(instr.dstIdx);
+		Lanes old;
+		__builtin_memcpy(&old, slot, sizeof(old));
+		combined = active ? combined : old;
+		__builtin_memcpy(slot, &combined, sizeof(combined));
+	};
+	// The saved destination, and the destination swizzled like AttrByte::swizleDst.
+	auto getDst = [&getVal](const Instruction& instr, const LaneMask& active, Lanes& saved, Lanes& dst) {
+		getVal(instr.dstArg, instr.dstIdx, 0, active, saved);
+		dst = (saved & atom_arg_mask[instr.attrByte.dstAlign]) >> atom_arg_shift[instr.attrByte.dstAlign];
+	};
+	// Also the source, swizzled like AttrByte::swizleSrc.
+	auto getOperands = [&getVal, &getDst](const Instruction& instr, const LaneMask& active, Lanes& saved, Lanes& dst, Lanes& val) {
+		getDst(instr, active, saved, dst);
+		getVal(instr.attrByte.srcArg, instr.srcIdx, instr.imm, active, val);
+		val = (val & atom_arg_mask[instr.attrByte.srcAlign]) >> atom_arg_shift[instr.attrByte.srcAlign];
+	};
+	// The lanes of active that take the jump.
+	auto jumpTaken = [&state](uint8_t opcode, const LaneMask& active, LaneMask& taken) {
+		switch(opcode) {
+		case Opcodes::JUMP_ABOVE: taken = active & (state.flagAbove != 0); break;
+		case Opcodes::JUMP_ABOVEOREQUAL: taken = active & ((state.flagAbove | state.flagEqual) != 0); break;
+		case Opcodes::JUMP_BELOW: taken = active & (state.flagBelow != 0); break;
+		case Opcodes::JUMP_BELOWOREQUAL: taken = active & ((state.flagBelow | state.flagEqual) != 0); break;
+		case Opcodes::JUMP_EQUAL: taken = active & (state.flagEqual != 0); break;
+		case Opcodes::JUMP_NOTEQUAL: taken = active & (state.flagEqual == 0); break;
+		default: taken = active; break;
+		}
+	};
+
+	while(true) {
+		uint32_t current = instructionExit;
+		for(int lane = 0; lane < lanes; lane++) {
+			if(state.next[lane] < current) {
+				current = state.next[lane];
+			}
+		}
+		if(current == instructionExit) {
+			break;
+		}
+
+		const Instruction& instr = decoded.code[current];
+		uint8_t op = instr.opcode;
+		LaneMask active;
+		for(int lane = 0; lane < lanes; lane++) {
+			active[lane] = state.next[lane] == current ? -1 : 0;
+		}
+		// Lanes that take a jump, and where they go.
+		LaneMask taken{};
+		uint32_t targets[lanes];
+
+		Lanes saved, dst, val;
+		if(inRange(op, Opcodes::MOVE_TO_REG, Opcodes::MOVE_TO_MC)) {
+			getOperands(instr, active, saved, dst, val);
+			putVal(instr, val, saved, active);
+		} else if(inRange(op, Opcodes::AND_INTO_REG, Opcodes::AND_INTO_MC)) {
+			getOperands(instr, active, saved, dst, val);
+			putVal(instr, dst & val, saved, active);
+		} else if(inRange(op, Opcodes::OR_INTO_REG, Opcodes::OR_INTO_MC)) {
+			getOperands(instr, active, saved, dst, val);
+			putVal(instr, dst | val, saved, active);
+		} else if(inRange(op, Opcodes::XOR_INTO_REG, Opcodes::XOR_INTO_MC)) {
+			getOperands(instr, active, saved, dst, val);
+			putVal(instr, dst ^ val, saved, active);
+		} else if(inRange(op, Opcodes::ADD_INTO_REG, Opcodes::ADD_INTO_MC)) {
+			getOperands(instr, active, saved, dst, val);
+			putVal(instr, dst + val, saved, active);
+		} else if(inRange(op, Opcodes::SUB_INTO_REG, Opcodes::SUB_INTO_MC)) {
+			getOperands(instr, active, saved, dst, val);
+			putVal(instr, dst - val, saved, active);
+		} else if(inRange(op, Opcodes::MASK_INTO_REG, Opcodes::MASK_INTO_MC)) {
+			getOperands(instr, active, saved, dst, val);
+			putVal(instr, (dst & instr.mask) | val, saved, active);
+		} else if(inRange(op, Opcodes::SHIFT_LEFT_IN_REG, Opcodes::SHIFT_LEFT_IN_MC)) {
+			// Like the interpreter on x86, the count is taken mod 32.
+			getDst(instr, active, saved, dst);
+			putVal(instr, dst << (instr.imm & 31), saved, active);
+		} else if(inRange(op, Opcodes::SHIFT_RIGHT_IN_REG, Opcodes::SHIFT_RIGHT_IN_MC)) {
+			getDst(instr, active, saved, dst);
+			putVal(instr, dst >> (instr.imm & 31), saved, active);
+		} else if(inRange(op, Opcodes::CLEAR_IN_REG, Opcodes::CLEAR_IN_MC)) {
+			getDst(instr, active, saved, dst);
+			putVal(instr, Lanes{}, saved, active);
+		} else if(inRange(op, Opcodes::MUL_WITH_REG, Opcodes::MUL_WITH_MC)) {
+			getOperands(instr, active, saved, dst, val);
+			state.divMulQuotient = active ? dst * val : state.divMulQuotient;
+		} else if(inRange(op, Opcodes::DIV_WITH_REG, Opcodes::DIV_WITH_MC) || op == FusedOpcodes::DIV_BY_CONSTANT) {
+			// There is no vector division; a div by 0 in atombios results in a 0.
+			getOperands(instr, active, saved, dst, val);
+			for(int lane = 0; lane < lanes; lane++) {
+				if(active[lane]) {
+					state.divMulQuotient[lane] = val[lane] ? dst[lane] / val[lane] : 0;
+					state.divMulRemainder[lane] = val[lane] ? dst[lane] % val[lane] : 0;
+				}
+			}
+		} else if(inRange(op, Opcodes::COMPARE_FROM_REG, Opcodes::COMPARE_FROM_MC) || op == FusedOpcodes::COMPARE_AND_JUMP
+				|| inRange(op, Opcodes::TEST_FROM_REG, Opcodes::TEST_FROM_MC) || op == FusedOpcodes::TEST_AND_JUMP) {
+			// Flags are kept as 0 or 1 per lane.
+			getOperands(instr, active, saved, dst, val);
+			state.flagEqual = active ? (Lanes)(dst == val) & 1 : state.flagEqual;
+			// TEST only sets the equal flag.
+			if(inRange(op, Opcodes::COMPARE_FROM_REG, Opcodes::COMPARE_FROM_MC) || op == FusedOpcodes::COMPARE_AND_JUMP) {
+				state.flagAbove = active ? (Lanes)(dst > val) & 1 : state.flagAbove;
+				state.flagBelow = active ? (Lanes)(dst < val) & 1 : state.flagBelow;
+			}
+			if(op == FusedOpcodes::COMPARE_AND_JUMP || op == FusedOpcodes::TEST_AND_JUMP) {
+				jumpTaken(instr.fusedOpcode, active, taken);
+				for(int lane = 0; lane < lanes; lane++) {
+					targets[lane] = instr.target;
+				}
+			}
+		} else if(inRange(op, Opcodes::JUMP_ALWAYS, Opcodes::JUMP_NOTEQUAL)) {
+			jumpTaken(op, active, taken);
+			for(int lane = 0; lane < lanes; lane++) {
+				targets[lane] = instr.target;
+			}
+		} else if(op == Opcodes::SWITCH) {
+			// Like the interpreter, the cases are compared against the source as it is read.
+			getVal(instr.attrByte.srcArg, instr.srcIdx, instr.imm, active, val);
+			taken = active;
+			for(int lane = 0; lane < lanes; lane++) {
+				targets[lane] = decoded.switches[instr.target].lookup(val[lane], instr.next);
+			}
+		} else if(op == Opcodes::SET_DATA_TABLE) {
+			_setDataTable(instr.imm);
+			state.dataBlock = active ? Lanes{} + _dataBlock : state.dataBlock;
+		} else if(op == Opcodes::END_OF_TABLE) {
+			taken = active;
+			for(int lane = 0; lane < lanes; lane++) {
+				targets[lane] = instructionExit;
+			}
+		} else {
+			assert(false && "not run by the lockstep interpreter");
+		}
+
+		for(int lane = 0; lane < lanes; lane++) {
+			if(taken[lane]) {
+				state.next[lane] = targets[lane];
+			} else if(active[lane]) {
+				state.next[lane] = instr.next;
+			}
+		}
+	}
+
+	for(size_t i = 0; i < size; i++) {
+		for(size_t lane = 0; lane < end - first; lane++) {
+			params[(first + lane) * size + i] = state.params[i].lane[lane];
+		}
+	}
+
+	// The state is the one the last block left behind.
+	int last = end - first - 1;
+	_flagAbove = state.flagAbove[last];
+	_flagEqual = state.flagEqual[last];
+	_flagBelow = state.flagBelow[last];
+	_divMulQuotient = state.divMulQuotient[last];
+	_divMulRemainder = state.divMulRemainder[last];
+	_dataBlock = state.dataBlock[last];
+	_workSpaceMaskShift = state.workSpaceMaskShift[last];
+}
@@ -0,0 +1,447 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Memoization of pure commands.
+// A command is pure if it (and every command it calls) only works on its parameter space, its WorkSpace, the ROM
+// and the MemoState: no card accesses, no FB, no delays, and no IO or reg block changes that outlive it.
+// The result of a run then only depends on the parameter space from params_shift on, and on the MemoState that
+// the command reads before writing it, so it can be cached under these.
+
+namespace {
+
+// What an instruction does with the MemoState.
+struct Effects {
+	bool impure = false;
+	// Read before the instruction writes anything.
+	uint8_t reads = 0;
+	// Written along some / all paths through the instruction; these only differ for CALL_TABLE.
+	uint8_t writes = 0;
+	uint8_t mustWrites = 0;
+
+	void write(uint8_t state) {
+		writes |= state;
+		mustWrites |= state;
+	}
+};
+
+uint8_t jumpReads(uint8_t opcode) {
+	switch(opcode) {
+	case Opcodes::JUMP_EQUAL:
+	case Opcodes::JUMP_NOTEQUAL:
+		return MemoFlagEqual;
+	case Opcodes::JUMP_ABOVE:
+		return MemoFlagAbove;
+	case Opcodes::JUMP_BELOW:
+		return MemoFlagBelow;
+	case Opcodes::JUMP_ABOVEOREQUAL:
+		return MemoFlagAbove | MemoFlagEqual;
+	case Opcodes::JUMP_BELOWOREQUAL:
+		return MemoFlagBelow | MemoFlagEqual;
+	}
+	return 0;
+}
+
+void readOperand(OpcodeArgEncoding arg, uint32_t idx, Effects& effects) {
+	switch(arg) {
+	case OpcodeArgEncoding::Imm:
+	case OpcodeArgEncoding::ParameterSpace:
+		return;
+	case OpcodeArgEncoding::ID:
+		effects.reads |= MemoDataBlock;
+		return;
+	case OpcodeArgEncoding::WorkSpace:
+		switch(idx) {
+		case WS_QUOTIENT:
+			effects.reads |= MemoQuotient;
+			return;
+		case WS_REMAINDER:
+			effects.reads |= MemoRemainder;
+			return;
+		case WS_DATAPTR:
+			effects.reads |= MemoDataBlock;
+			return;
+		case WS_SHIFT:
+		case WS_OR_MASK:
+		case WS_AND_MASK:
+			effects.reads |= MemoMaskShift;
+			return;
+		case WS_FB_WINDOW:
+		case WS_ATTRIBUTES:
+		case WS_REGPTR:
+			effects.impure = true;
+			return;
+		}
+		return;
+	default:
+		effects.impure = true;
+		return;
+	}
+}
+
+void writeOperand(OpcodeArgEncoding arg, uint32_t idx, Effects& effects) {
+	switch(arg) {
+	case OpcodeArgEncoding::ParameterSpace:
+		return;
+	case OpcodeArgEncoding::WorkSpace:
+		switch(idx) {
+		case WS_QUOTIENT:
+			effects.write(MemoQuotient);
+			return;
+		case WS_REMAINDER:
+			effects.write(MemoRemainder);
+			return;
+		case WS_DATAPTR:
+			effects.write(MemoDataBlock);
+			return;
+		case WS_SHIFT:
+			effects.write(MemoMaskShift);
+			return;
+		case WS_OR_MASK:
+		case WS_AND_MASK:
+		case WS_FB_WINDOW:
+		case WS_ATTRIBUTES:
+		case WS_REGPTR:
+			effects.impure = true;
+			return;
+		}
+		return;
+	default:
+		effects.impure = true;
+		return;
+	}
+}
+
+// Everything but CALL_TABLE.
+Effects instructionEffects(const Instruction& instr) {
+	Effects effects;
+	uint8_t op = instr.opcode;
+
+	if(!instr.valid) {
+		effects.impure = true;
+		return effects;
+	}
+
+	// Dword MOVEs and CLEARs do not read their destination.
+	bool partial = instr.attrByte.dstAlign != SrcEncoding::SrcDword;
+	auto binary = [&] {
+		readOperand(instr.dstArg, instr.dstIdx, effects);
+		readOperand(instr.attrByte.srcArg, instr.srcIdx, effects);
+	};
+
+	if(inRange(op, Opcodes::MOVE_TO_REG, Opcodes::MOVE_TO_MC)) {
+		if(partial) {
+			readOperand(instr.dstArg, instr.dstIdx, effects);
+		}
+		readOperand(instr.attrByte.srcArg, instr.srcIdx, effects);
+		writeOperand(instr.dstArg, instr.dstIdx, effects);
+	} else if(inRange(op, Opcodes::AND_INTO_REG, Opcodes::OR_INTO_MC)
+			|| inRange(op, Opcodes::ADD_INTO_REG, Opcodes::SUB_INTO_MC)
+			|| inRange(op, Opcodes::MASK_INTO_REG, Opcodes::MASK_INTO_MC)
+			|| inRange(op, Opcodes::XOR_INTO_REG, Opcodes::XOR_INTO_MC)) {
+		binary();
+		writeOperand(instr.dstArg, instr.dstIdx, effects);
+	} else if(inRange(op, Opcodes::SHIFT_LEFT_IN_REG, Opcodes::SHIFT_RIGHT_IN_MC)) {
+		readOperand(instr.dstArg, instr.dstIdx, effects);
+		writeOperand(instr.dstArg, instr.dstIdx, effects);
+	} else if(inRange(op, Opcodes::CLEAR_IN_REG, Opcodes::CLEAR_IN_MC)) {
+		if(partial) {
+			readOperand(instr.dstArg, instr.dstIdx, effects);
+		}
+		writeOperand(instr.dstArg, instr.dstIdx, effects);
+	} else if(inRange(op, Opcodes::MUL_WITH_REG, Opcodes::MUL_WITH_MC)) {
+		binary();
+		effects.write(MemoQuotient);
+	} else if(inRange(op, Opcodes::DIV_WITH_REG, Opcodes::DIV_WITH_MC) || op == FusedOpcodes::DIV_BY_CONSTANT) {
+		binary();
+		effects.write(MemoQuotient | MemoRemainder);
+	} else if(inRange(op, Opcodes::COMPARE_FROM_REG, Opcodes::COMPARE_FROM_MC) || op == FusedOpcodes::COMPARE_AND_JUMP) {
+		binary();
+		effects.write(MemoFlagAbove | MemoFlagEqual | MemoFlagBelow);
+	} else if(inRange(op, Opcodes::TEST_FROM_REG, Opcodes::TEST_FROM_MC) || op == FusedOpcodes::TEST_AND_JUMP) {
+		binary();
+		effects.write(MemoFlagEqual);
+	} else if(inRange(op, Opcodes::JUMP_ALWAYS, Opcodes::JUMP_NOTEQUAL)) {
+		effects.reads |= jumpReads(op);
+	} else if(op == Opcodes::SWITCH) {
+		readOperand(instr.attrByte.srcArg, instr.srcIdx, effects);
+	} else if(op == Opcodes::SET_DATA_TABLE) {
+		effects.write(MemoDataBlock);
+	} else if(op != Opcodes::END_OF_TABLE) {
+		// SET_ATI_PORT, SET_PCI_PORT, SET_SYSIO_PORT, SET_REG_BLOCK, DELAY_MICROSECONDS and MASKED_REG_UPDATE.
+		effects.impure = true;
+	}
+
+	// The fused jump reads the flags after they were set.
+	if(op == FusedOpcodes::COMPARE_AND_JUMP || op == FusedOpcodes::TEST_AND_JUMP) {
+		effects.reads |= jumpReads(instr.fusedOpcode) & ~effects.mustWrites;
+	}
+	return effects;
+}
+
+bool endsCommand(const Instruction& instr) {
+	return instr.opcode == Opcodes::END_OF_TABLE;
+}
+
+// FNV-1a.
+uint32_t hashWords(const libatombios_vector<uint32_t>& words) {
+	uint32_t hash = 0x811C9DC5;
+	for(uint32_t word : words) {
+		for(int i = 0; i < 4; i++) {
+			hash ^= (word >> (i * 8)) & 0xFF;
+			hash *= 0x01000193;
+		}
+	}
+	return hash;
+}
+
+bool sameWords(const libatombios_vector<uint32_t>& a, const libatombios_vector<uint32_t>& b) {
+	if(a.size() != b.size()) {
+		return false;
+	}
+	for(size_t i = 0; i < a.size(); i++) {
+		if(a[i] != b[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+}
+
+void AtomBiosImpl::setMemoization(uint32_t entries) {
+	if(entries == _memoEntries) {
+		return;
+	}
+
+	_memoEntries = entries;
+	_dropDecodedCommands();
+}
+
+AtomBios::MemoStats AtomBiosImpl::memoStats(int table) {
+	AtomBios::MemoStats stats{};
+
+	Command* command = _commandTable.commands.get(table);
+	if(command && command->decoded) {
+		stats.pure = command->decoded->purity == MemoPurity::Pure;
+		stats.entries = command->decoded->memo.size();
+		stats.hits = command->decoded->memoHits;
+		stats.misses = command->decoded->memoMisses;
+	}
+	return stats;
+}
+
+uint32_t AtomBiosImpl::_memoState(int bit) {
+	switch(1 << bit) {
+	case MemoFlagAbove: return _flagAbove;
+	case MemoFlagEqual: return _flagEqual;
+	case MemoFlagBelow: return _flagBelow;
+	case MemoQuotient: return _divMulQuotient;
+	case MemoRemainder: return _divMulRemainder;
+	case MemoDataBlock: return _dataBlock;
+	case MemoMaskShift: return _workSpaceMaskShift;
+	}
+
+	assert(false && "not a MemoState bit");
+	return 0;
+}
+
+void AtomBiosImpl::_setMemoState(int bit, uint32_t val) {
+	switch(1 << bit) {
+	case MemoFlagAbove: _flagAbove = val; return;
+	case MemoFlagEqual: _flagEqual = val; return;
+	case MemoFlagBelow: _flagBelow = val; return;
+	case MemoQuotient: _divMulQuotient = val; return;
+	case MemoRemainder: _divMulRemainder = val; return;
+	case MemoDataBlock: _dataBlock = val; return;
+	case MemoMaskShift: _workSpaceMaskShift = val; return;
+	}
+
+	assert(false && "not a MemoState bit");
+}
+
+// A forward pass over the instructions, tracking the MemoState that was written along all paths so far.
+void AtomBiosImpl::_analyzePurity(Command& command, DecodedCommand& decoded) {
+	decoded.purity = MemoPurity::Analyzing;
+
+	// Per instruction: whether it is reached, and the MemoState written along all paths to it.
+	libatombios_vector<bool> reached;
+	libatombios_vector<uint8_t> written;
+	reached.resize(decoded.code.size(), false);
+	written.resize(decoded.code.size(), 0);
+	libatombios_vector<uint32_t> worklist;
+
+	bool pure = true;
+	uint8_t keyState = 0;
+	uint8_t writtenState = 0;
+	uint8_t exitState = memoStateAll;
+
+	auto reach = [&](uint32_t idx, uint8_t state) {
+		if(idx == instructionExit) {
+			exitState &= state;
+			return;
+		}
+		if(idx == instructionInvalid) {
+			pure = false;
+			return;
+		}
+
+		uint8_t merged = reached[idx] ? (written[idx] & state) : state;
+		if(!reached[idx] || merged != written[idx]) {
+			reached[idx] = true;
+			written[idx] = merged;
+			worklist.push_back(idx);
+		}
+	};
+
+	reach(decoded.entry < decoded.code.size() ? decoded.entry : instructionExit, 0);
+	while(pure && !worklist.empty()) {
+		uint32_t idx = worklist.back();
+		worklist.pop();
+		const Instruction& instr = decoded.code[idx];
+		uint8_t state = written[idx];
+
+		Effects effects;
+		if(instr.valid && instr.opcode == Opcodes::CALL_TABLE) {
+			Command* callee = _commandTable.commands.get(instr.imm);
+			if(callee && callee->exists()) {
+				DecodedCommand& calleeDecoded = _decoded(*callee);
+				if(calleeDecoded.purity == MemoPurity::Unknown) {
+					_analyzePurity(*callee, calleeDecoded);
+				}
+				effects.impure = calleeDecoded.purity != MemoPurity::Pure;
+				effects.reads = calleeDecoded.memoKeyState;
+				effects.writes = calleeDecoded.memoWrittenState;
+				effects.mustWrites = calleeDecoded.memoMustWriteState;
+			} else {
+				effects.impure = true;
+			}
+		} else {
+			effects = instructionEffects(instr);
+		}
+		if(effects.impure) {
+			pure = false;
+			break;
+		}
+
+		keyState |= effects.reads & ~state;
+		writtenState |= effects.writes;
+		state |= effects.mustWrites;
+
+		if(endsCommand(instr)) {
+			reach(instructionExit, state);
+			continue;
+		}
+		if(jumps(instr)) {
+			reach(instr.target, state);
+			if(jumpsAlways(instr)) {
+				continue;
+			}
+		}
+		if(instr.opcode == Opcodes::SWITCH) {
+			for(uint32_t target : decoded.switches[instr.target].targets) {
+				reach(target, state);
+			}
+		}
+		reach(instr.next, state);
+	}
+
+	if(pure) {
+		decoded.purity = MemoPurity::Pure;
+		// State that is only written along some paths keeps its value from before the run along the others.
+		decoded.memoKeyState = keyState | (writtenState & ~exitState);
+		decoded.memoWrittenState = writtenState;
+		decoded.memoMustWriteState = exitState & writtenState;
+	} else {
+		decoded.purity = MemoPurity::Impure;
+	}
+	if(AtomBIOSDebugSettings::logCommands) {
+		lilrad_log(DEBUG, "memo: command %x is %s\n", command.i(), decoded.purity == MemoPurity::Pure ? "pure" : "not pure");
+	}
+}
+
+void AtomBiosImpl::_runMemoized(Command& command, DecodedCommand& decoded, libatombios_vector<uint32_t>& params, int params_shift) {
+	// The parameter space the command sees, followed by the state it depends on.
+	libatombios_vector<uint32_t> key;
+	size_t psDwords = params.size() > static_cast<size_t>(params_shift) ? params.size() - params_shift : 0;
+	key.resize(psDwords);
+	for(size_t i = 0; i < psDwords; i++) {
+		key[i] = params[params_shift + i];
+	}
+	for(int bit = 0; bit < memoStateCount; bit++) {
+		if(decoded.memoKeyState & (1 << bit)) {
+			key.push_back(_memoState(bit));
+		}
+	}
+	uint32_t hash = hashWords(key);
+	decoded.memoClock++;
+
+	for(MemoEntry& entry : decoded.memo) {
+		if(entry.hash != hash || !sameWords(entry.key, key)) {
+			continue;
+		}
+
+		if(AtomBIOSDebugSettings::logCommands) {
+			lilrad_log(DEBUG, "memo: command %x (params_shift = %i) taken from the cache\n", command.i(), params_shift);
+		}
+		entry.lastUse = decoded.memoClock;
+		decoded.memoHits++;
+
+		if(params.size() < params_shift + entry.params.size()) {
+			params.resize(params_shift + entry.params.size());
+		}
+		for(size_t i = 0; i < entry.params.size(); i++) {
+			params[params_shift + i] = entry.params[i];
+		}
+		for(int bit = 0; bit < memoStateCount; bit++) {
+			if(decoded.memoWrittenState & (1 << bit)) {
+				_setMemoState(bit, entry.state[bit]);
+			}
+		}
+
+		if(entry.psDwords && params_shift + entry.psDwords - 1 > _maxPSIndex) { _maxPSIndex = params_shift + entry.psDwords - 1; }
+		if(entry.maxWSIndex > _maxWSIndex) { _maxWSIndex = entry.maxWSIndex; }
+		return;
+	}
+
+	// Run it, keeping apart the telemetry of this run.
+	decoded.memoMisses++;
+	uint32_t maxPSIndex = _maxPSIndex;
+	uint32_t maxWSIndex = _maxWSIndex;
+	_maxPSIndex = 0;
+	_maxWSIndex = 0;
+
+	_runDecoded(command, decoded, params, params_shift);
+
+	MemoEntry* entry;
+	if(decoded.memo.size() < _memoEntries) {
+		decoded.memo.resize(decoded.memo.size() + 1);
+		entry = &decoded.memo.back();
+	} else {
+		entry = &decoded.memo[0];
+		for(MemoEntry& other : decoded.memo) {
+			if(other.lastUse < entry->lastUse) {
+				entry = &other;
+			}
+		}
+	}
+
+	entry->key = key;
+	entry->hash = hash;
+	entry->lastUse = decoded.memoClock;
+	psDwords = params.size() > static_cast<size_t>(params_shift) ? params.size() - params_shift : 0;
+	entry->params.resize(psDwords);
+	for(size_t i = 0; i < psDwords; i++) {
+		entry->params[i] = params[params_shift + i];
+	}
+	for(int bit = 0; bit < memoStateCount; bit++) {
+		entry->state[bit] = decoded.memoWrittenState & (1 << bit) ? _memoState(bit) : 0;
+	}
+	entry->psDwords = _maxPSIndex >= static_cast<uint32_t>(params_shift) ? _maxPSIndex - params_shift + 1 : 0;
+	entry->maxWSIndex = _maxWSIndex;
+
+	if(maxPSIndex > _maxPSIndex) { _maxPSIndex = maxPSIndex; }
+	if(maxWSIndex > _maxWSIndex) { _maxWSIndex = maxWSIndex; }
+}
@@ -0,0 +1,379 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// The optimizer works on the decoded form of a command, before superinstructions are formed.
+// Only state that is local to the command (and the reg block, along paths that set it) is reasoned about;
+// everything that other commands or the host may change is treated as unknown.
+
+namespace {
+
+// WorkSpace indexes that are backed by the WorkSpace itself, instead of interpreter state.
+bool isPlainWorkSpace(uint32_t idx) {
+	return !isSpecialWorkSpace(idx);
+}
+
+// Sources that can be read again later without side effects.
+bool isPureSrc(OpcodeArgEncoding arg, uint32_t idx) {
+	switch(arg) {
+	case OpcodeArgEncoding::Imm:
+	case OpcodeArgEncoding::ParameterSpace:
+	case OpcodeArgEncoding::ID:
+		return true;
+	case OpcodeArgEncoding::WorkSpace:
+		return isPlainWorkSpace(idx);
+	default:
+		return false;
+	}
+}
+
+template<typename F>
+void forEachSuccessor(DecodedCommand& decoded, const Instruction& instr, F f) {
+	if(instr.next != instructionExit) {
+		f(instr.next);
+	}
+	if(!instr.valid) {
+		return;
+	}
+	if(inRange(instr.opcode, Opcodes::JUMP_ALWAYS, Opcodes::JUMP_NOTEQUAL) && instr.target < instructionInvalid) {
+		f(instr.target);
+	}
+	if(instr.opcode == Opcodes::SWITCH) {
+		for(uint32_t target : decoded.switches[instr.target].targets) {
+			if(target < instructionInvalid) {
+				f(target);
+			}
+		}
+	}
+}
+
+///
+/// Reg block folding: forward propagation of SET_REG_BLOCK constants.
+///
+
+// regBlock values: one of these, or a known reg block.
+constexpr int32_t regBlockUnvisited = -2;
+constexpr int32_t regBlockUnknown = -1;
+
+int32_t regBlockAfter(const Instruction& instr, int32_t regBlock) {
+	if(!instr.valid) {
+		return regBlockUnknown;
+	}
+	if(instr.opcode == Opcodes::SET_REG_BLOCK) {
+		return instr.imm;
+	}
+	// Other commands may change it.
+	if(instr.opcode == Opcodes::CALL_TABLE) {
+		return regBlockUnknown;
+	}
+	if(writesDst(instr) && instr.dstArg == OpcodeArgEncoding::WorkSpace && instr.dstIdx == WS_REGPTR) {
+		return regBlockUnknown;
+	}
+	return regBlock;
+}
+
+void foldRegBlocks(DecodedCommand& decoded) {
+	libatombios_vector<int32_t> regBlocks;
+	regBlocks.resize(decoded.code.size(), regBlockUnvisited);
+
+	// The reg block is inherited from the caller.
+	libatombios_vector<uint32_t> worklist;
+	regBlocks[decoded.entry] = regBlockUnknown;
+	worklist.push_back(decoded.entry);
+
+	while(!worklist.empty()) {
+		uint32_t i = worklist.back();
+		worklist.resize(worklist.size() - 1);
+
+		int32_t out = regBlockAfter(decoded.code[i], regBlocks[i]);
+		forEachSuccessor(decoded, decoded.code[i], [&](uint32_t succ) {
+			int32_t merged = regBlocks[succ] == regBlockUnvisited || regBlocks[succ] == out ? out : regBlockUnknown;
+			if(merged != regBlocks[succ]) {
+				regBlocks[succ] = merged;
+				worklist.push_back(succ);
+			}
+		});
+	}
+
+	for(size_t i = 0; i < decoded.code.size(); i++) {
+		Instruction& instr = decoded.code[i];
+		if(regBlocks[i] < 0 || !instr.valid) {
+			continue;
+		}
+
+		bool dstReg = hasDst(instr) && instr.dstArg == OpcodeArgEncoding::Reg;
+		bool srcReg = hasSrc(instr) && instr.attrByte.srcArg == OpcodeArgEncoding::Reg;
+		if(!dstReg && !srcReg) {
+			continue;
+		}
+
+		if(dstReg) {
+			instr.dstIdx += regBlocks[i];
+		}
+		if(srcReg) {
+			instr.srcIdx += regBlocks[i];
+		}
+		instr.optFlags |= OptimizerFlags::OptRegBlockFolded;
+		instr.foldedRegBlock = regBlocks[i];
+		decoded.foldedRegBlocks++;
+	}
+}
+
+///
+/// WorkSpace forwarding: within extended basic blocks, reads of a WorkSpace index that a plain
+/// dword MOVE stored a pure source into are replaced by that source.
+///
+
+struct ForwardedValue {
+	bool known = false;
+	OpcodeArgEncoding arg;
+	uint32_t idx;
+	uint32_t imm;
+};
+
+void forwardWorkSpace(DecodedCommand& decoded) {
+	// Instructions that are only entered from the instruction before them continue its block.
+	libatombios_vector<uint32_t> predecessors;
+	libatombios_vector<uint8_t> continuesBlock;
+	predecessors.resize(decoded.code.size(), 0);
+	continuesBlock.resize(decoded.code.size(), 0);
+	predecessors[decoded.entry]++;
+	for(Instruction& instr : decoded.code) {
+		forEachSuccessor(decoded, instr, [&](uint32_t succ) {
+			predecessors[succ]++;
+		});
+		if(instr.next != instructionExit) {
+			continuesBlock[instr.next] = 1;
+		}
+	}
+	for(size_t i = 0; i < decoded.code.size(); i++) {
+		continuesBlock[i] &= predecessors[i] == 1;
+	}
+
+	ForwardedValue values[256];
+
+	auto forget = [&values](auto pred) {
+		for(ForwardedValue& value : values) {
+			if(value.known && pred(value)) {
+				value.known = false;
+			}
+		}
+	};
+
+	for(size_t start = 0; start < decoded.code.size(); start++) {
+		// Only start at block leaders; the other instructions are visited through them.
+		if(continuesBlock[start]) {
+			continue;
+		}
+
+		for(ForwardedValue& value : values) {
+			value.known = false;
+		}
+
+		uint32_t i = start;
+		while(true) {
+			Instruction& instr = decoded.code[i];
+			if(!instr.valid) {
+				break;
+			}
+
+			if(hasSrc(instr) && instr.attrByte.srcArg == OpcodeArgEncoding::WorkSpace && values[instr.srcIdx].known) {
+				ForwardedValue& value = values[instr.srcIdx];
+				instr.optFlags |= OptimizerFlags::OptSrcForwarded;
+				instr.forwardedFrom = instr.srcIdx;
+				instr.attrByte.srcArg = value.arg;
+				instr.srcIdx = value.idx;
+				instr.imm = value.imm;
+				decoded.forwardedSources++;
+			}
+
+			// Forget what this instruction changes.
+			if(writesDst(instr) && instr.dstArg == OpcodeArgEncoding::WorkSpace) {
+				uint32_t ws = instr.dstIdx;
+				values[ws].known = false;
+				forget([ws](ForwardedValue& value) { return value.arg == OpcodeArgEncoding::WorkSpace && value.idx == ws; });
+				if(ws == WS_DATAPTR) {
+					forget([](ForwardedValue& value) { return value.arg == OpcodeArgEncoding::ID; });
+				}
+			}
+			if(writesDst(instr) && instr.dstArg == OpcodeArgEncoding::ParameterSpace) {
+				uint32_t ps = instr.dstIdx;
+				forget([ps](ForwardedValue& value) { return value.arg == OpcodeArgEncoding::ParameterSpace && value.idx == ps; });
+			}
+			if(instr.opcode == Opcodes::SET_DATA_TABLE) {
+				forget([](ForwardedValue& value) { return value.arg == OpcodeArgEncoding::ID; });
+			}
+			if(instr.opcode == Opcodes::CALL_TABLE) {
+				forget([](ForwardedValue& value) {
+					return value.arg == OpcodeArgEncoding::ParameterSpace || value.arg == OpcodeArgEncoding::ID;
+				});
+			}
+
+			// Remember plain copies.
+			if(instr.opcode == Opcodes::MOVE_TO_WS && isPlainWorkSpace(instr.dstIdx)
+					&& instr.attrByte.srcAlign == SrcEncoding::SrcDword && instr.attrByte.dstAlign == SrcEncoding::SrcDword
+					&& isPureSrc(instr.attrByte.srcArg, instr.srcIdx)
+					&& !(instr.attrByte.srcArg == OpcodeArgEncoding::WorkSpace && instr.srcIdx == instr.dstIdx)) {
+				ForwardedValue& value = values[instr.dstIdx];
+				value.known = true;
+				value.arg = instr.attrByte.srcArg;
+				value.idx = instr.srcIdx;
+				value.imm = instr.imm;
+			}
+
+			if(instr.next == instructionExit || !continuesBlock[instr.next]) {
+				break;
+			}
+			i = instr.next;
+		}
+	}
+}
+
+///
+/// Dead WorkSpace stores: the WorkSpace is local to each run of a command, so any store that is not
+/// read again before the command ends (or the index is overwritten) can be dropped.
+///
+
+// Returns false if nothing more was found.
+bool markDeadStores(DecodedCommand& decoded) {
+	size_t count = decoded.code.size();
+	libatombios_vector<WorkSpaceSet> liveIn;
+	liveIn.resize(count);
+
+	auto liveOut = [&](const Instruction& instr) {
+		WorkSpaceSet out;
+		forEachSuccessor(decoded, instr, [&](uint32_t succ) {
+			out.merge(liveIn[succ]);
+		});
+		return out;
+	};
+
+	bool changed = true;
+	while(changed) {
+		changed = false;
+		for(size_t n = count; n-- > 0;) {
+			Instruction& instr = decoded.code[n];
+			if(instr.optFlags & OptimizerFlags::OptDeadStore) {
+				// Dead stores will be skipped over.
+				changed |= liveIn[n].merge(liveOut(instr));
+				continue;
+			}
+
+			WorkSpaceSet live = liveOut(instr);
+			if(instr.valid && hasDst(instr) && instr.dstArg == OpcodeArgEncoding::WorkSpace && isPlainWorkSpace(instr.dstIdx)) {
+				if(writesDst(instr) && overwritesDst(instr)) {
+					live.reset(instr.dstIdx);
+				} else {
+					live.set(instr.dstIdx);
+				}
+			}
+			if(instr.valid && hasSrc(instr) && instr.attrByte.srcArg == OpcodeArgEncoding::WorkSpace && isPlainWorkSpace(instr.srcIdx)) {
+				live.set(instr.srcIdx);
+			}
+			changed |= liveIn[n].merge(live);
+		}
+	}
+
+	bool found = false;
+	for(size_t n = 0; n < count; n++) {
+		Instruction& instr = decoded.code[n];
+		if(!instr.valid || (instr.optFlags & OptimizerFlags::OptDeadStore) || !writesDst(instr)) {
+			continue;
+		}
+		if(instr.dstArg != OpcodeArgEncoding::WorkSpace || !isPlainWorkSpace(instr.dstIdx)) {
+			continue;
+		}
+		if(hasSrc(instr) && !isPureSrc(instr.attrByte.srcArg, instr.srcIdx)) {
+			continue;
+		}
+		if(liveOut(instr).test(instr.dstIdx)) {
+			continue;
+		}
+
+		instr.optFlags |= OptimizerFlags::OptDeadStore;
+		decoded.deadStores++;
+		found = true;
+	}
+	return found;
+}
+
+// Unlinks the dead stores from the control flow.
+void removeDeadStores(DecodedCommand& decoded) {
+	auto skip = [&decoded](uint32_t i) {
+		while(i < instructionInvalid && (decoded.code[i].optFlags & OptimizerFlags::OptDeadStore)) {
+			i = decoded.code[i].next;
+		}
+		return i;
+	};
+
+	for(Instruction& instr : decoded.code) {
+		instr.next = skip(instr.next);
+		if(instr.valid && inRange(instr.opcode, Opcodes::JUMP_ALWAYS, Opcodes::JUMP_NOTEQUAL)) {
+			instr.target = skip(instr.target);
+		}
+	}
+	for(SwitchTable& table : decoded.switches) {
+		for(uint32_t& target : table.targets) {
+			target = skip(target);
+		}
+	}
+	decoded.entry = skip(decoded.entry);
+}
+
+///
+/// Division by constants.
+///
+
+// Granlund & Montgomery, "Division by invariant integers using multiplication", figure 4.1.
+// Valid for all 32 bit dividends, and divisors >= 2.
+void divisionMagic(uint32_t divisor, uint32_t& magic, uint8_t& shift) {
+	uint32_t l = 32 - __builtin_clz(divisor - 1);
+	magic = static_cast<uint32_t>(((uint64_t(1) << 32) * ((uint64_t(1) << l) - divisor)) / divisor + 1);
+	shift = l - 1;
+}
+
+void reduceDivisions(DecodedCommand& decoded) {
+	for(Instruction& instr : decoded.code) {
+		if(!instr.valid || !inRange(instr.opcode, Opcodes::DIV_WITH_REG, Opcodes::DIV_WITH_MC)) {
+			continue;
+		}
+		if(instr.attrByte.srcArg != OpcodeArgEncoding::Imm) {
+			continue;
+		}
+
+		// Division by 0 and 1 are left alone; they are rare, and not any faster this way.
+		uint32_t divisor = instr.attrByte.swizleSrc(instr.imm);
+		if(divisor < 2) {
+			continue;
+		}
+
+		instr.opcode = FusedOpcodes::DIV_BY_CONSTANT;
+		divisionMagic(divisor, instr.divMagic, instr.divShift);
+		decoded.reducedDivisions++;
+	}
+}
+
+}
+
+void AtomBiosImpl::_optimizeInstructions(DecodedCommand& decoded) {
+	if(decoded.code.empty()) {
+		return;
+	}
+
+	foldRegBlocks(decoded);
+	forwardWorkSpace(decoded);
+	while(markDeadStores(decoded)) {
+	}
+	// In self-check mode, dead stores are still run, so that reads of them can be caught.
+	if(_optimizerMode != AtomBios::OptimizerMode::SelfCheck) {
+		removeDeadStores(decoded);
+	}
+	reduceDivisions(decoded);
+
+	if(AtomBIOSDebugSettings::logCommandTableCreation) {
+		lilrad_log(DEBUG, "optimizer: %u reg blocks folded, %u sources forwarded, %u dead stores, %u divisions reduced\n",
+			decoded.foldedRegBlocks, decoded.forwardedSources, decoded.deadStores, decoded.reducedDivisions);
+	}
+}
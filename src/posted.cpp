@@ -0,0 +1,93 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Posted writes: the thread that runs commands fills the queue, and the I/O thread empties it. Each side only writes
+// its own end; the tail is published after the write it covers is in the queue, and the head after the write it
+// covers was made, so a drained queue means the card saw every write.
+
+void AtomBiosImpl::setPostedWrites(uint32_t depth, void (*wait)(void* context), void* context) {
+	assert(!_runActive);
+	if(_postedMask) {
+		_waitPostedWrites();
+	}
+
+	// A queue of 1 would have a mask of 0.
+	uint32_t size = 2;
+	while(size < depth) {
+		size <<= 1;
+	}
+	_postedQueue.resize(depth ? size : 0);
+	_postedMask = depth ? size - 1 : 0;
+	_postedWait = wait;
+	_postedWaitContext = context;
+	_postedStats = AtomBios::PostedWriteStats{};
+}
+
+void AtomBiosImpl::_postWrite(CardSpace space, uint32_t reg, uint32_t val) {
+	uint64_t tail = _postedTail;
+	uint64_t head = __atomic_load_n(&_postedHead, __ATOMIC_ACQUIRE);
+	if(tail - head > _postedMask) {
+		_postedStats.fullStalls++;
+		do {
+			_postedStats.waitCalls++;
+			if(_postedWait) {
+				_postedWait(_postedWaitContext);
+			}
+			head = __atomic_load_n(&_postedHead, __ATOMIC_ACQUIRE);
+		} while(tail - head > _postedMask);
+	}
+
+	_postedQueue[tail & _postedMask] = PostedWrite{space, reg, val};
+	__atomic_store_n(&_postedTail, tail + 1, __ATOMIC_RELEASE);
+
+	uint32_t depth = tail + 1 - head;
+	_postedStats.writes++;
+	_postedStats.depthSum += depth;
+	if(depth > _postedStats.maxDepth) {
+		_postedStats.maxDepth = depth;
+	}
+}
+
+void AtomBiosImpl::_waitPostedWrites() {
+	if(__atomic_load_n(&_postedHead, __ATOMIC_ACQUIRE) == _postedTail) {
+		return;
+	}
+
+	_postedStats.drainStalls++;
+	do {
+		_postedStats.waitCalls++;
+		if(_postedWait) {
+			_postedWait(_postedWaitContext);
+		}
+	} while(__atomic_load_n(&_postedHead, __ATOMIC_ACQUIRE) != _postedTail);
+}
+
+size_t AtomBiosImpl::drainPostedWrites(size_t max) {
+	uint64_t head = __atomic_load_n(&_postedHead, __ATOMIC_RELAXED);
+	uint64_t tail = __atomic_load_n(&_postedTail, __ATOMIC_ACQUIRE);
+
+	size_t made = 0;
+	for(; head != tail && made < max; head++, made++) {
+		const PostedWrite& write = _postedQueue[head & _postedMask];
+		switch(write.space) {
+		case CardSpace::Reg:
+			libatombios_card_reg_write(write.reg, write.val);
+			break;
+		case CardSpace::PLL:
+			libatombios_card_pll_write(write.reg, write.val);
+			break;
+		case CardSpace::MC:
+			libatombios_card_mc_write(write.reg, write.val);
+			break;
+		case CardSpace::Delay:
+			assert(false && "delays are not posted");
+			break;
+		}
+		// Published per write, so the other side sees room in the queue as soon as there is.
+		__atomic_store_n(&_postedHead, head + 1, __ATOMIC_RELEASE);
+	}
+	return made;
+}
@@ -0,0 +1,139 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Recording the card accesses of a run, and making them again without the bytecode.
+// A run only depends on what it starts from and on the values it reads, so as long as the reads return what they
+// did when the run was recorded, the recorded writes and delays are the ones the bytecode would make. Once a read
+// differs, the command is run from the start against the accesses that were already made, which the interpreter
+// takes from the recording instead of making them again, and it continues with the card from the read on.
+
+void AtomBiosImpl::_saveFrameBuffer(libatombios_vector<uint8_t>& fb) {
+	fb.resize(_fbWindowSize);
+	if(_fbWindowSize) {
+		memcpy(fb.data(), _fbWindow, _fbWindowSize);
+	}
+}
+
+void AtomBiosImpl::_restoreFrameBuffer(const libatombios_vector<uint8_t>& fb) {
+	assert(fb.size() == _fbWindowSize);
+	if(_fbWindowSize) {
+		memcpy(_fbWindow, fb.data(), _fbWindowSize);
+	}
+}
+
+AtomBios::Recording* AtomBiosImpl::recordCommand(AtomBios::CommandTables table, libatombios_vector<uint32_t>& params) {
+	Command* command = _commandTable.commands.get(table);
+	assert(command && command->exists());
+
+	// Like runCommand; the recording starts out without a selected index.
+	invalidateIndexCache();
+
+	AtomBios::Recording* recording = new AtomBios::Recording;
+	recording->table = table;
+	recording->startState = _saveRunState();
+	recording->startParams = params;
+	_saveFrameBuffer(recording->startFB);
+
+	// Differential mode keeps a trace of its own, and is not used here.
+	_cardTrace.clear();
+	_cardTraceMode = CardTraceMode::Record;
+	_runActive = true;
+	_runBytecode(*command, params, 0);
+	if(_postedMask) {
+		_waitPostedWrites();
+	}
+	_runActive = false;
+	_cardTraceMode = CardTraceMode::Off;
+
+	recording->accesses = _cardTrace;
+	_cardTrace.clear();
+	recording->endState = _saveRunState();
+	recording->endParams = params;
+	_saveFrameBuffer(recording->endFB);
+
+	if(AtomBIOSDebugSettings::logCommands) {
+		lilrad_log(DEBUG, "replay: recorded %zu accesses of command %x\n", recording->accesses.size(), command->i());
+	}
+	return recording;
+}
+
+bool AtomBiosImpl::replayCommand(const AtomBios::Recording& recording, libatombios_vector<uint32_t>& params) {
+	Command* command = _commandTable.commands.get(recording.table);
+	assert(command && command->exists());
+
+	invalidateIndexCache();
+
+	bool sameFB = recording.startFB.size() == _fbWindowSize
+		&& (!_fbWindowSize || memcmp(_fbWindow, recording.startFB.data(), _fbWindowSize) == 0);
+	if(!_saveRunState().sameAs(recording.startState) || !_sameParameterSpace(params, recording.startParams) || !sameFB) {
+		if(AtomBIOSDebugSettings::logCommands) {
+			lilrad_log(DEBUG, "replay: command %x starts out differently than it was recorded, running it\n", command->i());
+		}
+		_runCommand(*command, params);
+		return false;
+	}
+
+	for(size_t i = 0; i < recording.accesses.size(); i++) {
+		const CardAccess& access = recording.accesses[i];
+		if(access.write) {
+			_cardWrite(access.space, access.reg, access.val);
+			continue;
+		}
+
+		uint32_t val = _cardRead(access.space, access.reg);
+		if(val == access.val) {
+			continue;
+		}
+
+		if(AtomBIOSDebugSettings::logCommands) {
+			lilrad_log(DEBUG, "replay: read %zu of command %x (reg %x, space %i) is %x instead of %x, running the command from there\n",
+				i, command->i(), access.reg, static_cast<int>(access.space), val, access.val);
+		}
+
+		// The accesses up to this read were made; the read returns what the card returned just now.
+		_cardTrace.clear();
+		for(size_t j = 0; j <= i; j++) {
+			_cardTrace.push_back(recording.accesses[j]);
+		}
+		_cardTrace[i].val = val;
+
+		_cardTraceMode = CardTraceMode::FastForward;
+		_cardTracePos = 0;
+		_cardTraceDiverged = false;
+		_runActive = true;
+		_runBytecode(*command, params, 0);
+		if(_postedMask) {
+			_waitPostedWrites();
+		}
+		_runActive = false;
+		_cardTraceMode = CardTraceMode::Off;
+		_cardTrace.clear();
+		return false;
+	}
+
+	if(_postedMask) {
+		_waitPostedWrites();
+	}
+
+	// The telemetry counts the run as if the bytecode was run.
+	RunState end = recording.endState;
+	end.maxPSIndex = _maxPSIndex > end.maxPSIndex ? _maxPSIndex : end.maxPSIndex;
+	end.maxWSIndex = _maxWSIndex > end.maxWSIndex ? _maxWSIndex : end.maxWSIndex;
+	end.skippedIndexWrites = _skippedIndexWrites + recording.endState.skippedIndexWrites - recording.startState.skippedIndexWrites;
+	_restoreRunState(end);
+
+	size_t size = params.size();
+	params = recording.endParams;
+	if(params.size() < size) {
+		params.resize(size);
+	}
+	_restoreFrameBuffer(recording.endFB);
+
+	if(AtomBIOSDebugSettings::logCommands) {
+		lilrad_log(DEBUG, "replay: made the %zu accesses of command %x\n", recording.accesses.size(), command->i());
+	}
+	return true;
+}
@@ -0,0 +1,145 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Running several commands at once, by their footprints.
+// Each request is put into the wave after the last wave that holds an earlier request it conflicts with, so
+// conflicting requests keep their order, and the requests of a wave do not conflict with each other. The waves are
+// run one after the other, each one over the workers. All requests start from the same state, which is also the
+// one their footprints were found for.
+
+struct AtomBiosImpl::ScheduleTask {
+	AtomBios::CommandRequest* requests;
+	size_t count;
+	// The requests of the wave being run.
+	const size_t* wave;
+	size_t waveSize;
+	size_t workers;
+	AtomBiosImpl** impls;
+
+	RunState start;
+	// The state the last request left behind.
+	RunState end;
+};
+
+void AtomBiosImpl::_runScheduled(ScheduleTask& task, size_t request) {
+	AtomBios::CommandRequest& req = task.requests[request];
+	Command* command = _commandTable.commands.get(req.table);
+
+	// The telemetry covers all requests.
+	RunState state = task.start;
+	state.maxPSIndex = _maxPSIndex;
+	state.maxWSIndex = _maxWSIndex;
+	state.skippedIndexWrites = _skippedIndexWrites;
+	_restoreRunState(state);
+
+	libatombios_vector<uint32_t> paramVector;
+	paramVector.resize(req.size);
+	memcpy(paramVector.data(), req.params, req.size * sizeof(uint32_t));
+
+	_runCommand(*command, paramVector);
+
+	memcpy(req.params, paramVector.data(), req.size * sizeof(uint32_t));
+
+	if(request == task.count - 1) {
+		task.end = _saveRunState();
+	}
+}
+
+void AtomBiosImpl::_runScheduleTask(void* taskContext, size_t worker) {
+	ScheduleTask* task = static_cast<ScheduleTask*>(taskContext);
+	AtomBiosImpl* impl = task->impls[worker];
+
+	for(size_t i = worker; i < task->waveSize; i += task->workers) {
+		impl->_runScheduled(*task, task->wave[i]);
+	}
+}
+
+void AtomBiosImpl::runCommands(AtomBios::CommandRequest* requests, size_t count) {
+	libatombios_vector<Command*> commands;
+	for(size_t i = 0; i < count; i++) {
+		Command* command = _commandTable.commands.get(requests[i].table);
+		assert(command && command->exists());
+		commands.push_back(command);
+	}
+
+	ScheduleTask task{};
+	task.requests = requests;
+	task.count = count;
+	task.start = _saveRunState();
+
+	// The mismatch counters of the self-check and differential modes are only kept here.
+	if(_batchWorkerCount < 2 || count < 2 || _optimizerMode == AtomBios::OptimizerMode::SelfCheck
+			|| _jitMode == AtomBios::JitMode::Differential) {
+		for(size_t i = 0; i < count; i++) {
+			_runScheduled(task, i);
+		}
+		return;
+	}
+
+	libatombios_vector<const CommandFootprint*> footprints;
+	libatombios_vector<size_t> waves;
+	size_t waveCount = 0;
+	for(size_t i = 0; i < count; i++) {
+		footprints.push_back(&_footprint(*commands[i]));
+
+		size_t wave = 0;
+		for(size_t j = 0; j < i; j++) {
+			if(waves[j] >= wave && footprints[i]->conflictsWith(*footprints[j])) {
+				wave = waves[j] + 1;
+			}
+		}
+		waves.push_back(wave);
+		if(wave >= waveCount) {
+			waveCount = wave + 1;
+		}
+	}
+
+	while(_batchWorkers.size() < _batchWorkerCount) {
+		_batchWorkers.push_back(new AtomBiosImpl(_data.data(), _data.size()));
+	}
+	for(size_t i = 0; i < _batchWorkerCount; i++) {
+		_configureWorker(_batchWorkers[i]);
+		_batchWorkers[i]->_maxPSIndex = 0;
+		_batchWorkers[i]->_maxWSIndex = 0;
+		_batchWorkers[i]->_skippedIndexWrites = 0;
+	}
+	task.impls = _batchWorkers.data();
+
+	if(AtomBIOSDebugSettings::logCommands) {
+		lilrad_log(DEBUG, "schedule: %zu commands in %zu waves\n", count, waveCount);
+	}
+	libatombios_vector<size_t> wave;
+	for(size_t w = 0; w < waveCount; w++) {
+		wave.clear();
+		for(size_t i = 0; i < count; i++) {
+			if(waves[i] == w) {
+				wave.push_back(i);
+			}
+		}
+
+		task.wave = wave.data();
+		task.waveSize = wave.size();
+		task.workers = _batchWorkerCount < wave.size() ? _batchWorkerCount : wave.size();
+		// A single request does not need another thread.
+		if(task.workers == 1) {
+			_runScheduleTask(&task, 0);
+		} else {
+			_batchRun(_runScheduleTask, &task, task.workers, _batchRunContext);
+		}
+	}
+
+	// The state is the one the last request left behind; the telemetry covers all of them.
+	RunState end = task.end;
+	end.maxPSIndex = _maxPSIndex;
+	end.maxWSIndex = _maxWSIndex;
+	end.skippedIndexWrites = _skippedIndexWrites;
+	for(size_t i = 0; i < _batchWorkerCount; i++) {
+		if(_batchWorkers[i]->_maxPSIndex > end.maxPSIndex) { end.maxPSIndex = _batchWorkers[i]->_maxPSIndex; }
+		if(_batchWorkers[i]->_maxWSIndex > end.maxWSIndex) { end.maxWSIndex = _batchWorkers[i]->_maxWSIndex; }
+		end.skippedIndexWrites += _batchWorkers[i]->_skippedIndexWrites;
+	}
+	_restoreRunState(end);
+}
@@ -0,0 +1,128 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Snapshots of a run, taken when a command is entered.
+// Every command that waits for a call is kept as the instruction that follows the call, and its WorkSpace; the
+// flags, the reg block and the other interpreter state are shared by all commands, and are part of the RunState.
+// Restoring a snapshot runs the entered command from its beginning, and then continues each calling command, the
+// innermost one first, from where its call returned.
+
+void AtomBiosImpl::_enterTable(Command& command, libatombios_vector<uint32_t>& params, int params_shift) {
+	// The command that restoreSnapshot enters again.
+	if(_resumingEntry) {
+		_resumingEntry = false;
+		return;
+	}
+
+	_enteredCommand = &command;
+	_enteredParams = &params;
+	_enteredParamsShift = params_shift;
+	// The hook may look at the card.
+	if(_postedMask) {
+		_waitPostedWrites();
+	}
+	_tableEntryHook(static_cast<AtomBios::CommandTables>(command.i()), _callStack.size(), _tableEntryHookContext);
+	_enteredCommand = nullptr;
+}
+
+uint32_t AtomBiosImpl::_instructionAt(DecodedCommand& decoded, uint32_t ip) {
+	// The instructions are sorted by their offset.
+	size_t low = 0;
+	size_t high = decoded.code.size();
+	while(low < high) {
+		size_t mid = (low + high) / 2;
+		if(decoded.code[mid].ip < ip) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	if(low == decoded.code.size() || decoded.code[low].ip != ip) {
+		lilrad_log(ERROR, "snapshot: no instruction at %x\n", ip + 0x6);
+		return instructionExit;
+	}
+	return low;
+}
+
+AtomBios::Snapshot* AtomBiosImpl::takeSnapshot() {
+	if(_runActive && !_enteredCommand) {
+		lilrad_log(ERROR, "snapshot: runs can only be taken from the table entry hook\n");
+		return nullptr;
+	}
+
+	for(size_t i = 0; _runActive && i < _callStack.size(); i++) {
+		if(!_callStack[i].workSpace) {
+			if(AtomBIOSDebugSettings::logCommands) {
+				lilrad_log(DEBUG, "snapshot: command %x is run as native code, and can not be continued\n",
+					_enteredCommand->i());
+			}
+			return nullptr;
+		}
+	}
+
+	AtomBios::Snapshot* snapshot = new AtomBios::Snapshot;
+	snapshot->state = _saveRunState();
+	if(!_runActive) {
+		return snapshot;
+	}
+
+	snapshot->params = *_enteredParams;
+	for(size_t i = 0; i < _callStack.size(); i++) {
+		CallFrame& call = _callStack[i];
+		snapshot->frames.push_back(AtomBios::Snapshot::Frame{call.command->i(), call.resumeIp, call.paramsShift, *call.workSpace});
+	}
+	snapshot->frames.push_back(AtomBios::Snapshot::Frame{_enteredCommand->i(), 0, _enteredParamsShift, {}});
+	return snapshot;
+}
+
+void AtomBiosImpl::restoreSnapshot(const AtomBios::Snapshot& snapshot, libatombios_vector<uint32_t>& params) {
+	assert(!_runActive);
+
+	_restoreRunState(snapshot.state);
+	if(snapshot.frames.empty()) {
+		return;
+	}
+
+	// The parameter space keeps at least the size the caller passed.
+	size_t size = params.size();
+	params = snapshot.params;
+	if(params.size() < size) {
+		params.resize(size);
+	}
+
+	// The host may have accessed the index registers since the snapshot was taken.
+	invalidateIndexCache();
+
+	_runActive = true;
+	size_t callers = snapshot.frames.size() - 1;
+	for(size_t i = 0; i < callers; i++) {
+		const AtomBios::Snapshot::Frame& frame = snapshot.frames[i];
+		Command* command = _commandTable.commands.get(frame.table);
+		_callStack.push_back(CallFrame{command, &frame.workSpace, frame.resumeIp, frame.paramsShift});
+	}
+
+	const AtomBios::Snapshot::Frame& entered = snapshot.frames[callers];
+	if(AtomBIOSDebugSettings::logCommands) {
+		lilrad_log(DEBUG, "snapshot: continuing command %x at depth %zu\n", entered.table, callers);
+	}
+	_resumingEntry = _tableEntryHook != nullptr;
+	_runBytecode(*_commandTable.commands.get(entered.table), params, entered.paramsShift);
+
+	for(size_t i = callers; i-- > 0;) {
+		CallFrame call = _callStack.pop();
+		if(call.resumeIp == instructionExit) {
+			continue;
+		}
+
+		DecodedCommand& decoded = _decoded(*call.command);
+		_interpret(*call.command, decoded, params, call.paramsShift, _instructionAt(decoded, call.resumeIp), call.workSpace);
+	}
+	if(_postedMask) {
+		_waitPostedWrites();
+	}
+	_runActive = false;
+}
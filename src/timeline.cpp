@@ -0,0 +1,63 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include "atom-private.hpp"
+
+// Timeline of the tables that are run.
+// Every running table has a span, whose counters take the accesses and delays until the table returns or calls
+// another table; the span is passed to the host when the table returns.
+
+void AtomBiosImpl::setTimeline(void (*span)(const AtomBios::TableSpan& span, void* context), uint64_t (*clock)(void* context),
+		uint32_t accessNanoseconds, void* context) {
+	_timelineSpan = span;
+	_timelineClock = clock;
+	_timelineAccessNanoseconds = accessNanoseconds;
+	_timelineContext = context;
+	_timelineTime = 0;
+	_timelineSpans.clear();
+}
+
+uint64_t AtomBiosImpl::_timelineNow() {
+	return _timelineClock ? _timelineClock(_timelineContext) : _timelineTime;
+}
+
+void AtomBiosImpl::_timelineEnter(int table) {
+	AtomBios::TableSpan span{};
+	span.table = static_cast<AtomBios::CommandTables>(table);
+	span.depth = _callStack.size();
+	span.begin = _timelineNow();
+	_timelineSpans.push_back(span);
+}
+
+void AtomBiosImpl::_timelineExit() {
+	// The timeline may have been started while the table was running.
+	if(_timelineSpans.empty()) {
+		return;
+	}
+
+	AtomBios::TableSpan span = _timelineSpans.pop();
+	span.end = _timelineNow();
+	_timelineSpan(span, _timelineContext);
+}
+
+void AtomBiosImpl::_timelineAccess(CardSpace space, bool write, uint32_t val) {
+	if(space == CardSpace::Delay) {
+		_timelineTime += static_cast<uint64_t>(val) * 1000;
+	} else {
+		_timelineTime += _timelineAccessNanoseconds;
+	}
+
+	if(_timelineSpans.empty()) {
+		return;
+	}
+	AtomBios::TableSpan& span = _timelineSpans[_timelineSpans.size() - 1];
+	if(space == CardSpace::Delay) {
+		span.delays++;
+		span.delayMicroseconds += val;
+	} else if(write) {
+		span.writes++;
+	} else {
+		span.reads++;
+	}
+}
@@ -0,0 +1,230 @@
+#include <libatombios/atom.hpp>
+#include <libatombios/atom-debug.hpp>
+#include <libatombios/extern-funcs.hpp>
+#include <libatombios/trace.hpp>
+
+#include "atom-private.hpp"
+
+// Binary traces; see trace.hpp for the format.
+// Events are encoded into a buffer of a fixed size, which is passed to the host whenever the next event might not
+// fit, so a trace can run for as long as the host keeps taking the data.
+
+namespace {
+
+uint8_t* encodeVarint(uint8_t* out, uint32_t val) {
+	while(val >= 0x80) {
+		*out++ = (val & 0x7F) | 0x80;
+		val >>= 7;
+	}
+	*out++ = val;
+	return out;
+}
+
+uint32_t zigzag(uint32_t delta) {
+	return (delta << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(delta) >> 31);
+}
+
+uint32_t unzigzag(uint32_t val) {
+	return (val >> 1) ^ -(val & 1);
+}
+
+} // namespace anonymous
+
+void AtomBiosImpl::setTraceWriter(void (*write)(const uint8_t* data, size_t size, void* context), void* context, size_t bufferSize) {
+	flushTrace();
+
+	_traceWrite = write;
+	_traceWriteContext = context;
+	_traceUsed = 0;
+	if(!write) {
+		_traceBuffer.resize(0);
+		return;
+	}
+
+	_traceBuffer.resize(bufferSize < AtomBiosTrace::maxEventSize ? AtomBiosTrace::maxEventSize : bufferSize);
+	memcpy(_traceBuffer.data(), AtomBiosTrace::magic, sizeof(AtomBiosTrace::magic));
+	_traceBuffer[sizeof(AtomBiosTrace::magic)] = AtomBiosTrace::version;
+	_traceUsed = AtomBiosTrace::headerSize;
+	_traceReg = 0;
+	_traceVal = 0;
+}
+
+void AtomBiosImpl::flushTrace() {
+	if(_traceWrite && _traceUsed) {
+		_traceWrite(_traceBuffer.data(), _traceUsed, _traceWriteContext);
+	}
+	_traceUsed = 0;
+}
+
+uint8_t* AtomBiosImpl::_traceReserve() {
+	if(_traceUsed + AtomBiosTrace::maxEventSize > _traceBuffer.size()) {
+		flushTrace();
+	}
+	return _traceBuffer.data() + _traceUsed;
+}
+
+void AtomBiosImpl::_traceTableEnter(int table) {
+	uint8_t* out = _traceReserve();
+	uint8_t* start = out;
+
+	*out++ = static_cast<uint8_t>(AtomBiosTrace::EventType::TableEnter);
+	out = encodeVarint(out, table);
+	out = encodeVarint(out, _callStack.size());
+	_traceUsed += out - start;
+
+	_traceReg = 0;
+	_traceVal = 0;
+}
+
+void AtomBiosImpl::_traceTableExit() {
+	uint8_t* out = _traceReserve();
+	*out = static_cast<uint8_t>(AtomBiosTrace::EventType::TableExit);
+	_traceUsed++;
+}
+
+void AtomBiosImpl::_traceAccess(CardSpace space, bool write, uint32_t reg, uint32_t val) {
+	static_assert(static_cast<uint8_t>(AtomBiosTrace::Space::Reg) == static_cast<uint8_t>(CardSpace::Reg));
+	static_assert(static_cast<uint8_t>(AtomBiosTrace::Space::PLL) == static_cast<uint8_t>(CardSpace::PLL));
+	static_assert(static_cast<uint8_t>(AtomBiosTrace::Space::MC) == static_cast<uint8_t>(CardSpace::MC));
+
+	uint8_t* out = _traceReserve();
+	uint8_t* start = out;
+
+	if(space == CardSpace::Delay) {
+		*out++ = static_cast<uint8_t>(AtomBiosTrace::EventType::Delay);
+		out = encodeVarint(out, val);
+		_traceUsed += out - start;
+		return;
+	}
+
+	uint8_t type = static_cast<uint8_t>(write ? AtomBiosTrace::EventType::Write : AtomBiosTrace::EventType::Read)
+		| (static_cast<uint8_t>(space) << AtomBiosTrace::spaceShift);
+	if(val == _traceVal) {
+		type |= AtomBiosTrace::sameValue;
+	}
+	*out++ = type;
+	out = encodeVarint(out, zigzag(reg - _traceReg));
+	if(val != _traceVal) {
+		out = encodeVarint(out, zigzag(val - _traceVal));
+	}
+	_traceUsed += out - start;
+
+	_traceReg = reg;
+	_traceVal = val;
+}
+
+/// Reader.
+
+struct AtomBiosTrace::Reader::Index {
+	libatombios_vector<Invocation> invocations;
+};
+
+AtomBiosTrace::Reader::Reader(const uint8_t* data, size_t size)
+: _data{data}, _size{size}, _pos{headerSize}, _valid{false}, _truncated{false}, _reg{0}, _val{0}, _index{new Index} {
+	if(size < headerSize || memcmp(data, magic, sizeof(magic)) || data[sizeof(magic)] != version) {
+		lilrad_log(ERROR, "trace: not a trace of version %u\n", version);
+		_pos = size;
+		return;
+	}
+	_valid = true;
+
+	// Find the invocations.
+	Event event;
+	while(true) {
+		uint64_t offset = _pos;
+		if(!next(event)) {
+			break;
+		}
+		if(event.type != EventType::TableEnter) {
+			continue;
+		}
+
+		_index->invocations.push_back(Invocation{offset, event.table, event.depth});
+	}
+
+	_pos = headerSize;
+	_reg = 0;
+	_val = 0;
+}
+
+AtomBiosTrace::Reader::~Reader() {
+	delete _index;
+}
+
+bool AtomBiosTrace::Reader::_readVarint(uint32_t& val) {
+	val = 0;
+	for(int shift = 0; shift < 35; shift += 7) {
+		if(_pos >= _size) {
+			return false;
+		}
+		uint8_t byte = _data[_pos++];
+		val |= static_cast<uint32_t>(byte & 0x7F) << shift;
+		if(!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool AtomBiosTrace::Reader::next(Event& event) {
+	if(_pos >= _size) {
+		return false;
+	}
+
+	size_t start = _pos;
+	uint8_t type = _data[_pos++];
+	event = Event{};
+	event.type = static_cast<EventType>(type & typeMask);
+
+	bool complete = true;
+	switch(event.type) {
+	case EventType::TableEnter:
+		complete = _readVarint(event.table) && _readVarint(event.depth);
+		_reg = 0;
+		_val = 0;
+		break;
+	case EventType::TableExit:
+		break;
+	case EventType::Read:
+	case EventType::Write: {
+		event.space = static_cast<Space>((type & spaceMask) >> spaceShift);
+		uint32_t reg;
+		uint32_t val = 0;
+		complete = _readVarint(reg) && ((type & sameValue) || _readVarint(val));
+		_reg += unzigzag(reg);
+		if(!(type & sameValue)) {
+			_val += unzigzag(val);
+		}
+		event.reg = _reg;
+		event.val = _val;
+		break;
+	}
+	case EventType::Delay:
+		complete = _readVarint(event.val);
+		break;
+	default:
+		lilrad_log(ERROR, "trace: unknown event %x at offset %zx\n", type, start);
+		complete = false;
+		break;
+	}
+
+	if(!complete) {
+		_truncated = true;
+		_pos = _size;
+		return false;
+	}
+	return true;
+}
+
+size_t AtomBiosTrace::Reader::invocations() const {
+	return _index->invocations.size();
+}
+
+const AtomBiosTrace::Invocation& AtomBiosTrace::Reader::invocation(size_t i) const {
+	return _index->invocations[i];
+}
+
+void AtomBiosTrace::Reader::seekInvocation(size_t i) {
+	assert(i < _index->invocations.size());
+	_pos = _index->invocations[i].offset;
+}
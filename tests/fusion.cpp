@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libatombios/atom.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include <vector>
+
+#include "../src-builder/rom-builder.hpp"
+
+// Superinstructions have to give the results of the instructions they replace. COMPARE / TEST and JUMP pairs are
+// run once fused and once with an instruction in between, which keeps them apart; a jump to the JUMP of a fused pair
+// has to run it on its own. A register read, ANDs and ORs of immediates and a write back are fused into one masked
+// update, which has to leave the WorkSpace as the plain instructions would.
+
+using AtomRomBuilder::Label;
+using AtomRomBuilder::Table;
+
+static constexpr uint32_t maskedReg = 0x10;
+
+static uint32_t regs[256];
+
+extern "C" void lilrad_log(enum LilradLogType type, const char* format, ...) {
+}
+
+extern "C" void* lilrad_alloc(size_t size) {
+	return malloc(size);
+}
+
+extern "C" void lilrad_free(void* ptr) {
+	free(ptr);
+}
+
+extern "C" void libatombios_card_reg_write(uint32_t reg, uint32_t val) {
+	regs[reg & 0xFF] = val;
+}
+extern "C" uint32_t libatombios_card_reg_read(uint32_t reg) {
+	return regs[reg & 0xFF];
+}
+
+namespace {
+
+constexpr auto PS = OpcodeArgEncoding::ParameterSpace;
+constexpr auto WS = OpcodeArgEncoding::WorkSpace;
+constexpr auto Reg = OpcodeArgEncoding::Reg;
+constexpr auto Imm = OpcodeArgEncoding::Imm;
+
+constexpr Opcodes conditions[] = {
+	Opcodes::JUMP_ABOVE, Opcodes::JUMP_ABOVEOREQUAL, Opcodes::JUMP_BELOW,
+	Opcodes::JUMP_BELOWOREQUAL, Opcodes::JUMP_EQUAL, Opcodes::JUMP_NOTEQUAL
+};
+constexpr uint32_t compareWith = 5;
+constexpr uint32_t testWith = 4;
+// The bit set unless the JUMP that is also reached by a jump of its own is taken.
+constexpr uint32_t innerJumpBit = 1 << 16;
+
+// PS[0] is compared; PS[1] gets a bit for each fused pair that does not jump, PS[2] for each of the pairs that are
+// kept apart.
+Table compareTable() {
+	Table table(0, 16);
+	int bit = 0;
+	for(Opcodes compare : {Opcodes::COMPARE_FROM_REG, Opcodes::TEST_FROM_REG}) {
+		uint32_t with = compare == Opcodes::COMPARE_FROM_REG ? compareWith : testWith;
+		for(Opcodes condition : conditions) {
+			Label fusedSkip = table.label();
+			table.op(compare, PS, 0, Imm, with);
+			table.jump(condition, fusedSkip);
+			table.op(Opcodes::OR_INTO_REG, PS, 1, Imm, 1 << bit);
+			table.bind(fusedSkip);
+
+			Label apartSkip = table.label();
+			table.op(compare, PS, 0, Imm, with);
+			table.op(Opcodes::MOVE_TO_REG, PS, 3, Imm, 0);
+			table.jump(condition, apartSkip);
+			table.op(Opcodes::OR_INTO_REG, PS, 2, Imm, 1 << bit);
+			table.bind(apartSkip);
+			bit++;
+		}
+	}
+
+	// For compareWith, the COMPARE with 0 is jumped over; its JUMP then runs with the flags of the first COMPARE.
+	Label inner = table.label();
+	Label innerSkip = table.label();
+	table.op(Opcodes::COMPARE_FROM_REG, PS, 0, Imm, compareWith);
+	table.jump(Opcodes::JUMP_EQUAL, inner);
+	table.op(Opcodes::COMPARE_FROM_REG, PS, 0, Imm, 0);
+	table.bind(inner);
+	table.jump(Opcodes::JUMP_EQUAL, innerSkip);
+	table.op(Opcodes::OR_INTO_REG, PS, 1, Imm, innerJumpBit);
+	table.bind(innerSkip);
+	table.end();
+	return table;
+}
+
+// The bits of compareTable for COMPARE, from the flags the interpreter sets.
+uint32_t expectedCompareBits(uint32_t val) {
+	bool above = val > compareWith;
+	bool equal = val == compareWith;
+	bool below = val < compareWith;
+	bool taken[] = {above, above || equal, below, below || equal, equal, !equal};
+	uint32_t bits = 0;
+	for(int i = 0; i < 6; i++) {
+		if(!taken[i]) {
+			bits |= 1 << i;
+		}
+	}
+	return bits;
+}
+
+constexpr uint32_t compareBitsMask = 0x3F;
+// The pairs of the loops, and the two around the jump to a JUMP.
+constexpr uint32_t fusedPairs = 2 * 6 + 2;
+
+// Updates maskedReg; PS[0] gets the WorkSpace after the update.
+Table maskedUpdateTable() {
+	Table table(4, 4);
+	table.op(Opcodes::MOVE_TO_REG, WS, 0, Reg, maskedReg);
+	table.op(Opcodes::AND_INTO_REG, WS, 0, Imm, 0xFFFF00FF);
+	table.op(Opcodes::OR_INTO_REG, WS, 0, Imm, 0x3400);
+	table.op(Opcodes::AND_INTO_REG, WS, 0, Imm, 0x0F, SrcEncoding::SrcByte0, SrcEncoding::SrcByte24);
+	table.op(Opcodes::MOVE_TO_REG, Reg, maskedReg, WS, 0);
+	table.op(Opcodes::MOVE_TO_REG, PS, 0, WS, 0);
+	table.end();
+	return table;
+}
+
+uint32_t expectedMaskedUpdate(uint32_t val) {
+	return (((val & 0xFFFF00FF) | 0x3400) & 0x0FFFFFFF);
+}
+
+} // namespace anonymous
+
+int main() {
+	AtomRomBuilder::Rom rom;
+	rom.setCommand(AtomBios::ASIC_Init, compareTable());
+	rom.setCommand(AtomBios::GetDisplaySurfaceSize, maskedUpdateTable());
+	std::vector<uint8_t> image = rom.build();
+
+	AtomBios atomBios(image.data(), image.size());
+
+	int failures = 0;
+	for(uint32_t val : {0u, 3u, 4u, 5u, 6u, 0x80000004u, 0xFFFFFFFFu}) {
+		uint32_t params[4] = {val, 0, 0, 0};
+		atomBios.runCommand(AtomBios::ASIC_Init, params, 4);
+		if((params[1] & ~innerJumpBit) != params[2]) {
+			fprintf(stderr, "%x: fused pairs give %x, pairs kept apart %x\n", val, params[1] & ~innerJumpBit, params[2]);
+			failures++;
+		}
+		if((params[1] & compareBitsMask) != expectedCompareBits(val)) {
+			fprintf(stderr, "%x: COMPARE bits %x, expected %x\n", val, params[1] & compareBitsMask, expectedCompareBits(val));
+			failures++;
+		}
+		if(!(params[1] & innerJumpBit) != (val == compareWith || val == 0)) {
+			fprintf(stderr, "%x: the JUMP of a fused pair did not use the flags it was reached with\n", val);
+			failures++;
+		}
+	}
+
+	for(uint32_t val : {0u, 0xFFFFFFFFu, 0x12345678u}) {
+		regs[maskedReg] = val;
+		uint32_t params[1] = {0};
+		atomBios.runCommand(AtomBios::GetDisplaySurfaceSize, params, 1);
+		uint32_t expected = expectedMaskedUpdate(val);
+		if(regs[maskedReg] != expected || params[0] != expected) {
+			fprintf(stderr, "masked update of %x: register %x, WorkSpace %x, expected %x\n", val, regs[maskedReg], params[0], expected);
+			failures++;
+		}
+	}
+
+	// Without superinstructions, the above would not test anything.
+	AtomBios::FusionStats compareStats = atomBios.fusionStats(AtomBios::ASIC_Init);
+	AtomBios::FusionStats maskedStats = atomBios.fusionStats(AtomBios::GetDisplaySurfaceSize);
+	if(compareStats.superinstructions != fusedPairs || maskedStats.superinstructions != 1) {
+		fprintf(stderr, "superinstructions: %u and %u, expected %u and 1\n", compareStats.superinstructions,
+			maskedStats.superinstructions, fusedPairs);
+		failures++;
+	}
+	return failures ? 1 : 0;
+}
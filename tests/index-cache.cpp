@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libatombios/atom.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include <vector>
+
+#include "../src-builder/rom-builder.hpp"
+
+// The PLL index cache has to follow index register writes the bytecode makes itself, including the ones made by
+// IIO functions: a PLL access after one of them must select its index again.
+
+using AtomRomBuilder::Table;
+
+static constexpr uint32_t pllIndexReg = 0x40;
+static constexpr uint32_t pllDataReg = 0x41;
+
+static std::vector<uint32_t> indexWrites;
+
+extern "C" void lilrad_log(enum LilradLogType type, const char* format, ...) {
+}
+
+extern "C" void* lilrad_alloc(size_t size) {
+	return malloc(size);
+}
+
+extern "C" void lilrad_free(void* ptr) {
+	free(ptr);
+}
+
+extern "C" void libatombios_card_reg_write(uint32_t reg, uint32_t val) {
+	if(reg == pllIndexReg) {
+		indexWrites.push_back(val);
+	}
+}
+extern "C" uint32_t libatombios_card_reg_read(uint32_t reg) {
+	return 0;
+}
+
+int main() {
+	constexpr auto Imm = OpcodeArgEncoding::Imm;
+
+	Table table(0, 0);
+	table.op(Opcodes::MOVE_TO_REG, OpcodeArgEncoding::PLL, 5, Imm, 0x11);
+	table.setATIPort(1);
+	table.op(Opcodes::MOVE_TO_REG, OpcodeArgEncoding::Reg, 7, Imm, 0);
+	table.setATIPort(0);
+	table.op(Opcodes::MOVE_TO_REG, OpcodeArgEncoding::PLL, 5, Imm, 0x22);
+	table.end();
+
+	// Writes the register it is called for to the PLL index register. The dword MOVE does not read its destination,
+	// so it is run once.
+	AtomRomBuilder::IIOFunction selectIndex;
+	selectIndex.clear(32, 0);
+	selectIndex.moveIndex(16, 0, 0);
+	selectIndex.write(pllIndexReg);
+
+	AtomRomBuilder::Rom rom;
+	rom.setCommand(AtomBios::ASIC_Init, table);
+	rom.setIIOFunction(1, selectIndex);
+	std::vector<uint8_t> image = rom.build();
+
+	AtomBios atomBios(image.data(), image.size());
+	atomBios.setPLLIndexDataPair(pllIndexReg, pllDataReg);
+	atomBios.runCommand(AtomBios::ASIC_Init, nullptr, 0);
+
+	std::vector<uint32_t> expected = {5, 7, 5};
+	if(indexWrites != expected) {
+		fprintf(stderr, "PLL index writes:");
+		for(uint32_t index : indexWrites) {
+			fprintf(stderr, " %u", index);
+		}
+		fprintf(stderr, ", expected 5 7 5\n");
+		return 1;
+	}
+	return 0;
+}
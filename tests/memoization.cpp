@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libatombios/atom.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include <vector>
+
+#include "../src-builder/rom-builder.hpp"
+
+// Runs of pure tables with the same parameters (and state they depend on) are taken from the cache, and have to give
+// the results of a plain run. Entries are keyed by the flags a table reads before setting them, so a table that
+// changes the flags (itself memoized, and restoring them on a hit) makes the next run a miss. Beyond the amount of
+// entries, the least recently used one is replaced; tables that access the card are never memoized.
+
+using AtomRomBuilder::Label;
+using AtomRomBuilder::Table;
+
+static uint32_t regReads;
+
+extern "C" void lilrad_log(enum LilradLogType type, const char* format, ...) {
+}
+
+extern "C" void* lilrad_alloc(size_t size) {
+	return malloc(size);
+}
+
+extern "C" void lilrad_free(void* ptr) {
+	free(ptr);
+}
+
+extern "C" uint32_t libatombios_card_reg_read(uint32_t reg) {
+	return ++regReads;
+}
+
+namespace {
+
+constexpr auto PS = OpcodeArgEncoding::ParameterSpace;
+constexpr auto Reg = OpcodeArgEncoding::Reg;
+constexpr auto Imm = OpcodeArgEncoding::Imm;
+
+constexpr auto computeTable = AtomBios::ASIC_Init;
+constexpr auto compareTable = AtomBios::GetDisplaySurfaceSize;
+constexpr auto flagTable = AtomBios::ASIC_RegistersInit;
+constexpr auto cardTable = AtomBios::VRAM_BlockVenderDetection;
+
+// PS[1] = (PS[0] + 0x10) << 2.
+Table compute() {
+	Table table(0, 8);
+	table.op(Opcodes::MOVE_TO_REG, PS, 1, PS, 0);
+	table.op(Opcodes::ADD_INTO_REG, PS, 1, Imm, 0x10);
+	table.shiftLeft(PS, 1, 2);
+	table.end();
+	return table;
+}
+
+uint32_t computed(uint32_t val) {
+	return (val + 0x10) << 2;
+}
+
+// Sets the flags from PS[0].
+Table compare() {
+	Table table(0, 4);
+	table.op(Opcodes::COMPARE_FROM_REG, PS, 0, Imm, 0);
+	table.end();
+	return table;
+}
+
+// PS[0] = 1 if the equal flag is set when the table starts, 2 otherwise.
+Table readFlag() {
+	Table table(0, 4);
+	Label equal = table.label();
+	Label done = table.label();
+	table.jump(Opcodes::JUMP_EQUAL, equal);
+	table.op(Opcodes::MOVE_TO_REG, PS, 0, Imm, 2);
+	table.jump(Opcodes::JUMP_ALWAYS, done);
+	table.bind(equal);
+	table.op(Opcodes::MOVE_TO_REG, PS, 0, Imm, 1);
+	table.bind(done);
+	table.end();
+	return table;
+}
+
+// PS[0] = a register.
+Table readCard() {
+	Table table(0, 4);
+	table.op(Opcodes::MOVE_TO_REG, PS, 0, Reg, 0x10);
+	table.end();
+	return table;
+}
+
+} // namespace anonymous
+
+int main() {
+	AtomRomBuilder::Rom rom;
+	rom.setCommand(computeTable, compute());
+	rom.setCommand(compareTable, compare());
+	rom.setCommand(flagTable, readFlag());
+	rom.setCommand(cardTable, readCard());
+	std::vector<uint8_t> image = rom.build();
+
+	AtomBios atomBios(image.data(), image.size());
+	atomBios.setMemoization(2);
+
+	int failures = 0;
+	auto expectStats = [&](AtomBios::CommandTables table, const char* what, bool pure, uint32_t hits, uint32_t misses) {
+		AtomBios::MemoStats stats = atomBios.memoStats(table);
+		if(stats.pure != pure || stats.hits != hits || stats.misses != misses) {
+			fprintf(stderr, "%s: table %d is %spure, with %u hits and %u misses; expected %spure, %u and %u\n", what, table,
+				stats.pure ? "" : "not ", stats.hits, stats.misses, pure ? "" : "not ", hits, misses);
+			failures++;
+		}
+	};
+	auto runCompute = [&](uint32_t val) {
+		uint32_t params[2] = {val, 0};
+		atomBios.runCommand(computeTable, params, 2);
+		if(params[1] != computed(val)) {
+			fprintf(stderr, "compute %x: %x, expected %x\n", val, params[1], computed(val));
+			failures++;
+		}
+	};
+	auto runFlag = [&](bool equal) {
+		uint32_t params[1] = {equal ? 0u : 1u};
+		atomBios.runCommand(compareTable, params, 1);
+		params[0] = 0;
+		atomBios.runCommand(flagTable, params, 1);
+		if(params[0] != (equal ? 1u : 2u)) {
+			fprintf(stderr, "flag table after a %s compare: %u\n", equal ? "equal" : "not equal", params[0]);
+			failures++;
+		}
+	};
+
+	// 1 and 2 fill the cache; 1 is used again, so 2 is replaced by 3.
+	runCompute(1);
+	runCompute(2);
+	runCompute(1);
+	runCompute(3);
+	expectStats(computeTable, "filling the cache", true, 1, 3);
+	runCompute(1);
+	runCompute(3);
+	runCompute(2);
+	expectStats(computeTable, "after replacing an entry", true, 3, 4);
+
+	// The flag table is keyed by the equal flag; the compare table restores the flag it sets on a hit.
+	runFlag(true);
+	runFlag(true);
+	runFlag(false);
+	runFlag(true);
+	runFlag(false);
+	expectStats(compareTable, "compare table", true, 3, 2);
+	expectStats(flagTable, "flag table", true, 3, 2);
+
+	for(int i = 1; i <= 3; i++) {
+		uint32_t params[1] = {0};
+		atomBios.runCommand(cardTable, params, 1);
+		if(params[0] != regReads || regReads != static_cast<uint32_t>(i)) {
+			fprintf(stderr, "card table run %d: %u, after %u register reads\n", i, params[0], regReads);
+			failures++;
+		}
+	}
+	expectStats(cardTable, "card table", false, 0, 0);
+
+	// Changing the amount of entries discards them.
+	atomBios.setMemoization(4);
+	expectStats(computeTable, "after setMemoization", false, 0, 0);
+	runCompute(1);
+	expectStats(computeTable, "first run after setMemoization", true, 0, 1);
+	return failures ? 1 : 0;
+}
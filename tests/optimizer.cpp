@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libatombios/atom.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include <utility>
+#include <vector>
+
+#include "../src-builder/rom-builder.hpp"
+
+// The optimizer must not change what a table computes: the parameter space and the card accesses of a run with it
+// have to be the ones of a plain run, and self-check mode must not find mismatches. The table has a fold of a known
+// reg block next to one that is not known, WorkSpace copies that can and can not be forwarded, a dead store, and
+// divisions by immediates.
+
+using AtomRomBuilder::Label;
+using AtomRomBuilder::Table;
+
+static constexpr uint16_t regBlock = 0x100;
+
+struct Access {
+	bool write;
+	uint32_t reg;
+	uint32_t val;
+
+	bool operator==(const Access&) const = default;
+};
+
+static std::vector<Access> accesses;
+static uint32_t regs[0x400];
+
+extern "C" void lilrad_log(enum LilradLogType type, const char* format, ...) {
+}
+
+extern "C" void* lilrad_alloc(size_t size) {
+	return malloc(size);
+}
+
+extern "C" void lilrad_free(void* ptr) {
+	free(ptr);
+}
+
+extern "C" void libatombios_card_reg_write(uint32_t reg, uint32_t val) {
+	accesses.push_back(Access{true, reg, val});
+	regs[reg % 0x400] = val;
+}
+extern "C" uint32_t libatombios_card_reg_read(uint32_t reg) {
+	accesses.push_back(Access{false, reg, regs[reg % 0x400]});
+	return regs[reg % 0x400];
+}
+
+namespace {
+
+constexpr auto PS = OpcodeArgEncoding::ParameterSpace;
+constexpr auto WS = OpcodeArgEncoding::WorkSpace;
+constexpr auto Reg = OpcodeArgEncoding::Reg;
+constexpr auto Imm = OpcodeArgEncoding::Imm;
+
+constexpr uint32_t divisors[] = {3, 7, 10, 641, 0x80000001, 0xFFFFFFFF};
+constexpr size_t divisionResults = 6;
+constexpr size_t paramSize = divisionResults + 2 * std::size(divisors);
+
+// PS[0] and PS[1] are the inputs.
+Table optimizedTable() {
+	Table table(16, paramSize * 4);
+
+	// Folded: the reg block is set right before.
+	table.setRegBlock(regBlock);
+	table.op(Opcodes::MOVE_TO_REG, Reg, 0x10, PS, 0);
+	table.op(Opcodes::MOVE_TO_REG, WS, 2, Reg, 0x10);
+	table.op(Opcodes::ADD_INTO_REG, Reg, 0x11, WS, 2);
+
+	// Forwarded: WS[0] is a copy of PS[1], until PS[1] changes.
+	table.op(Opcodes::MOVE_TO_REG, WS, 0, PS, 1);
+	table.op(Opcodes::ADD_INTO_REG, PS, 2, WS, 0);
+	table.op(Opcodes::MOVE_TO_REG, PS, 1, Imm, 9);
+	table.op(Opcodes::ADD_INTO_REG, PS, 3, WS, 0);
+	table.op(Opcodes::MOVE_TO_REG, WS, 0, Imm, 0x1234);
+	table.op(Opcodes::OR_INTO_REG, PS, 4, WS, 0, SrcEncoding::SrcByte8, SrcEncoding::SrcByte16);
+
+	// Dead: WS[1] is overwritten before it is read.
+	table.op(Opcodes::MOVE_TO_REG, WS, 1, Imm, 7);
+	table.op(Opcodes::MOVE_TO_REG, WS, 1, PS, 0);
+
+	for(size_t i = 0; i < std::size(divisors); i++) {
+		table.op(Opcodes::DIV_WITH_REG, WS, 1, Imm, divisors[i]);
+		table.op(Opcodes::MOVE_TO_REG, PS, divisionResults + 2 * i, WS, WS_QUOTIENT);
+		table.op(Opcodes::MOVE_TO_REG, PS, divisionResults + 2 * i + 1, WS, WS_REMAINDER);
+	}
+
+	// Not folded: the reg block depends on the path.
+	Label joined = table.label();
+	table.op(Opcodes::COMPARE_FROM_REG, PS, 0, Imm, 0);
+	table.jump(Opcodes::JUMP_EQUAL, joined);
+	table.setRegBlock(2 * regBlock);
+	table.bind(joined);
+	table.op(Opcodes::MOVE_TO_REG, Reg, 0x20, WS, 1);
+	table.op(Opcodes::MOVE_TO_REG, PS, 5, Reg, 0x21);
+	table.end();
+	return table;
+}
+
+struct Run {
+	std::vector<uint32_t> params;
+	std::vector<Access> accesses;
+	uint32_t selfCheckMismatches;
+	AtomBios::OptimizerStats stats;
+};
+
+Run run(const std::vector<uint8_t>& image, AtomBios::OptimizerMode mode, uint32_t in0, uint32_t in1) {
+	std::vector<uint8_t> copy = image;
+	AtomBios atomBios(copy.data(), copy.size());
+	atomBios.setOptimizerMode(mode);
+
+	accesses.clear();
+	for(size_t i = 0; i < std::size(regs); i++) {
+		regs[i] = i * 0x01010101;
+	}
+
+	Run result;
+	result.params.resize(paramSize);
+	result.params[0] = in0;
+	result.params[1] = in1;
+	atomBios.runCommand(AtomBios::ASIC_Init, result.params.data(), result.params.size());
+	result.accesses = accesses;
+	result.selfCheckMismatches = atomBios.selfCheckMismatches();
+	result.stats = atomBios.optimizerStats(AtomBios::ASIC_Init);
+	return result;
+}
+
+} // namespace anonymous
+
+int main() {
+	AtomRomBuilder::Rom rom;
+	rom.setCommand(AtomBios::ASIC_Init, optimizedTable());
+	std::vector<uint8_t> image = rom.build();
+
+	std::vector<std::pair<uint32_t, uint32_t>> inputs = {
+		{0, 0}, {1, 2}, {6, 0x80000000}, {7, 5}, {640, 3}, {641, 0xFFFFFFFF}, {0x80000001, 1}, {0xFFFFFFFF, 0xFFFFFFFF}
+	};
+	int failures = 0;
+	for(auto& [in0, in1] : inputs) {
+		Run plain = run(image, AtomBios::OptimizerMode::Off, in0, in1);
+		for(AtomBios::OptimizerMode mode : {AtomBios::OptimizerMode::On, AtomBios::OptimizerMode::SelfCheck}) {
+			const char* name = mode == AtomBios::OptimizerMode::On ? "on" : "self-check";
+			Run optimized = run(image, mode, in0, in1);
+			if(optimized.params != plain.params) {
+				for(size_t i = 0; i < paramSize; i++) {
+					if(optimized.params[i] != plain.params[i]) {
+						fprintf(stderr, "%x %x, optimizer %s: PS[%zu] is %x, plain %x\n", in0, in1, name, i,
+							optimized.params[i], plain.params[i]);
+					}
+				}
+				failures++;
+			}
+			if(optimized.accesses != plain.accesses) {
+				fprintf(stderr, "%x %x, optimizer %s: the card accesses differ from the plain ones\n", in0, in1, name);
+				failures++;
+			}
+			if(optimized.selfCheckMismatches) {
+				fprintf(stderr, "%x %x, optimizer %s: %u self-check mismatches\n", in0, in1, name, optimized.selfCheckMismatches);
+				failures++;
+			}
+
+			// Otherwise, the above would not test anything.
+			const AtomBios::OptimizerStats& stats = optimized.stats;
+			if(!stats.foldedRegBlocks || !stats.forwardedSources || !stats.deadStores
+					|| stats.reducedDivisions != std::size(divisors)) {
+				fprintf(stderr, "optimizer %s: %u reg blocks folded, %u sources forwarded, %u dead stores, %u divisions reduced\n",
+					name, stats.foldedRegBlocks, stats.forwardedSources, stats.deadStores, stats.reducedDivisions);
+				failures++;
+			}
+		}
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libatombios/atom.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include <vector>
+
+#include "../src-builder/rom-builder.hpp"
+
+// A replay whose reads return the recorded values makes the recorded accesses and leaves the recorded results. Once
+// a read differs, or the parameters differ from the recorded ones, the replay falls back to running the table; the
+// results and the accesses the card sees have to be the ones of a plain run, without the accesses the replay made
+// before the read being made twice.
+
+using AtomRomBuilder::Label;
+using AtomRomBuilder::Table;
+
+static constexpr uint32_t branchReg = 0x10;
+static constexpr uint32_t resultReg = 0x11;
+
+struct Access {
+	bool write;
+	uint32_t reg;
+	uint32_t val;
+
+	bool operator==(const Access&) const = default;
+};
+
+static std::vector<Access> accesses;
+static uint32_t regs[0x100];
+
+extern "C" void lilrad_log(enum LilradLogType type, const char* format, ...) {
+}
+
+extern "C" void* lilrad_alloc(size_t size) {
+	return malloc(size);
+}
+
+extern "C" void lilrad_free(void* ptr) {
+	free(ptr);
+}
+
+extern "C" void libatombios_card_reg_write(uint32_t reg, uint32_t val) {
+	accesses.push_back(Access{true, reg, val});
+	regs[reg & 0xFF] = val;
+}
+extern "C" uint32_t libatombios_card_reg_read(uint32_t reg) {
+	accesses.push_back(Access{false, reg, regs[reg & 0xFF]});
+	return regs[reg & 0xFF];
+}
+
+namespace {
+
+constexpr auto PS = OpcodeArgEncoding::ParameterSpace;
+constexpr auto WS = OpcodeArgEncoding::WorkSpace;
+constexpr auto Reg = OpcodeArgEncoding::Reg;
+constexpr auto Imm = OpcodeArgEncoding::Imm;
+
+// Branches on branchReg, writes PS[1] to a register, and returns resultReg in PS[1].
+Table replayedTable() {
+	Table table(4, 8);
+	Label zero = table.label();
+	Label done = table.label();
+	table.op(Opcodes::MOVE_TO_REG, WS, 0, Reg, branchReg);
+	table.op(Opcodes::COMPARE_FROM_REG, WS, 0, Imm, 0);
+	table.jump(Opcodes::JUMP_EQUAL, zero);
+	table.op(Opcodes::MOVE_TO_REG, Reg, 0x20, Imm, 0xAA);
+	table.op(Opcodes::MOVE_TO_REG, PS, 0, Imm, 1);
+	table.jump(Opcodes::JUMP_ALWAYS, done);
+	table.bind(zero);
+	table.op(Opcodes::MOVE_TO_REG, Reg, 0x21, Imm, 0xBB);
+	table.op(Opcodes::MOVE_TO_REG, PS, 0, Imm, 2);
+	table.bind(done);
+	table.op(Opcodes::MOVE_TO_REG, Reg, 0x22, PS, 1);
+	table.op(Opcodes::MOVE_TO_REG, PS, 1, Reg, resultReg);
+	table.end();
+	return table;
+}
+
+void resetCard(uint32_t branch, uint32_t result) {
+	for(uint32_t& reg : regs) {
+		reg = 0;
+	}
+	regs[branchReg] = branch;
+	regs[resultReg] = result;
+	accesses.clear();
+}
+
+struct Result {
+	std::vector<uint32_t> params;
+	std::vector<Access> accesses;
+};
+
+} // namespace anonymous
+
+int main() {
+	AtomRomBuilder::Rom rom;
+	rom.setCommand(AtomBios::ASIC_Init, replayedTable());
+	std::vector<uint8_t> image = rom.build();
+
+	AtomBios atomBios(image.data(), image.size());
+	AtomBios::Snapshot* start = atomBios.takeSnapshot();
+
+	resetCard(0, 5);
+	uint32_t recordedParams[2] = {0, 0x33};
+	AtomBios::Recording* recording = atomBios.recordCommand(AtomBios::ASIC_Init, recordedParams, 2);
+	std::vector<Access> recordedAccesses = accesses;
+
+	// The same table, run plainly from the same state.
+	auto plainRun = [&](uint32_t branch, uint32_t result, uint32_t param) {
+		AtomBios plain(image.data(), image.size());
+		resetCard(branch, result);
+		Result run;
+		run.params = {0, param};
+		plain.runCommand(AtomBios::ASIC_Init, run.params.data(), run.params.size());
+		run.accesses = accesses;
+		return run;
+	};
+
+	int failures = 0;
+	auto replay = [&](const char* what, uint32_t branch, uint32_t result, uint32_t param, bool expectComplete) {
+		Result expected = plainRun(branch, result, param);
+
+		atomBios.restoreSnapshot(start, nullptr, 0);
+		resetCard(branch, result);
+		std::vector<uint32_t> params = {0, param};
+		bool complete = atomBios.replayCommand(recording, params.data(), params.size());
+
+		if(complete != expectComplete) {
+			fprintf(stderr, "%s: the replay was %scompleted\n", what, complete ? "" : "not ");
+			failures++;
+		}
+		if(params != expected.params) {
+			fprintf(stderr, "%s: PS is %x %x, plain run %x %x\n", what, params[0], params[1], expected.params[0], expected.params[1]);
+			failures++;
+		}
+		if(accesses != expected.accesses) {
+			fprintf(stderr, "%s: the card saw %zu accesses, the plain run %zu:\n", what, accesses.size(), expected.accesses.size());
+			for(const Access& access : accesses) {
+				fprintf(stderr, "  %s %x %x\n", access.write ? "write" : "read", access.reg, access.val);
+			}
+			failures++;
+		}
+	};
+
+	if(recordedAccesses != plainRun(0, 5, 0x33).accesses) {
+		fprintf(stderr, "the recording run made other accesses than a plain run\n");
+		failures++;
+	}
+	replay("same reads", 0, 5, 0x33, true);
+	replay("first read differs", 1, 5, 0x33, false);
+	replay("last read differs", 0, 9, 0x33, false);
+	replay("parameters differ", 0, 5, 0x44, false);
+	// The recording is still usable after fallbacks.
+	replay("same reads again", 0, 5, 0x33, true);
+
+	atomBios.freeRecording(recording);
+	atomBios.freeSnapshot(start);
+	return failures ? 1 : 0;
+}
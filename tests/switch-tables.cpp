@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libatombios/atom.hpp>
+#include <libatombios/extern-funcs.hpp>
+
+#include <vector>
+
+#include "../src-builder/rom-builder.hpp"
+
+// SWITCH is dispatched through a table that is built when the command is decoded: dense for cases that cover their
+// value range well, sparse (a sorted list of values) otherwise. Either one has to take the case the bytecode would
+// take by comparing the cases in order, including values between, below and above the cases, and duplicates.
+
+using AtomRomBuilder::Label;
+using AtomRomBuilder::Table;
+
+extern "C" void lilrad_log(enum LilradLogType type, const char* format, ...) {
+}
+
+extern "C" void* lilrad_alloc(size_t size) {
+	return malloc(size);
+}
+
+extern "C" void lilrad_free(void* ptr) {
+	free(ptr);
+}
+
+namespace {
+
+constexpr uint32_t noMatch = 0xFFFF;
+
+// PS[1] = the result of the first case that matches PS[0], or noMatch.
+Table switchTable(const std::vector<std::pair<uint32_t, uint32_t>>& cases) {
+	constexpr auto PS = OpcodeArgEncoding::ParameterSpace;
+	constexpr auto Imm = OpcodeArgEncoding::Imm;
+
+	Table table(0, 8);
+	std::vector<std::pair<uint32_t, Label>> labels;
+	for(auto& [val, result] : cases) {
+		labels.push_back({val, table.label()});
+	}
+	Label done = table.label();
+
+	table.switchOn(PS, 0, SrcEncoding::SrcDword, labels);
+	table.op(Opcodes::MOVE_TO_REG, PS, 1, Imm, noMatch);
+	table.jump(Opcodes::JUMP_ALWAYS, done);
+	for(size_t i = 0; i < cases.size(); i++) {
+		table.bind(labels[i].second);
+		table.op(Opcodes::MOVE_TO_REG, PS, 1, Imm, cases[i].second);
+		table.jump(Opcodes::JUMP_ALWAYS, done);
+	}
+	table.bind(done);
+	table.end();
+	return table;
+}
+
+uint32_t expectedResult(const std::vector<std::pair<uint32_t, uint32_t>>& cases, uint32_t val) {
+	for(auto& [caseVal, result] : cases) {
+		if(caseVal == val) {
+			return result;
+		}
+	}
+	return noMatch;
+}
+
+} // namespace anonymous
+
+int main() {
+	// Dense, with a hole at 4 and a duplicate of 2 that is never taken.
+	std::vector<std::pair<uint32_t, uint32_t>> dense = {{3, 0x30}, {2, 0x20}, {5, 0x50}, {2, 0x21}};
+	// Sparse, with a case at the top of the value range.
+	std::vector<std::pair<uint32_t, uint32_t>> sparse = {{1000, 0x10}, {1, 0x11}, {0xFFFFFFFF, 0x12}, {70000, 0x13}};
+
+	AtomRomBuilder::Rom rom;
+	rom.setCommand(AtomBios::ASIC_Init, switchTable(dense));
+	rom.setCommand(AtomBios::GetDisplaySurfaceSize, switchTable(sparse));
+	std::vector<uint8_t> image = rom.build();
+
+	AtomBios atomBios(image.data(), image.size());
+
+	int failures = 0;
+	auto check = [&](AtomBios::CommandTables table, const std::vector<std::pair<uint32_t, uint32_t>>& cases,
+			const std::vector<uint32_t>& values) {
+		for(uint32_t val : values) {
+			uint32_t params[2] = {val, 0};
+			atomBios.runCommand(table, params, 2);
+			uint32_t expected = expectedResult(cases, val);
+			if(params[1] != expected) {
+				fprintf(stderr, "table %d, SWITCH on %x: %x, expected %x\n", table, val, params[1], expected);
+				failures++;
+			}
+		}
+	};
+	check(AtomBios::ASIC_Init, dense, {0, 1, 2, 3, 4, 5, 6, 0xFFFFFFFF});
+	check(AtomBios::GetDisplaySurfaceSize, sparse, {0, 1, 2, 999, 1000, 1001, 70000, 0xFFFFFFFE, 0xFFFFFFFF});
+	return failures ? 1 : 0;
+}
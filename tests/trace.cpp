@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libatombios/atom.hpp>
+#include <libatombios/extern-funcs.hpp>
+#include <libatombios/trace.hpp>
+
+#include <vector>
+
+#include "../src-builder/rom-builder.hpp"
+
+// A trace has to read back as the accesses and delays the card saw, in order. The values and registers step up and
+// down by amounts that take varints of each length from 1 to 5 bytes, and repeat a value (which is not encoded); a
+// small buffer splits the events over many writes. The invocations are found again, and reading can start at any
+// of them. A trace that ends within an event reads as truncated after the complete events.
+
+using AtomRomBuilder::Table;
+
+struct Access {
+	AtomBiosTrace::EventType type;
+	AtomBiosTrace::Space space;
+	uint32_t reg;
+	uint32_t val;
+
+	bool operator==(const Access&) const = default;
+};
+
+static std::vector<Access> accesses;
+static std::vector<uint8_t> traceData;
+static size_t traceWrites;
+
+extern "C" void lilrad_log(enum LilradLogType type, const char* format, ...) {
+}
+
+extern "C" void* lilrad_alloc(size_t size) {
+	return malloc(size);
+}
+
+extern "C" void lilrad_free(void* ptr) {
+	free(ptr);
+}
+
+static constexpr uint32_t readVal = 0x0FEDCBA9;
+
+extern "C" void libatombios_card_reg_write(uint32_t reg, uint32_t val) {
+	accesses.push_back(Access{AtomBiosTrace::EventType::Write, AtomBiosTrace::Space::Reg, reg, val});
+}
+extern "C" uint32_t libatombios_card_reg_read(uint32_t reg) {
+	accesses.push_back(Access{AtomBiosTrace::EventType::Read, AtomBiosTrace::Space::Reg, reg, readVal});
+	return readVal;
+}
+extern "C" void libatombios_card_pll_write(uint32_t reg, uint32_t val) {
+	accesses.push_back(Access{AtomBiosTrace::EventType::Write, AtomBiosTrace::Space::PLL, reg, val});
+}
+extern "C" uint32_t libatombios_card_mc_read(uint32_t reg) {
+	accesses.push_back(Access{AtomBiosTrace::EventType::Read, AtomBiosTrace::Space::MC, reg, 0});
+	return 0;
+}
+extern "C" void libatombios_delay_microseconds(uint32_t microseconds) {
+	accesses.push_back(Access{AtomBiosTrace::EventType::Delay, AtomBiosTrace::Space::Reg, 0, microseconds});
+}
+
+namespace {
+
+constexpr auto WS = OpcodeArgEncoding::WorkSpace;
+constexpr auto Reg = OpcodeArgEncoding::Reg;
+constexpr auto Imm = OpcodeArgEncoding::Imm;
+
+// Each step takes a longer varint than the one before, in either direction.
+constexpr uint32_t values[] = {
+	0, 0x3F, 0x40, 0x2040, 0x102040, 0x10000000, 0x90000000, 0x90000000, 0x7FFFFFFF, 1, 0xFFFFFFFF
+};
+constexpr uint16_t regs[] = {1, 0x41, 0x2041, 0xFFFF, 0, 0x8000, 0x8000, 0x7FFF, 2, 0xFFFE, 3};
+static_assert(std::size(values) == std::size(regs));
+
+constexpr auto caller = AtomBios::ASIC_Init;
+constexpr auto callee = AtomBios::GetDisplaySurfaceSize;
+
+Table callerTable() {
+	Table table(4, 0);
+	for(size_t i = 0; i < std::size(values); i++) {
+		table.op(Opcodes::MOVE_TO_REG, Reg, regs[i], Imm, values[i]);
+	}
+	table.op(Opcodes::MOVE_TO_REG, WS, 0, Reg, 0x1234);
+	table.delayMicroseconds(200);
+	table.callTable(callee);
+	table.op(Opcodes::MOVE_TO_REG, Reg, 0x10, WS, 0);
+	table.end();
+	return table;
+}
+
+// The differences start over from 0 in the callee.
+Table calleeTable() {
+	Table table(4, 0);
+	table.op(Opcodes::MOVE_TO_REG, OpcodeArgEncoding::PLL, 0x20, Imm, 0x90000000);
+	table.op(Opcodes::MOVE_TO_REG, WS, 0, OpcodeArgEncoding::MC, 0x30);
+	table.op(Opcodes::MOVE_TO_REG, Reg, 0x11, Imm, 0);
+	table.end();
+	return table;
+}
+
+void writeTrace(const uint8_t* data, size_t size, void* context) {
+	traceData.insert(traceData.end(), data, data + size);
+	traceWrites++;
+}
+
+struct Invocation {
+	uint32_t table;
+	uint32_t depth;
+};
+
+// The accesses and invocations from the reader's position on.
+void readEvents(AtomBiosTrace::Reader& reader, std::vector<Access>& read, std::vector<Invocation>& invocations, int& exits) {
+	AtomBiosTrace::Event event;
+	while(reader.next(event)) {
+		switch(event.type) {
+		case AtomBiosTrace::EventType::TableEnter:
+			invocations.push_back(Invocation{event.table, event.depth});
+			break;
+		case AtomBiosTrace::EventType::TableExit:
+			exits++;
+			break;
+		case AtomBiosTrace::EventType::Delay:
+			read.push_back(Access{event.type, AtomBiosTrace::Space::Reg, 0, event.val});
+			break;
+		default:
+			read.push_back(Access{event.type, event.space, event.reg, event.val});
+			break;
+		}
+	}
+}
+
+} // namespace anonymous
+
+int main() {
+	AtomRomBuilder::Rom rom;
+	rom.setCommand(caller, callerTable());
+	rom.setCommand(callee, calleeTable());
+	std::vector<uint8_t> image = rom.build();
+
+	AtomBios atomBios(image.data(), image.size());
+	atomBios.setTraceWriter(writeTrace, nullptr, AtomBiosTrace::maxEventSize);
+	atomBios.runCommand(caller, nullptr, 0);
+	atomBios.flushTrace();
+
+	int failures = 0;
+	if(traceWrites < 2) {
+		fprintf(stderr, "the trace was written at once\n");
+		failures++;
+	}
+
+	AtomBiosTrace::Reader reader(traceData.data(), traceData.size());
+	std::vector<Access> read;
+	std::vector<Invocation> invocations;
+	int exits = 0;
+	readEvents(reader, read, invocations, exits);
+	if(!reader.valid() || reader.truncated()) {
+		fprintf(stderr, "the trace is %s\n", reader.valid() ? "truncated" : "not valid");
+		failures++;
+	}
+	if(read != accesses) {
+		fprintf(stderr, "the trace has %zu accesses, the card saw %zu:\n", read.size(), accesses.size());
+		for(size_t i = 0; i < read.size() || i < accesses.size(); i++) {
+			if(i < read.size()) {
+				fprintf(stderr, "  trace %d %d %x %x", static_cast<int>(read[i].type), static_cast<int>(read[i].space), read[i].reg, read[i].val);
+			}
+			if(i < accesses.size()) {
+				fprintf(stderr, "  card %d %d %x %x", static_cast<int>(accesses[i].type), static_cast<int>(accesses[i].space), accesses[i].reg, accesses[i].val);
+			}
+			fprintf(stderr, "\n");
+		}
+		failures++;
+	}
+	if(invocations.size() != 2 || invocations[0].table != caller || invocations[0].depth != 0
+			|| invocations[1].table != callee || invocations[1].depth != 1 || exits != 2) {
+		fprintf(stderr, "the trace has %zu invocations and %d exits, expected the caller and the callee\n", invocations.size(), exits);
+		failures++;
+	}
+
+	// The callee's accesses are the ones after the last delay.
+	if(reader.invocations() != 2 || reader.invocation(1).table != callee) {
+		fprintf(stderr, "the reader found %zu invocations\n", reader.invocations());
+		failures++;
+	} else {
+		reader.seekInvocation(1);
+		std::vector<Access> calleeRead;
+		std::vector<Invocation> calleeInvocations;
+		int calleeExits = 0;
+		readEvents(reader, calleeRead, calleeInvocations, calleeExits);
+
+		size_t delay = 0;
+		for(size_t i = 0; i < accesses.size(); i++) {
+			if(accesses[i].type == AtomBiosTrace::EventType::Delay) {
+				delay = i;
+			}
+		}
+		std::vector<Access> calleeAccesses(accesses.begin() + delay + 1, accesses.end());
+		if(calleeRead != calleeAccesses || calleeInvocations.size() != 1 || calleeExits != 2) {
+			fprintf(stderr, "reading from the callee's invocation gives %zu accesses, expected %zu\n", calleeRead.size(), calleeAccesses.size());
+			failures++;
+		}
+	}
+
+	// A write without its register.
+	std::vector<uint8_t> truncated = traceData;
+	truncated.push_back(static_cast<uint8_t>(AtomBiosTrace::EventType::Write));
+	truncated.push_back(0x80);
+	AtomBiosTrace::Reader truncatedReader(truncated.data(), truncated.size());
+	std::vector<Access> truncatedRead;
+	std::vector<Invocation> truncatedInvocations;
+	int truncatedExits = 0;
+	readEvents(truncatedReader, truncatedRead, truncatedInvocations, truncatedExits);
+	if(!truncatedReader.truncated() || truncatedRead != accesses) {
+		fprintf(stderr, "a trace that ends within an event is %struncated, with %zu accesses\n",
+			truncatedReader.truncated() ? "" : "not ", truncatedRead.size());
+		failures++;
+	}
+	return failures ? 1 : 0;
+}